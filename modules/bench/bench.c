@@ -0,0 +1,119 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "cl-log.h"
+#include "bench.h"
+
+
+static BenchAllocs allocs = { 0 };
+
+
+#ifdef CL_BENCH_WRAP_MALLOC
+
+/* the benchmarks are single threaded, plain counters do */
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+
+void *__wrap_malloc(size_t size) {
+    allocs.count++;
+    allocs.bytes += size;
+    return __real_malloc(size);
+}
+
+
+void *__wrap_calloc(size_t count, size_t size) {
+    allocs.count++;
+    allocs.bytes += count * size;
+    return __real_calloc(count, size);
+}
+
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    allocs.count++;
+    allocs.bytes += size;
+    return __real_realloc(ptr, size);
+}
+
+#endif /* CL_BENCH_WRAP_MALLOC */
+
+
+double bench_now(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+bool bench_allocs_enabled(void) {
+#ifdef CL_BENCH_WRAP_MALLOC
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+void bench_allocs_reset(void) {
+    allocs = (BenchAllocs){ 0 };
+}
+
+
+void bench_allocs_get(BenchAllocs *out) {
+    *out = allocs;
+}
+
+
+/**
+ * Returns the peak resident set size of the process in bytes.
+ */
+size_t bench_peak_rss(void) {
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return 0;
+    }
+
+    return (size_t)usage.ru_maxrss * 1024;
+}
+
+
+bool bench_parse_size(str_t arg, size_t *size) {
+    char *end = NULL;
+    unsigned long long value = strtoull(arg, &end, 10);
+
+    if (end == arg) {
+        return false;
+    }
+
+    switch (*end) {
+        case 'G':
+            value *= 1024;
+            /* fallthrough */
+        case 'M':
+            value *= 1024;
+            /* fallthrough */
+        case 'K':
+            value *= 1024;
+            end++;
+            break;
+        default:
+            break;
+    }
+
+    if (*end || value == 0) {
+        return false;
+    }
+
+    *size = (size_t)value;
+
+    return true;
+}
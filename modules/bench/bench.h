@@ -0,0 +1,52 @@
+#ifndef CL_BENCH_H_
+#define CL_BENCH_H_
+
+#include <stdio.h>
+
+#include "cl-core.h"
+#include "cl-annotation.h"
+
+
+/**
+ * Heap usage of the benchmarked code, counted by wrapping the
+ * allocator at link time. All zero when the linker does not
+ * support it.
+ */
+CL_TYPE(BenchAllocs) {
+    size_t count;   /* malloc, calloc and realloc calls */
+    size_t bytes;   /* bytes requested by them */
+};
+
+
+double bench_now            (void);
+bool   bench_allocs_enabled (void);
+void   bench_allocs_reset   (void);
+void   bench_allocs_get     (__Out BenchAllocs *allocs);
+size_t bench_peak_rss       (void);
+
+/**
+ * Parses a size like 512K, 16M or 1G.
+ */
+bool bench_parse_size(str_t arg, __Out size_t *size);
+
+/**
+ * Writes about `size` bytes of Clover code to `out`. The same
+ * seed always gives the same corpus.
+ */
+bool bench_corpus_write(FILE *out, size_t size, uint64_t seed);
+
+typedef bool (*BenchWriteFn)(FILE *out, size_t size, uint64_t seed);
+
+/**
+ * Writes a corpus into a new temporary file and returns its
+ * path, which the caller frees and unlinks.
+ */
+char *bench_corpus_file(size_t size, uint64_t seed) __NoDiscard;
+
+/**
+ * Same as bench_corpus_file, with any generator.
+ */
+char *bench_temp_file(BenchWriteFn write, size_t size,
+    uint64_t seed) __NoDiscard;
+
+#endif /* CL_BENCH_H_ */
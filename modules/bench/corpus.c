@@ -0,0 +1,273 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "cl-log.h"
+#include "bench.h"
+
+
+/**
+ * The corpus is a stream of top level declarations, each made
+ * of statements picked at random from a fixed mix, roughly the
+ * proportions of hand written code: mostly names, calls and
+ * small integers, with some strings, comments, floats and hex
+ * or binary literals.
+ */
+
+static const str_t NAMES[] = {
+    "x", "y", "i", "n", "io", "len", "node", "index", "count", "buffer",
+    "result", "value", "alpha", "offset", "println", "capacity",
+    "parse_header", "next_token", "user_data", "some_longer_identifier_name",
+};
+
+static const str_t TYPES[] = {
+    "int", "float", "char", "bool", "str", "Node", "Buffer",
+};
+
+static const str_t BINARY_OPS[] = {
+    "+", "-", "*", "/", "%", "==", "!=", "<", ">", "<=", ">=", "&&", "||",
+    "&", "|", "^", "<<", ">>",
+};
+
+static const str_t WORDS[] = {
+    "the", "buffer", "is", "grown", "when", "full", "and", "every", "node",
+    "keeps", "its", "offset", "into", "source", "text", "TODO:", "check",
+};
+
+
+CL_TYPE(Corpus) {
+    FILE    *out;
+    uint64_t state;
+    size_t   written;
+};
+
+
+static uint32_t _rand(Corpus *self) {
+    /* xorshift64* */
+    self->state ^= self->state >> 12;
+    self->state ^= self->state << 25;
+    self->state ^= self->state >> 27;
+
+    return (uint32_t)((self->state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+
+static __Inline uint32_t _below(Corpus *self, uint32_t n) {
+    return _rand(self) % n;
+}
+
+
+#define _pick(self, arr) ((arr)[_below(self, CL_N_ELEMS(arr))])
+
+
+static void _emit(Corpus *self, str_t fmt, ...) __Format(2, 3);
+
+
+static void _emit(Corpus *self, str_t fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    int length = vfprintf(self->out, fmt, args);
+    va_end(args);
+
+    if (length > 0) {
+        self->written += length;
+    }
+}
+
+
+static void emit_literal(Corpus *self) {
+    uint32_t kind = _below(self, 16);
+
+    if (kind < 9) {
+        _emit(self, "%u", _below(self, (kind < 6) ? 100 : 100000));
+    } else if (kind < 11) {
+        _emit(self, "%u.%03u", _below(self, 1000), _below(self, 1000));
+    } else if (kind < 13) {
+        _emit(self, "0x%X", _rand(self) & 0xFFFF);
+    } else if (kind < 14) {
+        _emit(self, "0b%u%u%u%u", _below(self, 2), _below(self, 2),
+            _below(self, 2), _below(self, 2));
+    } else if (kind < 15) {
+        _emit(self, "\"%s %s\\n\"", _pick(self, WORDS), _pick(self, WORDS));
+    } else {
+        _emit(self, "'%c'", 'a' + _below(self, 26));
+    }
+}
+
+
+static void emit_operand(Corpus *self) {
+    switch (_below(self, 4)) {
+        case 0:
+            emit_literal(self);
+            break;
+        case 1:
+            _emit(self, "%s.%s", _pick(self, NAMES), _pick(self, NAMES));
+            break;
+        case 2:
+            _emit(self, "%s[%u]", _pick(self, NAMES), _below(self, 64));
+            break;
+        default:
+            _emit(self, "%s", _pick(self, NAMES));
+            break;
+    }
+}
+
+
+static void emit_expression(Corpus *self) {
+    emit_operand(self);
+
+    for (uint32_t i = _below(self, 3); i > 0; i--) {
+        _emit(self, " %s ", _pick(self, BINARY_OPS));
+        emit_operand(self);
+    }
+}
+
+
+static void emit_comment(Corpus *self, str_t indent) {
+    _emit(self, "%s//", indent);
+
+    for (uint32_t i = 2 + _below(self, 10); i > 0; i--) {
+        _emit(self, " %s", _pick(self, WORDS));
+    }
+
+    _emit(self, "\n");
+}
+
+
+static void emit_statement(Corpus *self) {
+    switch (_below(self, 10)) {
+        case 0:
+            emit_comment(self, "    ");
+            return;
+        case 1:
+            _emit(self, "    if (");
+            emit_expression(self);
+            _emit(self, ") {\n        return ");
+            emit_operand(self);
+            _emit(self, ";\n    }\n");
+            return;
+        case 2:
+            _emit(self, "    while (%s < %u) {\n        %s = %s + 1;\n    }\n",
+                _pick(self, NAMES), _below(self, 1000),
+                _pick(self, NAMES), _pick(self, NAMES));
+            return;
+        case 3:
+            _emit(self, "    defer %s.free();\n", _pick(self, NAMES));
+            return;
+        case 4:
+        case 5:
+            _emit(self, "    %s.%s(", _pick(self, NAMES), _pick(self, NAMES));
+            emit_operand(self);
+            _emit(self, ", ");
+            emit_literal(self);
+            _emit(self, ");\n");
+            return;
+        default:
+            _emit(self, "    %s %s_%u: %s = ",
+                _below(self, 4) ? "var" : "const", _pick(self, NAMES),
+                _below(self, 1000), _pick(self, TYPES));
+            emit_expression(self);
+            _emit(self, ";\n");
+            return;
+    }
+}
+
+
+static void emit_declaration(Corpus *self) {
+    uint32_t kind = _below(self, 8);
+
+    if (kind == 0) {
+        _emit(self, "struct %s%u {\n", _pick(self, TYPES), _below(self, 1000));
+
+        for (uint32_t i = 1 + _below(self, 6); i > 0; i--) {
+            _emit(self, "    %s: %s,\n", _pick(self, NAMES), _pick(self, TYPES));
+        }
+
+        _emit(self, "}\n\n");
+        return;
+    }
+
+    if (kind == 1) {
+        emit_comment(self, "");
+    }
+
+    _emit(self, "%sfn %s_%u(%s: %s, %s: %s) {\n",
+        _below(self, 3) ? "" : "pub ", _pick(self, NAMES), _below(self, 10000),
+        _pick(self, NAMES), _pick(self, TYPES),
+        _pick(self, NAMES), _pick(self, TYPES));
+
+    for (uint32_t i = 2 + _below(self, 12); i > 0; i--) {
+        emit_statement(self);
+    }
+
+    _emit(self, "    return ");
+    emit_expression(self);
+    _emit(self, ";\n}\n\n");
+}
+
+
+bool bench_corpus_write(FILE *out, size_t size, uint64_t seed) {
+    Corpus corpus = { .out = out, .state = seed | 1, .written = 0 };
+
+    _emit(&corpus, "import io;\n\n");
+
+    while (corpus.written < size) {
+        emit_declaration(&corpus);
+    }
+
+    return !ferror(out);
+}
+
+
+char *bench_temp_file(BenchWriteFn write, size_t size, uint64_t seed) {
+    str_t tmpdir = getenv("TMPDIR");
+
+    if (!tmpdir || !*tmpdir) {
+        tmpdir = "/tmp";
+    }
+
+    size_t length = strlen(tmpdir) + sizeof("/clover-bench-XXXXXX");
+    char *path = malloc(length);
+
+    if (!path) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    snprintf(path, length, "%s/clover-bench-XXXXXX", tmpdir);
+
+    int fd = mkstemp(path);
+    FILE *out = (fd < 0) ? NULL : fdopen(fd, "w");
+
+    if (!out) {
+        cl_error("%s: %s\n", path, strerror(errno));
+
+        if (fd >= 0) {
+            close(fd);
+            unlink(path);
+        }
+
+        free(path);
+        return NULL;
+    }
+
+    bool written = write(out, size, seed);
+
+    if (fclose(out) != 0 || !written) {
+        cl_error("%s: %s\n", path, strerror(errno));
+        unlink(path);
+        free(path);
+        return NULL;
+    }
+
+    return path;
+}
+
+
+char *bench_corpus_file(size_t size, uint64_t seed) {
+    return bench_temp_file(bench_corpus_write, size, seed);
+}
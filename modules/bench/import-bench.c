@@ -0,0 +1,359 @@
+#define _XOPEN_SOURCE 700 /* realpath */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <cl-log.h>
+#include <cl-vector.h>
+#include <cl-pool.h>
+#include <cl-compiler.h>
+
+#include "bench.h"
+
+#define BENCH_SEED          0x696D706F7274ULL
+#define BENCH_RUNS          3
+#define BENCH_DEPTH         8
+#define BENCH_WIDTH         16
+#define BENCH_FANOUT        3
+
+
+/**
+ * A layered program: `main` imports every module of layer 0,
+ * and module i of layer k imports BENCH_FANOUT modules of layer
+ * k + 1, so every module below layer 0 is reached from several
+ * importers and the longest chain is BENCH_DEPTH + 1 files.
+ */
+CL_TYPE(Program) {
+    char   dir[64];
+    size_t module_size;
+    size_t total_size;
+};
+
+
+static bool _write_module(Program *self, str_t name, uint32_t layer,
+    uint32_t index) {
+    char path[128];
+
+    snprintf(path, sizeof(path), "%s/%s.cl", self->dir, name);
+
+    FILE *out = fopen(path, "w");
+
+    if (!out) {
+        cl_error("%s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    if (layer == UINT32_MAX) {
+        for (uint32_t i = 0; i < BENCH_WIDTH; i++) {
+            fprintf(out, "import m0_%u;\n", i);
+        }
+    } else if (layer + 1 < BENCH_DEPTH) {
+        for (uint32_t i = 0; i < BENCH_FANOUT; i++) {
+            fprintf(out, "import m%u_%u;\n", layer + 1,
+                (index + i) % BENCH_WIDTH);
+        }
+    }
+
+    bool written = bench_corpus_write(out, self->module_size,
+        BENCH_SEED + layer * BENCH_WIDTH + index);
+
+    self->total_size += (size_t)ftell(out);
+
+    if (fclose(out) != 0 || !written) {
+        cl_error("%s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+
+static bool program_write(Program *self) {
+    str_t tmpdir = getenv("TMPDIR");
+
+    snprintf(self->dir, sizeof(self->dir), "%s/clover-import-XXXXXX",
+        (tmpdir && *tmpdir) ? tmpdir : "/tmp");
+
+    if (!mkdtemp(self->dir)) {
+        cl_error("%s: %s\n", self->dir, strerror(errno));
+        return false;
+    }
+
+    char name[32];
+
+    for (uint32_t layer = 0; layer < BENCH_DEPTH; layer++) {
+        for (uint32_t i = 0; i < BENCH_WIDTH; i++) {
+            snprintf(name, sizeof(name), "m%u_%u", layer, i);
+
+            if (!_write_module(self, name, layer, i)) {
+                return false;
+            }
+        }
+    }
+
+    return _write_module(self, "main", UINT32_MAX, 0);
+}
+
+
+static void program_remove(Program *self) {
+    char path[128];
+
+    for (uint32_t layer = 0; layer < BENCH_DEPTH; layer++) {
+        for (uint32_t i = 0; i < BENCH_WIDTH; i++) {
+            snprintf(path, sizeof(path), "%s/m%u_%u.cl", self->dir, layer, i);
+            unlink(path);
+            snprintf(path, sizeof(path), "%s/m%u_%u.cli", self->dir, layer, i);
+            unlink(path);
+        }
+    }
+
+    snprintf(path, sizeof(path), "%s/main.cl", self->dir);
+    unlink(path);
+    rmdir(self->dir);
+}
+
+
+/**
+ * Parses one file and everything it imports, best of `runs`.
+ * The corpus is only meant to be valid syntax, so nothing goes
+ * through codegen.
+ */
+static double _best_compile(str_t path, uint32_t jobs, bool interfaces,
+    int runs, bool *ok) {
+    Vector *files = vector_new(sizeof(str_t));
+    CompileOptions options = {
+        .jobs = jobs,
+        .interfaces = interfaces,
+        .parse_only = true,
+    };
+    double best = -1;
+
+    *ok = files && vector_push(files, CL_VOIDPTR(&path));
+
+    for (int i = 0; *ok && i < runs; i++) {
+        double start = bench_now();
+
+        *ok = cl_compile(files, &options);
+
+        double seconds = bench_now() - start;
+
+        if (best < 0 || seconds < best) {
+            best = seconds;
+        }
+    }
+
+    if (files) {
+        vector_free(files);
+    }
+
+    return best;
+}
+
+
+static bool _write_file(str_t dir, str_t name, str_t text) {
+    char path[128];
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    FILE *out = fopen(path, "w");
+
+    if (!out) {
+        cl_error("%s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    fputs(text, out);
+
+    return fclose(out) == 0;
+}
+
+
+static void _remove_file(str_t dir, str_t name) {
+    char path[128];
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    unlink(path);
+}
+
+
+/**
+ * One compile through the cache, the way the compile server
+ * runs it, checked against what a fresh run returns.
+ */
+static bool _check_cached(UnitCache *cache, str_t path, Vector *import_paths,
+    bool expected, str_t step) {
+    Vector *files = vector_new(sizeof(str_t));
+    CompileOptions options = {
+        .jobs = 1,
+        .cache = cache,
+        .import_paths = import_paths,
+        .parse_only = true,
+    };
+    bool ok = files && vector_push(files, CL_VOIDPTR(&path));
+
+    if (ok && cl_compile(files, &options) != expected) {
+        cl_error("cached compile %s after %s\n",
+            expected ? "failed" : "passed", step);
+        ok = false;
+    }
+
+    if (files) {
+        vector_free(files);
+    }
+
+    return ok;
+}
+
+
+/**
+ * A unit the cache reuses must find its imports again: `user`
+ * imports `lib`, found in the import path `inc` until a broken
+ * `lib` next to `user` shadows it, and not at all without the
+ * import path or once it is deleted. The cache is told about
+ * files that go away, like the server's watcher would be, and
+ * the errors these compiles print are expected.
+ */
+static bool _check_cache(Program *program) {
+    char inc[96];
+    char user[128];
+    char lib[128];
+
+    snprintf(inc, sizeof(inc), "%s/inc", program->dir);
+    snprintf(user, sizeof(user), "%s/user.cl", program->dir);
+    snprintf(lib, sizeof(lib), "%s/lib.cl", inc);
+
+    UnitCache *cache = unit_cache_new(NULL, NULL);
+    Vector *paths = vector_new(sizeof(str_t));
+    str_t inc_path = inc;
+    bool ok = cache && paths && vector_push(paths, CL_VOIDPTR(&inc_path)) &&
+        mkdir(inc, 0700) == 0 &&
+        _write_file(program->dir, "user.cl", "import lib;\n") &&
+        _write_file(inc, "lib.cl", "fn f() {}\n");
+
+    char *lib_key = ok ? realpath(lib, NULL) : NULL;
+
+    ok = ok && lib_key &&
+        _check_cached(cache, user, paths, true, "the first compile") &&
+        _write_file(program->dir, "lib.cl", "fn (\n") &&
+        _check_cached(cache, user, paths, false, "shadowing a module");
+
+    _remove_file(program->dir, "lib.cl");
+
+    ok = ok &&
+        _check_cached(cache, user, paths, true, "removing the shadow") &&
+        _check_cached(cache, user, NULL, false, "dropping the import path");
+
+    _remove_file(inc, "lib.cl");
+
+    if (lib_key) {
+        unit_cache_invalidate_importers(cache, lib_key);
+    }
+
+    ok = ok && _check_cached(cache, user, paths, false, "deleting a module");
+
+    _remove_file(program->dir, "user.cl");
+    rmdir(inc);
+    free(lib_key);
+
+    if (paths) {
+        vector_free(paths);
+    }
+
+    if (cache) {
+        unit_cache_free(cache);
+    }
+
+    return ok;
+}
+
+
+/**
+ * Usage: import-bench SIZE [RUNS [JOBS]]
+ *
+ * Writes a layered program of modules of SIZE bytes each and
+ * compiles it from its main file on one job and on JOBS, which
+ * defaults to the number of processors. Prints both times next
+ * to the time of a chain of single modules as long as the
+ * longest import chain, which the parallel run should come
+ * close to, and the time on JOBS once every module has its
+ * interface written. Fails when the program does not parse
+ * cleanly, or when a compile through a unit cache does not
+ * follow its imports being shadowed or deleted.
+ */
+int main(int argc, str_t argv[]) {
+    Program program = { 0 };
+
+    if (argc < 2 || !bench_parse_size(argv[1], &program.module_size)) {
+        fprintf(stderr, "usage: %s SIZE [RUNS [JOBS]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int runs = (argc > 2) ? atoi(argv[2]) : BENCH_RUNS;
+    int jobs = (argc > 3) ? atoi(argv[3]) : 0;
+
+    if (runs <= 0) {
+        runs = BENCH_RUNS;
+    }
+
+    if (jobs <= 0) {
+        jobs = (int)cl_cpu_count();
+    }
+
+    if (!program_write(&program)) {
+        program_remove(&program);
+        return EXIT_FAILURE;
+    }
+
+    char main_path[128];
+    char leaf_path[128];
+    bool ok_serial, ok_parallel, ok_leaf, ok_written, ok_interfaces;
+
+    snprintf(main_path, sizeof(main_path), "%s/main.cl", program.dir);
+    snprintf(leaf_path, sizeof(leaf_path), "%s/m%u_0.cl", program.dir,
+        BENCH_DEPTH - 1);
+
+    double serial = _best_compile(main_path, 1, false, runs, &ok_serial);
+    double parallel = _best_compile(main_path, (uint32_t)jobs, false, runs,
+        &ok_parallel);
+    double leaf = _best_compile(leaf_path, 1, false, runs, &ok_leaf);
+
+    /* the first run with interfaces writes them, the others read */
+    _best_compile(main_path, (uint32_t)jobs, true, 1, &ok_written);
+
+    double interfaces = _best_compile(main_path, (uint32_t)jobs, true, runs,
+        &ok_interfaces);
+    double chain = leaf * (BENCH_DEPTH + 1);
+    size_t modules = BENCH_DEPTH * BENCH_WIDTH + 1;
+
+    printf("imports %s: %zu modules, %.1f MB, chain of %d, best of %d\n",
+        argv[1], modules, program.total_size / 1e6, BENCH_DEPTH + 1, runs);
+    printf("  1 job:   %.4f s, %.1f MB/s\n",
+        serial, program.total_size / serial / 1e6);
+    printf("  %d jobs: %.4f s, %.1f MB/s, %.2fx\n", jobs,
+        parallel, program.total_size / parallel / 1e6, serial / parallel);
+    printf("  longest chain alone: %.4f s, parallel run at %.2fx of it\n",
+        chain, parallel / chain);
+    printf("  %d jobs, modules read from interfaces: %.4f s, %.2fx\n",
+        jobs, interfaces, parallel / interfaces);
+    printf("  peak RSS %.1f MB\n", bench_peak_rss() / 1e6);
+
+    bool ok_cache = _check_cache(&program);
+
+    program_remove(&program);
+
+    if (!ok_cache) {
+        return EXIT_FAILURE;
+    }
+
+    if (!ok_serial || !ok_parallel || !ok_leaf || !ok_written ||
+        !ok_interfaces) {
+        cl_error("the program does not parse cleanly\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cl-log.h>
+#include <cl-arena.h>
+#include <cl-pool.h>
+#include <cl-source.h>
+#include <cl-tokens.h>
+#include <cl-intern.h>
+#include <cl-lexer.h>
+
+#include "bench.h"
+
+#define BENCH_SEED          0x696E7465726EULL
+
+
+/**
+ * One unit of a parallel compile: every job lexes the same
+ * corpus, so all of them intern the same names at once, which
+ * is as much contention as the interner can get.
+ */
+CL_TYPE(InternJob) {
+    Source      *src;
+    Interner    *symbols;
+    Arena       *arena;
+    TokenStream *tokens;
+    bool         ok;
+};
+
+
+static void _intern_job(InternJob *job) {
+    job->arena = arena_new(0);
+    job->tokens = job->arena ? tokens_new(job->arena) : NULL;
+    job->ok = job->tokens && cl_lex(job->src, job->tokens, job->symbols);
+}
+
+
+/**
+ * Checks that every job got the same ids, and that every id
+ * names the text of its token.
+ */
+static bool _check_jobs(InternJob *jobs, uint32_t count) {
+    TokenStream *first = jobs[0].tokens;
+
+    for (uint32_t i = 1; i < count; i++) {
+        TokenStream *other = jobs[i].tokens;
+
+        if (other->count != first->count ||
+            other->value_count != first->value_count ||
+            memcmp(other->values, first->values,
+                first->value_count * sizeof(*first->values)) != 0) {
+            cl_error("job %u got other symbol ids than job 0\n", i);
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < first->count; i++) {
+        if (first->kinds[i] != TK_ID) {
+            continue;
+        }
+
+        uint32_t length = 0;
+        uint32_t id = tokens_value(first, i);
+        str_t name = interner_name(jobs[0].symbols, id, &length);
+
+        if (!name || length != first->lengths[i] ||
+            memcmp(name, source_get(jobs[0].src, first->offsets[i]),
+                length) != 0) {
+            cl_error("symbol %u does not name token %zu\n", id, i);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+static bool run_jobs(Source *src, uint32_t threads) {
+    Interner *symbols = interner_new();
+    InternJob *jobs = calloc(threads, sizeof(InternJob));
+    ThreadPool *pool = pool_new(threads);
+
+    if (!symbols || !jobs || !pool) {
+        interner_free(symbols);
+        free(jobs);
+        return false;
+    }
+
+    double start = bench_now();
+
+    for (uint32_t i = 0; i < threads; i++) {
+        jobs[i] = (InternJob){ .src = src, .symbols = symbols };
+
+        if (!pool_submit(pool, (PoolJobFn)_intern_job, &jobs[i])) {
+            _intern_job(&jobs[i]);
+        }
+    }
+
+    pool_wait(pool);
+
+    double seconds = bench_now() - start;
+    bool ok = true;
+
+    for (uint32_t i = 0; i < threads; i++) {
+        ok = ok && jobs[i].ok;
+    }
+
+    ok = ok && _check_jobs(jobs, threads);
+
+    if (ok) {
+        InternerStats stats;
+
+        interner_stats(symbols, &stats);
+
+        double tokens = (double)jobs[0].tokens->count * threads;
+
+        printf("  %2u threads: %.4f s, %.2f Mtok/s, %zu symbols, "
+            "%.2f probes per lookup\n", threads, seconds,
+            tokens / seconds / 1e6, stats.symbols,
+            (double)stats.probes / stats.lookups);
+    }
+
+    for (uint32_t i = 0; i < threads; i++) {
+        arena_free(jobs[i].arena);
+    }
+
+    pool_free(pool);
+    free(jobs);
+    interner_free(symbols);
+
+    return ok;
+}
+
+
+/**
+ * Usage: intern-bench SIZE [THREADS]
+ *
+ * Lexes a generated corpus of SIZE bytes on 1, 2, 4... up to
+ * THREADS threads at once, all interning into one interner,
+ * and fails when the threads do not agree on the symbol ids.
+ */
+int main(int argc, str_t argv[]) {
+    size_t size = 0;
+
+    if (argc < 2 || !bench_parse_size(argv[1], &size)) {
+        fprintf(stderr, "usage: %s SIZE [THREADS]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int max_threads = (argc > 2) ? atoi(argv[2]) : (int)cl_cpu_count();
+
+    if (max_threads <= 0) {
+        max_threads = 1;
+    }
+
+    char *path = bench_corpus_file(size, BENCH_SEED);
+
+    if (!path) {
+        return EXIT_FAILURE;
+    }
+
+    Source *src = source_new(NULL, path);
+
+    unlink(path);
+    free(path);
+
+    if (!src) {
+        return EXIT_FAILURE;
+    }
+
+    printf("intern %s: %.1f MB per thread\n", argv[1], src->length / 1e6);
+
+    bool ok = true;
+
+    for (uint32_t threads = 1; ok; threads *= 2) {
+        if (threads > (uint32_t)max_threads) {
+            threads = (uint32_t)max_threads;
+        }
+
+        ok = run_jobs(src, threads);
+
+        if (threads == (uint32_t)max_threads) {
+            break;
+        }
+    }
+
+    source_free(src);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cl-log.h>
+#include <cl-arena.h>
+#include <cl-source.h>
+#include <cl-tokens.h>
+#include <cl-intern.h>
+#include <cl-lexer.h>
+
+#include "bench.h"
+
+#define BENCH_SEED          0x636C6F766572ULL
+#define BENCH_RUNS          5
+#define BENCH_LARGE_SIZE    (256UL * 1024 * 1024)
+
+
+CL_TYPE(LexRun) {
+    double        seconds;
+    size_t        tokens;
+    size_t        arena_peak;
+    BenchAllocs   allocs;
+    InternerStats symbols;
+};
+
+
+/**
+ * Lexes into a token stream from a fresh arena, interning into
+ * a fresh interner, the same way the compiler does for every
+ * unit of a compilation.
+ */
+static bool lex_once(Source *src, LexRun *run) {
+    bench_allocs_reset();
+
+    double start = bench_now();
+    Interner *symbols = interner_new();
+    Arena *arena = arena_new(0);
+    TokenStream *tokens = arena ? tokens_new(arena) : NULL;
+    bool ok = tokens && symbols && cl_lex(src, tokens, symbols);
+    double end = bench_now();
+
+    bench_allocs_get(&run->allocs);
+    run->seconds = end - start;
+    run->tokens = tokens ? tokens->count : 0;
+    run->arena_peak = arena ? arena->stats.high_water : 0;
+    run->symbols = (InternerStats){ 0 };
+
+    if (symbols) {
+        interner_stats(symbols, &run->symbols);
+    }
+
+    arena_free(arena);
+    interner_free(symbols);
+
+    return ok;
+}
+
+
+/**
+ * Usage: lexer-bench SIZE [RUNS]
+ *
+ * Lexes a generated corpus of SIZE bytes RUNS times and prints
+ * the best run. Fails when the corpus does not lex cleanly.
+ */
+int main(int argc, str_t argv[]) {
+    size_t size = 0;
+
+    if (argc < 2 || !bench_parse_size(argv[1], &size)) {
+        fprintf(stderr, "usage: %s SIZE [RUNS]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int runs = (argc > 2) ? atoi(argv[2]) : 0;
+
+    if (runs <= 0) {
+        runs = (size >= BENCH_LARGE_SIZE) ? 1 : BENCH_RUNS;
+    }
+
+    char *path = bench_corpus_file(size, BENCH_SEED);
+
+    if (!path) {
+        return EXIT_FAILURE;
+    }
+
+    Source *src = source_new(NULL, path);
+
+    unlink(path);
+    free(path);
+
+    if (!src) {
+        return EXIT_FAILURE;
+    }
+
+    LexRun best = { .seconds = -1 };
+
+    for (int i = 0; i < runs; i++) {
+        LexRun run;
+
+        if (!lex_once(src, &run)) {
+            cl_error("the corpus does not lex cleanly\n");
+            source_free(src);
+            return EXIT_FAILURE;
+        }
+
+        if (best.seconds < 0 || run.seconds < best.seconds) {
+            best = run;
+        }
+    }
+
+    double mb = src->length / 1e6;
+
+    printf("lexer %s: %.1f MB, %zu tokens, best of %d: %.4f s\n",
+        argv[1], mb, best.tokens, runs, best.seconds);
+    printf("  %.1f MB/s, %.2f Mtok/s\n",
+        mb / best.seconds, best.tokens / best.seconds / 1e6);
+
+    if (bench_allocs_enabled()) {
+        printf("  %zu allocations, %.1f MB requested\n",
+            best.allocs.count, best.allocs.bytes / 1e6);
+    } else {
+        printf("  allocations not counted\n");
+    }
+
+    printf("  arena high-water %.1f MB\n", best.arena_peak / 1e6);
+    printf("  %zu symbols, %.2f MB interned, %.2f probes per lookup "
+        "(longest %zu)\n", best.symbols.symbols,
+        best.symbols.memory_bytes / 1e6,
+        best.symbols.lookups ? (double)best.symbols.probes /
+            best.symbols.lookups : 0.0, best.symbols.max_probe);
+    printf("  peak RSS %.1f MB\n", bench_peak_rss() / 1e6);
+
+    source_free(src);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include <cl-log.h>
+#include <cl-arena.h>
+#include <cl-source.h>
+#include <cl-tokens.h>
+#include <cl-intern.h>
+#include <cl-lexer.h>
+#include <cl-number.h>
+
+#include "bench.h"
+
+#define BENCH_SEED          0x6E756D626572ULL
+#define BENCH_RUNS          5
+
+
+static uint64_t _rand(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+
+static void _write_digits(FILE *out, uint64_t *state, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        fputc('0' + (int)(_rand(state) % 10), out);
+    }
+}
+
+
+/**
+ * Writes number literals only, one per line: integers up to
+ * UINT64_MAX, hex and binary of any width, and floats of 1 to
+ * 30 significant digits, so both the fast and the fallback
+ * float conversions are taken.
+ */
+static bool _write_numbers(FILE *out, size_t size, uint64_t seed) {
+    uint64_t state = seed;
+
+    while ((size_t)ftell(out) < size) {
+        uint64_t bits = _rand(&state);
+        uint32_t shift = (uint32_t)(_rand(&state) % 64);
+
+        switch (_rand(&state) % 4) {
+            case 0:
+                fprintf(out, "%" PRIu64 "\n", bits >> shift);
+                break;
+            case 1:
+                fprintf(out, "0x%" PRIX64 "\n", bits >> shift);
+                break;
+            case 2:
+                fputs("0b", out);
+
+                for (int bit = 63 - (int)shift; bit >= 0; bit--) {
+                    fputc('0' + (int)((bits >> bit) & 1), out);
+                }
+
+                fputc('\n', out);
+                break;
+            default:
+                fprintf(out, "%" PRIu64 ".", bits >> (shift | 32));
+                _write_digits(out, &state, 1 + (uint32_t)(_rand(&state) % 24));
+                fputc('\n', out);
+                break;
+        }
+    }
+
+    return !ferror(out);
+}
+
+
+/**
+ * Decodes every literal the way codegen does when it uses one,
+ * and returns a sum of their bits so none of them is skipped.
+ */
+static uint64_t _decode_literals(Source *src, TokenStream *tokens) {
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i < tokens->count; i++) {
+        sum += cl_number_value((TokenType)tokens->kinds[i],
+            source_get(src, tokens->offsets[i]), tokens->lengths[i]).integer;
+    }
+
+    return sum;
+}
+
+
+/**
+ * Checks every decoded literal against strtoull and strtod,
+ * bit for bit.
+ */
+static size_t _check_literals(Source *src, TokenStream *tokens) {
+    size_t mismatches = 0;
+    char text[128];
+
+    for (size_t i = 0; i < tokens->count; i++) {
+        Token tk = tokens_get(tokens, i);
+
+        if (tk.length >= sizeof(text)) {
+            mismatches++;
+            continue;
+        }
+
+        memcpy(text, source_get(src, tk.offset), tk.length);
+        text[tk.length] = '\0';
+
+        Literal literal = cl_number_value(tk.type, source_get(src, tk.offset),
+            tk.length);
+        Literal expected = { 0 };
+
+        switch (tk.type) {
+            case TK_INT:
+                expected.integer = strtoull(text, NULL, 10);
+                break;
+            case TK_HEX:
+                expected.integer = strtoull(text + 2, NULL, 16);
+                break;
+            case TK_BIN:
+                expected.integer = strtoull(text + 2, NULL, 2);
+                break;
+            case TK_FLOAT:
+                expected.real = strtod(text, NULL);
+                break;
+            default:
+                mismatches++;
+                continue;
+        }
+
+        if (expected.integer != literal.integer) {
+            if (mismatches++ < 10) {
+                cl_error("%s decoded as 0x%016" PRIX64 ", expected 0x%016"
+                    PRIX64 "\n", text, literal.integer, expected.integer);
+            }
+        }
+    }
+
+    return mismatches;
+}
+
+
+/**
+ * Usage: number-bench SIZE [RUNS]
+ *
+ * Lexes a generated file of SIZE bytes of number literals RUNS
+ * times, then decodes all of them, prints the best run of both,
+ * and fails when any literal is not decoded exactly like the C
+ * library does.
+ */
+int main(int argc, str_t argv[]) {
+    size_t size = 0;
+
+    if (argc < 2 || !bench_parse_size(argv[1], &size)) {
+        fprintf(stderr, "usage: %s SIZE [RUNS]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int runs = (argc > 2) ? atoi(argv[2]) : BENCH_RUNS;
+
+    if (runs <= 0) {
+        runs = BENCH_RUNS;
+    }
+
+    char *path = bench_temp_file(_write_numbers, size, BENCH_SEED);
+
+    if (!path) {
+        return EXIT_FAILURE;
+    }
+
+    Source *src = source_new(NULL, path);
+
+    unlink(path);
+    free(path);
+
+    if (!src) {
+        return EXIT_FAILURE;
+    }
+
+    Interner *symbols = interner_new();
+    double best = -1;
+    double decode_best = -1;
+    uint64_t sum = 0;
+    size_t count = 0;
+    size_t mismatches = 0;
+    bool ok = symbols != NULL;
+
+    for (int i = 0; ok && i < runs; i++) {
+        Arena *arena = arena_new(0);
+        TokenStream *tokens = arena ? tokens_new(arena) : NULL;
+
+        double start = bench_now();
+        ok = tokens && cl_lex(src, tokens, symbols);
+        double seconds = bench_now() - start;
+
+        if (ok && (best < 0 || seconds < best)) {
+            best = seconds;
+        }
+
+        if (ok) {
+            start = bench_now();
+            sum += _decode_literals(src, tokens);
+            seconds = bench_now() - start;
+
+            if (decode_best < 0 || seconds < decode_best) {
+                decode_best = seconds;
+            }
+        }
+
+        if (ok && i == 0) {
+            count = tokens->count;
+            mismatches = _check_literals(src, tokens);
+        }
+
+        arena_free(arena);
+    }
+
+    interner_free(symbols);
+
+    if (!ok) {
+        cl_error("the literals do not lex cleanly\n");
+        source_free(src);
+        return EXIT_FAILURE;
+    }
+
+    double mb = src->length / 1e6;
+
+    printf("numbers %s: %.1f MB, %zu literals, best of %d: %.4f s\n",
+        argv[1], mb, count, runs, best);
+    printf("  %.1f MB/s, %.2f Mlit/s, %zu mismatches\n",
+        mb / best, count / best / 1e6, mismatches);
+    printf("  decoding: %.1f MB/s, %.2f Mlit/s (sum %016" PRIX64 ")\n",
+        mb / decode_best, count / decode_best / 1e6, sum);
+
+    source_free(src);
+
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
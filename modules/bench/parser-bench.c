@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cl-log.h>
+#include <cl-arena.h>
+#include <cl-source.h>
+#include <cl-tokens.h>
+#include <cl-intern.h>
+#include <cl-lexer.h>
+#include <cl-ast.h>
+#include <cl-parser.h>
+
+#include "bench.h"
+
+#define BENCH_SEED          0x636C6F766572ULL
+#define BENCH_RUNS          5
+#define BENCH_LARGE_SIZE    (256UL * 1024 * 1024)
+
+
+CL_TYPE(ParseRun) {
+    double      lex_seconds;
+    double      parse_seconds;
+    size_t      nodes;
+    size_t      extra;
+    BenchAllocs allocs;     /* of the parse alone */
+};
+
+
+/**
+ * Lexes into a fresh arena and parses into a fresh tree from
+ * it, as the compiler does for every unit, timing both.
+ */
+static bool parse_once(Source *src, ParseRun *run) {
+    Interner *symbols = interner_new();
+    Arena *arena = arena_new(0);
+    TokenStream *tokens = arena ? tokens_new(arena) : NULL;
+    Ast *ast = tokens ? ast_new(arena) : NULL;
+    bool ok = ast && symbols;
+
+    double start = bench_now();
+    ok = ok && cl_lex(src, tokens, symbols);
+    double lexed = bench_now();
+
+    bench_allocs_reset();
+    ok = ok && cl_parse(src, tokens, ast);
+    double parsed = bench_now();
+    bench_allocs_get(&run->allocs);
+
+    run->lex_seconds = lexed - start;
+    run->parse_seconds = parsed - lexed;
+    run->nodes = ast ? ast->node_count : 0;
+    run->extra = ast ? ast->extra_count : 0;
+
+    arena_free(arena);
+    interner_free(symbols);
+
+    return ok;
+}
+
+
+/**
+ * Usage: parser-bench SIZE [RUNS]
+ *
+ * Lexes and parses a generated corpus of SIZE bytes RUNS times
+ * and prints the best lex and parse times, with the size of the
+ * tree. Fails when the corpus does not parse cleanly.
+ */
+int main(int argc, str_t argv[]) {
+    size_t size = 0;
+
+    if (argc < 2 || !bench_parse_size(argv[1], &size)) {
+        fprintf(stderr, "usage: %s SIZE [RUNS]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int runs = (argc > 2) ? atoi(argv[2]) : 0;
+
+    if (runs <= 0) {
+        runs = (size >= BENCH_LARGE_SIZE) ? 1 : BENCH_RUNS;
+    }
+
+    char *path = bench_corpus_file(size, BENCH_SEED);
+
+    if (!path) {
+        return EXIT_FAILURE;
+    }
+
+    Source *src = source_new(NULL, path);
+
+    unlink(path);
+    free(path);
+
+    if (!src) {
+        return EXIT_FAILURE;
+    }
+
+    ParseRun best = { .lex_seconds = -1, .parse_seconds = -1 };
+
+    for (int i = 0; i < runs; i++) {
+        ParseRun run;
+
+        if (!parse_once(src, &run)) {
+            cl_error("the corpus does not parse cleanly\n");
+            source_free(src);
+            return EXIT_FAILURE;
+        }
+
+        if (best.lex_seconds < 0 || run.lex_seconds < best.lex_seconds) {
+            best.lex_seconds = run.lex_seconds;
+        }
+
+        if (best.parse_seconds < 0 || run.parse_seconds < best.parse_seconds) {
+            best.parse_seconds = run.parse_seconds;
+            best.nodes = run.nodes;
+            best.extra = run.extra;
+            best.allocs = run.allocs;
+        }
+    }
+
+    double mb = src->length / 1e6;
+    size_t ast_bytes = best.nodes * sizeof(AstNode) +
+        best.extra * sizeof(AstIndex);
+
+    printf("parser %s: %.1f MB, %zu nodes, best of %d\n",
+        argv[1], mb, best.nodes, runs);
+    printf("  lex:   %.4f s, %.1f MB/s\n",
+        best.lex_seconds, mb / best.lex_seconds);
+    printf("  parse: %.4f s, %.1f MB/s, %.2f Mnodes/s\n",
+        best.parse_seconds, mb / best.parse_seconds,
+        best.nodes / best.parse_seconds / 1e6);
+    printf("  %.2f source bytes per node, %.2f tree bytes per node "
+        "(%.1f MB)\n", (double)src->length / best.nodes,
+        (double)ast_bytes / best.nodes, ast_bytes / 1e6);
+
+    if (bench_allocs_enabled()) {
+        printf("  %zu allocations while parsing, %.1f MB requested\n",
+            best.allocs.count, best.allocs.bytes / 1e6);
+    } else {
+        printf("  allocations not counted\n");
+    }
+
+    printf("  peak RSS %.1f MB\n", bench_peak_rss() / 1e6);
+
+    source_free(src);
+
+    return EXIT_SUCCESS;
+}
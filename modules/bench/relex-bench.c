@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cl-log.h>
+#include <cl-source.h>
+#include <cl-tokens.h>
+#include <cl-intern.h>
+#include <cl-lexer.h>
+#include <cl-diagnostic.h>
+
+#include "bench.h"
+
+#define BENCH_SEED          0x72656C6578ULL
+#define BENCH_EDITS         500
+#define BENCH_MAX_REMOVED   24
+
+
+/* what editors usually type, plus the bytes that change how the
+   text around them is split into tokens */
+static const str_t SNIPPETS[] = {
+    "", " ", "\n", "x", "_", "1", "0", ".", ",", ";", "/", "//", "\"", "'",
+    "\\", "(", ")", "{", "}", "<", "=", "!", "0x", "0b1", "1.5", "12ab",
+    "fn", "var y = 2;", "// note\n", "\"str\\n\"", "'c'", "import io;\n",
+    "fn f(a: int) {\n    return a;\n}\n",
+};
+
+
+CL_TYPE(RelexStats) {
+    size_t edits;
+    double relex_seconds;
+    double lex_seconds;
+};
+
+
+static uint64_t _rand(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+
+/* literals get a fresh id every time they are lexed, so they
+   are compared by their contents */
+static bool _same_tokens(TokenStream *a, TokenStream *b, Interner *symbols) {
+    if (a->count != b->count || a->failed != b->failed) {
+        return false;
+    }
+
+    if (memcmp(a->kinds, b->kinds, a->count * sizeof(*a->kinds)) != 0 ||
+        memcmp(a->offsets, b->offsets, a->count * sizeof(*a->offsets)) != 0 ||
+        memcmp(a->lengths, b->lengths, a->count * sizeof(*a->lengths)) != 0) {
+        return false;
+    }
+
+    for (size_t i = 0; i < a->count; i++) {
+        if (interner_unique(symbols, tokens_value(a, i)) !=
+            interner_unique(symbols, tokens_value(b, i))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * Applies the edit incrementally, then lexes the whole edited
+ * source again and checks that both streams are the same.
+ */
+static bool check_edit(Source *src, TokenStream *tokens, Interner *symbols,
+    SourceEdit edit, RelexStats *stats) {
+    double start = bench_now();
+    cl_relex(src, tokens, edit, symbols);
+    double middle = bench_now();
+
+    TokenStream *full = tokens_new(NULL);
+
+    if (!full) {
+        return false;
+    }
+
+    double lex_start = bench_now();
+    cl_lex(src, full, symbols);
+    double end = bench_now();
+
+    bool same = _same_tokens(tokens, full, symbols);
+
+    stats->edits++;
+    stats->relex_seconds += middle - start;
+    stats->lex_seconds += end - lex_start;
+
+    if (!same) {
+        cl_error("relex mismatch after replacing %u bytes at %u with "
+            "\"%.*s\": %zu tokens, expected %zu\n", edit.removed,
+            edit.offset, (int)edit.length, edit.text, tokens->count,
+            full->count);
+    }
+
+    tokens_free(full);
+
+    return same;
+}
+
+
+/**
+ * Usage: relex-bench SIZE [EDITS]
+ *
+ * Makes EDITS random edits to a generated corpus of SIZE bytes,
+ * each followed by the edit that undoes it, so the text stays
+ * close to valid code. Every edit is checked against a full
+ * lex, and the average time of both is printed.
+ */
+int main(int argc, str_t argv[]) {
+    size_t size = 0;
+
+    if (argc < 2 || !bench_parse_size(argv[1], &size)) {
+        fprintf(stderr, "usage: %s SIZE [EDITS]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int edits = (argc > 2) ? atoi(argv[2]) : BENCH_EDITS;
+    char *path = bench_corpus_file(size, BENCH_SEED);
+
+    if (!path) {
+        return EXIT_FAILURE;
+    }
+
+    Source *src = source_new(NULL, path);
+
+    unlink(path);
+    free(path);
+
+    TokenStream *tokens = src ? tokens_new(NULL) : NULL;
+    Interner *symbols = interner_new();
+
+    if (!tokens || !symbols) {
+        return EXIT_FAILURE;
+    }
+
+    /* the random edits break the code, keep the errors quiet */
+    DiagBuffer *diags = diag_buffer_new();
+
+    diag_buffer_capture(diags);
+    cl_lex(src, tokens, symbols);
+
+    RelexStats stats = { 0 };
+    uint64_t state = BENCH_SEED;
+    bool ok = true;
+
+    for (int i = 0; i < edits && ok; i++) {
+        uint32_t offset = _rand(&state) % (src->length + 1);
+        uint32_t removed = _rand(&state) % (BENCH_MAX_REMOVED + 1);
+        str_t text = SNIPPETS[_rand(&state) % CL_N_ELEMS(SNIPPETS)];
+
+        if (removed > src->length - offset) {
+            removed = src->length - offset;
+        }
+
+        char *saved = strndup(src->text + offset, removed);
+
+        if (!saved) {
+            ok = false;
+            break;
+        }
+
+        SourceEdit edit = { offset, removed, text, strlen(text) };
+        SourceEdit undo = { offset, edit.length, saved, removed };
+
+        ok = check_edit(src, tokens, symbols, edit, &stats) &&
+             check_edit(src, tokens, symbols, undo, &stats);
+
+        free(saved);
+
+        diag_buffer_free(diags);
+        diags = diag_buffer_new();
+        diag_buffer_capture(diags);
+    }
+
+    diag_buffer_capture(NULL);
+    diag_buffer_free(diags);
+
+    if (ok) {
+        printf("relex %s: %zu edits match a full lex\n", argv[1], stats.edits);
+        printf("  relex %.1f us/edit, full lex %.1f us/edit, %.0fx faster\n",
+            stats.relex_seconds / stats.edits * 1e6,
+            stats.lex_seconds / stats.edits * 1e6,
+            stats.lex_seconds / stats.relex_seconds);
+    }
+
+    tokens_free(tokens);
+    interner_free(symbols);
+    source_free(src);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
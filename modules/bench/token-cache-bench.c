@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <cl-log.h>
+#include <cl-arena.h>
+#include <cl-source.h>
+#include <cl-tokens.h>
+#include <cl-intern.h>
+#include <cl-lexer.h>
+#include <cl-token-cache.h>
+
+#include "bench.h"
+
+#define BENCH_SEED          0x746F6B656E73ULL
+#define BENCH_RUNS          5
+
+
+/**
+ * Tells whether two streams lexed into different interners
+ * have the same tokens and symbol names.
+ */
+static bool _same_tokens(TokenStream *a, Interner *a_symbols,
+    TokenStream *b, Interner *b_symbols) {
+    if (a->count != b->count ||
+        memcmp(a->kinds, b->kinds, a->count) != 0 ||
+        memcmp(a->offsets, b->offsets, a->count * sizeof(uint32_t)) != 0 ||
+        memcmp(a->lengths, b->lengths, a->count * sizeof(uint32_t)) != 0) {
+        return false;
+    }
+
+    for (size_t i = 0; i < a->count; i++) {
+        uint32_t a_length = 0, b_length = 0;
+        str_t a_name = interner_name(a_symbols, tokens_value(a, i),
+            &a_length);
+        str_t b_name = interner_name(b_symbols, tokens_value(b, i),
+            &b_length);
+
+        if ((a_name == NULL) != (b_name == NULL) || a_length != b_length ||
+            (a_name && memcmp(a_name, b_name, a_length) != 0)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * Usage: token-cache-bench SIZE [RUNS]
+ *
+ * Lexes a generated corpus of SIZE bytes, stores the tokens in
+ * a fresh cache directory and loads them back into an empty
+ * interner, as a new process would. Prints the best lex and
+ * load times of RUNS and the size of the entry per token.
+ * Fails when the loaded tokens differ from the lexed ones.
+ */
+int main(int argc, str_t argv[]) {
+    size_t size = 0;
+
+    if (argc < 2 || !bench_parse_size(argv[1], &size)) {
+        fprintf(stderr, "usage: %s SIZE [RUNS]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int runs = (argc > 2) ? atoi(argv[2]) : BENCH_RUNS;
+
+    if (runs <= 0) {
+        runs = BENCH_RUNS;
+    }
+
+    char *path = bench_corpus_file(size, BENCH_SEED);
+    Source *src = path ? source_new(NULL, path) : NULL;
+
+    if (path) {
+        unlink(path);
+        free(path);
+    }
+
+    str_t tmpdir = getenv("TMPDIR");
+    char dir[64];
+
+    snprintf(dir, sizeof(dir), "%s/clover-cache-XXXXXX",
+        (tmpdir && *tmpdir) ? tmpdir : "/tmp");
+
+    if (!src) {
+        return EXIT_FAILURE;
+    }
+
+    if (!mkdtemp(dir)) {
+        cl_error("%s: %s\n", dir, strerror(errno));
+        source_free(src);
+        return EXIT_FAILURE;
+    }
+
+    /* with no room at all, closing the cache empties it */
+    TokenCache *cache = token_cache_open(dir, 0);
+    Interner *lexed_symbols = interner_new();
+    Arena *arena = arena_new(0);
+    TokenStream *lexed = arena ? tokens_new(arena) : NULL;
+    double lex_best = -1, load_best = -1;
+    bool ok = cache && lexed && lexed_symbols;
+
+    for (int i = 0; ok && i < runs; i++) {
+        lexed->count = 0;
+        lexed->value_count = 0;
+
+        double start = bench_now();
+        ok = cl_lex(src, lexed, lexed_symbols);
+        double seconds = bench_now() - start;
+
+        if (lex_best < 0 || seconds < lex_best) {
+            lex_best = seconds;
+        }
+    }
+
+    ok = ok && token_cache_store(cache, src, lexed, lexed_symbols);
+
+    for (int i = 0; ok && i < runs; i++) {
+        Interner *symbols = interner_new();
+        Arena *load_arena = arena_new(0);
+        TokenStream *loaded = load_arena ? tokens_new(load_arena) : NULL;
+
+        double start = bench_now();
+        ok = loaded && symbols &&
+            token_cache_load(cache, src, loaded, symbols);
+        double seconds = bench_now() - start;
+
+        if (load_best < 0 || seconds < load_best) {
+            load_best = seconds;
+        }
+
+        ok = ok && _same_tokens(lexed, lexed_symbols, loaded, symbols);
+
+        arena_free(load_arena);
+        interner_free(symbols);
+    }
+
+    TokenCacheStats stats = { 0 };
+
+    if (cache) {
+        token_cache_stats(cache, &stats);
+        token_cache_close(cache);
+    }
+
+    rmdir(dir);
+
+    if (ok) {
+        double mb = src->length / 1e6;
+
+        printf("token cache %s: %.1f MB, %zu tokens, best of %d\n",
+            argv[1], mb, lexed->count, runs);
+        printf("  lex:  %.4f s, %.1f MB/s\n", lex_best, mb / lex_best);
+        printf("  load: %.4f s, %.1f MB/s, %.2fx\n", load_best,
+            mb / load_best, lex_best / load_best);
+        printf("  entry %.1f MB, %.2f bytes per token, %.1f%% of the "
+            "source\n", stats.bytes_written / 1e6,
+            (double)stats.bytes_written / lexed->count,
+            100.0 * stats.bytes_written / src->length);
+        printf("  peak RSS %.1f MB\n", bench_peak_rss() / 1e6);
+    } else {
+        cl_error("the loaded tokens differ from the lexed ones\n");
+    }
+
+    arena_free(arena);
+    interner_free(lexed_symbols);
+    source_free(src);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
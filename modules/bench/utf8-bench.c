@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cl-log.h>
+#include <cl-source.h>
+
+#include "bench.h"
+
+#define BENCH_SEED          0x75746638ULL
+#define BENCH_RUNS          5
+#define BENCH_SAMPLES       200000
+#define BENCH_SAMPLE_MAX    256
+
+
+static uint64_t _rand(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+
+static void _write_code_point(FILE *out, uint32_t code) {
+    if (code < 0x80) {
+        fputc((int)code, out);
+    } else if (code < 0x800) {
+        fputc(0xC0 | (int)(code >> 6), out);
+        fputc(0x80 | (int)(code & 0x3F), out);
+    } else if (code < 0x10000) {
+        fputc(0xE0 | (int)(code >> 12), out);
+        fputc(0x80 | (int)((code >> 6) & 0x3F), out);
+        fputc(0x80 | (int)(code & 0x3F), out);
+    } else {
+        fputc(0xF0 | (int)(code >> 18), out);
+        fputc(0x80 | (int)((code >> 12) & 0x3F), out);
+        fputc(0x80 | (int)((code >> 6) & 0x3F), out);
+        fputc(0x80 | (int)(code & 0x3F), out);
+    }
+}
+
+
+/**
+ * Writes lines of ASCII words mixed with 2, 3 and 4 byte
+ * characters, about one in four of them multibyte.
+ */
+static bool _write_text(FILE *out, size_t size, uint64_t seed) {
+    uint64_t state = seed;
+
+    while ((size_t)ftell(out) < size) {
+        for (int i = 0; i < 60; i++) {
+            uint64_t bits = _rand(&state);
+            uint32_t code;
+
+            switch (bits % 16) {
+                case 0:
+                    code = 0x80 + (uint32_t)(bits >> 8) % (0x800 - 0x80);
+                    break;
+                case 1:
+                    code = 0x800 + (uint32_t)(bits >> 8) % (0xD800 - 0x800);
+                    break;
+                case 2:
+                    code = 0xE000 + (uint32_t)(bits >> 8) % (0x10000 - 0xE000);
+                    break;
+                case 3:
+                    code = 0x10000 + (uint32_t)(bits >> 8) % (0x110000 - 0x10000);
+                    break;
+                default:
+                    code = 'a' + (uint32_t)(bits >> 8) % 26;
+                    break;
+            }
+
+            _write_code_point(out, code);
+        }
+
+        fputc('\n', out);
+    }
+
+    return !ferror(out);
+}
+
+
+/**
+ * The obvious decoder the validator must agree with: decode a
+ * code point, then reject overlong forms, surrogates and code
+ * points above U+10FFFF.
+ */
+static size_t _reference(const uint8_t *text, size_t length, bool *ascii) {
+    static const uint32_t MIN_CODE[] = { 0, 0, 0x80, 0x800, 0x10000 };
+
+    *ascii = true;
+
+    for (size_t i = 0; i < length;) {
+        uint8_t lead = text[i];
+        size_t n = (lead < 0x80) ? 1 : (lead >> 5) == 0x06 ? 2 :
+                   (lead >> 4) == 0x0E ? 3 : (lead >> 3) == 0x1E ? 4 : 0;
+
+        if (n == 0 || i + n > length) {
+            *ascii = false;
+            return i;
+        }
+
+        uint32_t code = (n == 1) ? lead : lead & (0x7F >> n);
+
+        for (size_t k = 1; k < n; k++) {
+            if ((text[i + k] & 0xC0) != 0x80) {
+                *ascii = false;
+                return i;
+            }
+
+            code = (code << 6) | (text[i + k] & 0x3F);
+        }
+
+        if (code < MIN_CODE[n] || code > 0x10FFFF ||
+            (code >= 0xD800 && code <= 0xDFFF)) {
+            *ascii = false;
+            return i;
+        }
+
+        *ascii = *ascii && n == 1;
+        i += n;
+    }
+
+    return length;
+}
+
+
+/**
+ * Validates short slices of the text, some with a byte
+ * replaced, and compares the result with the reference.
+ */
+static size_t _check_samples(Source *src, uint64_t seed) {
+    uint64_t state = seed;
+    size_t mismatches = 0;
+    uint8_t sample[BENCH_SAMPLE_MAX];
+
+    for (size_t i = 0; i < BENCH_SAMPLES; i++) {
+        size_t length = 1 + (size_t)(_rand(&state) % BENCH_SAMPLE_MAX);
+        size_t offset = (size_t)(_rand(&state) % (src->length - length));
+
+        memcpy(sample, &src->text[offset], length);
+
+        if (i % 2 == 0) {
+            sample[_rand(&state) % length] = (uint8_t)_rand(&state);
+        }
+
+        bool ascii, expected_ascii;
+        size_t error = source_validate_utf8((str_t)sample, length, &ascii);
+        size_t expected = _reference(sample, length, &expected_ascii);
+
+        if (error != expected || (error == length && ascii != expected_ascii)) {
+            if (mismatches++ < 10) {
+                cl_error("sample %zu: error at %zu, expected %zu\n",
+                    i, error, expected);
+            }
+        }
+    }
+
+    return mismatches;
+}
+
+
+static double _best_run(str_t text, size_t length, int runs, bool *valid,
+    bool *ascii) {
+    double best = -1;
+
+    for (int i = 0; i < runs; i++) {
+        double start = bench_now();
+        size_t error = source_validate_utf8(text, length, ascii);
+        double seconds = bench_now() - start;
+
+        *valid = (error == length);
+
+        if (best < 0 || seconds < best) {
+            best = seconds;
+        }
+    }
+
+    return best;
+}
+
+
+static Source *_load(BenchWriteFn write, size_t size) {
+    char *path = bench_temp_file(write, size, BENCH_SEED);
+
+    if (!path) {
+        return NULL;
+    }
+
+    Source *src = source_new(NULL, path);
+
+    unlink(path);
+    free(path);
+
+    return src;
+}
+
+
+/**
+ * Usage: utf8-bench SIZE [RUNS]
+ *
+ * Validates SIZE bytes of Clover code, which is plain ASCII,
+ * and SIZE bytes of mixed multibyte text RUNS times each and
+ * prints the best runs. Fails when either is not found valid,
+ * or when the validator disagrees with a plain decoder on
+ * any of the sampled and corrupted slices of the text.
+ */
+int main(int argc, str_t argv[]) {
+    size_t size = 0;
+
+    if (argc < 2 || !bench_parse_size(argv[1], &size)) {
+        fprintf(stderr, "usage: %s SIZE [RUNS]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int runs = (argc > 2) ? atoi(argv[2]) : BENCH_RUNS;
+
+    if (runs <= 0) {
+        runs = BENCH_RUNS;
+    }
+
+    Source *code = _load(bench_corpus_write, size);
+    Source *text = code ? _load(_write_text, size) : NULL;
+
+    if (!text) {
+        if (code) {
+            source_free(code);
+        }
+
+        return EXIT_FAILURE;
+    }
+
+    bool code_valid, code_ascii, text_valid, text_ascii;
+    double code_best = _best_run(code->text, code->length, runs,
+        &code_valid, &code_ascii);
+    double text_best = _best_run(text->text, text->length, runs,
+        &text_valid, &text_ascii);
+    size_t mismatches = _check_samples(text, BENCH_SEED);
+
+    printf("utf8 %s (%s): best of %d\n", argv[1], source_simd_name(), runs);
+    printf("  code: %.1f MB, %.2f GB/s, %s\n", code->length / 1e6,
+        code->length / code_best / 1e9, code_ascii ? "ascii" : "not ascii");
+    printf("  text: %.1f MB, %.2f GB/s, %s\n", text->length / 1e6,
+        text->length / text_best / 1e9, text_ascii ? "ascii" : "not ascii");
+    printf("  %d samples, %zu mismatches\n", BENCH_SAMPLES, mismatches);
+
+    bool ok = code_valid && code_ascii && text_valid && !text_ascii &&
+        mismatches == 0;
+
+    if (!code_valid || !text_valid) {
+        cl_error("valid UTF-8 was rejected\n");
+    }
+
+    source_free(code);
+    source_free(text);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
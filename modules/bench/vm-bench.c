@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include <cl-log.h>
+#include <cl-vector.h>
+#include <cl-compiler.h>
+#include <cl-object.h>
+#include <cl-vm.h>
+
+#include "bench.h"
+
+#define BENCH_RUNS          5
+#define BENCH_CORRUPTIONS   64      /* corrupted copies of the object */
+#define BENCH_FLIPS         4       /* at most, bytes changed in each */
+#define BENCH_CORRUPT_LIMIT 2       /* seconds a copy may run */
+
+
+/**
+ * Compiles a program into a new temporary object, whose path
+ * goes to `object_path` for the caller to unlink.
+ */
+static bool _compile(str_t path, bool optimize, char *object_path,
+    size_t size) {
+    str_t tmpdir = getenv("TMPDIR");
+
+    snprintf(object_path, size, "%s/clover-vm-XXXXXX",
+        (tmpdir && *tmpdir) ? tmpdir : "/tmp");
+
+    int fd = mkstemp(object_path);
+
+    if (fd < 0) {
+        cl_error("%s: %s\n", object_path, strerror(errno));
+        return false;
+    }
+
+    close(fd);
+
+    Vector *files = vector_new(sizeof(str_t));
+    CompileOptions options = {
+        .output_file = object_path,
+        .optimize = optimize,
+    };
+    bool ok = files && vector_push(files, CL_VOIDPTR(&path)) &&
+        cl_compile(files, &options);
+
+    if (files) {
+        vector_free(files);
+    }
+
+    return ok;
+}
+
+
+/**
+ * Runs the program of an object once on a new VM. Fails unless
+ * `main` returns 0, which the programs do when what they
+ * computed is right.
+ */
+static bool _run(ObjectFile *object, double *seconds, VmStats *stats) {
+    Vm *vm = vm_new(object);
+    int status = EXIT_FAILURE;
+
+    if (!vm) {
+        return false;
+    }
+
+    double start = bench_now();
+    bool ok = vm_run(vm, &status);
+
+    *seconds = bench_now() - start;
+    vm_stats(vm, stats);
+    vm_free(vm);
+
+    if (ok && status != 0) {
+        cl_error("the program computed a wrong result\n");
+    }
+
+    return ok && status == 0;
+}
+
+
+static uint64_t _rand(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+
+/**
+ * Loads and runs a corrupted object in a child process, where
+ * a crash cannot take the benchmark down. Returns whether the
+ * VM turned it away or ran it without crashing; a copy that
+ * loops is stopped after BENCH_CORRUPT_LIMIT seconds.
+ */
+static bool _survives(str_t path) {
+    pid_t pid = fork();
+    int status = 0;
+
+    if (pid < 0) {
+        cl_error("fork: %s\n", strerror(errno));
+        return false;
+    }
+
+    if (pid == 0) {
+        /* what the VM says about the bytecode is expected */
+        if (!freopen("/dev/null", "w", stdout) ||
+            !freopen("/dev/null", "w", stderr)) {
+            _exit(EXIT_FAILURE);
+        }
+
+        alarm(BENCH_CORRUPT_LIMIT);
+
+        ObjectFile *object = object_open(path);
+        Vm *vm = object ? vm_new(object) : NULL;
+        int result;
+
+        if (vm) {
+            vm_run(vm, &result);
+        }
+
+        _exit(EXIT_SUCCESS);
+    }
+
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+        continue;
+    }
+
+    return !WIFSIGNALED(status) || WTERMSIG(status) == SIGALRM;
+}
+
+
+/**
+ * Flips a few random bytes of the code and constants of an
+ * object, BENCH_CORRUPTIONS times, and checks that the VM
+ * survives every copy: the verifier has to catch what would
+ * make it read or jump out of bounds.
+ */
+static bool _corrupt(ObjectFile *object, str_t name) {
+    size_t size = object->map_size;
+    size_t code = (size_t)(object->code - (const uint8_t *)object->map);
+    uint8_t *copy = malloc(size);
+    str_t tmpdir = getenv("TMPDIR");
+    char path[128];
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    int crashes = 0;
+
+    if (!copy || object->code_size == 0) {
+        free(copy);
+        return copy != NULL;
+    }
+
+    snprintf(path, sizeof(path), "%s/clover-vm-XXXXXX",
+        (tmpdir && *tmpdir) ? tmpdir : "/tmp");
+
+    int fd = mkstemp(path);
+
+    if (fd < 0) {
+        cl_error("%s: %s\n", path, strerror(errno));
+        free(copy);
+        return false;
+    }
+
+    close(fd);
+
+    for (int i = 0; i < BENCH_CORRUPTIONS; i++) {
+        memcpy(copy, object->map, size);
+
+        for (int flips = 1 + _rand(&state) % BENCH_FLIPS; flips > 0;
+            flips--) {
+            copy[code + _rand(&state) % object->code_size] ^=
+                (uint8_t)(1 + _rand(&state) % 255);
+        }
+
+        FILE *out = fopen(path, "wb");
+        bool written = out && fwrite(copy, 1, size, out) == size;
+
+        if (!out || fclose(out) != 0 || !written) {
+            cl_error("%s: %s\n", path, strerror(errno));
+            crashes = -1;
+            break;
+        }
+
+        if (!_survives(path)) {
+            crashes++;
+        }
+    }
+
+    unlink(path);
+    free(copy);
+
+    if (crashes > 0) {
+        cl_error("%d of %d corrupted copies of %s crashed the VM\n",
+            crashes, BENCH_CORRUPTIONS, name);
+    }
+
+    return crashes == 0;
+}
+
+
+/**
+ * Compiles the program, with the optimizer or without, runs it
+ * `runs` times and prints how it went.
+ */
+static bool _measure(str_t path, bool optimize, int runs) {
+    char object_path[128];
+    bool compiled = _compile(path, optimize, object_path,
+        sizeof(object_path));
+    ObjectFile *object = compiled ? object_open(object_path) : NULL;
+
+    unlink(object_path);
+
+    if (!object) {
+        cl_error("%s does not compile cleanly\n", path);
+        return false;
+    }
+
+    VmStats stats = { 0 };
+    double best = -1;
+    bool ok = true;
+
+    for (int i = 0; ok && i < runs; i++) {
+        double seconds = 0;
+
+        ok = _run(object, &seconds, &stats);
+
+        if (best < 0 || seconds < best) {
+            best = seconds;
+        }
+    }
+
+    str_t name = strrchr(path, '/');
+
+    name = name ? name + 1 : path;
+    ok = ok && (optimize || _corrupt(object, name));
+    object_close(object);
+
+    if (!ok) {
+        return false;
+    }
+
+    printf("vm %s%s: %s dispatch, best of %d\n", name,
+        optimize ? " -O" : "", vm_dispatch_name(), runs);
+    printf("  %llu instructions, %llu calls\n",
+        (unsigned long long)stats.instructions,
+        (unsigned long long)stats.calls);
+    printf("  %.4f s, %.1f M instructions/s, %.1f ns/instruction\n",
+        best, stats.instructions / best / 1e6,
+        best * 1e9 / stats.instructions);
+
+    return true;
+}
+
+
+/**
+ * Usage: vm-bench FILE [RUNS]
+ *
+ * Compiles a Clover program and runs it RUNS times, each on a
+ * new VM, then does the same with the optimizer on. Prints the
+ * instructions it executes and the best rate, in instructions
+ * per second, next to the dispatch the VM was built with. Fails
+ * when the program does not compile, its `main` does not return
+ * 0, or a copy of its object with a few bytes changed crashes
+ * the VM.
+ */
+int main(int argc, str_t argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s FILE [RUNS]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int runs = (argc > 2) ? atoi(argv[2]) : BENCH_RUNS;
+
+    if (runs <= 0) {
+        runs = BENCH_RUNS;
+    }
+
+    if (!_measure(argv[1], false, runs) || !_measure(argv[1], true, runs)) {
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,27 @@
+// Recursive and leaf calls, most of them with a few arguments.
+
+fn fib(n: int): int {
+    if n < 2 {
+        return n;
+    }
+
+    return fib(n - 1) + fib(n - 2);
+}
+
+fn mix(a: int, b: int, c: int): int {
+    return (a * 31 + b) ^ c;
+}
+
+fn main(): int {
+    var hash = 0;
+
+    for var i = 0; i < 2000000; i = i + 1 {
+        hash = mix(hash, i, 7) & 65535;
+    }
+
+    if fib(27) != 196418 || hash < 0 {
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,40 @@
+// Struct fields read and written, through a pointer and in place.
+
+struct Body {
+    x: int,
+    y: int,
+    vx: int = 1,
+    vy: int = 2,
+}
+
+fn step(b: *Body) {
+    b.x = b.x + b.vx;
+    b.y = b.y + b.vy;
+
+    if b.x > 1000 || b.x < 0 {
+        b.vx = -b.vx;
+    }
+
+    if b.y > 1000 || b.y < 0 {
+        b.vy = -b.vy;
+    }
+}
+
+fn main(): int {
+    var a: Body;
+    var b: Body;
+
+    b.vx = 3;
+
+    for var i = 0; i < 3000000; i = i + 1 {
+        step(a);
+        b.x = b.x + b.vx;
+        b.y = b.y + a.vy;
+    }
+
+    if a.x < 0 || a.x > 1001 || a.y < 0 || a.y > 1002 || b.x != 9000000 {
+        return 1;
+    }
+
+    return 0;
+}
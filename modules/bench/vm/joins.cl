@@ -0,0 +1,30 @@
+// Calls whose arguments are only known after a branch, which the
+// optimizer sees as values joined from both sides.
+
+fn pick(a: int, b: int, c: int): int {
+    return a * 10000 + b * 100 + c;
+}
+
+fn main(): int {
+    var sum = 0;
+
+    for var i = 0; i < 1000000; i = i + 1 {
+        var odd = (i & 1) == 1;
+        var b = 0;
+
+        if odd {
+            b = 7;
+        } else {
+            b = 3;
+        }
+
+        sum = (sum + pick(1, odd ? 2 : 5, b)) & 1048575;
+    }
+
+    // half the calls are pick(1, 2, 7), the other half pick(1, 5, 3)
+    if sum != ((500000 * 10207 + 500000 * 10503) & 1048575) {
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,33 @@
+// Counted and conditional loops over integer arithmetic.
+
+fn main(): int {
+    var sum = 0;
+
+    for var i = 0; i < 10000000; i = i + 1 {
+        sum = sum + (i & 7);
+    }
+
+    var n = 0;
+
+    while n < 5000000 {
+        if n % 3 == 0 {
+            sum = sum - 1;
+        }
+
+        n = n + 1;
+    }
+
+    var grid = 0;
+
+    for var y = 0; y < 1000; y = y + 1 {
+        for var x = 0; x < 1000; x = x + 1 {
+            grid = grid ^ (x * y);
+        }
+    }
+
+    if sum != 33333333 || grid != 676240 {
+        return 1;
+    }
+
+    return 0;
+}
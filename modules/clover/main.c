@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cl-log.h>
+#include <cl-compiler.h>
+#include <cl-object.h>
+#include <cl-vm.h>
+
+
+#define isoption(s)     (*s == '-')
+#define strcmpeq(a,b)   (strcmp(a,b) == 0)
+
+
+CL_TYPE(Options) {
+    str_t   input_file;
+    Vector *import_paths;
+    bool    stats;
+    bool    optimize;
+};
+
+
+static void show_help(str_t program) {
+    printf((
+        "Usage:\n"
+        "  %s run [option] [--] file\n"
+        "\n"
+        "Runs a Clover program, compiling it first when it is a .cl\n"
+        "file rather than a .co object. Exits with what `main`\n"
+        "returns, or 0 when it returns nothing.\n"
+        "\n"
+        "Run options:\n"
+        "  -I DIR           Look for imported modules in DIR too\n"
+        "  -O               Optimize the program it compiles\n"
+        "  --stats          Print the instructions executed and how\n"
+        "                   fast when done\n"
+        "\n"
+        "General Options:\n"
+        "  -h  --help       Shows this message and exits\n"
+        "  -v  --version    Shows program version and exits\n"
+    ), program);
+}
+
+
+static void show_version(str_t program) {
+    printf("%s " CL_VERSION " (" CL_BUILDINFO ", %s dispatch)\n", program,
+        vm_dispatch_name());
+}
+
+
+static bool has_suffix(str_t str, str_t suffix) {
+    size_t length = strlen(str);
+    size_t suffix_length = strlen(suffix);
+
+    return length >= suffix_length &&
+        strcmpeq(str + length - suffix_length, suffix);
+}
+
+
+static double now(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+/**
+ * Parses the command line. Returns false when there is nothing
+ * to run, with the exit status in `status`.
+ */
+static bool options_init(Options *options, int argc, str_t argv[],
+    int *status) {
+    const str_t program = CL_PRGNAME;
+
+    *status = EXIT_FAILURE;
+
+    if (argc < 2) {
+        show_help(program);
+        return false;
+    }
+
+    if (strcmpeq(argv[1], "-h") || strcmpeq(argv[1], "--help")) {
+        show_help(program);
+        *status = EXIT_SUCCESS;
+        return false;
+    }
+
+    if (strcmpeq(argv[1], "-v") || strcmpeq(argv[1], "--version")) {
+        show_version(program);
+        *status = EXIT_SUCCESS;
+        return false;
+    }
+
+    if (!strcmpeq(argv[1], "run")) {
+        cl_error("unknown command: %s\n", argv[1]);
+        return false;
+    }
+
+    options->input_file = NULL;
+    options->stats = false;
+    options->optimize = false;
+    options->import_paths = vector_new(sizeof(str_t));
+
+    if (!options->import_paths) {
+        cl_fatal("%s\n", strerror(errno));
+        return false;
+    }
+
+    bool end_options = false;
+    bool failed = false;
+
+    for (int i = 2; i < argc && !failed; i++) {
+        str_t curr = argv[i];
+
+        if (!isoption(curr) || end_options) {
+            if (options->input_file) {
+                cl_error("only one file can be run\n");
+                failed = true;
+            }
+
+            options->input_file = curr;
+            continue;
+        }
+
+        if (strcmpeq(curr, "-I")) {
+            if (i + 1 >= argc) {
+                cl_error("missing argument for option: -I\n");
+                failed = true;
+                break;
+            }
+
+            vector_push(options->import_paths, CL_VOIDPTR(&argv[++i]));
+        } else if (strncmp(curr, "-I", 2) == 0) {
+            str_t dir = curr + 2;
+
+            vector_push(options->import_paths, CL_VOIDPTR(&dir));
+        } else if (strcmpeq(curr, "-O")) {
+            options->optimize = true;
+        } else if (strcmpeq(curr, "--stats")) {
+            options->stats = true;
+        } else if (strcmpeq(curr, "--")) {
+            end_options = true;
+        } else {
+            cl_error("unknown option: %s\n", curr);
+            failed = true;
+        }
+    }
+
+    if (!failed && !options->input_file) {
+        cl_error("no file to run\n");
+        failed = true;
+    }
+
+    if (failed) {
+        vector_free(options->import_paths);
+        return false;
+    }
+
+    return true;
+}
+
+
+static void options_deinit(Options *options) {
+    vector_free(options->import_paths);
+}
+
+
+/**
+ * Compiles a file into a new temporary object and returns its
+ * path, which the caller frees and unlinks, or NULL when it
+ * does not compile.
+ */
+static char *compile(Options *options) {
+    str_t tmpdir = getenv("TMPDIR");
+    size_t size = strlen((tmpdir && *tmpdir) ? tmpdir : "/tmp") + 32;
+    char *path = malloc(size);
+
+    if (!path) {
+        cl_error("out of memory!\n");
+        return NULL;
+    }
+
+    snprintf(path, size, "%s/clover-run-XXXXXX",
+        (tmpdir && *tmpdir) ? tmpdir : "/tmp");
+
+    int fd = mkstemp(path);
+
+    if (fd < 0) {
+        cl_error("%s: %s\n", path, strerror(errno));
+        free(path);
+        return NULL;
+    }
+
+    close(fd);
+
+    Vector *files = vector_new(sizeof(str_t));
+    CompileOptions compile = {
+        .output_file = path,
+        .import_paths = options->import_paths,
+        .interfaces = true,
+        .optimize = options->optimize,
+    };
+
+    bool compiled = files &&
+        vector_push(files, CL_VOIDPTR(&options->input_file)) &&
+        cl_compile(files, &compile);
+
+    if (files) {
+        vector_free(files);
+    }
+
+    if (!compiled) {
+        unlink(path);
+        free(path);
+        return NULL;
+    }
+
+    return path;
+}
+
+
+static void show_stats(Vm *vm, double seconds) {
+    VmStats stats;
+
+    vm_stats(vm, &stats);
+
+    fprintf(stderr, "%llu instructions, %llu calls in %.3f s, "
+        "%.1f M instructions/s (%s dispatch)\n",
+        (unsigned long long)stats.instructions,
+        (unsigned long long)stats.calls, seconds,
+        (seconds > 0) ? stats.instructions / seconds / 1e6 : 0.0,
+        vm_dispatch_name());
+}
+
+
+static int run(Options *options) {
+    char *temp_path = NULL;
+    str_t path = options->input_file;
+
+    if (!has_suffix(path, ".co")) {
+        temp_path = compile(options);
+
+        if (!temp_path) {
+            printf("compilation terminated.\n");
+            return EXIT_FAILURE;
+        }
+
+        path = temp_path;
+    }
+
+    ObjectFile *object = object_open(path);
+
+    /* the object is mapped, so the file can go right away */
+    if (temp_path) {
+        unlink(temp_path);
+        free(temp_path);
+    }
+
+    if (!object) {
+        return EXIT_FAILURE;
+    }
+
+    Vm *vm = vm_new(object);
+    int status = EXIT_FAILURE;
+
+    if (vm) {
+        double start = now();
+
+        if (!vm_run(vm, &status)) {
+            status = EXIT_FAILURE;
+        }
+
+        if (options->stats) {
+            show_stats(vm, now() - start);
+        }
+
+        vm_free(vm);
+    }
+
+    object_close(object);
+
+    return status;
+}
+
+
+int main(int argc, str_t argv[]) {
+    Options options;
+    int status;
+
+    if (!options_init(&options, argc, argv, &status)) {
+        return status;
+    }
+
+    status = run(&options);
+
+    options_deinit(&options);
+
+    return status;
+}
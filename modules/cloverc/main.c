@@ -6,6 +6,8 @@
 #include <cl-log.h>
 #include <cl-compiler.h>
 
+#include "server.h"
+
 
 #define isoption(s)     (*s == '-')
 #define strcmpeq(a,b)   (strcmp(a,b) == 0)
@@ -13,8 +15,12 @@
 
 
 CL_TYPE(Options) {
-    Vector *input_files;
-    str_t   output_file;
+    Vector        *input_files;
+    CompileOptions compile;
+    bool           cache;
+    str_t          cache_dir;       /* NULL for the default one */
+    size_t         cache_size;
+    bool           cache_stats;
 };
 
 
@@ -25,13 +31,44 @@ static void show_help(str_t program) {
         "\n"
         "Compile options:\n"
         "  -o FILE          Set output file name (defaults to a.co)\n"
+        "  -j N             Compile N files in parallel (defaults to\n"
+        "                   the number of processors)\n"
+        "  -I DIR           Look for imported modules in DIR too\n"
+        "  --no-interfaces  Neither read nor write the .cli interface\n"
+        "                   files of modules\n"
+        "  --diagnostics-format=FORMAT\n"
+        "                   Print diagnostics as human (default),\n"
+        "                   json (one object per line) or sarif\n"
+        "\n"
+        "Optimization options:\n"
+        "  -O               Optimize every function written\n"
+        "  --passes=LIST    Run the passes in LIST, separated by\n"
+        "                   commas, instead of the default ones\n"
+        "                   (implies -O)\n"
+        "  --dump-ir        Print the IR of every function after\n"
+        "                   each pass\n"
+        "  --time-passes    Print the time each pass took\n"
+        "\n"
+        "Cache options:\n"
+        "  --cache[=DIR]    Keep lexed files in DIR (defaults to\n"
+        "                   $XDG_CACHE_HOME/clover)\n"
+        "  --cache-size=SIZE\n"
+        "                   Keep the cache under SIZE bytes, with an\n"
+        "                   optional K, M or G (defaults to 256M)\n"
+        "  --cache-stats    Print cache hits and misses when done\n"
+        "\n"
+        "Server options (must come first):\n"
+        "  --server[=SOCKET]\n"
+        "                   Keep compiling for clients on SOCKET,\n"
+        "                   reusing files that did not change\n"
+        "  --client[=SOCKET]\n"
+        "                   Let the server on SOCKET compile, or\n"
+        "                   compile here if there is none\n"
         "\n"
         "General Options:\n"
         "  -h  --help       Shows this message and exits\n"
         "  -v  --version    Shows program version and exits\n"
     ), program);
-
-    exit(EXIT_SUCCESS);
 }
 
 
@@ -46,28 +83,90 @@ static void show_version(str_t program) {
         "\n"
         "License: https://www.gnu.org/licenses/lgpl-3.0.html\n"
     ), program);
+}
+
+
+static bool parse_jobs(str_t arg, uint32_t *out_jobs) {
+    char *end = NULL;
+    unsigned long jobs = strtoul(arg, &end, 10);
+
+    if (!*arg || *end || jobs == 0 || jobs > UINT16_MAX) {
+        cl_error("invalid number of jobs: %s\n", arg);
+        return false;
+    }
 
-    exit(EXIT_SUCCESS);
+    *out_jobs = (uint32_t)jobs;
+
+    return true;
 }
 
 
-static void options_init(Options *options, int argc, str_t argv[]) {
+static bool parse_size(str_t arg, size_t *out_size) {
+    char *end = NULL;
+    unsigned long long size = strtoull(arg, &end, 10);
+    int shift = 0;
+
+    switch (*end) {
+        case 'K': shift = 10; end++; break;
+        case 'M': shift = 20; end++; break;
+        case 'G': shift = 30; end++; break;
+    }
+
+    if (!*arg || *arg == '-' || *end || size > (SIZE_MAX >> shift)) {
+        cl_error("invalid size: %s\n", arg);
+        return false;
+    }
+
+    *out_size = (size_t)size << shift;
+
+    return true;
+}
+
+
+/**
+ * Parses the command line. Returns false when there is nothing
+ * to compile, with the exit status in `status`; nothing in here
+ * exits, since the server parses the command line of every
+ * request.
+ */
+static bool options_init(Options *options, int argc, str_t argv[],
+    int *status) {
     const str_t program = (!argv[0]) ? prgname(argv[0]) : CL_PRGNAME;
 
+    *status = EXIT_SUCCESS;
+
     if (argc < 2) {
         show_help(program);
+        return false;
     }
 
     options->input_files = vector_new(sizeof(str_t));
+    options->compile = (CompileOptions){ .interfaces = true };
+    options->cache = false;
+    options->cache_dir = NULL;
+    options->cache_size = CL_TOKEN_CACHE_DEFAULT_SIZE;
+    options->cache_stats = false;
+    options->compile.import_paths = vector_new(sizeof(str_t));
+
+    if (!options->input_files || !options->compile.import_paths) {
+        if (options->input_files) {
+            vector_free(options->input_files);
+        }
+
+        if (options->compile.import_paths) {
+            vector_free(options->compile.import_paths);
+        }
 
-    if (!options->input_files) {
         cl_fatal("%s\n", strerror(errno));
-        exit(EXIT_FAILURE);
+        *status = EXIT_FAILURE;
+        return false;
     }
 
     bool end_options = false;
+    bool failed = false;
+    bool done = false;
 
-    for (int i = 1; i < argc; i++) {
+    for (int i = 1; i < argc && !failed && !done; i++) {
         str_t curr = argv[i];
 
         if (!isoption(curr) || end_options) {
@@ -77,37 +176,195 @@ static void options_init(Options *options, int argc, str_t argv[]) {
 
         if (strcmpeq(curr, "-h") || strcmpeq(curr, "--help")) {
             show_help(program);
+            done = true;
         } else if (strcmpeq(curr, "-v") || strcmpeq(curr, "--version")) {
             show_version(program);
+            done = true;
         } else if (strcmpeq(curr, "-o")) {
             if (i + 1 >= argc) {
                 cl_error("missing argument for option: -o\n");
-                exit(EXIT_FAILURE);
+                failed = true;
+                break;
+            }
+
+            options->compile.output_file = argv[++i];
+        } else if (strcmpeq(curr, "-j")) {
+            if (i + 1 >= argc) {
+                cl_error("missing argument for option: -j\n");
+                failed = true;
+                break;
             }
 
-            options->output_file = argv[++i];
+            failed = !parse_jobs(argv[++i], &options->compile.jobs);
+        } else if (strncmp(curr, "-j", 2) == 0) {
+            failed = !parse_jobs(curr + 2, &options->compile.jobs);
+        } else if (strcmpeq(curr, "-I")) {
+            if (i + 1 >= argc) {
+                cl_error("missing argument for option: -I\n");
+                failed = true;
+                break;
+            }
+
+            vector_push(options->compile.import_paths, CL_VOIDPTR(&argv[++i]));
+        } else if (strncmp(curr, "-I", 2) == 0) {
+            str_t dir = curr + 2;
+
+            vector_push(options->compile.import_paths, CL_VOIDPTR(&dir));
+        } else if (strncmp(curr, "--diagnostics-format=", 21) == 0) {
+            if (!diag_format_parse(curr + 21,
+                &options->compile.diag_format)) {
+                cl_error("invalid diagnostics format: %s\n", curr + 21);
+                failed = true;
+            }
+        } else if (strcmpeq(curr, "--no-interfaces")) {
+            options->compile.interfaces = false;
+        } else if (strcmpeq(curr, "-O")) {
+            options->compile.optimize = true;
+        } else if (strncmp(curr, "--passes=", 9) == 0) {
+            options->compile.optimize = true;
+            options->compile.passes = curr + 9;
+        } else if (strcmpeq(curr, "--dump-ir")) {
+            options->compile.dump_ir = true;
+        } else if (strcmpeq(curr, "--time-passes")) {
+            options->compile.time_passes = true;
+        } else if (strcmpeq(curr, "--cache")) {
+            options->cache = true;
+        } else if (strncmp(curr, "--cache=", 8) == 0) {
+            options->cache = true;
+            options->cache_dir = curr + 8;
+        } else if (strncmp(curr, "--cache-size=", 13) == 0) {
+            failed = !parse_size(curr + 13, &options->cache_size);
+        } else if (strcmpeq(curr, "--cache-stats")) {
+            options->cache_stats = true;
+        } else if (strncmp(curr, "--server", 8) == 0 ||
+                   strncmp(curr, "--client", 8) == 0) {
+            cl_error("%s must be the first option\n", curr);
+            failed = true;
         } else if (strcmpeq(curr, "--")) {
             end_options = true;
         }
     }
+
+    if (failed || done) {
+        vector_free(options->input_files);
+        vector_free(options->compile.import_paths);
+        *status = failed ? EXIT_FAILURE : EXIT_SUCCESS;
+        return false;
+    }
+
+    return true;
 }
 
 
 static void options_deinit(Options *options) {
     vector_free(options->input_files);
+    vector_free(options->compile.import_paths);
 }
 
 
-int main(int argc, str_t argv[]) {
+/**
+ * Opens the token cache of the options. Compiling goes on
+ * without one when it cannot be opened.
+ */
+static TokenCache *open_token_cache(Options *options) {
+    char *default_dir = NULL;
+    str_t dir = options->cache_dir;
+
+    if (!dir) {
+        dir = default_dir = token_cache_default_dir();
+
+        if (!dir) {
+            cl_error("no cache directory, set XDG_CACHE_HOME\n");
+            return NULL;
+        }
+    }
+
+    TokenCache *token_cache = token_cache_open(dir, options->cache_size);
+
+    free(default_dir);
+
+    return token_cache;
+}
+
+
+static void show_cache_stats(TokenCache *token_cache) {
+    TokenCacheStats stats;
+
+    token_cache_stats(token_cache, &stats);
+
+    fprintf(stderr, "token cache: %zu hits, %zu misses, %zu stored, "
+        "%zu evicted, %.1f KB read, %.1f KB written\n", stats.hits,
+        stats.misses, stats.stores, stats.evictions,
+        stats.bytes_read / 1e3, stats.bytes_written / 1e3);
+}
+
+
+/**
+ * Compiles one command line, with the units of earlier ones
+ * when running as a server.
+ */
+static int run(int argc, str_t argv[], UnitCache *cache) {
     Options options;
+    int status;
 
-    options_init(&options, argc, argv);
+    if (!options_init(&options, argc, argv, &status)) {
+        return status;
+    }
+
+    options.compile.cache = cache;
+
+    if (options.cache) {
+        options.compile.token_cache = open_token_cache(&options);
+    }
 
-    if (!cl_compile(options.input_files, options.output_file)) {
+    if (!cl_compile(options.input_files, &options.compile) &&
+        options.compile.diag_format == CL_DIAG_FORMAT_HUMAN) {
         printf("compilation terminated.\n");
     }
 
+    if (options.compile.token_cache) {
+        if (options.cache_stats) {
+            show_cache_stats(options.compile.token_cache);
+        }
+
+        token_cache_close(options.compile.token_cache);
+    }
+
     options_deinit(&options);
 
-    return 0;
+    return EXIT_SUCCESS;
+}
+
+
+/**
+ * Returns the socket given to a server option, or the default
+ * one.
+ */
+static str_t socket_option(str_t arg) {
+    return (arg[8] == '=') ? arg + 9 : server_default_socket();
+}
+
+
+int main(int argc, str_t argv[]) {
+    if (argc >= 2 && (strcmpeq(argv[1], "--server") ||
+        strncmp(argv[1], "--server=", 9) == 0)) {
+        return server_run(socket_option(argv[1]), run);
+    }
+
+    if (argc >= 2 && (strcmpeq(argv[1], "--client") ||
+        strncmp(argv[1], "--client=", 9) == 0)) {
+        str_t socket_path = socket_option(argv[1]);
+        int status;
+
+        /* drop the option, keeping the program name in front */
+        argv[1] = argv[0];
+        argc--;
+        argv++;
+
+        if (client_run(socket_path, argc, argv, &status)) {
+            return status;
+        }
+    }
+
+    return run(argc, argv, NULL);
 }
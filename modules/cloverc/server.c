@@ -0,0 +1,840 @@
+#define _GNU_SOURCE /* SCM_RIGHTS, CMSG_* and struct ucred */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#ifdef CL_HAVE_INOTIFY
+#include <sys/inotify.h>
+#endif
+
+#include <cl-log.h>
+#include <cl-vector.h>
+
+#include "server.h"
+
+
+/*
+ * A request is a header, sent along with the client's stdout
+ * and stderr, followed by `length` bytes: the client's working
+ * directory and its arguments, each terminated by a NUL. The
+ * reply is the exit status of the request, as an int32_t.
+ */
+#define CL_SERVER_MAGIC       0x52564C43 /* "CLVR" */
+#define CL_SERVER_MAX_REQUEST (1 << 20)
+
+/* seconds a client may take to send its request */
+#define CL_SERVER_TIMEOUT     5
+
+#define CL_SERVER_WATCH_MASK  (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM \
+                               | IN_CREATE | IN_DELETE)
+
+
+CL_TYPE(RequestHeader) {
+    uint32_t magic;
+    uint32_t length;
+};
+
+
+/**
+ * A watched directory.
+ */
+CL_TYPE(Watch) {
+    int   wd;
+    char *dir;
+};
+
+CL_VECTOR_DEFINE(Watch, watch)
+
+
+CL_TYPE(Server) {
+    int             listen_fd;
+    int             inotify_fd;
+    WatchVector     watches;
+    bool            blind;      /* some file is not watched */
+    UnitCache      *cache;
+    ServerHandlerFn handler;
+};
+
+
+static volatile sig_atomic_t stop_requested = 0;
+
+
+static void _on_signal(int signum) {
+    (void)signum;
+    stop_requested = 1;
+}
+
+
+static bool _read_full(int fd, void *buffer, size_t size) {
+    char *data = buffer;
+
+    while (size > 0) {
+        ssize_t n = read(fd, data, size);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            return false;
+        }
+
+        data += n;
+        size -= (size_t)n;
+    }
+
+    return true;
+}
+
+
+static bool _write_full(int fd, const void *buffer, size_t size) {
+    const char *data = buffer;
+
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            return false;
+        }
+
+        data += n;
+        size -= (size_t)n;
+    }
+
+    return true;
+}
+
+
+static bool _socket_address(str_t path, struct sockaddr_un *addr) {
+    *addr = (struct sockaddr_un){ .sun_family = AF_UNIX };
+
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        cl_error("socket path too long: %s\n", path);
+        return false;
+    }
+
+    strcpy(addr->sun_path, path);
+
+    return true;
+}
+
+
+/**
+ * Whether the other end of a connection runs as this user. A
+ * request runs with the rights of the server, and the client
+ * hands its output over, so neither side talks to anyone else.
+ */
+static bool _peer_is_user(int fd) {
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t length = sizeof(cred);
+
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &length) == 0 &&
+        cred.uid == getuid();
+#else
+    uid_t uid;
+    gid_t gid;
+
+    return getpeereid(fd, &uid, &gid) == 0 && uid == getuid();
+#endif
+}
+
+
+static int _connect(str_t path) {
+    struct sockaddr_un addr;
+
+    if (!_socket_address(path, &addr)) {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    if (!_peer_is_user(fd)) {
+        cl_warning("%s: the server runs as another user\n", path);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+/**
+ * Makes sure that nobody else can put a socket where the server
+ * listens. The directory is created 0700 when missing, and must
+ * belong to the user, or to root and be sticky when others can
+ * write to it, like /tmp.
+ */
+static bool _check_dir(str_t path) {
+    char dir[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    char *slash;
+    struct stat st;
+
+    snprintf(dir, sizeof(dir), "%s", path);
+    slash = strrchr(dir, '/');
+
+    if (!slash) {
+        snprintf(dir, sizeof(dir), ".");
+    } else if (slash == dir) {
+        slash[1] = '\0';
+    } else {
+        *slash = '\0';
+    }
+
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        cl_error("%s: %s\n", dir, strerror(errno));
+        return false;
+    }
+
+    if (lstat(dir, &st) != 0) {
+        cl_error("%s: %s\n", dir, strerror(errno));
+        return false;
+    }
+
+    bool shared = st.st_mode & (S_IWGRP | S_IWOTH);
+
+    if (!S_ISDIR(st.st_mode) ||
+        (st.st_uid != getuid() && st.st_uid != 0) ||
+        (shared && !(st.st_mode & S_ISVTX))) {
+        cl_error("%s: others may replace the socket in it\n", dir);
+        return false;
+    }
+
+    return true;
+}
+
+
+static int _listen(str_t path) {
+    struct sockaddr_un addr;
+
+    if (!_socket_address(path, &addr) || !_check_dir(path)) {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd < 0) {
+        cl_error("%s\n", strerror(errno));
+        return -1;
+    }
+
+    int status = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+
+    if (status != 0 && errno == EADDRINUSE) {
+        int other = _connect(path);
+
+        if (other >= 0) {
+            close(other);
+            close(fd);
+            cl_error("a server is already listening on %s\n", path);
+            return -1;
+        }
+
+        struct stat st;
+
+        if (lstat(path, &st) != 0 || !S_ISSOCK(st.st_mode) ||
+            st.st_uid != getuid()) {
+            close(fd);
+            cl_error("%s: not a socket of this user\n", path);
+            return -1;
+        }
+
+        /* left behind by a server that did not exit cleanly */
+        unlink(path);
+        status = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    }
+
+    if (status == 0) {
+        status = chmod(path, 0600);
+    }
+
+    if (status != 0 || listen(fd, 16) != 0) {
+        cl_error("%s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+/**
+ * Returns `$XDG_RUNTIME_DIR/cloverc.sock`, or a socket in a
+ * directory of /tmp named after the user when that is not set.
+ */
+str_t server_default_socket(void) {
+    static char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    str_t runtime_dir = getenv("XDG_RUNTIME_DIR");
+
+    if (runtime_dir && *runtime_dir) {
+        snprintf(path, sizeof(path), "%s/cloverc.sock", runtime_dir);
+    } else {
+        snprintf(path, sizeof(path), "/tmp/cloverc-%u/cloverc.sock",
+            (unsigned)getuid());
+    }
+
+    return path;
+}
+
+
+/* == file watching == */
+
+
+#ifdef CL_HAVE_INOTIFY
+/**
+ * Watches the directory of every cached file rather than the
+ * file itself, so editors that save by writing a new file and
+ * renaming it over the old one are seen too.
+ */
+static void _watch_file(str_t path, void *user_data) {
+    Server *self = user_data;
+    str_t slash = strrchr(path, '/');
+
+    if (self->inotify_fd < 0 || !slash) {
+        self->blind = true;
+        return;
+    }
+
+    size_t length = (slash == path) ? 1 : (size_t)(slash - path);
+    char *dir = strndup(path, length);
+
+    if (!dir) {
+        self->blind = true;
+        return;
+    }
+
+    int wd = inotify_add_watch(self->inotify_fd, dir, CL_SERVER_WATCH_MASK);
+
+    if (wd < 0) {
+        cl_warning("cannot watch %s: %s\n", dir, strerror(errno));
+        self->blind = true;
+        free(dir);
+        return;
+    }
+
+    for (size_t i = 0; i < self->watches.count; i++) {
+        if (self->watches.data[i].wd == wd) {
+            free(dir);
+            return;
+        }
+    }
+
+    if (!watch_vector_push(&self->watches, (Watch){ wd, dir })) {
+        inotify_rm_watch(self->inotify_fd, wd);
+        self->blind = true;
+        free(dir);
+    }
+}
+
+
+static void _on_event(Server *self, const struct inotify_event *event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        unit_cache_invalidate_all(self->cache);
+        return;
+    }
+
+    for (size_t i = 0; i < self->watches.count; i++) {
+        Watch *watch = &self->watches.data[i];
+
+        if (watch->wd != event->wd) {
+            continue;
+        }
+
+        if (event->mask & IN_IGNORED) {
+            /* the directory is gone, and its files with it */
+            free(watch->dir);
+            self->watches.data[i] = self->watches.data[--self->watches.count];
+            unit_cache_invalidate_all(self->cache);
+            self->blind = true;
+            return;
+        }
+
+        if (event->len == 0) {
+            return;
+        }
+
+        char path[PATH_MAX];
+        bool root = strcmp(watch->dir, "/") == 0;
+
+        if (snprintf(path, sizeof(path), "%s/%s", root ? "" : watch->dir,
+            event->name) >= (int)sizeof(path)) {
+            return;
+        }
+
+        /* a file coming or going can change what imports find */
+        if (event->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                           IN_MOVED_TO)) {
+            unit_cache_invalidate_importers(self->cache, path);
+        } else {
+            unit_cache_invalidate(self->cache, path);
+        }
+
+        return;
+    }
+}
+
+
+/**
+ * Handles the pending events without waiting for new ones.
+ */
+static void _read_events(Server *self) {
+    _Alignas(struct inotify_event) char buffer[16 * 1024];
+
+    if (self->inotify_fd < 0) {
+        return;
+    }
+
+    for (;;) {
+        ssize_t n = read(self->inotify_fd, buffer, sizeof(buffer));
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            return;
+        }
+
+        for (char *p = buffer; p < buffer + n;) {
+            const struct inotify_event *event = (void *)p;
+
+            _on_event(self, event);
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+#else
+static void _read_events(Server *self) {
+    (void)self;
+}
+#endif /* CL_HAVE_INOTIFY */
+
+
+/* == requests == */
+
+
+/**
+ * Receives the request header along with the client's output
+ * descriptors.
+ */
+static bool _receive_header(int conn, RequestHeader *header, int fds[2]) {
+    union {
+        char           buffer[CMSG_SPACE(2 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+
+    struct iovec iov = { .iov_base = header, .iov_len = sizeof(*header) };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buffer,
+        .msg_controllen = sizeof(control.buffer),
+    };
+
+    ssize_t n;
+
+    do {
+        n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+
+    if (n <= 0) {
+        return false;
+    }
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS) {
+        return false;
+    }
+
+    size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+    memcpy(fds, CMSG_DATA(cmsg), (count < 2 ? count : 2) * sizeof(int));
+
+    if (count != 2) {
+        for (size_t i = 0; i < count && i < 2; i++) {
+            close(fds[i]);
+        }
+
+        return false;
+    }
+
+    if ((size_t)n != sizeof(*header) || header->magic != CL_SERVER_MAGIC ||
+        header->length > CL_SERVER_MAX_REQUEST) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    return true;
+}
+
+
+/**
+ * Splits the request into the working directory and the
+ * arguments. The argv array is malloc'd and points into the
+ * payload.
+ */
+static bool _parse_request(char *payload, size_t length, str_t *cwd,
+    int *argc, str_t **argv) {
+    if (length == 0 || payload[length - 1] != '\0') {
+        return false;
+    }
+
+    int count = -1;
+
+    for (size_t i = 0; i < length; i++) {
+        count += (payload[i] == '\0');
+    }
+
+    if (count < 1) {
+        return false;
+    }
+
+    str_t *args = malloc(((size_t)count + 1) * sizeof(str_t));
+
+    if (!args) {
+        return false;
+    }
+
+    char *p = payload;
+
+    *cwd = p;
+    p += strlen(p) + 1;
+
+    for (int i = 0; i < count; i++) {
+        args[i] = p;
+        p += strlen(p) + 1;
+    }
+
+    args[count] = NULL;
+
+    *argc = count;
+    *argv = args;
+
+    return true;
+}
+
+
+/**
+ * Runs a request as if the compiler had been started in the
+ * client's directory with the client's stdout and stderr.
+ */
+static int _run_request(Server *self, str_t cwd, int argc, str_t argv[],
+    int fds[2]) {
+    int home = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (home < 0 || chdir(cwd) != 0) {
+        if (home >= 0) {
+            close(home);
+        }
+
+        dprintf(fds[1], "%s: %s\n", cwd, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    int saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    int saved_err = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(fds[0], STDOUT_FILENO);
+    dup2(fds[1], STDERR_FILENO);
+
+    int status = self->handler(argc, argv, self->cache);
+
+    fflush(stdout);
+    fflush(stderr);
+    clearerr(stdout);
+    clearerr(stderr);
+    dup2(saved_out, STDOUT_FILENO);
+    dup2(saved_err, STDERR_FILENO);
+    close(saved_out);
+    close(saved_err);
+
+    if (fchdir(home) != 0) {
+        cl_warning("%s\n", strerror(errno));
+    }
+
+    close(home);
+
+    return status;
+}
+
+
+static bool _timed_out(void) {
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+
+/**
+ * Serves the request of one client. Requests are served one at
+ * a time, so a client that does not send all of its request
+ * within CL_SERVER_TIMEOUT is dropped rather than waited for.
+ */
+static void _serve(Server *self, int conn) {
+    struct timeval timeout = { .tv_sec = CL_SERVER_TIMEOUT };
+    RequestHeader header;
+    int fds[2];
+
+    if (setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+        sizeof(timeout)) != 0) {
+        cl_warning("%s\n", strerror(errno));
+        return;
+    }
+
+    errno = 0;
+
+    if (!_receive_header(conn, &header, fds)) {
+        if (_timed_out()) {
+            cl_warning("dropped a client that sent nothing\n");
+        }
+
+        return;
+    }
+
+    char *payload = malloc(header.length ? header.length : 1);
+    str_t cwd;
+    str_t *argv = NULL;
+    int argc = 0;
+
+    errno = 0;
+
+    if (payload && _read_full(conn, payload, header.length) &&
+        _parse_request(payload, header.length, &cwd, &argc, &argv)) {
+        int32_t status = _run_request(self, cwd, argc, argv, fds);
+
+        _write_full(conn, &status, sizeof(status));
+    } else if (_timed_out()) {
+        cl_warning("dropped a client that did not finish its request\n");
+    } else {
+        cl_warning("dropped a malformed request\n");
+    }
+
+    free(argv);
+    free(payload);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+
+/**
+ * Serves compile requests on a socket until interrupted,
+ * keeping the units of every compile in a cache. Without
+ * inotify, or once some file cannot be watched, every request
+ * treats all cached files as changed, so nothing is read from
+ * the cache without being compared to the file first.
+ */
+int server_run(str_t socket_path, ServerHandlerFn handler) {
+    Server self = { .inotify_fd = -1, .handler = handler };
+
+    self.listen_fd = _listen(socket_path);
+
+    if (self.listen_fd < 0) {
+        return EXIT_FAILURE;
+    }
+
+#ifdef CL_HAVE_INOTIFY
+    self.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (self.inotify_fd < 0) {
+        cl_warning("cannot watch files: %s\n", strerror(errno));
+    }
+
+    self.cache = unit_cache_new(_watch_file, &self);
+#else
+    self.cache = unit_cache_new(NULL, NULL);
+#endif
+
+    if (!self.cache) {
+        cl_fatal("%s\n", strerror(errno));
+        close(self.listen_fd);
+        unlink(socket_path);
+        return EXIT_FAILURE;
+    }
+
+    struct sigaction action = { .sa_handler = _on_signal };
+
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    cl_info("listening on %s\n", socket_path);
+
+    while (!stop_requested) {
+        struct pollfd fds[2] = {
+            { .fd = self.listen_fd, .events = POLLIN },
+            { .fd = self.inotify_fd, .events = POLLIN },
+        };
+
+        if (poll(fds, (self.inotify_fd >= 0) ? 2 : 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            cl_error("%s\n", strerror(errno));
+            break;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            _read_events(&self);
+        }
+
+        if (!(fds[0].revents & POLLIN)) {
+            continue;
+        }
+
+        int conn = accept(self.listen_fd, NULL, NULL);
+
+        if (conn < 0) {
+            continue;
+        }
+
+        if (!_peer_is_user(conn)) {
+            cl_warning("refused a client of another user\n");
+            close(conn);
+            continue;
+        }
+
+        /* the client may have saved a file right before asking */
+        _read_events(&self);
+
+        if (self.inotify_fd < 0 || self.blind) {
+            unit_cache_invalidate_all(self.cache);
+        }
+
+        _serve(&self, conn);
+        close(conn);
+    }
+
+    close(self.listen_fd);
+    unlink(socket_path);
+
+    for (size_t i = 0; i < self.watches.count; i++) {
+        free(self.watches.data[i].dir);
+    }
+
+    watch_vector_free(&self.watches);
+    unit_cache_free(self.cache);
+
+    if (self.inotify_fd >= 0) {
+        close(self.inotify_fd);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+
+/**
+ * Sends a command line to the server and waits for it to be
+ * done. Returns false, having sent nothing, when there is no
+ * server to talk to.
+ */
+bool client_run(str_t socket_path, int argc, str_t argv[], int *status) {
+    char cwd[PATH_MAX];
+    int conn = _connect(socket_path);
+
+    if (conn < 0) {
+        return false;
+    }
+
+    if (!getcwd(cwd, sizeof(cwd))) {
+        close(conn);
+        return false;
+    }
+
+    size_t length = strlen(cwd) + 1;
+
+    for (int i = 0; i < argc; i++) {
+        length += strlen(argv[i]) + 1;
+    }
+
+    char *payload = malloc(length);
+
+    if (!payload || length > CL_SERVER_MAX_REQUEST) {
+        free(payload);
+        close(conn);
+        return false;
+    }
+
+    char *p = stpcpy(payload, cwd) + 1;
+
+    for (int i = 0; i < argc; i++) {
+        p = stpcpy(p, argv[i]) + 1;
+    }
+
+    RequestHeader header = {
+        .magic = CL_SERVER_MAGIC,
+        .length = (uint32_t)length,
+    };
+
+    union {
+        char           buffer[CMSG_SPACE(2 * sizeof(int))];
+        struct cmsghdr align;
+    } control = { 0 };
+
+    struct iovec iov = { .iov_base = &header, .iov_len = sizeof(header) };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buffer,
+        .msg_controllen = sizeof(control.buffer),
+    };
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    int fds[2] = { STDOUT_FILENO, STDERR_FILENO };
+
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (sendmsg(conn, &msg, 0) != (ssize_t)sizeof(header)) {
+        free(payload);
+        close(conn);
+        return false;
+    }
+
+    int32_t reply = EXIT_FAILURE;
+
+    if (!_write_full(conn, payload, length) ||
+        !_read_full(conn, &reply, sizeof(reply))) {
+        cl_error("lost the connection to the server\n");
+        reply = EXIT_FAILURE;
+    }
+
+    free(payload);
+    close(conn);
+
+    *status = reply;
+
+    return true;
+}
@@ -0,0 +1,19 @@
+#ifndef CLOVERC_SERVER_H_
+#define CLOVERC_SERVER_H_
+
+#include <cl-core.h>
+#include <cl-compiler.h>
+
+
+/**
+ * Runs one request, with the arguments of the command line the
+ * client was started with. Returns the exit status.
+ */
+typedef int (*ServerHandlerFn)(int argc, str_t argv[], UnitCache *cache);
+
+
+str_t server_default_socket (void);
+int   server_run            (str_t socket_path, ServerHandlerFn handler);
+bool  client_run            (str_t socket_path, int argc, str_t argv[], int *status);
+
+#endif /* CLOVERC_SERVER_H_ */
@@ -0,0 +1,48 @@
+#ifndef CL_VM_H_
+#define CL_VM_H_
+
+#include "cl-core.h"
+#include "cl-annotation.h"
+#include "cl-object.h"
+#include "cl-bytecode.h"
+
+/* registers of all the calls in progress */
+#define CL_VM_STACK_SLOTS   (1 << 20)
+
+/* frame slots of all the calls in progress, for structs and arrays */
+#define CL_VM_FRAME_SLOTS   (1 << 22)
+
+#define CL_VM_MAX_CALLS     (1 << 16)
+
+/* calls shown at each end of the trace of a runtime error */
+#define CL_VM_TRACE_CALLS   8
+
+
+/**
+ * What a run executed. `instructions` counts every dispatch.
+ */
+CL_TYPE(VmStats) {
+    uint64_t instructions;
+    uint64_t calls;
+};
+
+
+/**
+ * Runs the bytecode of an object. All of it is checked once by
+ * vm_new, every opcode, register, constant, global, string and
+ * jump target, so the interpreter loop itself only checks what
+ * depends on the values: divisions, array indices, the depth of
+ * calls and that whatever is used as an address is one.
+ *
+ * The loop dispatches with computed gotos where the compiler has
+ * them, unless built with `-Dvm_dispatch=switch`.
+ */
+typedef struct __CL_TNAME(Vm) Vm;
+
+Vm   *vm_new           (ObjectFile *object) __NoDiscard;
+bool  vm_run           (Vm *self, __Out int *status);
+void  vm_stats         (Vm *self, __Out VmStats *stats);
+str_t vm_dispatch_name (void);
+void  vm_free          (Vm *self);
+
+#endif /* CL_VM_H_ */
@@ -0,0 +1,831 @@
+#define CL_LOG_SCOPE "vm"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "cl-log.h"
+#include "cl-bits.h"
+#include "cl-vm.h"
+
+
+typedef union __CL_TNAME(VmValue) VmValue;
+
+/**
+ * A register, a global or a frame slot.
+ */
+union __CL_TNAME(VmValue) {
+    int64_t               i;
+    uint64_t              u;
+    double                f;
+    VmValue              *p;
+    const BytecodeString *s;
+};
+
+
+CL_TYPE(VmFunction) {
+    const BytecodeFunction *header;     /* NULL when not a function */
+    const uint64_t         *constants;
+    const Instruction      *code;
+};
+
+
+/**
+ * A call in progress, as its caller left things.
+ */
+CL_TYPE(VmCall) {
+    const VmFunction  *fn;
+    const Instruction *pc;
+    VmValue           *base;
+    VmValue           *frame;
+    size_t             frame_top;   /* before the callee took its frame */
+};
+
+
+struct __CL_TNAME(Vm) {
+    ObjectFile *object;
+    VmFunction *functions;      /* by symbol */
+    VmValue    *globals;
+    size_t      global_count;
+    VmValue    *stack;
+    VmValue    *frames;
+    size_t      frame_top;
+    VmCall     *calls;
+    VmStats     stats;
+};
+
+
+/* == verifier == */
+
+
+static bool _invalid(Vm *self, uint32_t symbol, str_t reason, size_t at) {
+    ObjectFile *object = self->object;
+
+    cl_error("invalid bytecode in %s at %zu: %s\n",
+        object_string(object, object->symbols[symbol].name), at, reason);
+
+    return false;
+}
+
+
+static bool _is_register(const BytecodeFunction *fn, uint32_t reg) {
+    return reg < fn->register_count;
+}
+
+
+/**
+ * A constant of LOADS must be the offset of a BytecodeString
+ * that fits in CONSTANTS, NUL included.
+ */
+static bool _is_string(Vm *self, uint64_t offset) {
+    ObjectFile *object = self->object;
+    size_t size = object->constants_size;
+
+    if (offset % sizeof(uint64_t) != 0 || size < sizeof(BytecodeString) ||
+        offset > size - sizeof(BytecodeString)) {
+        return false;
+    }
+
+    const BytecodeString *string = (const void *)(object->constants + offset);
+    size_t room = size - offset - sizeof(BytecodeString);
+
+    return string->length < room && string->bytes[string->length] == '\0';
+}
+
+
+static bool _check_operands(Vm *self, uint32_t symbol, VmFunction *fn,
+    size_t at) {
+    const BytecodeFunction *header = fn->header;
+    Instruction insn = fn->code[at];
+    Opcode op = CL_OP(insn);
+    uint32_t a = CL_A(insn), b = CL_B(insn), c = CL_C(insn);
+    uint32_t bx = CL_BX(insn);
+    bool ok = true;
+
+    /* LABELS has one entry per opcode, no more */
+    if ((unsigned)op >= __CL_OP_MAX) {
+        return _invalid(self, symbol, "unknown opcode", at);
+    }
+
+    switch (bytecode_op_format(op)) {
+        case CL_FMT_EMPTY:
+            return true;
+        case CL_FMT_J: {
+            int64_t target = (int64_t)at + 1 + CL_SJ(insn);
+
+            return (target >= 0 && target < header->code_count) ||
+                _invalid(self, symbol, "jump out of the function", at);
+        }
+        case CL_FMT_R:
+        case CL_FMT_RSBX:
+        case CL_FMT_RBX:
+            break;
+        case CL_FMT_RR:
+        case CL_FMT_RRI:
+        case CL_FMT_RRS:
+            ok = _is_register(header, b);
+            break;
+        case CL_FMT_RRR:
+            ok = _is_register(header, b) && _is_register(header, c);
+            break;
+        case CL_FMT_RIR:
+            ok = _is_register(header, c);
+            break;
+        case CL_FMT_RII:
+            ok = (b <= CL_PRINT_STRING && c <= 1);
+            break;
+        case CL_FMT_RK:
+            ok = (bx < header->constant_count);
+            break;
+        case CL_FMT_RS:
+            ok = (bx < header->constant_count) &&
+                _is_string(self, fn->constants[bx]);
+            break;
+        case CL_FMT_RG:
+            ok = (bx < self->global_count);
+            break;
+        case CL_FMT_RF: {
+            uint64_t callee = (bx < header->constant_count)
+                ? fn->constants[bx] : UINT64_MAX;
+
+            ok = callee < self->object->symbol_count &&
+                self->functions[callee].header &&
+                a + self->functions[callee].header->param_count <=
+                    header->register_count;
+            break;
+        }
+        case CL_FMT_TEST_RR:
+            ok = _is_register(header, b) && c <= 1;
+            /* fall through */
+        case CL_FMT_TEST_R:
+            ok = ok && (op != CL_OP_TEST || b <= 1) &&
+                at + 1 < header->code_count &&
+                CL_OP(fn->code[at + 1]) == CL_OP_JMP;
+            break;
+        default:
+            return _invalid(self, symbol, "unknown opcode", at);
+    }
+
+    if (op == CL_OP_FRAME && bx > header->frame_size) {
+        ok = false;
+    }
+
+    return (ok && _is_register(header, a)) ||
+        _invalid(self, symbol, "operand out of range", at);
+}
+
+
+/**
+ * Finds the bytecode of a function symbol and checks that it
+ * is whole, before its instructions are.
+ */
+static bool _load_function(Vm *self, uint32_t symbol) {
+    ObjectFile *object = self->object;
+    const ObjectSymbol *sym = &object->symbols[symbol];
+    const uint8_t *data = object_symbol_data(object, sym);
+    const BytecodeFunction *header = (const void *)data;
+
+    if (object->sections[sym->section].kind != CL_OBJECT_SECTION_CODE ||
+        sym->value % sizeof(uint64_t) != 0 || sym->size < sizeof(*header)) {
+        return _invalid(self, symbol, "function out of place", 0);
+    }
+
+    uint64_t expected = sizeof(*header) +
+        (uint64_t)header->constant_count * sizeof(uint64_t) +
+        (uint64_t)header->code_count * sizeof(Instruction);
+
+    if (sym->size != expected || header->code_count == 0 ||
+        header->register_count == 0 ||
+        header->register_count > CL_BYTECODE_MAX_REGISTERS ||
+        header->param_count > header->register_count ||
+        header->frame_size > CL_VM_FRAME_SLOTS) {
+        return _invalid(self, symbol, "malformed function", 0);
+    }
+
+    VmFunction *fn = &self->functions[symbol];
+
+    fn->header = header;
+    fn->constants = (const void *)(data + sizeof(*header));
+    fn->code = (const void *)(data + sizeof(*header) +
+        header->constant_count * sizeof(uint64_t));
+
+    return true;
+}
+
+
+static bool _check_function(Vm *self, uint32_t symbol) {
+    VmFunction *fn = &self->functions[symbol];
+    size_t count = fn->header->code_count;
+    Opcode last = CL_OP(fn->code[count - 1]);
+
+    for (size_t i = 0; i < count; i++) {
+        if (!_check_operands(self, symbol, fn, i)) {
+            return false;
+        }
+    }
+
+    if (last != CL_OP_RET && last != CL_OP_RET0 && last != CL_OP_JMP) {
+        return _invalid(self, symbol, "function does not end", count - 1);
+    }
+
+    return true;
+}
+
+
+/**
+ * Loads every function of the object, then checks them all,
+ * since a call needs to know about its callee.
+ */
+static bool _verify(Vm *self) {
+    ObjectFile *object = self->object;
+
+    for (uint32_t i = 0; i < object->symbol_count; i++) {
+        const ObjectSymbol *symbol = &object->symbols[i];
+
+        if (symbol->kind == CL_OBJECT_SYM_VAR) {
+            self->global_count++;
+        }
+
+        if (symbol->kind == CL_OBJECT_SYM_FN && symbol->section != 0 &&
+            !_load_function(self, i)) {
+            return false;
+        }
+    }
+
+    for (uint32_t i = 0; i < object->symbol_count; i++) {
+        if (self->functions[i].header && !_check_function(self, i)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/* == interpreter == */
+
+
+static void _print(VmValue value, uint32_t kind, bool newline) {
+    switch (kind) {
+        case CL_PRINT_INT:
+            printf("%" PRId64, value.i);
+            break;
+        case CL_PRINT_FLOAT:
+            printf("%g", value.f);
+            break;
+        case CL_PRINT_BOOL:
+            fputs(value.i ? "true" : "false", stdout);
+            break;
+        default:
+            if (value.s) {
+                fwrite(value.s->bytes, 1, value.s->length, stdout);
+            }
+
+            break;
+    }
+
+    if (newline) {
+        putchar('\n');
+    }
+}
+
+
+static void _trace(Vm *self, const VmFunction *fn) {
+    ObjectFile *object = self->object;
+    const ObjectSymbol *symbol = &object->symbols[fn - self->functions];
+
+    fprintf(stderr, "    in %s (%s:%u)\n", object_string(object, symbol->name),
+        object_string(object, symbol->file), symbol->line);
+}
+
+
+/**
+ * Reports a runtime error with the calls that led to it, the
+ * innermost first. `calls[i]` holds the caller of the call made
+ * at depth i. A deep trace, a runaway recursion most likely,
+ * keeps CL_VM_TRACE_CALLS calls at each end.
+ */
+static void _fail(Vm *self, const VmFunction *fn, size_t depth,
+    str_t reason) {
+    size_t skip_from = 0, skip_to = 0;
+
+    if (depth > 2 * CL_VM_TRACE_CALLS) {
+        skip_from = depth - (CL_VM_TRACE_CALLS - 1);
+        skip_to = CL_VM_TRACE_CALLS;
+    }
+
+    cl_error("%s\n", reason);
+    _trace(self, fn);
+
+    for (size_t i = depth; i-- > 0;) {
+        if (i < skip_from && i >= skip_to) {
+            fprintf(stderr, "    ... %zu more calls\n", skip_from - skip_to);
+            i = skip_to;
+            continue;
+        }
+
+        _trace(self, self->calls[i].fn);
+    }
+}
+
+
+/**
+ * Whether `count` slots from `p` lie in the frames, where every
+ * struct and array is. Registers are not typed, so a value is
+ * only known to be an address when it is used as one.
+ */
+static __Inline bool _in_frames(const Vm *self, const VmValue *p,
+    uint64_t count) {
+    uintptr_t offset = (uintptr_t)p - (uintptr_t)self->frames;
+    uint64_t slot = offset / sizeof(VmValue);
+
+    return offset % sizeof(VmValue) == 0 && slot <= CL_VM_FRAME_SLOTS &&
+        count <= CL_VM_FRAME_SLOTS - slot;
+}
+
+
+#ifdef CL_VM_COMPUTED_GOTO
+#define __VM_LABEL(name, format)    &&L_##name,
+#define VM_DISPATCH(op)             goto *LABELS[op];
+#define VM_CASE(name)               L_##name:
+#define VM_NEXT()                   do { VM_FETCH(); \
+                                         goto *LABELS[CL_OP(insn)]; } while (0)
+#else
+#define VM_DISPATCH(op)             switch ((unsigned)(op))
+#define VM_CASE(name)               case CL_OP_##name:
+#define VM_NEXT()                   break
+#endif
+
+#define VM_FETCH()                  (insn = *pc++, executed++)
+
+#define RA                          R[CL_A(insn)]
+#define RB                          R[CL_B(insn)]
+#define RC                          R[CL_C(insn)]
+
+/* a test takes the JMP after it, or steps over it */
+#define VM_TEST(cond, expected)                                             \
+    do {                                                                    \
+        pc += ((cond) == (expected)) ? CL_SJ(*pc) + 1 : 1;                  \
+    } while (0)
+
+#define VM_FAIL(reason)                                                     \
+    do {                                                                    \
+        _fail(self, fn, depth, reason);                        \
+        goto failed;                                                        \
+    } while (0)
+
+
+/**
+ * Runs a function without parameters until it returns. The
+ * frame it takes stays, so that the structs and arrays its
+ * globals point to live as long as the VM.
+ */
+static bool _execute(Vm *self, uint32_t symbol, VmValue *result) {
+#ifdef CL_VM_COMPUTED_GOTO
+    static const void *const LABELS[] = {
+        CL_OPCODES(__VM_LABEL)
+    };
+#endif
+    const VmFunction *fn = &self->functions[symbol];
+    const uint8_t *strings = self->object->constants;
+    VmValue *globals = self->globals;
+    VmValue *stack_end = self->stack + CL_VM_STACK_SLOTS;
+    VmCall *calls = self->calls;
+    size_t frame_top = self->frame_top;
+    size_t depth = 0;
+    uint64_t executed = 0;
+
+    if (frame_top + fn->header->frame_size > CL_VM_FRAME_SLOTS) {
+        _fail(self, fn, 0, "stack overflow");
+        return false;
+    }
+
+    VmValue *R = self->stack;
+    VmValue *F = self->frames + frame_top;
+    const uint64_t *K = fn->constants;
+    const Instruction *pc = fn->code;
+    Instruction insn;
+
+    frame_top += fn->header->frame_size;
+    self->stats.calls++;
+
+    for (;;) {
+        VM_FETCH();
+
+        VM_DISPATCH(CL_OP(insn)) {
+            VM_CASE(MOVE) {
+                RA = RB;
+                VM_NEXT();
+            }
+            VM_CASE(LOADI) {
+                RA.i = CL_SBX(insn);
+                VM_NEXT();
+            }
+            VM_CASE(LOADK) {
+                RA.u = K[CL_BX(insn)];
+                VM_NEXT();
+            }
+            VM_CASE(LOADS) {
+                RA.s = (const void *)(strings + K[CL_BX(insn)]);
+                VM_NEXT();
+            }
+            VM_CASE(GETG) {
+                RA = globals[CL_BX(insn)];
+                VM_NEXT();
+            }
+            VM_CASE(SETG) {
+                globals[CL_BX(insn)] = RA;
+                VM_NEXT();
+            }
+            VM_CASE(ADD) {
+                RA.u = RB.u + RC.u;
+                VM_NEXT();
+            }
+            VM_CASE(SUB) {
+                RA.u = RB.u - RC.u;
+                VM_NEXT();
+            }
+            VM_CASE(MUL) {
+                RA.u = RB.u * RC.u;
+                VM_NEXT();
+            }
+            VM_CASE(DIV) {
+                if (RC.i == 0) {
+                    VM_FAIL("division by zero");
+                }
+
+                RA.i = cl_div(RB.i, RC.i);
+                VM_NEXT();
+            }
+            VM_CASE(MOD) {
+                if (RC.i == 0) {
+                    VM_FAIL("division by zero");
+                }
+
+                RA.i = cl_mod(RB.i, RC.i);
+                VM_NEXT();
+            }
+            VM_CASE(ADDI) {
+                RA.u = RB.u + (uint64_t)(int64_t)CL_SC(insn);
+                VM_NEXT();
+            }
+            VM_CASE(BAND) {
+                RA.u = RB.u & RC.u;
+                VM_NEXT();
+            }
+            VM_CASE(BOR) {
+                RA.u = RB.u | RC.u;
+                VM_NEXT();
+            }
+            VM_CASE(BXOR) {
+                RA.u = RB.u ^ RC.u;
+                VM_NEXT();
+            }
+            VM_CASE(SHL) {
+                RA.u = RB.u << (RC.u & 63);
+                VM_NEXT();
+            }
+            VM_CASE(SHR) {
+                RA.i = RB.i >> (RC.u & 63);
+                VM_NEXT();
+            }
+            VM_CASE(FADD) {
+                RA.f = RB.f + RC.f;
+                VM_NEXT();
+            }
+            VM_CASE(FSUB) {
+                RA.f = RB.f - RC.f;
+                VM_NEXT();
+            }
+            VM_CASE(FMUL) {
+                RA.f = RB.f * RC.f;
+                VM_NEXT();
+            }
+            VM_CASE(FDIV) {
+                RA.f = RB.f / RC.f;
+                VM_NEXT();
+            }
+            VM_CASE(NEG) {
+                RA.u = 0 - RB.u;
+                VM_NEXT();
+            }
+            VM_CASE(FNEG) {
+                RA.f = -RB.f;
+                VM_NEXT();
+            }
+            VM_CASE(NOT) {
+                RA.i = !RB.i;
+                VM_NEXT();
+            }
+            VM_CASE(BNOT) {
+                RA.u = ~RB.u;
+                VM_NEXT();
+            }
+            VM_CASE(ITOF) {
+                RA.f = (double)RB.i;
+                VM_NEXT();
+            }
+            VM_CASE(FTOI) {
+                RA.i = cl_ftoi(RB.f);
+                VM_NEXT();
+            }
+            VM_CASE(EQ) {
+                VM_TEST(RA.i == RB.i, CL_C(insn));
+                VM_NEXT();
+            }
+            VM_CASE(LT) {
+                VM_TEST(RA.i < RB.i, CL_C(insn));
+                VM_NEXT();
+            }
+            VM_CASE(LE) {
+                VM_TEST(RA.i <= RB.i, CL_C(insn));
+                VM_NEXT();
+            }
+            VM_CASE(FEQ) {
+                VM_TEST(RA.f == RB.f, CL_C(insn));
+                VM_NEXT();
+            }
+            VM_CASE(FLT) {
+                VM_TEST(RA.f < RB.f, CL_C(insn));
+                VM_NEXT();
+            }
+            VM_CASE(FLE) {
+                VM_TEST(RA.f <= RB.f, CL_C(insn));
+                VM_NEXT();
+            }
+            VM_CASE(TEST) {
+                VM_TEST(RA.i != 0, CL_B(insn));
+                VM_NEXT();
+            }
+            VM_CASE(JMP) {
+                pc += CL_SJ(insn);
+                VM_NEXT();
+            }
+            VM_CASE(FRAME) {
+                RA.p = F + CL_BX(insn);
+                VM_NEXT();
+            }
+            VM_CASE(ZERO) {
+                if (!_in_frames(self, RA.p, CL_BX(insn))) {
+                    VM_FAIL("bad address");
+                }
+
+                memset(RA.p, 0, CL_BX(insn) * sizeof(VmValue));
+                VM_NEXT();
+            }
+            VM_CASE(REF) {
+                RA.p = RB.p + CL_C(insn);
+                VM_NEXT();
+            }
+            VM_CASE(COPY) {
+                if (!_in_frames(self, RA.p, CL_C(insn)) ||
+                    !_in_frames(self, RB.p, CL_C(insn))) {
+                    VM_FAIL("bad address");
+                }
+
+                memmove(RA.p, RB.p, CL_C(insn) * sizeof(VmValue));
+                VM_NEXT();
+            }
+            VM_CASE(GETF) {
+                if (!_in_frames(self, RB.p, CL_C(insn) + 1)) {
+                    VM_FAIL("bad address");
+                }
+
+                RA = RB.p[CL_C(insn)];
+                VM_NEXT();
+            }
+            VM_CASE(SETF) {
+                if (!_in_frames(self, RA.p, CL_B(insn) + 1)) {
+                    VM_FAIL("bad address");
+                }
+
+                RA.p[CL_B(insn)] = RC;
+                VM_NEXT();
+            }
+            VM_CASE(GETI) {
+                VmValue *array = RB.p;
+
+                if (!_in_frames(self, array, 1)) {
+                    VM_FAIL("bad address");
+                }
+
+                if (RC.u >= array[0].u) {
+                    VM_FAIL("index out of range");
+                }
+
+                if (!_in_frames(self, array + 1, RC.u + 1)) {
+                    VM_FAIL("bad address");
+                }
+
+                RA = array[1 + RC.u];
+                VM_NEXT();
+            }
+            VM_CASE(SETI) {
+                VmValue *array = RA.p;
+
+                if (!_in_frames(self, array, 1)) {
+                    VM_FAIL("bad address");
+                }
+
+                if (RB.u >= array[0].u) {
+                    VM_FAIL("index out of range");
+                }
+
+                if (!_in_frames(self, array + 1, RB.u + 1)) {
+                    VM_FAIL("bad address");
+                }
+
+                array[1 + RB.u] = RC;
+                VM_NEXT();
+            }
+            VM_CASE(CALL) {
+                const VmFunction *callee = &self->functions[K[CL_BX(insn)]];
+                const BytecodeFunction *header = callee->header;
+                VmValue *base = &RA;
+
+                if (depth + 1 == CL_VM_MAX_CALLS ||
+                    header->register_count > stack_end - base ||
+                    header->frame_size > CL_VM_FRAME_SLOTS - frame_top) {
+                    VM_FAIL("stack overflow");
+                }
+
+                calls[depth++] = (VmCall){ fn, pc, R, F, frame_top };
+                self->stats.calls++;
+
+                fn = callee;
+                K = fn->constants;
+                pc = fn->code;
+                R = base;
+                F = self->frames + frame_top;
+                frame_top += header->frame_size;
+                VM_NEXT();
+            }
+            VM_CASE(RET) {
+                R[0] = RA;
+                goto ret;
+            }
+            VM_CASE(RET0) {
+                R[0].i = 0;
+                goto ret;
+            }
+            VM_CASE(PRINT) {
+                if (CL_B(insn) == CL_PRINT_STRING && !_is_string(self,
+                    (uintptr_t)RA.s - (uintptr_t)strings)) {
+                    VM_FAIL("bad address");
+                }
+
+                _print(RA, CL_B(insn), CL_C(insn));
+                VM_NEXT();
+            }
+        }
+
+        continue;
+
+ret:
+        if (depth == 0) {
+            *result = R[0];
+            break;
+        }
+
+        VmCall *call = &calls[--depth];
+
+        fn = call->fn;
+        K = fn->constants;
+        pc = call->pc;
+        R = call->base;
+        F = call->frame;
+        frame_top = call->frame_top;
+    }
+
+    self->frame_top = frame_top;
+    self->stats.instructions += executed;
+
+    return true;
+
+failed:
+    self->frame_top = frame_top;
+    self->stats.instructions += executed;
+
+    return false;
+}
+
+
+/* == vm == */
+
+
+Vm *vm_new(ObjectFile *object) {
+    Vm *self = calloc(1, sizeof(Vm));
+
+    if (!self) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    self->object = object;
+    self->functions = calloc(object->symbol_count ? object->symbol_count : 1,
+        sizeof(VmFunction));
+
+    if (!self->functions) {
+        cl_error("out of memory!\n");
+        vm_free(self);
+        return NULL;
+    }
+
+    if (!_verify(self)) {
+        vm_free(self);
+        return NULL;
+    }
+
+    self->globals = calloc(self->global_count ? self->global_count : 1,
+        sizeof(VmValue));
+    self->stack = calloc(CL_VM_STACK_SLOTS, sizeof(VmValue));
+    self->frames = calloc(CL_VM_FRAME_SLOTS, sizeof(VmValue));
+    self->calls = calloc(CL_VM_MAX_CALLS, sizeof(VmCall));
+
+    if (!self->globals || !self->stack || !self->frames || !self->calls) {
+        cl_error("out of memory!\n");
+        vm_free(self);
+        return NULL;
+    }
+
+    return self;
+}
+
+
+/**
+ * Runs the init functions, in the order of their symbols, then
+ * the entry point. `status` is what the entry point returned,
+ * or 0 when it returns nothing.
+ */
+bool vm_run(Vm *self, int *status) {
+    ObjectFile *object = self->object;
+    uint32_t entry = object->header->entry;
+    VmValue result = { 0 };
+
+    *status = 0;
+
+    if (entry == CL_OBJECT_NO_ENTRY || !self->functions[entry].header) {
+        cl_error("no entry point\n");
+        return false;
+    }
+
+    if (self->functions[entry].header->param_count != 0) {
+        cl_error("%s takes parameters\n",
+            object_string(object, object->symbols[entry].name));
+        return false;
+    }
+
+    for (uint32_t i = 0; i < object->symbol_count; i++) {
+        const ObjectSymbol *symbol = &object->symbols[i];
+
+        if (CL_BIT_ISSET(CL_OBJECT_SYM_INIT, symbol->flags) &&
+            self->functions[i].header &&
+            self->functions[i].header->param_count == 0 &&
+            !_execute(self, i, &result)) {
+            return false;
+        }
+    }
+
+    if (!_execute(self, entry, &result)) {
+        return false;
+    }
+
+    if (CL_BIT_ISSET(CL_BYTECODE_RETURNS,
+            self->functions[entry].header->flags)) {
+        *status = (int)result.i;
+    }
+
+    fflush(stdout);
+
+    return true;
+}
+
+
+void vm_stats(Vm *self, VmStats *stats) {
+    *stats = self->stats;
+}
+
+
+str_t vm_dispatch_name(void) {
+#ifdef CL_VM_COMPUTED_GOTO
+    return "computed goto";
+#else
+    return "switch";
+#endif
+}
+
+
+void vm_free(Vm *self) {
+    if (!self) {
+        return;
+    }
+
+    free(self->functions);
+    free(self->globals);
+    free(self->stack);
+    free(self->frames);
+    free(self->calls);
+    free(self);
+}
@@ -0,0 +1,84 @@
+#ifndef CL_ARENA_H_
+#define CL_ARENA_H_
+
+#include "cl-core.h"
+#include "cl-annotation.h"
+
+/**
+ * Default size of an arena chunk. Requests larger than a
+ * quarter of the chunk size get a chunk of their own.
+ */
+#define CL_ARENA_CHUNK_SIZE (64 * 1024)
+#define CL_ARENA_ALIGN      16
+
+
+CL_TYPE(ArenaChunk) {
+    ArenaChunk *next;
+    size_t      used;
+    size_t      size;
+    _Alignas(CL_ARENA_ALIGN) char data[];
+};
+
+
+/**
+ * Usage statistics of an arena. `used` counts the bytes handed
+ * out since the last reset, `high_water` the largest `used`
+ * ever reached, `reserved` the bytes held in chunks.
+ */
+CL_TYPE(ArenaStats) {
+    size_t used;
+    size_t high_water;
+    size_t reserved;
+    size_t chunks;
+    size_t allocs;
+};
+
+
+/**
+ * A bump allocator. Allocating moves a pointer forward in the
+ * current chunk, nothing is freed on its own: everything goes
+ * away at once with arena_reset or arena_free. An arena is not
+ * thread safe, each unit owns its own.
+ */
+CL_TYPE(Arena) {
+    ArenaChunk *head;
+    size_t      chunk_size;
+    ArenaStats  stats;
+};
+
+
+Arena *arena_new        (size_t chunk_size) __NoDiscard;
+void  *arena_alloc_slow (Arena *self, size_t size);
+void  *arena_calloc     (Arena *self, size_t count, size_t size);
+void  *arena_realloc    (Arena *self, __Nullable void *ptr, size_t old_size, size_t new_size);
+char  *arena_strdup     (Arena *self, str_t str);
+void   arena_reset      (Arena *self);
+void   arena_free       (__Nullable Arena *self);
+
+
+/**
+ * Returns `size` bytes aligned to CL_ARENA_ALIGN, or NULL when
+ * out of memory.
+ */
+static __Inline void *arena_alloc(Arena *self, size_t size) {
+    ArenaChunk *chunk = self->head;
+    size_t aligned = (size + CL_ARENA_ALIGN - 1) & ~(size_t)(CL_ARENA_ALIGN - 1);
+
+    if (chunk && aligned <= chunk->size - chunk->used) {
+        void *ptr = chunk->data + chunk->used;
+
+        chunk->used += aligned;
+        self->stats.used += aligned;
+        self->stats.allocs++;
+
+        if (self->stats.used > self->stats.high_water) {
+            self->stats.high_water = self->stats.used;
+        }
+
+        return ptr;
+    }
+
+    return arena_alloc_slow(self, size);
+}
+
+#endif /* CL_ARENA_H_ */
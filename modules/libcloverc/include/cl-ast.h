@@ -0,0 +1,168 @@
+#ifndef CL_AST_H_
+#define CL_AST_H_
+
+#include <stdio.h>
+#include <string.h>
+
+#include "cl-core.h"
+#include "cl-annotation.h"
+#include "cl-arena.h"
+#include "cl-source.h"
+#include "cl-tokens.h"
+
+#define CL_AST_INITIAL_NODES    256
+#define CL_AST_INITIAL_EXTRA    256
+
+/**
+ * Average number of nodes and of `extra` entries per token, in
+ * percent, used to size the tree up front from the token count:
+ * about one in two tokens is punctuation that leaves no node
+ * behind.
+ */
+#define CL_AST_NODES_PER_100_TOKENS 60
+#define CL_AST_EXTRA_PER_100_TOKENS 30
+
+/**
+ * The index of no node. Node 0 is always the AST_FILE root,
+ * which is nobody's child, so 0 can mark a missing child, and
+ * extra[0] is left unused so that 0 can mark a missing list.
+ */
+#define CL_AST_NONE             0
+
+/* node flag bits */
+#define CL_AST_PUB              1   /* declared with pub */
+#define CL_AST_STATIC           2   /* declared with static */
+
+
+typedef uint32_t AstIndex;
+
+
+/**
+ * Node kinds. `token` is the index of the main token of the
+ * node, which also tells the operator of unary and binary
+ * nodes and the kind of a literal. `lhs` and `rhs` are node
+ * indices, unless noted otherwise:
+ *
+ *   "range"   `lhs` and `rhs` are the start and end of a list
+ *             of node indices in `extra`
+ *   "extra"   the field is the index in `extra` of the listed
+ *             node indices, a "pair" being a (start, end) range
+ */
+CL_ENUM(AstKind) {
+    AST_FILE,           /* range: declarations */
+    AST_IMPORT,         /* lhs: path, rhs: alias token or 0 */
+    AST_FN,             /* token: name, lhs: extra (params pair, return type), rhs: body */
+    AST_PARAM,          /* token: name, lhs: type */
+    AST_STRUCT,         /* token: name, range: fields */
+    AST_FIELD,          /* token: name, lhs: type, rhs: default value */
+    AST_ENUM,           /* token: name, range: members */
+    AST_ENUM_MEMBER,    /* token: name, lhs: value */
+    AST_VAR,            /* token: name, lhs: type, rhs: value */
+    AST_CONST,          /* token: name, lhs: type, rhs: value */
+
+    AST_TYPE_OPTIONAL,  /* ?T, lhs: type */
+    AST_TYPE_POINTER,   /* *T, lhs: type */
+    AST_TYPE_ARRAY,     /* [N]T, lhs: length or none for a slice, rhs: type */
+
+    AST_BLOCK,          /* range: statements */
+    AST_IF,             /* lhs: condition, rhs: extra (then, else) */
+    AST_WHILE,          /* lhs: condition, rhs: body */
+    AST_FOR,            /* lhs: extra (init, condition, step), rhs: body */
+    AST_SWITCH,         /* range: the subject, then the arms */
+    AST_SWITCH_ARM,     /* lhs: body, rhs: extra (values pair) or none for else */
+    AST_DEFER,          /* lhs: statement */
+    AST_RETURN,         /* lhs: value */
+    AST_BREAK,
+    AST_CONTINUE,
+
+    AST_NAME,           /* token: identifier */
+    AST_LITERAL,        /* token: number, string, char, true or false */
+    AST_UNARY,          /* token: operator, lhs: operand */
+    AST_BINARY,         /* token: operator, lhs and rhs: operands */
+    AST_ASSIGN,         /* lhs: target, rhs: value */
+    AST_TERNARY,        /* lhs: condition, rhs: extra (then, else) */
+    AST_CAST,           /* lhs: value, rhs: type */
+    AST_CALL,           /* lhs: callee, rhs: extra (arguments pair) */
+    AST_INDEX,          /* lhs: value, rhs: index */
+    AST_ACCESS,         /* token: field name, lhs: value */
+    __AST_KIND_MAX
+};
+
+
+/**
+ * A node of the syntax tree. All nodes have the same 16 bytes
+ * and refer to each other by index, so a whole tree is two
+ * arrays, grows with a realloc and goes away with its arena.
+ */
+CL_TYPE(AstNode) {
+    uint8_t  kind;      /* AstKind */
+    uint8_t  flags;
+    uint16_t reserved;
+    uint32_t token;
+    AstIndex lhs;
+    AstIndex rhs;
+};
+
+
+/**
+ * A syntax tree: the nodes, the root being node 0, and the
+ * `extra` array of node indices for the nodes with more than
+ * two children. A tree created with an arena grows inside of
+ * it and needs no ast_free.
+ */
+CL_TYPE(Ast) {
+    AstNode  *nodes;
+    size_t    node_count;
+    size_t    node_capacity;
+    AstIndex *extra;
+    size_t    extra_count;
+    size_t    extra_capacity;
+    Arena    *arena;
+};
+
+
+Ast     *ast_new         (__Nullable Arena *arena) __NoDiscard;
+bool     ast_reserve     (Ast *self, size_t nodes, size_t extra);
+bool     ast_grow        (Ast *self);
+bool     ast_grow_extra  (Ast *self, size_t count);
+void     ast_reset       (Ast *self);
+str_t    ast_kind_name   (AstKind kind);
+void     ast_dump        (Ast *self, TokenStream *tokens, Source *src, FILE *out);
+void     ast_free        (Ast *self);
+
+
+/**
+ * Appends a node and returns its index, CL_AST_NONE when out
+ * of memory. Only a full tree leaves the inline path.
+ */
+static __Inline AstIndex ast_push(Ast *self, AstNode node) {
+    if (self->node_count == self->node_capacity && !ast_grow(self)) {
+        return CL_AST_NONE;
+    }
+
+    self->nodes[self->node_count] = node;
+
+    return (AstIndex)self->node_count++;
+}
+
+
+/**
+ * Appends `count` node indices to `extra` and returns where
+ * they start, or SIZE_MAX when out of memory.
+ */
+static __Inline size_t ast_push_extra(Ast *self, const AstIndex *items,
+    size_t count) {
+    if (self->extra_count + count > self->extra_capacity &&
+        !ast_grow_extra(self, count)) {
+        return SIZE_MAX;
+    }
+
+    size_t start = self->extra_count;
+
+    memcpy(&self->extra[start], items, count * sizeof(*items));
+    self->extra_count = start + count;
+
+    return start;
+}
+
+#endif /* CL_AST_H_ */
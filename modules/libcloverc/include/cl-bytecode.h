@@ -0,0 +1,237 @@
+#ifndef CL_BYTECODE_H_
+#define CL_BYTECODE_H_
+
+#include "cl-core.h"
+#include "cl-annotation.h"
+
+/**
+ * The bytecode of the Clover virtual machine.
+ *
+ * Every function has up to 256 registers of 64 bits, the first
+ * ones holding its parameters. Instructions are 32 bits, an
+ * 8-bit opcode followed by its operands in one of three shapes:
+ *
+ *   31      24 23     16 15      8 7       0
+ *   [   C    ][   B    ][   A    ][   op   ]
+ *   [        Bx        ][   A    ][   op   ]
+ *   [             sJ             ][   op   ]
+ *
+ * Signed operands are stored with a bias, sBx as Bx - 32767,
+ * sC as C - 128 and sJ as a 24-bit field - 8388607. Jumps are
+ * relative to the instruction after them.
+ *
+ * A function sits in the CODE section of an object as a
+ * BytecodeFunction, followed by its constants, 8 bytes each,
+ * and then by its instructions. Its symbol points at the
+ * header and covers all three.
+ *
+ * Constants are raw 64-bit values: integers, the bits of
+ * doubles, the symbol index of a called function, or the
+ * offset of a BytecodeString in the CONSTANTS section.
+ *
+ * Globals are numbered in the order of the var symbols of the
+ * object; functions flagged CL_OBJECT_SYM_INIT set them before
+ * the entry point runs.
+ *
+ * Structs and arrays are slots of 64 bits in the frame of a
+ * function, `frame_size` slots that a call reserves and its
+ * return releases, except for the outermost call, whose frame
+ * stays for the globals. A register holds the address of the
+ * first slot; arrays keep their length there and their
+ * elements after it.
+ */
+#define CL_BYTECODE_MAX_REGISTERS   256
+#define CL_BYTECODE_MAX_CONSTANTS   65536
+
+#define CL_BYTECODE_SBX_BIAS        32767
+#define CL_BYTECODE_SC_BIAS         128
+#define CL_BYTECODE_SJ_BIAS         8388607
+
+/* function flag bits */
+#define CL_BYTECODE_RETURNS         1   /* returns a value */
+
+/* what PRINT prints */
+#define CL_PRINT_INT                0
+#define CL_PRINT_FLOAT              1
+#define CL_PRINT_BOOL               2
+#define CL_PRINT_STRING             3
+
+
+/**
+ * Operand shapes. R is a register, I an immediate, K a
+ * constant, S a string constant, G a global, F a called
+ * function, J a jump; a trailing "+J" marks the tests, which
+ * are followed by the JMP they take.
+ */
+CL_ENUM(BytecodeFormat) {
+    CL_FMT_NONE,        /* not an opcode */
+    CL_FMT_EMPTY,       /* no operands */
+    CL_FMT_R,           /* A */
+    CL_FMT_RR,          /* A B */
+    CL_FMT_RRR,         /* A B C */
+    CL_FMT_RRI,         /* A B, C unsigned */
+    CL_FMT_RIR,         /* A, B unsigned, C */
+    CL_FMT_RRS,         /* A B, sC */
+    CL_FMT_RII,         /* A, B and C unsigned */
+    CL_FMT_RSBX,        /* A, sBx */
+    CL_FMT_RBX,         /* A, Bx unsigned */
+    CL_FMT_RK,          /* A, Bx constant */
+    CL_FMT_RS,          /* A, Bx string constant */
+    CL_FMT_RG,          /* A, Bx global */
+    CL_FMT_RF,          /* A, Bx function constant */
+    CL_FMT_TEST_RR,     /* A B, C 0 or 1, +J */
+    CL_FMT_TEST_R,      /* A, B 0 or 1, +J */
+    CL_FMT_J,           /* sJ */
+    __CL_FMT_MAX
+};
+
+
+/**
+ * The instruction set, as X(name, format). R[x] is a register,
+ * K[x] a constant and G[x] a global; a test skips the JMP that
+ * follows it unless its condition equals its last operand.
+ */
+#define CL_OPCODES(X)                                                       \
+    X(MOVE,   CL_FMT_RR)        /* R[A] = R[B] */                           \
+    X(LOADI,  CL_FMT_RSBX)      /* R[A] = sBx */                            \
+    X(LOADK,  CL_FMT_RK)        /* R[A] = K[Bx] */                          \
+    X(LOADS,  CL_FMT_RS)        /* R[A] = the string at K[Bx] */            \
+    X(GETG,   CL_FMT_RG)        /* R[A] = G[Bx] */                          \
+    X(SETG,   CL_FMT_RG)        /* G[Bx] = R[A] */                          \
+    X(ADD,    CL_FMT_RRR)       /* R[A] = R[B] + R[C] */                    \
+    X(SUB,    CL_FMT_RRR)                                                   \
+    X(MUL,    CL_FMT_RRR)                                                   \
+    X(DIV,    CL_FMT_RRR)       /* fails on division by zero */             \
+    X(MOD,    CL_FMT_RRR)                                                   \
+    X(ADDI,   CL_FMT_RRS)       /* R[A] = R[B] + sC */                      \
+    X(BAND,   CL_FMT_RRR)                                                   \
+    X(BOR,    CL_FMT_RRR)                                                   \
+    X(BXOR,   CL_FMT_RRR)                                                   \
+    X(SHL,    CL_FMT_RRR)       /* by R[C] modulo 64 */                     \
+    X(SHR,    CL_FMT_RRR)                                                   \
+    X(FADD,   CL_FMT_RRR)       /* on doubles */                            \
+    X(FSUB,   CL_FMT_RRR)                                                   \
+    X(FMUL,   CL_FMT_RRR)                                                   \
+    X(FDIV,   CL_FMT_RRR)                                                   \
+    X(NEG,    CL_FMT_RR)        /* R[A] = -R[B] */                          \
+    X(FNEG,   CL_FMT_RR)                                                    \
+    X(NOT,    CL_FMT_RR)        /* R[A] = !R[B] */                          \
+    X(BNOT,   CL_FMT_RR)        /* R[A] = ~R[B] */                          \
+    X(ITOF,   CL_FMT_RR)        /* R[A] = (double)R[B] */                   \
+    X(FTOI,   CL_FMT_RR)        /* R[A] = (int64_t)R[B] */                  \
+    X(EQ,     CL_FMT_TEST_RR)   /* (R[A] == R[B]) == C */                   \
+    X(LT,     CL_FMT_TEST_RR)   /* (R[A] < R[B]) == C */                    \
+    X(LE,     CL_FMT_TEST_RR)   /* (R[A] <= R[B]) == C */                   \
+    X(FEQ,    CL_FMT_TEST_RR)                                               \
+    X(FLT,    CL_FMT_TEST_RR)                                               \
+    X(FLE,    CL_FMT_TEST_RR)                                               \
+    X(TEST,   CL_FMT_TEST_R)    /* (R[A] != 0) == B */                      \
+    X(JMP,    CL_FMT_J)                                                     \
+    X(FRAME,  CL_FMT_RBX)       /* R[A] = &frame[Bx] */                     \
+    X(ZERO,   CL_FMT_RBX)       /* zeroes Bx slots at R[A] */               \
+    X(REF,    CL_FMT_RRI)       /* R[A] = &R[B][C] */                       \
+    X(COPY,   CL_FMT_RRI)       /* copies C slots from R[B] to R[A] */      \
+    X(GETF,   CL_FMT_RRI)       /* R[A] = R[B][C] */                        \
+    X(SETF,   CL_FMT_RIR)       /* R[A][B] = R[C] */                        \
+    X(GETI,   CL_FMT_RRR)       /* R[A] = R[B][R[C]], bounds checked */     \
+    X(SETI,   CL_FMT_RRR)       /* R[A][R[B]] = R[C], bounds checked */     \
+    X(CALL,   CL_FMT_RF)        /* R[A] = K[Bx](R[A], ...) */               \
+    X(RET,    CL_FMT_R)         /* returns R[A] */                          \
+    X(RET0,   CL_FMT_EMPTY)                                                 \
+    X(PRINT,  CL_FMT_RII)       /* prints R[A] as CL_PRINT_ B, C newline */
+
+#define __CL_OP_ENUM(name, format)  CL_OP_##name,
+
+CL_ENUM(Opcode) {
+    CL_OPCODES(__CL_OP_ENUM)
+    __CL_OP_MAX
+};
+
+
+CL_TYPE(BytecodeFunction) {
+    uint32_t code_count;        /* instructions */
+    uint32_t constant_count;
+    uint16_t register_count;
+    uint8_t  param_count;
+    uint8_t  flags;
+    uint32_t frame_size;        /* slots */
+};
+
+
+/**
+ * A string constant: its length, then its bytes and a NUL.
+ */
+CL_TYPE(BytecodeString) {
+    uint64_t length;
+    char     bytes[];
+};
+
+
+typedef uint32_t Instruction;
+
+
+static __Inline Instruction cl_abc(Opcode op, uint32_t a, uint32_t b,
+    uint32_t c) {
+    return (uint32_t)op | (a << 8) | (b << 16) | (c << 24);
+}
+
+
+static __Inline Instruction cl_abx(Opcode op, uint32_t a, uint32_t bx) {
+    return (uint32_t)op | (a << 8) | (bx << 16);
+}
+
+
+static __Inline Instruction cl_asbx(Opcode op, uint32_t a, int32_t sbx) {
+    return cl_abx(op, a, (uint32_t)(sbx + CL_BYTECODE_SBX_BIAS));
+}
+
+
+static __Inline Instruction cl_sj(Opcode op, int32_t sj) {
+    return (uint32_t)op | ((uint32_t)(sj + CL_BYTECODE_SJ_BIAS) << 8);
+}
+
+
+#define CL_OP(i)        ((Opcode)((i) & 0xFF))
+#define CL_A(i)         (((i) >> 8) & 0xFF)
+#define CL_B(i)         (((i) >> 16) & 0xFF)
+#define CL_C(i)         ((i) >> 24)
+#define CL_BX(i)        ((i) >> 16)
+#define CL_SBX(i)       ((int32_t)CL_BX(i) - CL_BYTECODE_SBX_BIAS)
+#define CL_SC(i)        ((int32_t)CL_C(i) - CL_BYTECODE_SC_BIAS)
+#define CL_SJ(i)        ((int32_t)((i) >> 8) - CL_BYTECODE_SJ_BIAS)
+
+
+/**
+ * Division, remainder and conversion of a float the way the VM
+ * does them, which constant folding must agree with: dividing
+ * INT64_MIN by -1 wraps around, and a float out of range
+ * saturates, NaN giving 0. Dividing by zero is left to callers.
+ */
+static __Inline int64_t cl_div(int64_t a, int64_t b) {
+    return (b == -1) ? (int64_t)(0 - (uint64_t)a) : a / b;
+}
+
+
+static __Inline int64_t cl_mod(int64_t a, int64_t b) {
+    return (b == -1) ? 0 : a % b;
+}
+
+
+static __Inline int64_t cl_ftoi(double value) {
+    if (value != value) {
+        return 0;
+    }
+
+    if (value >= 9223372036854775808.0) {
+        return INT64_MAX;
+    }
+
+    return (value < -9223372036854775808.0) ? INT64_MIN : (int64_t)value;
+}
+
+
+str_t          bytecode_op_name     (Opcode op);
+BytecodeFormat bytecode_op_format   (Opcode op);
+int            bytecode_disassemble (Instruction insn, const uint64_t *constants, uint32_t count, char *out, size_t size);
+
+#endif /* CL_BYTECODE_H_ */
@@ -0,0 +1,37 @@
+#ifndef CL_CODEGEN_H_
+#define CL_CODEGEN_H_
+
+#include "cl-core.h"
+#include "cl-annotation.h"
+#include "cl-source.h"
+#include "cl-tokens.h"
+#include "cl-intern.h"
+#include "cl-ast.h"
+#include "cl-object.h"
+#include "cl-passes.h"
+
+/**
+ * Turns the syntax trees of the files given to cl_compile into
+ * bytecode, one file at a time, and adds it to an object with
+ * a symbol for every top-level declaration. Mistakes are
+ * reported as diagnostics of the file they are in.
+ *
+ * What is compiled so far: functions of the same file, the
+ * builtin `io.print` and `io.println`, integers, floats, bools,
+ * string literals, and structs and fixed-size arrays of those,
+ * which are values: assigning one copies it, and only `*T`
+ * parameters refer to the caller's. Functions of imported
+ * modules cannot be called yet.
+ *
+ * With a PassManager, every function goes through it on its way
+ * to the object, and keeps the bytecode as written when the
+ * optimizer gives up on it.
+ */
+typedef struct __CL_TNAME(CodeGen) CodeGen;
+
+CodeGen *codegen_new   (ObjectWriter *writer, __Nullable PassManager *passes) __NoDiscard;
+bool     codegen_unit  (CodeGen *self, Source *src, TokenStream *tokens, Ast *ast, Interner *symbols);
+uint32_t codegen_entry (CodeGen *self);
+void     codegen_free  (CodeGen *self);
+
+#endif /* CL_CODEGEN_H_ */
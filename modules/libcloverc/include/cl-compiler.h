@@ -5,7 +5,68 @@
 #include "cl-bits.h"
 
 #include "cl-vector.h"
+#include "cl-diagnostic.h"
+#include "cl-token-cache.h"
 
-bool cl_compile(Vector *files, str_t output_file);
+
+/**
+ * Keeps the units of earlier cl_compile calls loaded, so a
+ * file that did not change is neither read nor lexed again,
+ * and one that changed is re-lexed only around the change.
+ * Units are looked up by real path; whoever watches the files
+ * must call unit_cache_invalidate when one of them changes. The
+ * imports of a reused unit are looked up again on every compile,
+ * and a unit whose imports now find other files is reloaded.
+ */
+typedef struct __CL_TNAME(UnitCache) UnitCache;
+
+/**
+ * Called with the real path of every file that enters the
+ * cache, so it can be watched.
+ */
+typedef void (*UnitCacheAddFn)(str_t path, void *user_data);
+
+
+CL_TYPE(CompileOptions) {
+    str_t       output_file;
+    uint32_t    jobs;           /* 0 uses one job per processor */
+    DiagFormat  diag_format;
+    UnitCache  *cache;          /* NULL compiles every file from scratch */
+    Vector     *import_paths;   /* directories searched for imports, or NULL */
+    TokenCache *token_cache;    /* NULL lexes every file */
+    bool        interfaces;     /* read and write module interfaces */
+    bool        optimize;       /* run the passes over every function */
+    str_t       passes;         /* which ones, NULL for CL_PASSES_DEFAULT */
+    bool        dump_ir;        /* print the IR after each pass */
+    bool        time_passes;    /* report the time each pass took */
+    bool        parse_only;     /* stop before codegen, write no object */
+};
+
+
+/**
+ * Compiles the files and every module they import, each once,
+ * however many files import it. Imports are looked up next to
+ * the importing file, then in the import paths. When all of
+ * them compile, the files are written to the object named by
+ * `output_file`, or to CL_OBJECT_DEFAULT_OUTPUT, unless
+ * `parse_only` is set.
+ *
+ * With `interfaces`, every imported module that compiles
+ * cleanly gets its interface written next to it, and one whose
+ * interface matches its text is read from there instead of
+ * being lexed and parsed. The compile server does neither, it
+ * keeps its modules loaded anyway.
+ *
+ * With `optimize`, every function written goes through the
+ * passes named by `passes` (see cl-passes.h) first.
+ */
+bool cl_compile(Vector *files, CompileOptions *options);
+
+UnitCache *unit_cache_new                  (__Nullable UnitCacheAddFn on_add, void *user_data) __NoDiscard;
+void       unit_cache_invalidate           (UnitCache *self, str_t path);
+void       unit_cache_invalidate_importers (UnitCache *self, str_t path);
+void       unit_cache_invalidate_all       (UnitCache *self);
+size_t     unit_cache_count                (UnitCache *self);
+void       unit_cache_free                 (UnitCache *self);
 
 #endif /* COMPILER_H_ */
@@ -1,8 +1,12 @@
 #ifndef CL_DIAGNOSTIC_H_
 #define CL_DIAGNOSTIC_H_
 
+#include <stdio.h>
+
 #include "cl-core.h"
+#include "cl-annotation.h"
 #include "cl-source.h"
+#include "cl-vector.h"
 
 #define diag_note(loc,msg,args...)    __cl_diag(CL_DIAG_NOTE,loc,msg,##args)
 #define diag_info(loc,msg,args...)    __cl_diag(CL_DIAG_INFO,loc,msg,##args)
@@ -19,14 +23,22 @@ CL_ENUM(DiagType) {
 };
 
 
+CL_ENUM(DiagFormat) {
+    CL_DIAG_FORMAT_HUMAN,   /* file:line:col: error: ... with a snippet */
+    CL_DIAG_FORMAT_JSON,    /* one JSON object per line */
+    CL_DIAG_FORMAT_SARIF,   /* a single SARIF 2.1.0 log */
+    __CL_DIAG_FORMAT_MAX
+};
+
+
+/**
+ * Where a diagnostic points to. Only the offset is stored, the
+ * line, column and line text are looked up in the source line
+ * table when the diagnostic is printed.
+ */
 CL_TYPE(DiagLocation) {
     uint32_t offset;
-    uint32_t line_offset;
     uint32_t length;
-    uint32_t line_length;
-
-    uint32_t line;
-    uint32_t column;
 
     uint32_t caret;
 
@@ -34,6 +46,64 @@ CL_TYPE(DiagLocation) {
 };
 
 
-void __cl_diag(DiagType type, DiagLocation loc, str_t msg, ...);
+typedef struct __CL_TNAME(Diagnostic) Diagnostic;
+
+CL_VECTOR_TYPE(Diagnostic);
+
+/**
+ * A recorded diagnostic. A note reported right after another
+ * diagnostic is attached to it instead of standing alone.
+ */
+struct __CL_TNAME(Diagnostic) {
+    DiagType         type;
+    DiagLocation     loc;
+    char            *message;
+    DiagnosticVector notes;
+};
+
+CL_VECTOR_FUNCS(Diagnostic, diagnostic)
+
+
+/**
+ * Collects the diagnostics of one unit until they are flushed.
+ * The source files the diagnostics point to must stay alive
+ * until then.
+ */
+CL_TYPE(DiagBuffer) {
+    DiagnosticVector items;
+    uint32_t         counts[__CL_DIAG_MAX];
+};
+
+
+/**
+ * Renders flushed diagnostics to a stream. Colors are decided
+ * once, when the sink is created.
+ */
+CL_TYPE(DiagSink) {
+    DiagFormat format;
+    FILE      *out;
+    bool       colors;
+    size_t     written;
+};
+
+
+void __cl_diag(DiagType type, DiagLocation loc, str_t msg, ...)
+    __Format(3, 4);
+
+DiagBuffer *diag_buffer_new     (void) __NoDiscard;
+void        diag_buffer_capture (__Nullable DiagBuffer *self);
+void        diag_buffer_write   (DiagBuffer *self, DiagSink *sink);
+void        diag_buffer_flush   (DiagBuffer *self, DiagSink *sink);
+void        diag_buffer_clear   (DiagBuffer *self);
+void        diag_buffer_free    (DiagBuffer *self);
+
+void diag_sink_init  (DiagSink *self, DiagFormat format, FILE *out, int fd);
+void diag_sink_begin (DiagSink *self);
+void diag_sink_end   (DiagSink *self);
+
+/**
+ * Parses a format name ("human", "json" or "sarif").
+ */
+bool diag_format_parse(str_t name, __Out DiagFormat *format);
 
 #endif /* CL_DIAGNOSTIC_H_ */
@@ -0,0 +1,15 @@
+#ifndef CL_HASH_H_
+#define CL_HASH_H_
+
+#include "cl-core.h"
+#include "cl-annotation.h"
+
+
+/**
+ * XXH64 of `length` bytes: a fast 64-bit hash of whole files,
+ * good enough to tell their contents apart in a cache, though
+ * not against someone crafting collisions.
+ */
+uint64_t cl_hash64(const void *data, size_t length, uint64_t seed);
+
+#endif /* CL_HASH_H_ */
@@ -0,0 +1,47 @@
+#ifndef CL_INTERFACE_H_
+#define CL_INTERFACE_H_
+
+#include "cl-core.h"
+#include "cl-annotation.h"
+#include "cl-source.h"
+#include "cl-tokens.h"
+#include "cl-intern.h"
+#include "cl-ast.h"
+
+/**
+ * Suffix of interface files, which sit next to their module,
+ * `a/b.cl` having its interface in `a/b.cli`.
+ */
+#define CL_INTERFACE_SUFFIX     ".cli"
+
+
+/**
+ * The binary interface of a module: its imports and its `pub`
+ * declarations, without function bodies or the values of
+ * variables, as a syntax tree over the few tokens it uses.
+ * Token offsets point into the source the interface was made
+ * from, whose hash the interface keeps, so an interface that
+ * matches its source can stand in for the parsed module, down
+ * to the locations of diagnostics.
+ *
+ * Nodes, `extra`, kinds, offsets, lengths and literals are used
+ * in place in the mapped file; only the symbols are interned
+ * when it is loaded. `tokens` and `ast` are read-only views of
+ * all of it, for the code that works on parsed units.
+ */
+CL_TYPE(ModuleInterface) {
+    TokenStream tokens;
+    Ast         ast;
+
+    uint64_t    source_hash;
+    void       *map;
+    size_t      map_size;
+};
+
+
+char            *interface_path  (str_t module_path) __NoDiscard;
+ModuleInterface *interface_load  (str_t path, Source *src, Interner *symbols) __NoDiscard;
+bool             interface_write (str_t path, Source *src, TokenStream *tokens, Ast *ast, Interner *symbols);
+void             interface_free  (ModuleInterface *self);
+
+#endif /* CL_INTERFACE_H_ */
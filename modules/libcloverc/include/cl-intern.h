@@ -0,0 +1,104 @@
+#ifndef CL_INTERN_H_
+#define CL_INTERN_H_
+
+#include "cl-core.h"
+#include "cl-annotation.h"
+
+/**
+ * Symbol id that no name maps to.
+ */
+#define CL_SYMBOL_NONE      0
+
+/**
+ * Set in the ids of literals, which count apart from the ids
+ * of names, so the two never meet.
+ */
+#define CL_SYMBOL_LITERAL   (UINT32_C(1) << 31)
+
+/**
+ * Number of independently locked parts of the table, a power
+ * of two. Each name always goes to the same shard.
+ */
+#define CL_INTERN_SHARDS    64
+
+/**
+ * Number of names an InternCache remembers, a power of two.
+ */
+#define CL_INTERN_CACHE_SIZE 1024
+
+
+/**
+ * Usage statistics of an interner. `string_bytes` counts the
+ * names with their terminators, `memory_bytes` everything the
+ * interner holds, literals included. `probes` counts the slots
+ * looked at past the first one of a lookup, so it is zero when
+ * no two names ever landed in the same slot.
+ */
+CL_TYPE(InternerStats) {
+    size_t symbols;
+    size_t string_bytes;
+    size_t memory_bytes;
+    size_t lookups;
+    size_t probes;
+    size_t max_probe;
+};
+
+
+/**
+ * Maps names to dense 32-bit symbol ids, starting at 1, so two
+ * names are equal exactly when their ids are. Interning is
+ * thread safe: names are spread over CL_INTERN_SHARDS tables,
+ * each with its own lock, and any number of units may intern
+ * at the same time. A name and its id stay valid until the
+ * interner is freed.
+ *
+ * The interner is the constant pool of a compilation too: the
+ * lexer adds the decoded contents of string and character
+ * literals to it with intern_cache_literal. Literals are only
+ * copied, never looked up, and their ids have
+ * CL_SYMBOL_LITERAL set; interner_unique finds the first of
+ * the equal ones once a literal is used. interner_name gives
+ * the contents of both, which may hold NUL bytes for a
+ * literal, its length is the one interner_name gives.
+ */
+typedef struct __CL_TNAME(Interner) Interner;
+
+
+CL_TYPE(InternCacheEntry) {
+    const char *name;
+    uint32_t    length;
+    uint32_t    id;
+};
+
+
+/**
+ * Remembers the last names one thread interned, so names that
+ * come up again and again, which are most of them, are found
+ * without taking a lock. Literals are copied into a block of
+ * its own, which only takes the lock when it is full. Owned by
+ * a single thread, usually part of a lexer.
+ */
+CL_TYPE(InternCache) {
+    Interner        *symbols;
+    char            *literal_cursor;
+    char            *literal_end;
+    size_t           literal_block;     /* size of the next block */
+    uint32_t         literal_offset;    /* id of the next literal */
+    InternCacheEntry entries[CL_INTERN_CACHE_SIZE];
+};
+
+
+Interner *interner_new         (void) __NoDiscard;
+uint32_t  interner_intern      (Interner *self, const char *text, uint32_t length);
+uint32_t  interner_add_literal (Interner *self, const char *text, uint32_t length);
+uint32_t  interner_unique      (Interner *self, uint32_t id);
+str_t     interner_name        (Interner *self, uint32_t id, __Nullable __Out uint32_t *length);
+size_t    interner_count       (Interner *self);
+void      interner_stats       (Interner *self, __Out InternerStats *stats);
+void      interner_free        (__Nullable Interner *self);
+
+void      intern_cache_init    (InternCache *self, __Nullable Interner *symbols);
+uint32_t  intern_cache_intern  (InternCache *self, const char *text, uint32_t length);
+uint32_t  intern_cache_literal (InternCache *self, const char *text, uint32_t length);
+
+#endif /* CL_INTERN_H_ */
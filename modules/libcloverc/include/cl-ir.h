@@ -0,0 +1,229 @@
+#ifndef CL_IR_H_
+#define CL_IR_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cl-core.h"
+#include "cl-annotation.h"
+#include "cl-bits.h"
+#include "cl-vector.h"
+#include "cl-bytecode.h"
+
+/**
+ * The SSA form the optimizer works on.
+ *
+ * codegen writes bytecode straight from the syntax tree. With
+ * optimizations on, ir_lift turns every function it writes into
+ * this form, the passes of a PassManager rewrite it and
+ * ir_lower turns it back into bytecode: registers become values
+ * defined once, and a test with its JMP becomes a branch.
+ *
+ * Instructions live in one array and refer to each other by
+ * index, the way nodes of an Ast do, and an instruction is the
+ * value it defines. Index 0 is never used, so CL_IR_NONE can
+ * stand for no value. A block lists its instructions in order,
+ * phis first and one terminator last; a phi has one operand per
+ * predecessor of its block, in the order of `preds`.
+ *
+ * Passes do not rewrite every use of a value they replace: the
+ * value becomes an ALIAS of what replaces it and ir_settle
+ * rewrites the operands and drops removed instructions, which
+ * the PassManager does after every pass.
+ */
+#define CL_IR_NONE          0
+#define CL_IR_NO_BLOCK      UINT32_MAX
+#define CL_IR_VARIADIC      (-1)    /* operands in `extra` */
+
+/* what an op does */
+#define CL_IR_VALUE         CL_BIT(1)   /* defines a value */
+#define CL_IR_PURE          CL_BIT(2)   /* computed from its operands only */
+#define CL_IR_LOAD          CL_BIT(3)   /* reads globals or the frame */
+#define CL_IR_STORE         CL_BIT(4)   /* writes them */
+#define CL_IR_EFFECT        CL_BIT(5)   /* stays even when unused */
+#define CL_IR_TRAPS         CL_BIT(6)   /* may fail at run time */
+#define CL_IR_TERM          CL_BIT(7)   /* ends a block */
+
+#define __CL_IR_N   CL_IR_VARIADIC
+#define __CL_IR_V   CL_IR_VALUE
+#define __CL_IR_P   (CL_IR_VALUE | CL_IR_PURE)
+#define __CL_IR_L   CL_IR_LOAD
+#define __CL_IR_S   (CL_IR_STORE | CL_IR_EFFECT)
+#define __CL_IR_E   CL_IR_EFFECT
+#define __CL_IR_T   CL_IR_TRAPS
+#define __CL_IR_J   CL_IR_TERM
+
+
+/**
+ * The ops, as X(name, operands, flags). Operands are values;
+ * `imm` holds what is not, and the targets of JMP and BR, which
+ * ir_target reads.
+ */
+#define CL_IR_OPS(X)                                                        \
+    X(NOP,    0, 0)                           /* removed */                 \
+    X(ALIAS,  1, 0)                           /* replaced by args[0] */     \
+    X(CONST,  0, __CL_IR_P)                   /* imm */                     \
+    X(STRING, 0, __CL_IR_P)                   /* BytecodeString at imm */   \
+    X(PARAM,  0, __CL_IR_V)                   /* parameter imm */           \
+    X(PHI,    __CL_IR_N, __CL_IR_V)                                         \
+    X(ADD,    2, __CL_IR_P)                                                 \
+    X(SUB,    2, __CL_IR_P)                                                 \
+    X(MUL,    2, __CL_IR_P)                                                 \
+    X(DIV,    2, __CL_IR_V | __CL_IR_T)                                     \
+    X(MOD,    2, __CL_IR_V | __CL_IR_T)                                     \
+    X(BAND,   2, __CL_IR_P)                                                 \
+    X(BOR,    2, __CL_IR_P)                                                 \
+    X(BXOR,   2, __CL_IR_P)                                                 \
+    X(SHL,    2, __CL_IR_P)                                                 \
+    X(SHR,    2, __CL_IR_P)                                                 \
+    X(FADD,   2, __CL_IR_P)                                                 \
+    X(FSUB,   2, __CL_IR_P)                                                 \
+    X(FMUL,   2, __CL_IR_P)                                                 \
+    X(FDIV,   2, __CL_IR_P)                                                 \
+    X(NEG,    1, __CL_IR_P)                                                 \
+    X(FNEG,   1, __CL_IR_P)                                                 \
+    X(NOT,    1, __CL_IR_P)                                                 \
+    X(BNOT,   1, __CL_IR_P)                                                 \
+    X(ITOF,   1, __CL_IR_P)                                                 \
+    X(FTOI,   1, __CL_IR_P)                                                 \
+    X(EQ,     2, __CL_IR_P)                   /* 1 when true, else 0 */     \
+    X(LT,     2, __CL_IR_P)                                                 \
+    X(LE,     2, __CL_IR_P)                                                 \
+    X(FEQ,    2, __CL_IR_P)                                                 \
+    X(FLT,    2, __CL_IR_P)                                                 \
+    X(FLE,    2, __CL_IR_P)                                                 \
+    X(FRAME,  0, __CL_IR_P)                   /* &frame[imm] */             \
+    X(REF,    1, __CL_IR_P)                   /* &args[0][imm] */           \
+    X(GETG,   0, __CL_IR_V | __CL_IR_L)       /* global imm */              \
+    X(SETG,   1, __CL_IR_S)                                                 \
+    X(GETF,   1, __CL_IR_V | __CL_IR_L)       /* args[0][imm] */            \
+    X(SETF,   2, __CL_IR_S)                   /* stores args[1] */          \
+    X(GETI,   2, __CL_IR_V | __CL_IR_L | __CL_IR_T)                         \
+    X(SETI,   3, __CL_IR_S | __CL_IR_T)                                     \
+    X(ZERO,   1, __CL_IR_S)                   /* imm slots */               \
+    X(COPY,   2, __CL_IR_L | __CL_IR_S)       /* imm slots to args[0] */    \
+    X(CALL,   __CL_IR_N, __CL_IR_V | __CL_IR_L | __CL_IR_S) /* symbol */    \
+    X(PRINT,  1, __CL_IR_E)                   /* kind | newline << 8 */     \
+    X(JMP,    0, __CL_IR_J)                   /* to target 0 */             \
+    X(BR,     1, __CL_IR_J)                   /* to target 0 if args[0] */  \
+    X(RET,    1, __CL_IR_J)                                                 \
+    X(RET0,   0, __CL_IR_J)
+
+#define __CL_IR_ENUM(name, operands, flags)  CL_IR_##name,
+
+CL_ENUM(IrOp) {
+    CL_IR_OPS(__CL_IR_ENUM)
+    __CL_IR_MAX
+};
+
+
+typedef uint32_t IrValue;
+typedef uint32_t IrBlockId;
+
+CL_VECTOR_DEFINE(IrValue, ir_value)
+CL_VECTOR_DEFINE(IrBlockId, ir_block_id)
+
+
+/**
+ * An instruction. Phis and calls keep their operands in the
+ * `extra` of the function, args[0] being where they start and
+ * args[1] how many there are.
+ */
+CL_TYPE(IrInstr) {
+    uint8_t   op;       /* IrOp */
+    IrBlockId block;
+    IrValue   args[3];
+    uint64_t  imm;
+};
+
+
+CL_TYPE(IrBlock) {
+    IrValueVector   instrs;
+    IrBlockIdVector preds;
+    IrBlockId       idom;   /* set by ir_dominators */
+    uint32_t        order;  /* in reverse postorder, set by ir_order */
+    bool            dead;
+};
+
+CL_VECTOR_DEFINE(IrInstr, ir_instr)
+CL_VECTOR_DEFINE(IrBlock, ir_block)
+
+
+/**
+ * A function. Block 0 is the entry and has no predecessors;
+ * `layout` is the order the blocks are written out in, which
+ * starts as the order of the bytecode they came from.
+ */
+CL_TYPE(IrFunction) {
+    IrInstrVector   instrs;
+    IrValueVector   extra;
+    IrBlockVector   blocks;
+    IrBlockIdVector layout;
+    IrBlockIdVector rpo;        /* reachable blocks, set by ir_order */
+    uint32_t        param_count;
+    uint32_t        frame_size;
+    uint8_t         flags;      /* CL_BYTECODE_ */
+    bool            failed;     /* ran out of memory */
+};
+
+
+/**
+ * How many parameters the function with symbol `symbol` takes,
+ * or -1 when it is not known.
+ */
+typedef int (*IrArityFn)(uint32_t symbol, void *user_data);
+
+
+static __Inline IrInstr *ir_instr(IrFunction *self, IrValue value) {
+    return &self->instrs.data[value];
+}
+
+
+static __Inline IrBlock *ir_block(IrFunction *self, IrBlockId block) {
+    return &self->blocks.data[block];
+}
+
+
+static __Inline IrBlockId ir_target(const IrInstr *instr, int index) {
+    return (IrBlockId)(instr->imm >> (index * 32));
+}
+
+
+static __Inline void ir_set_target(IrInstr *instr, int index,
+    IrBlockId block) {
+    uint64_t mask = (uint64_t)UINT32_MAX << (index * 32);
+
+    instr->imm = (instr->imm & ~mask) | ((uint64_t)block << (index * 32));
+}
+
+
+int         ir_op_operands (IrOp op);
+uint32_t    ir_op_flags    (IrOp op);
+str_t       ir_op_name     (IrOp op);
+
+IrFunction *ir_lift        (const BytecodeFunction *function, IrArityFn arity, void *user_data) __NoDiscard;
+void        ir_free        (IrFunction *self);
+IrBlockId   ir_block_add   (IrFunction *self);
+IrValue     ir_insert      (IrFunction *self, IrBlockId block, size_t at, IrInstr instr);
+IrValue     ir_append      (IrFunction *self, IrBlockId block, IrInstr instr);
+IrValue     ir_phi_new     (IrFunction *self, IrBlockId block, uint32_t count);
+IrValue    *ir_operands    (IrFunction *self, IrValue value, uint32_t *count);
+IrValue     ir_resolve     (IrFunction *self, IrValue value);
+void        ir_replace     (IrFunction *self, IrValue value, IrValue by);
+void        ir_remove      (IrFunction *self, IrValue value);
+IrValue     ir_terminator  (IrFunction *self, IrBlockId block);
+uint32_t    ir_succs       (IrFunction *self, IrBlockId block, IrBlockId succs[2]);
+size_t      ir_pred_index  (IrFunction *self, IrBlockId block, IrBlockId pred);
+void        ir_pred_remove (IrFunction *self, IrBlockId block, size_t index);
+bool        ir_pred_add    (IrFunction *self, IrBlockId block, IrBlockId pred, size_t like);
+void        ir_block_kill  (IrFunction *self, IrBlockId block);
+void        ir_settle      (IrFunction *self);
+bool        ir_order       (IrFunction *self);
+bool        ir_dominators  (IrFunction *self);
+bool        ir_dominates   (IrFunction *self, IrBlockId a, IrBlockId b);
+bool        ir_verify      (IrFunction *self, __Out str_t *why);
+void        ir_dump        (IrFunction *self, str_t name, FILE *out);
+bool        ir_lower       (IrFunction *self, uint8_t **code, size_t *size);
+
+#endif /* CL_IR_H_ */
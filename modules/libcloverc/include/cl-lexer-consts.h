@@ -6,7 +6,7 @@
 
 
 #define CL_ESCAPE_CHARS "abefnrt\"\'\\"
-#define CL_ESCAPE_PAIRS "\a\b\e\f\n\r\t\'\\"
+#define CL_ESCAPE_PAIRS "\a\b\e\f\n\r\t\"\'\\"
 #define CL_DELIMITERS   " .,:;()[]{}<>^'\"|/!?&%*-+=\r\n"
 #define CL_DIGITS       "0123456789"
 #define CL_ID_MAXLEN    63
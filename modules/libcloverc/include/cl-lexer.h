@@ -0,0 +1,68 @@
+#ifndef CL_LEXER_H_
+#define CL_LEXER_H_
+
+#include "cl-core.h"
+#include "cl-annotation.h"
+#include "cl-types.h"
+#include "cl-source.h"
+#include "cl-tokens.h"
+#include "cl-intern.h"
+
+/**
+ * Number of tokens lexer_peek can look ahead, a power of two.
+ */
+#define CL_LEXER_LOOKAHEAD  8
+
+/**
+ * How many bytes past the end of a token a scanner may read
+ * before deciding where the token ends, like the `.` and the
+ * digit after it in `1.x`.
+ */
+#define CL_LEXER_MAX_PEEK   2
+
+
+/**
+ * Scans a source one token at a time. Tokens are produced on
+ * demand, and only up to CL_LEXER_LOOKAHEAD of them are kept
+ * for lexer_peek, so memory does not grow with the file.
+ * Each lexer is independent, several may run on different
+ * threads and share an interner. Errors are reported as
+ * diagnostics while scanning.
+ *
+ * Identifiers get their symbol id from `symbols`; without an
+ * interner their value is CL_SYMBOL_NONE.
+ */
+typedef struct __CL_TNAME(Lexer) Lexer;
+
+
+Lexer *lexer_new    (Source *src, __Nullable Interner *symbols) __NoDiscard;
+bool   lexer_next   (Lexer *self, __Out Token *tk);
+bool   lexer_peek   (Lexer *self, size_t k, __Out Token *tk);
+bool   lexer_failed (Lexer *self);
+void   lexer_free   (Lexer *self);
+
+/**
+ * Scans the whole source into `tokens`. Returns false when a
+ * token was malformed.
+ */
+bool cl_lex(Source *src, TokenStream *tokens, __Nullable Interner *symbols);
+
+/**
+ * Applies `edit` to the source and updates `tokens`, which must
+ * come from a cl_lex of the same source with the same interner,
+ * to what cl_lex would produce for the edited text. Only the
+ * tokens around the edit are scanned again. Returns false when
+ * the resulting stream stopped at a malformed token, or when
+ * the edit failed; when memory ran out after editing the source
+ * the stream must be rebuilt with cl_lex.
+ */
+bool cl_relex(Source *src, TokenStream *tokens, SourceEdit edit,
+              __Nullable Interner *symbols);
+
+/**
+ * Returns how tokens of a kind are spelled, like "fn" or "{",
+ * or the name of the kind for literals, like "identifier".
+ */
+str_t cl_token_name(TokenType type);
+
+#endif /* CL_LEXER_H_ */
@@ -1,6 +1,8 @@
 #ifndef CL_LOG_H_
 #define CL_LOG_H_
 
+#include <stdio.h>
+
 #include "cl-core.h"
 #include "cl-annotation.h"
 
@@ -30,7 +32,37 @@ CL_ENUM(LogLevel) {
 };
 
 
+/**
+ * Collects everything the calling thread would print to stdout
+ * and stderr, so output produced by parallel jobs can be
+ * written out later in a fixed order.
+ */
+CL_TYPE(LogBuffer) {
+    FILE  *out;
+    FILE  *err;
+
+    char  *out_data;
+    size_t out_size;
+    char  *err_data;
+    size_t err_size;
+};
+
+
 void __cl_log (LogLevel level, __Nullable str_t scope, str_t msg, ...)
     __Format(3, 4);
 
+bool  log_buffer_init    (LogBuffer *self) __NoDiscard;
+void  log_buffer_capture (__Nullable LogBuffer *self);
+void  log_buffer_close   (LogBuffer *self);
+void  log_buffer_write   (LogBuffer *self);
+void  log_buffer_flush   (LogBuffer *self);
+bool  log_buffer_empty   (LogBuffer *self);
+void  log_buffer_discard (LogBuffer *self);
+
+/**
+ * Returns the stream the calling thread should print to instead
+ * of writing to `fd` (stdout or stderr) directly.
+ */
+FILE *cl_log_stream (int fd);
+
 #endif /* CL_LOG_H_ */
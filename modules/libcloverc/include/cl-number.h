@@ -0,0 +1,250 @@
+#ifndef CL_NUMBER_H_
+#define CL_NUMBER_H_
+
+#include <string.h>
+
+#include "cl-core.h"
+#include "cl-annotation.h"
+#include "cl-types.h"
+
+
+/**
+ * The value of every hex digit, 0xFF for every other byte.
+ */
+extern const uint8_t CL_HEX_VALUES[256];
+
+
+static __Inline uint64_t cl_load_eight(const char *text) {
+    uint64_t chunk;
+
+    memcpy(&chunk, text, sizeof(chunk));
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    chunk = __builtin_bswap64(chunk);
+#endif
+
+    return chunk;
+}
+
+
+/**
+ * Tells whether the 8 bytes of `chunk`, in memory order, are
+ * all '0' or '1'.
+ */
+static __Inline bool cl_is_eight_bits(uint64_t chunk) {
+    return (chunk & 0xFEFEFEFEFEFEFEFEULL) == 0x3030303030303030ULL;
+}
+
+
+/**
+ * Packs 8 binary digits into a byte, the first digit being the
+ * highest bit: the multiplication moves the low bit of every
+ * byte into the top byte, each to its own position.
+ */
+static __Inline uint32_t cl_parse_eight_bits(uint64_t chunk) {
+    return (uint32_t)(((chunk & 0x0101010101010101ULL) *
+                       0x8040201008040201ULL) >> 56);
+}
+
+
+/**
+ * Returns how many of the 8 bytes of `chunk`, in memory order,
+ * are decimal digits before the first byte that is not. Every
+ * byte is xor'ed with '0', which leaves the digits, and only
+ * them, below 10; adding 0x76 to the low 7 bits then sets the
+ * top bit of every byte that is not.
+ */
+static __Inline uint32_t cl_count_digits(uint64_t chunk) {
+    uint64_t values = chunk ^ 0x3030303030303030ULL;
+    uint64_t others = (((values & 0x7F7F7F7F7F7F7F7FULL) +
+                        0x7676767676767676ULL) | values) &
+                      0x8080808080808080ULL;
+
+    return others ? (uint32_t)__builtin_ctzll(others) / 8 : 8;
+}
+
+
+/**
+ * Reads 8 digits, the first one being the most significant,
+ * from `chunk` once every byte has been xor'ed with '0': pairs
+ * of digits first, then pairs of pairs, then the two halves.
+ */
+static __Inline uint32_t cl_parse_eight_digits(uint64_t values) {
+    values = values * 10 + (values >> 8);
+    values = ((values & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32)) +
+              ((values >> 16) & 0x000000FF000000FFULL) *
+              (1 + (10000ULL << 32))) >> 32;
+
+    return (uint32_t)values;
+}
+
+
+/**
+ * The powers of ten a run of up to 8 digits shifts the value by,
+ * and for every run the value below which it cannot overflow.
+ */
+extern const uint32_t CL_DIGIT_POW10[9];
+extern const uint64_t CL_DIGIT_LIMITS[9];
+
+
+/**
+ * Consumes the run of decimal digits at the start of `text`,
+ * which must end in some other byte, like the NUL of a source,
+ * appending them to `*value`. Digits that no longer fit in 64
+ * bits are left out and counted in `*dropped`, and so are all
+ * the digits after them. Returns the number of digits.
+ *
+ * While 8 bytes can be read, which `available` tells, the run
+ * in each 8 is found with one mask and read with one multiply,
+ * so short literals take no branch per digit, and the digits
+ * past the first 19 are only counted. Only the digits around
+ * the limit of 64 bits go one at a time.
+ */
+static __Inline uint32_t cl_scan_decimal(const char *text, size_t available,
+    uint64_t *value, uint32_t *dropped) {
+    uint64_t acc = *value;
+    uint32_t count = 0;
+
+    while (available - count >= 8) {
+        uint64_t chunk = cl_load_eight(text + count);
+        uint32_t run = cl_count_digits(chunk);
+
+        if (run == 0) {
+            break;
+        }
+
+        if (*dropped != 0) {
+            *dropped += run;
+        } else if (acc < CL_DIGIT_LIMITS[run]) {
+            /* the digits go to the top, the zeros below lead them */
+            uint64_t digits = (chunk ^ 0x3030303030303030ULL) <<
+                (64 - 8 * run);
+
+            acc = acc * CL_DIGIT_POW10[run] + cl_parse_eight_digits(digits);
+        } else {
+            break;
+        }
+
+        count += run;
+
+        if (run < 8) {
+            *value = acc;
+            return count;
+        }
+    }
+
+    for (;; count++) {
+        uint32_t digit = (uint32_t)(uint8_t)text[count] - '0';
+
+        if (digit > 9) {
+            break;
+        }
+
+        /* below this, acc * 10 + 9 cannot overflow */
+        if (acc < UINT64_MAX / 10) {
+            acc = acc * 10 + digit;
+        } else if (*dropped == 0 && acc == UINT64_MAX / 10 &&
+                   digit <= UINT64_MAX % 10) {
+            acc = acc * 10 + digit;
+        } else {
+            *dropped += 1;
+        }
+    }
+
+    *value = acc;
+
+    return count;
+}
+
+
+/**
+ * Returns how many decimal digits start `text`, which must end
+ * in some other byte, 8 at a time while `available` lets it.
+ */
+static __Inline uint32_t cl_span_decimal(const char *text, size_t available) {
+    uint32_t count = 0;
+
+    while (available - count >= 8) {
+        uint32_t run = cl_count_digits(cl_load_eight(text + count));
+
+        count += run;
+
+        if (run < 8) {
+            return count;
+        }
+    }
+
+    while ((uint32_t)(uint8_t)text[count] - '0' <= 9) {
+        count++;
+    }
+
+    return count;
+}
+
+
+/**
+ * Consumes the run of hex digits at the start of `text` into
+ * `*value`, and sets `*overflow` when they do not fit in 64
+ * bits. Returns the number of digits.
+ */
+static __Inline uint32_t cl_scan_hex(const char *text, uint64_t *value,
+    bool *overflow) {
+    uint64_t acc = 0;
+    uint32_t count = 0;
+    uint32_t digit;
+
+    while ((digit = CL_HEX_VALUES[(uint8_t)text[count]]) < 16) {
+        *overflow |= (acc >> 60) != 0;
+        acc = (acc << 4) | digit;
+        count++;
+    }
+
+    *value = acc;
+
+    return count;
+}
+
+
+/**
+ * Consumes the run of binary digits at the start of `text` into
+ * `*value` like cl_scan_hex, 8 at a time while `available` lets
+ * it.
+ */
+static __Inline uint32_t cl_scan_bin(const char *text, size_t available,
+    uint64_t *value, bool *overflow) {
+    uint64_t acc = 0;
+    uint32_t count = 0;
+    uint32_t digit;
+
+    while (available - count >= 8) {
+        uint64_t chunk = cl_load_eight(text + count);
+
+        if (!cl_is_eight_bits(chunk)) {
+            break;
+        }
+
+        *overflow |= (acc >> 56) != 0;
+        acc = (acc << 8) | cl_parse_eight_bits(chunk);
+        count += 8;
+    }
+
+    while ((digit = (uint32_t)(uint8_t)text[count] - '0') <= 1) {
+        *overflow |= (acc >> 63) != 0;
+        acc = (acc << 1) | digit;
+        count++;
+    }
+
+    *value = acc;
+
+    return count;
+}
+
+
+bool    cl_decimal_to_double (uint64_t mantissa, int64_t exp10, __Out double *out);
+double  cl_parse_double      (const char *text, size_t length);
+double  cl_make_double       (uint64_t mantissa, int64_t exp10, bool truncated,
+                              const char *text, size_t length);
+double  cl_float_value       (const char *text, size_t length);
+Literal cl_number_value      (TokenType type, const char *text, size_t length);
+
+#endif /* CL_NUMBER_H_ */
@@ -0,0 +1,158 @@
+#ifndef CL_OBJECT_H_
+#define CL_OBJECT_H_
+
+#include "cl-core.h"
+#include "cl-annotation.h"
+
+/**
+ * The Clover object format, `.co`.
+ *
+ * An object is one file that can be mapped and used in place:
+ * every structure is stored in the byte order of the machine
+ * that wrote it, at an offset aligned for it, and nothing in it
+ * is ever patched or copied by a reader.
+ *
+ *   ObjectHeader       at offset 0, 64 bytes
+ *   ObjectSection[]    the section table, right after the header
+ *   section data       each at `offset`, aligned to `align`
+ *
+ * Section 0 is always CL_OBJECT_SECTION_NONE and empty, so that
+ * section 0 can stand for "no section" in a symbol. The other
+ * sections appear at most once each:
+ *
+ *   STRINGS    NUL-terminated names; offset 0 is the empty name
+ *   SYMBOLS    ObjectSymbol[], `entry_size` bytes each
+ *   CODE       bytecode functions, see cl-bytecode.h
+ *   CONSTANTS  constant values, each aligned to its own size,
+ *              at most 8 bytes
+ *
+ * A symbol names a top-level declaration of the compiled files:
+ * its data is `size` bytes at `value` in `section`, or it has no
+ * data when `section` is 0. Names and file paths are offsets in
+ * STRINGS.
+ *
+ * Readers must reject another magic or major format; a minor
+ * format only ever adds section kinds or symbol flags, which
+ * readers skip.
+ */
+#define CL_OBJECT_MAGIC             "\x7F" "CLO"
+#define CL_OBJECT_FORMAT_MAJOR      1
+#define CL_OBJECT_FORMAT_MINOR      0
+#define CL_OBJECT_DEFAULT_OUTPUT    "a.co"
+
+/* no entry point */
+#define CL_OBJECT_NO_ENTRY          UINT32_MAX
+
+/* symbol flag bits */
+#define CL_OBJECT_SYM_PUB           1   /* declared with pub */
+#define CL_OBJECT_SYM_STATIC        2   /* declared with static */
+#define CL_OBJECT_SYM_FLOAT         3   /* the constant is a double */
+#define CL_OBJECT_SYM_INIT          4   /* runs before the entry point */
+
+
+CL_ENUM(ObjectSectionKind) {
+    CL_OBJECT_SECTION_NONE,
+    CL_OBJECT_SECTION_STRINGS,
+    CL_OBJECT_SECTION_SYMBOLS,
+    CL_OBJECT_SECTION_CODE,
+    CL_OBJECT_SECTION_CONSTANTS,
+    __CL_OBJECT_SECTION_MAX
+};
+
+
+CL_ENUM(ObjectSymbolKind) {
+    CL_OBJECT_SYM_FN,
+    CL_OBJECT_SYM_VAR,
+    CL_OBJECT_SYM_CONST,
+    CL_OBJECT_SYM_STRUCT,
+    CL_OBJECT_SYM_ENUM,
+    __CL_OBJECT_SYM_MAX
+};
+
+
+CL_TYPE(ObjectHeader) {
+    char     magic[4];
+    uint16_t format_major;
+    uint16_t format_minor;
+    char     version[16];       /* of the compiler, NUL padded */
+    uint64_t file_size;
+    uint32_t section_count;     /* including section 0 */
+    uint32_t section_offset;
+    uint32_t entry;             /* symbol of main, or CL_OBJECT_NO_ENTRY */
+    uint32_t flags;
+    uint8_t  reserved[16];
+};
+
+
+CL_TYPE(ObjectSection) {
+    uint32_t kind;              /* ObjectSectionKind */
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t align;
+    uint32_t entry_size;        /* 0 unless the section is a table */
+};
+
+
+CL_TYPE(ObjectSymbol) {
+    uint32_t name;
+    uint32_t file;
+    uint8_t  kind;              /* ObjectSymbolKind */
+    uint8_t  flags;
+    uint16_t section;           /* index in the section table */
+    uint32_t line;
+    uint64_t value;
+    uint64_t size;
+};
+
+
+/**
+ * Collects the parts of an object and writes it out with one
+ * write of one buffer. Every section goes at the index of its
+ * kind, so symbols name their section by its kind.
+ */
+typedef struct __CL_TNAME(ObjectWriter) ObjectWriter;
+
+ObjectWriter *object_writer_new       (void) __NoDiscard;
+uint32_t      object_writer_string    (ObjectWriter *self, const char *str, size_t length);
+uint64_t      object_writer_code      (ObjectWriter *self, const void *data, size_t size);
+uint64_t      object_writer_constant  (ObjectWriter *self, const void *data, size_t size);
+uint32_t      object_writer_symbol    (ObjectWriter *self, ObjectSymbol symbol);
+void          object_writer_set_entry (ObjectWriter *self, uint32_t symbol);
+bool          object_writer_write     (ObjectWriter *self, str_t path);
+void          object_writer_free      (ObjectWriter *self);
+
+
+/**
+ * A mapped object. Every pointer points into the mapping and
+ * was checked to lie within it, with the right alignment, when
+ * the object was opened; so were the names, files and data of
+ * all symbols.
+ */
+CL_TYPE(ObjectFile) {
+    const ObjectHeader  *header;
+    const ObjectSection *sections;
+    size_t               section_count;
+
+    const char          *strings;
+    size_t               strings_size;
+    const ObjectSymbol  *symbols;
+    size_t               symbol_count;
+    const uint8_t       *code;
+    size_t               code_size;
+    const uint8_t       *constants;
+    size_t               constants_size;
+
+    void                *map;
+    size_t               map_size;
+};
+
+
+ObjectFile *object_open          (str_t path) __NoDiscard;
+str_t       object_string        (ObjectFile *self, uint32_t offset);
+const void *object_symbol_data   (ObjectFile *self, const ObjectSymbol *symbol);
+str_t       object_section_name  (uint32_t kind);
+str_t       object_symbol_kind   (uint32_t kind);
+void        object_close         (ObjectFile *self);
+
+#endif /* CL_OBJECT_H_ */
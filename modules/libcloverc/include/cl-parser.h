@@ -0,0 +1,30 @@
+#ifndef CL_PARSER_H_
+#define CL_PARSER_H_
+
+#include "cl-core.h"
+#include "cl-annotation.h"
+#include "cl-source.h"
+#include "cl-tokens.h"
+#include "cl-ast.h"
+
+/**
+ * How deeply statements and expressions may nest before the
+ * parser gives up, so that no input can exhaust the stack.
+ */
+#define CL_PARSER_MAX_DEPTH 1024
+
+
+/**
+ * Parses the tokens of a source into `ast`, which is emptied
+ * first. Expressions are parsed the Pratt way, a single loop
+ * over a table of binding powers, and every list
+ * is gathered on a scratch stack and copied to `extra` once it
+ * is complete, so the children of a node are always adjacent.
+ *
+ * Errors are reported as diagnostics and parsing stops at the
+ * first one. Returns false on a syntax error or when memory
+ * ran out; the tree is then incomplete.
+ */
+bool cl_parse(Source *src, TokenStream *tokens, Ast *ast);
+
+#endif /* CL_PARSER_H_ */
@@ -0,0 +1,44 @@
+#ifndef CL_PASSES_H_
+#define CL_PASSES_H_
+
+#include <stdio.h>
+
+#include "cl-core.h"
+#include "cl-annotation.h"
+#include "cl-ir.h"
+
+/**
+ * The optimizer: lifts a function of bytecode into SSA form,
+ * runs a list of passes over it and lowers it back.
+ *
+ *   sccp   propagates constants along the paths that can run,
+ *          folds what they make constant and the branches they
+ *          decide, and simplifies x + 0, x * 1 and the like
+ *   cfg    removes blocks nothing reaches, merges blocks that
+ *          follow each other, jumps past empty ones and turns a
+ *          branch that picks 1 or 0 into the comparison itself
+ *   cse    finds pure computations an earlier one dominates,
+ *          and loads that a store or a load before them in the
+ *          block already made known
+ *   dce    removes what nothing uses and has no effect
+ *   defer  merges the copies of deferred code that codegen
+ *          writes at every exit of a scope: returns that end
+ *          with the same instructions share one copy of them,
+ *          and so do the blocks that join after an if
+ *
+ * The passes go in the order given, a name may appear more than
+ * once, and the ones left out are not run.
+ */
+#define CL_PASSES_DEFAULT   "sccp,cfg,cse,dce,defer,cfg,dce"
+
+typedef struct __CL_TNAME(PassManager) PassManager;
+
+
+PassManager *pass_manager_new      (__Nullable str_t passes) __NoDiscard;
+void         pass_manager_dump     (PassManager *self, __Nullable FILE *out);
+void         pass_manager_time     (PassManager *self, bool enabled);
+bool         pass_manager_optimize (PassManager *self, const BytecodeFunction *function, str_t name, IrArityFn arity, void *user_data, uint8_t **code, size_t *size);
+void         pass_manager_report   (PassManager *self, FILE *out);
+void         pass_manager_free     (PassManager *self);
+
+#endif /* CL_PASSES_H_ */
@@ -0,0 +1,29 @@
+#ifndef CL_POOL_H_
+#define CL_POOL_H_
+
+#include "cl-core.h"
+#include "cl-annotation.h"
+
+
+/**
+ * A fixed set of worker threads running jobs from a shared
+ * FIFO queue. A pool created with a single thread has no
+ * workers at all and runs every job inline in pool_submit,
+ * which keeps `-j 1` strictly serial.
+ */
+typedef struct __CL_TNAME(ThreadPool) ThreadPool;
+
+typedef void (*PoolJobFn)(void *user_data);
+
+
+ThreadPool *pool_new    (uint32_t threads) __NoDiscard;
+bool        pool_submit (ThreadPool *self, PoolJobFn fn, void *user_data);
+void        pool_wait   (ThreadPool *self);
+void        pool_free   (ThreadPool *self);
+
+/**
+ * Returns the number of online processors, at least 1.
+ */
+uint32_t cl_cpu_count(void);
+
+#endif /* CL_POOL_H_ */
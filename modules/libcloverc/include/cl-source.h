@@ -3,20 +3,104 @@
 
 #include "cl-core.h"
 #include "cl-annotation.h"
+#include "cl-bits.h"
+#include "cl-arena.h"
 
+/**
+ * Files at least this large are memory-mapped instead of
+ * being read into a heap buffer.
+ */
+#define CL_SOURCE_MAP_THRESHOLD (16 * 1024)
+
+/* source flag bits */
+#define CL_SOURCE_MAPPED        1   /* text is a file mapping */
+#define CL_SOURCE_ARENA         2   /* memory belongs to an arena */
+#define CL_SOURCE_EDITED        3   /* text and lines were malloc'd by source_edit */
+#define CL_SOURCE_ASCII         4   /* text is valid UTF-8 without multibyte sequences */
+
+
+/**
+ * Character classes understood by source_span_class.
+ */
+CL_ENUM(CharClass) {
+    CL_CHARS_NAME,      /* A-Z a-z 0-9 _ */
+    CL_CHARS_BLANK,     /* space \t \r */
+    CL_CHARS_SPACE,     /* space \t \r \n */
+    __CL_CHARS_MAX
+};
+
+
+/**
+ * The text of a source file. The text is always followed by
+ * a NUL byte, even when it is mapped straight from the page
+ * cache, so scanners may use it as a sentinel.
+ *
+ * `lines` holds the offset where each line starts, built once
+ * when the source is loaded, so positions can be looked up
+ * without rescanning the text.
+ *
+ * The text is checked to be UTF-8 when it is loaded, and
+ * again around every edit. `utf8_error` is the offset of the
+ * first malformed sequence, or `length` when there is none;
+ * sources that are plain ASCII get the CL_SOURCE_ASCII flag,
+ * so columns and characters can be counted in bytes.
+ *
+ * A source created with an arena is allocated from it, and
+ * source_free only unmaps the text; the rest goes away with
+ * the arena.
+ */
 CL_TYPE(Source) {
-    str_t  path;
-    str_t  text;
-    size_t length;
+    str_t     path;
+    str_t     text;
+    size_t    length;
+    uint32_t  flags;
+    size_t    utf8_error;
+
+    uint32_t *lines;
+    size_t    line_count;
+};
+
+/**
+ * Replaces `removed` bytes at `offset` with `length` bytes of
+ * `text`, which does not need to be NUL terminated.
+ */
+CL_TYPE(SourceEdit) {
+    uint32_t offset;
+    uint32_t removed;
+    str_t    text;
+    uint32_t length;
 };
 
-Source *source_new   (str_t file) __NoDiscard;
-char    source_at    (Source *self, size_t offset);
-sview_t source_get   (Source *self, size_t offset);
-size_t  source_span  (Source *self, size_t offset, str_t accept);
-size_t  source_cspan (Source *self, size_t offset, str_t reject);
-size_t  source_lnlen (Source *self, size_t offset);
-int     source_cmp   (Source *self, size_t offset, size_t length, str_t other);
-void    source_free  (Source *self);
+
+Source *source_new         (__Nullable Arena *arena, str_t file) __NoDiscard;
+Source *source_read        (__Nullable Arena *arena, str_t file) __NoDiscard;
+char    source_at          (Source *self, size_t offset);
+str_t   source_get         (Source *self, size_t offset);
+size_t  source_span        (Source *self, size_t offset, str_t accept);
+size_t  source_cspan       (Source *self, size_t offset, str_t reject);
+size_t  source_span_class  (Source *self, size_t offset, CharClass cls);
+size_t  source_cspan_eol   (Source *self, size_t offset);
+size_t  source_cspan_quote (Source *self, size_t offset, char quote);
+size_t  source_lnlen       (Source *self, size_t offset);
+void    source_locate      (Source *self, size_t offset, __Out uint32_t *line, __Out uint32_t *column);
+bool    source_line        (Source *self, uint32_t line, __Out size_t *offset, __Out size_t *length);
+int     source_cmp         (Source *self, size_t offset, size_t length, str_t other);
+bool    source_edit        (Source *self, SourceEdit edit);
+bool    source_is_utf8     (Source *self);
+void    source_free        (Source *self);
+
+/**
+ * Returns the name of the vector extension ("avx2", "sse2" or
+ * "scalar") the character class scanners run on.
+ */
+str_t source_simd_name(void);
+
+/**
+ * Returns the offset of the first malformed UTF-8 sequence in
+ * `length` bytes of `text`, or `length` when there is none, and
+ * whether those bytes are all ASCII. Runs on the same vector
+ * extension as the scanners.
+ */
+size_t source_validate_utf8(str_t text, size_t length, __Out bool *ascii);
 
 #endif /* CL_SOURCE_H_ */
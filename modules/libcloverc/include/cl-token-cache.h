@@ -0,0 +1,70 @@
+#ifndef CL_TOKEN_CACHE_H_
+#define CL_TOKEN_CACHE_H_
+
+#include "cl-core.h"
+#include "cl-annotation.h"
+#include "cl-source.h"
+#include "cl-tokens.h"
+#include "cl-intern.h"
+
+/**
+ * Default size cap of the cache directory.
+ */
+#define CL_TOKEN_CACHE_DEFAULT_SIZE (256UL * 1024 * 1024)
+
+/**
+ * Eviction stops once the directory is back down to this share
+ * of the cap, in percent, so that it does not run again on the
+ * very next store.
+ */
+#define CL_TOKEN_CACHE_LOW_WATER    75
+
+
+/**
+ * What a cache did so far, over all threads.
+ */
+CL_TYPE(TokenCacheStats) {
+    size_t hits;
+    size_t misses;
+    size_t stores;
+    size_t evictions;
+    size_t bytes_read;      /* of the entries that hit */
+    size_t bytes_written;
+};
+
+
+/**
+ * A directory of lexed token streams, one file per source text
+ * and compiler version, named after a 64-bit hash of both. An
+ * entry holds the token kinds as they are and every offset as
+ * the gap after the previous token, every length that the kind
+ * does not imply and every symbol as varints, followed by the
+ * names of the symbols and the number literals. Entries are
+ * mapped and decoded straight into a stream, so a hit skips
+ * cl_lex entirely.
+ *
+ * Several processes may share a directory: entries are written
+ * to a temporary file and renamed into place, so a reader sees
+ * either a whole entry or none, and every entry is checked as it
+ * is decoded. A hit refreshes the time of its entry, and when a
+ * store takes the directory over its size cap, the entries used
+ * least recently are removed first.
+ *
+ * All functions may be called from any number of threads.
+ */
+typedef struct __CL_TNAME(TokenCache) TokenCache;
+
+
+TokenCache *token_cache_open    (str_t dir, size_t max_size) __NoDiscard;
+bool        token_cache_load    (TokenCache *self, Source *src, TokenStream *tokens, Interner *symbols);
+bool        token_cache_store   (TokenCache *self, Source *src, TokenStream *tokens, Interner *symbols);
+void        token_cache_stats   (TokenCache *self, __Out TokenCacheStats *stats);
+void        token_cache_close   (TokenCache *self);
+
+/**
+ * Returns `$XDG_CACHE_HOME/clover`, or `~/.cache/clover` when
+ * that is not set, in a new string.
+ */
+char *token_cache_default_dir(void) __NoDiscard;
+
+#endif /* CL_TOKEN_CACHE_H_ */
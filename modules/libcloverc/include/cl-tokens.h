@@ -0,0 +1,128 @@
+#ifndef CL_TOKENS_H_
+#define CL_TOKENS_H_
+
+#include "cl-core.h"
+#include "cl-annotation.h"
+#include "cl-types.h"
+#include "cl-arena.h"
+#include "cl-intern.h"
+
+#define CL_TOKENS_INITIAL_CAPACITY      256
+#define CL_TOKENS_INITIAL_VALUES        128
+
+/* tokens covered by each mask of the tokens with a value */
+#define CL_TOKENS_BLOCK                 64
+
+/**
+ * Average number of source bytes per token, used to size the
+ * stream up front from the length of the source. Typical code
+ * with indentation and comments is closer to 6 than to the 4.5
+ * of dense code, so at most one growth follows.
+ */
+#define CL_TOKENS_BYTES_PER_TOKEN       6
+
+
+/**
+ * A token stream stored as parallel arrays: one byte for the
+ * kind, and 32 bits each for the offset and the length, which
+ * is 9 bytes per token. Lines and columns are not stored, they
+ * are derived from the offset on demand with source_locate.
+ *
+ * Only the kinds of cl_has_value have a value, so `values` only
+ * holds theirs, in order. Every CL_TOKENS_BLOCK tokens have a
+ * mask of those with a value and the index of the first one,
+ * and tokens_value counts the bits below a token. A value costs
+ * 4 bytes where there is one, and the masks under 0.2 bytes a
+ * token.
+ *
+ * Number literals take no room beyond their 9 bytes: their
+ * values are decoded from the text with cl_number_value.
+ *
+ * A stream created with an arena grows inside of it and needs
+ * no tokens_free.
+ *
+ * `failed` is set when lexing stopped at a malformed token, the
+ * stream then ends right before it.
+ */
+CL_TYPE(TokenStream) {
+    uint8_t  *kinds;
+    uint32_t *offsets;
+    uint32_t *lengths;
+    size_t    count;
+    size_t    capacity;
+    uint32_t *values;
+    size_t    value_count;
+    size_t    value_capacity;
+    uint32_t *value_bases;      /* one per block */
+    uint64_t *value_masks;
+    Arena    *arena;
+    bool      failed;
+};
+
+
+TokenStream *tokens_new            (__Nullable Arena *arena) __NoDiscard;
+bool         tokens_reserve        (TokenStream *self, size_t capacity);
+bool         tokens_reserve_values (TokenStream *self, size_t capacity);
+bool         tokens_grow           (TokenStream *self);
+bool         tokens_grow_values    (TokenStream *self);
+void         tokens_index_values   (TokenStream *self);
+Token        tokens_get            (TokenStream *self, size_t index);
+bool         tokens_splice         (TokenStream *self, size_t from, size_t to,
+                                    const Token *items, size_t count,
+                                    uint32_t shift);
+void         tokens_free           (TokenStream *self);
+
+
+/**
+ * Returns the value of a token, CL_SYMBOL_NONE for a kind that
+ * has none.
+ */
+static __Inline uint32_t tokens_value(const TokenStream *self, size_t index) {
+    if (!cl_has_value((TokenType)self->kinds[index])) {
+        return CL_SYMBOL_NONE;
+    }
+
+    size_t block = index / CL_TOKENS_BLOCK;
+    uint64_t below = self->value_masks[block] &
+        ((UINT64_C(1) << (index % CL_TOKENS_BLOCK)) - 1);
+
+    return self->values[self->value_bases[block] +
+        (size_t)__builtin_popcountll(below)];
+}
+
+
+/**
+ * Appends a token. Only a full stream leaves the inline path.
+ */
+static __Inline bool tokens_push(TokenStream *self, Token tk) {
+    if (self->count == self->capacity && !tokens_grow(self)) {
+        return false;
+    }
+
+    size_t count = self->count;
+    size_t block = count / CL_TOKENS_BLOCK;
+
+    if (count % CL_TOKENS_BLOCK == 0) {
+        self->value_bases[block] = (uint32_t)self->value_count;
+        self->value_masks[block] = 0;
+    }
+
+    if (cl_has_value(tk.type)) {
+        if (self->value_count == self->value_capacity &&
+            !tokens_grow_values(self)) {
+            return false;
+        }
+
+        self->values[self->value_count++] = tk.value;
+        self->value_masks[block] |= UINT64_C(1) << (count % CL_TOKENS_BLOCK);
+    }
+
+    self->kinds[count] = (uint8_t)tk.type;
+    self->offsets[count] = tk.offset;
+    self->lengths[count] = tk.length;
+    self->count = count + 1;
+
+    return true;
+}
+
+#endif /* CL_TOKENS_H_ */
@@ -2,6 +2,7 @@
 #define CL_TYPES_H_
 
 #include "cl-core.h"
+#include "cl-annotation.h"
 
 
 CL_ENUM(TokenType) {
@@ -68,15 +69,46 @@ CL_ENUM(TokenType) {
 };
 
 
+/**
+ * The value of a number literal, decoded from its text by
+ * cl_number_value: `real` for TK_FLOAT, `integer` for the other
+ * kinds.
+ */
+CL_TYPE(Literal) {
+    union {
+        uint64_t integer;
+        double   real;
+    };
+};
+
+
+/**
+ * `value` is the symbol id of an identifier, or of the decoded
+ * contents of a string or character literal, and CL_SYMBOL_NONE
+ * for every other token. Numbers have none either: the lexer
+ * only checks that they fit, and their value is decoded from
+ * the text when it is used.
+ */
 CL_TYPE(Token) {
     TokenType type;
 
     uint32_t offset;
-    uint32_t line_offset;
     uint32_t length;
-
-    uint32_t line;
-    uint32_t column;
+    uint32_t value;
 };
 
+
+static __Inline bool cl_is_number(TokenType type) {
+    return type >= TK_FLOAT && type <= TK_INT;
+}
+
+
+/**
+ * Whether tokens of a kind have a value: identifiers, string
+ * and character literals.
+ */
+static __Inline bool cl_has_value(TokenType type) {
+    return type >= TK_ID && type <= TK_CHAR;
+}
+
 #endif /* CL_TYPES_H_ */
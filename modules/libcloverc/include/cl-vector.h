@@ -1,6 +1,9 @@
 #ifndef CL_VECTOR_H_
 #define CL_VECTOR_H_
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "cl-core.h"
 #include "cl-annotation.h"
 
@@ -18,14 +21,154 @@ CL_TYPE(Vector) {
 typedef void (*VectorCallbackFn)(void *user_data);
 
 
-Vector *vector_new  (size_t item_size) __NoDiscard;
-bool    vector_push (Vector *self, void *data);
-bool    vector_pop  (Vector *self, __Out __Nullable void *data);
-void   *vector_get  (Vector *self, size_t index);
-void  **vector_getp (Vector *self, size_t index);
-void    vector_iter (Vector *self, VectorCallbackFn callback);
-void    vector_iterp(Vector *self, VectorCallbackFn callback);
-void    vector_trim (Vector *self);
-void    vector_free (Vector *self);
+Vector *vector_new    (size_t item_size) __NoDiscard;
+bool    vector_push   (Vector *self, void *data);
+bool    vector_reserve(Vector *self, size_t capacity);
+bool    vector_pop    (Vector *self, __Out __Nullable void *data);
+void   *vector_get    (Vector *self, size_t index);
+void  **vector_getp   (Vector *self, size_t index);
+void    vector_iter   (Vector *self, VectorCallbackFn callback);
+void    vector_iterp  (Vector *self, VectorCallbackFn callback);
+void    vector_trim   (Vector *self);
+void    vector_free   (Vector *self);
+
+
+/* == type-specialized vectors == */
+
+/**
+ * Declares a vector of T, named `T##Vector`, with inline
+ * functions prefixed by `name##_vector_`:
+ *
+ *   CL_VECTOR_DEFINE(Token, token)
+ *
+ *   TokenVector tokens = { 0 };
+ *   token_vector_reserve(&tokens, 1024);
+ *   token_vector_push(&tokens, tk);
+ *   token_vector_free(&tokens);
+ *
+ * A zeroed vector is empty and ready to use. Items are copied
+ * by assignment and push only leaves the inline path when the
+ * vector is full.
+ *
+ * CL_VECTOR_TYPE and CL_VECTOR_FUNCS split the definition for
+ * types that hold a vector of themselves.
+ */
+#define CL_VECTOR_DEFINE(T, name)                                           \
+    CL_VECTOR_TYPE(T);                                                      \
+    CL_VECTOR_FUNCS(T, name)
+
+#define CL_VECTOR_TYPE(T)                                                   \
+    CL_TYPE(T##Vector) {                                                    \
+        T     *data;                                                        \
+        size_t count;                                                       \
+        size_t capacity;                                                    \
+    }
+
+#define CL_VECTOR_FUNCS(T, name)                                            \
+    __CL_VECTOR_FUNCS(T, name, NULL, 0)
+
+/**
+ * Like CL_VECTOR_DEFINE, but the first N items are stored in
+ * the vector itself and only larger vectors allocate. Such a
+ * vector must be set up with `name##_vector_init` and must not
+ * be moved in memory while it uses the inline buffer.
+ */
+#define CL_VECTOR_DEFINE_SMALL(T, name, N)                                  \
+    CL_TYPE(T##Vector) {                                                    \
+        T     *data;                                                        \
+        size_t count;                                                       \
+        size_t capacity;                                                    \
+        T      small[N];                                                    \
+    };                                                                      \
+    __CL_VECTOR_FUNCS(T, name, self->small, N)
+
+
+#define __CL_VECTOR_FUNCS(T, name, SMALL, N)                                \
+    static inline void name##_vector_init(T##Vector *self) {                \
+        self->data = SMALL;                                                 \
+        self->count = 0;                                                    \
+        self->capacity = N;                                                 \
+    }                                                                       \
+                                                                            \
+    static inline bool name##_vector_reserve(T##Vector *self,               \
+        size_t capacity) {                                                  \
+        if (capacity <= self->capacity) {                                   \
+            return true;                                                    \
+        }                                                                   \
+                                                                            \
+        if (capacity > SIZE_MAX / sizeof(T)) {                              \
+            return false;                                                   \
+        }                                                                   \
+                                                                            \
+        T *tmp;                                                             \
+                                                                            \
+        if (N && self->data == SMALL) {                                     \
+            tmp = malloc(capacity * sizeof(T));                             \
+                                                                            \
+            if (tmp) {                                                      \
+                memcpy(tmp, self->data, self->count * sizeof(T));           \
+            }                                                               \
+        } else {                                                            \
+            tmp = realloc(self->data, capacity * sizeof(T));                \
+        }                                                                   \
+                                                                            \
+        if (!tmp) {                                                         \
+            return false;                                                   \
+        }                                                                   \
+                                                                            \
+        self->data = tmp;                                                   \
+        self->capacity = capacity;                                          \
+                                                                            \
+        return true;                                                        \
+    }                                                                       \
+                                                                            \
+    __attribute__((unused, noinline, cold))                                 \
+    static bool name##_vector_grow(T##Vector *self) {                       \
+        size_t capacity = self->capacity +                                  \
+            self->capacity * CL_VECTOR_GROWTH_PERCENT / 100;                \
+                                                                            \
+        if (capacity < CL_VECTOR_INITIAL_CAPACITY) {                        \
+            capacity = CL_VECTOR_INITIAL_CAPACITY;                          \
+        }                                                                   \
+                                                                            \
+        return name##_vector_reserve(self, capacity);                       \
+    }                                                                       \
+                                                                            \
+    static __Inline bool name##_vector_push(T##Vector *self, T item) {      \
+        if (self->count == self->capacity && !name##_vector_grow(self)) {   \
+            return false;                                                   \
+        }                                                                   \
+                                                                            \
+        self->data[self->count++] = item;                                   \
+                                                                            \
+        return true;                                                        \
+    }                                                                       \
+                                                                            \
+    static __Inline bool name##_vector_pop(T##Vector *self,                 \
+        __Out __Nullable T *item) {                                         \
+        if (self->count == 0) {                                             \
+            return false;                                                   \
+        }                                                                   \
+                                                                            \
+        self->count--;                                                      \
+                                                                            \
+        if (item) {                                                         \
+            *item = self->data[self->count];                                \
+        }                                                                   \
+                                                                            \
+        return true;                                                        \
+    }                                                                       \
+                                                                            \
+    static __Inline T *name##_vector_last(T##Vector *self) {                \
+        return self->count ? &self->data[self->count - 1] : NULL;           \
+    }                                                                       \
+                                                                            \
+    static inline void name##_vector_free(T##Vector *self) {                \
+        if (!(N && self->data == SMALL)) {                                  \
+            free(self->data);                                               \
+        }                                                                   \
+                                                                            \
+        name##_vector_init(self);                                           \
+    }
 
 #endif /* CL_VECTOR_H_ */
@@ -0,0 +1,242 @@
+#define CL_LOG_SCOPE "arena"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "cl-log.h"
+#include "cl-arena.h"
+
+
+static __Inline size_t _align(size_t size) {
+    return (size + CL_ARENA_ALIGN - 1) & ~(size_t)(CL_ARENA_ALIGN - 1);
+}
+
+
+static ArenaChunk *_chunk_new(Arena *self, size_t size) {
+    ArenaChunk *chunk = malloc(sizeof(ArenaChunk) + size);
+
+    if (!chunk) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    chunk->next = NULL;
+    chunk->used = 0;
+    chunk->size = size;
+
+    self->stats.reserved += size;
+    self->stats.chunks++;
+
+    return chunk;
+}
+
+
+static void _count(Arena *self, size_t size) {
+    self->stats.used += size;
+
+    if (self->stats.used > self->stats.high_water) {
+        self->stats.high_water = self->stats.used;
+    }
+}
+
+
+Arena *arena_new(size_t chunk_size) {
+    Arena *new_arena = calloc(1, sizeof(Arena));
+
+    if (!new_arena) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    new_arena->chunk_size = _align(chunk_size ? chunk_size : CL_ARENA_CHUNK_SIZE);
+
+    return new_arena;
+}
+
+
+/**
+ * Called by arena_alloc when the current chunk is full. Large
+ * requests get a chunk of their own behind the current one,
+ * so the space left in it is not thrown away.
+ */
+void *arena_alloc_slow(Arena *self, size_t size) {
+    size_t aligned = _align(size);
+
+    if (aligned < size) {
+        cl_debug("%s: size overflow: %zu\n", __func__, size);
+        return NULL;
+    }
+
+    if (aligned > self->chunk_size / 4 && self->head) {
+        ArenaChunk *chunk = _chunk_new(self, aligned);
+
+        if (!chunk) {
+            return NULL;
+        }
+
+        chunk->used = aligned;
+        chunk->next = self->head->next;
+        self->head->next = chunk;
+
+        _count(self, aligned);
+        self->stats.allocs++;
+
+        return chunk->data;
+    }
+
+    ArenaChunk *chunk = _chunk_new(self,
+        (aligned > self->chunk_size) ? aligned : self->chunk_size);
+
+    if (!chunk) {
+        return NULL;
+    }
+
+    chunk->used = aligned;
+    chunk->next = self->head;
+    self->head = chunk;
+
+    _count(self, aligned);
+    self->stats.allocs++;
+
+    return chunk->data;
+}
+
+
+void *arena_calloc(Arena *self, size_t count, size_t size) {
+    if (size && count > SIZE_MAX / size) {
+        cl_debug("%s: size overflow: %zu * %zu\n", __func__, count, size);
+        return NULL;
+    }
+
+    void *ptr = arena_alloc(self, count * size);
+
+    if (ptr) {
+        memset(ptr, 0, count * size);
+    }
+
+    return ptr;
+}
+
+
+/**
+ * Grows the last allocation of the current chunk, or a large
+ * allocation that owns its chunk, in place. Anything else is
+ * copied to a new block and the old one is left until the
+ * arena is released.
+ */
+void *arena_realloc(Arena *self, void *ptr, size_t old_size, size_t new_size) {
+    if (!ptr) {
+        return arena_alloc(self, new_size);
+    }
+
+    if (new_size <= old_size) {
+        return ptr;
+    }
+
+    size_t old_aligned = _align(old_size);
+    size_t new_aligned = _align(new_size);
+    ArenaChunk *head = self->head;
+
+    if ((char *)ptr + old_aligned == head->data + head->used &&
+        new_aligned - old_aligned <= head->size - head->used) {
+        head->used += new_aligned - old_aligned;
+        _count(self, new_aligned - old_aligned);
+        return ptr;
+    }
+
+    for (ArenaChunk **prev = &head->next; *prev; prev = &(*prev)->next) {
+        ArenaChunk *chunk = *prev;
+
+        if (chunk->data != ptr || chunk->used != old_aligned) {
+            continue;
+        }
+
+        ArenaChunk *tmp = realloc(chunk, sizeof(ArenaChunk) + new_aligned);
+
+        if (!tmp) {
+            cl_debug("%s: %s\n", __func__, strerror(errno));
+            return NULL;
+        }
+
+        tmp->used = tmp->size = new_aligned;
+        *prev = tmp;
+
+        self->stats.reserved += new_aligned - old_aligned;
+        _count(self, new_aligned - old_aligned);
+
+        return tmp->data;
+    }
+
+    void *new_ptr = arena_alloc(self, new_size);
+
+    if (new_ptr) {
+        memcpy(new_ptr, ptr, old_size);
+    }
+
+    return new_ptr;
+}
+
+
+char *arena_strdup(Arena *self, str_t str) {
+    size_t size = strlen(str) + 1;
+    char *copy = arena_alloc(self, size);
+
+    if (copy) {
+        memcpy(copy, str, size);
+    }
+
+    return copy;
+}
+
+
+/**
+ * Releases every allocation at once. The current chunk is kept
+ * for reuse when it has the regular size, the high-water mark
+ * is kept as well.
+ */
+void arena_reset(Arena *self) {
+    ArenaChunk *keep = self->head;
+    ArenaChunk *chunk = self->head;
+
+    if (keep && keep->size != self->chunk_size) {
+        keep = NULL;
+    }
+
+    while (chunk) {
+        ArenaChunk *next = chunk->next;
+
+        if (chunk != keep) {
+            self->stats.reserved -= chunk->size;
+            self->stats.chunks--;
+            free(chunk);
+        }
+
+        chunk = next;
+    }
+
+    if (keep) {
+        keep->used = 0;
+        keep->next = NULL;
+    }
+
+    self->head = keep;
+    self->stats.used = 0;
+}
+
+
+void arena_free(Arena *self) {
+    if (!self) {
+        return;
+    }
+
+    ArenaChunk *chunk = self->head;
+
+    while (chunk) {
+        ArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    free(self);
+}
@@ -0,0 +1,313 @@
+#define CL_LOG_SCOPE "ast"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "cl-log.h"
+#include "cl-ast.h"
+
+
+_Static_assert(sizeof(AstNode) == 16, "AST nodes must stay 16 bytes");
+_Static_assert(__AST_KIND_MAX <= UINT8_MAX, "AST kinds must fit in a byte");
+
+
+static const str_t KIND_NAMES[] = {
+    [AST_FILE]          = "file",
+    [AST_IMPORT]        = "import",
+    [AST_FN]            = "fn",
+    [AST_PARAM]         = "param",
+    [AST_STRUCT]        = "struct",
+    [AST_FIELD]         = "field",
+    [AST_ENUM]          = "enum",
+    [AST_ENUM_MEMBER]   = "enum-member",
+    [AST_VAR]           = "var",
+    [AST_CONST]         = "const",
+    [AST_TYPE_OPTIONAL] = "optional",
+    [AST_TYPE_POINTER]  = "pointer",
+    [AST_TYPE_ARRAY]    = "array",
+    [AST_BLOCK]         = "block",
+    [AST_IF]            = "if",
+    [AST_WHILE]         = "while",
+    [AST_FOR]           = "for",
+    [AST_SWITCH]        = "switch",
+    [AST_SWITCH_ARM]    = "arm",
+    [AST_DEFER]         = "defer",
+    [AST_RETURN]        = "return",
+    [AST_BREAK]         = "break",
+    [AST_CONTINUE]      = "continue",
+    [AST_NAME]          = "name",
+    [AST_LITERAL]       = "literal",
+    [AST_UNARY]         = "unary",
+    [AST_BINARY]        = "binary",
+    [AST_ASSIGN]        = "assign",
+    [AST_TERNARY]       = "ternary",
+    [AST_CAST]          = "cast",
+    [AST_CALL]          = "call",
+    [AST_INDEX]         = "index",
+    [AST_ACCESS]        = "access",
+};
+
+
+static void *_realloc(Ast *self, void *ptr, size_t old_size, size_t size) {
+    if (self->arena) {
+        return arena_realloc(self->arena, ptr, old_size, size);
+    }
+
+    return realloc(ptr, size);
+}
+
+
+static bool _ast_resize(Ast *self, size_t capacity) {
+    AstNode *nodes = _realloc(self, self->nodes,
+        self->node_capacity * sizeof(*nodes), capacity * sizeof(*nodes));
+
+    if (!nodes) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return false;
+    }
+
+    self->nodes = nodes;
+    self->node_capacity = capacity;
+
+    return true;
+}
+
+
+Ast *ast_new(Arena *arena) {
+    Ast *new_ast = arena ? arena_calloc(arena, 1, sizeof(Ast))
+                         : calloc(1, sizeof(Ast));
+
+    if (!new_ast) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    new_ast->arena = arena;
+
+    if (!_ast_resize(new_ast, CL_AST_INITIAL_NODES) ||
+        !ast_grow_extra(new_ast, 0)) {
+        ast_free(new_ast);
+        return NULL;
+    }
+
+    return new_ast;
+}
+
+
+/**
+ * Makes room for at least `nodes` nodes and `extra` indices.
+ */
+bool ast_reserve(Ast *self, size_t nodes, size_t extra) {
+    if (nodes > self->node_capacity && !_ast_resize(self, nodes)) {
+        return false;
+    }
+
+    if (extra > self->extra_capacity &&
+        !ast_grow_extra(self, extra - self->extra_count)) {
+        return false;
+    }
+
+    return true;
+}
+
+
+bool ast_grow(Ast *self) {
+    return _ast_resize(self, self->node_capacity + self->node_capacity / 2);
+}
+
+
+/**
+ * Makes room for `count` more indices in `extra`.
+ */
+bool ast_grow_extra(Ast *self, size_t count) {
+    size_t capacity = self->extra_capacity
+        ? self->extra_capacity + self->extra_capacity / 2
+        : CL_AST_INITIAL_EXTRA;
+
+    if (capacity < self->extra_count + count) {
+        capacity = self->extra_count + count;
+    }
+
+    AstIndex *extra = _realloc(self, self->extra,
+        self->extra_capacity * sizeof(*extra), capacity * sizeof(*extra));
+
+    if (!extra) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return false;
+    }
+
+    self->extra = extra;
+    self->extra_capacity = capacity;
+
+    return true;
+}
+
+
+/**
+ * Empties the tree and keeps its memory, for parsing again.
+ */
+void ast_reset(Ast *self) {
+    self->node_count = 0;
+    self->extra_count = 0;
+}
+
+
+str_t ast_kind_name(AstKind kind) {
+    return (kind < __AST_KIND_MAX) ? KIND_NAMES[kind] : "?";
+}
+
+
+/* == dump == */
+
+
+CL_TYPE(AstDumper) {
+    Ast         *ast;
+    TokenStream *tokens;
+    Source      *src;
+    FILE        *out;
+};
+
+
+static void _dump_node(AstDumper *self, AstIndex index, int depth);
+
+
+static void _dump_range(AstDumper *self, size_t start, size_t end, int depth) {
+    for (size_t i = start; i < end; i++) {
+        _dump_node(self, self->ast->extra[i], depth);
+    }
+}
+
+
+static void _dump_pair(AstDumper *self, size_t at, int depth) {
+    _dump_range(self, self->ast->extra[at], self->ast->extra[at + 1], depth);
+}
+
+
+/**
+ * Prints a node on a line of its own, with the text of its
+ * main token, then its children one level deeper.
+ */
+static void _dump_node(AstDumper *self, AstIndex index, int depth) {
+    if (index == CL_AST_NONE && depth > 0) {
+        return;
+    }
+
+    AstNode node = self->ast->nodes[index];
+    AstIndex *extra = self->ast->extra;
+
+    fprintf(self->out, "%*s%s", depth * 2, "", ast_kind_name(node.kind));
+
+    if (node.kind != AST_FILE && node.token < self->tokens->count) {
+        fprintf(self->out, " %.*s", (int)self->tokens->lengths[node.token],
+            source_get(self->src, self->tokens->offsets[node.token]));
+    }
+
+    if (CL_BIT_ISSET(CL_AST_PUB, node.flags)) {
+        fputs(" [pub]", self->out);
+    }
+
+    if (CL_BIT_ISSET(CL_AST_STATIC, node.flags)) {
+        fputs(" [static]", self->out);
+    }
+
+    fputc('\n', self->out);
+    depth++;
+
+    switch ((AstKind)node.kind) {
+        case AST_FILE:
+        case AST_STRUCT:
+        case AST_ENUM:
+        case AST_BLOCK:
+        case AST_SWITCH:
+            _dump_range(self, node.lhs, node.rhs, depth);
+            break;
+        case AST_IMPORT:
+        case AST_PARAM:
+        case AST_ENUM_MEMBER:
+        case AST_TYPE_OPTIONAL:
+        case AST_TYPE_POINTER:
+        case AST_DEFER:
+        case AST_RETURN:
+        case AST_UNARY:
+        case AST_ACCESS:
+            _dump_node(self, node.lhs, depth);
+            break;
+        case AST_FN:
+            _dump_pair(self, node.lhs, depth);
+            _dump_node(self, extra[node.lhs + 2], depth);
+            _dump_node(self, node.rhs, depth);
+            break;
+        case AST_IF:
+        case AST_TERNARY:
+            _dump_node(self, node.lhs, depth);
+            _dump_node(self, extra[node.rhs], depth);
+            _dump_node(self, extra[node.rhs + 1], depth);
+            break;
+        case AST_FOR:
+            _dump_node(self, extra[node.lhs], depth);
+            _dump_node(self, extra[node.lhs + 1], depth);
+            _dump_node(self, extra[node.lhs + 2], depth);
+            _dump_node(self, node.rhs, depth);
+            break;
+        case AST_SWITCH_ARM:
+            if (node.rhs != CL_AST_NONE) {
+                _dump_pair(self, node.rhs, depth);
+            }
+
+            _dump_node(self, node.lhs, depth);
+            break;
+        case AST_CALL:
+            _dump_node(self, node.lhs, depth);
+            _dump_pair(self, node.rhs, depth);
+            break;
+        case AST_FIELD:
+        case AST_VAR:
+        case AST_CONST:
+        case AST_TYPE_ARRAY:
+        case AST_WHILE:
+        case AST_BINARY:
+        case AST_ASSIGN:
+        case AST_CAST:
+        case AST_INDEX:
+            _dump_node(self, node.lhs, depth);
+            _dump_node(self, node.rhs, depth);
+            break;
+        case AST_BREAK:
+        case AST_CONTINUE:
+        case AST_NAME:
+        case AST_LITERAL:
+        case __AST_KIND_MAX:
+            break;
+    }
+}
+
+
+/**
+ * Prints the tree, one node per line, indented by depth.
+ */
+void ast_dump(Ast *self, TokenStream *tokens, Source *src, FILE *out) {
+    if (self->node_count == 0) {
+        return;
+    }
+
+    AstDumper dumper = {
+        .ast = self,
+        .tokens = tokens,
+        .src = src,
+        .out = out,
+    };
+
+    _dump_node(&dumper, 0, 0);
+}
+
+
+void ast_free(Ast *self) {
+    if (self->arena) {
+        return;
+    }
+
+    free(self->nodes);
+    free(self->extra);
+    free(self);
+}
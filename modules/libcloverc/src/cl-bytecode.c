@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "cl-bytecode.h"
+
+
+#define __CL_OP_NAME(name, format)      #name,
+#define __CL_OP_FORMAT(name, format)    format,
+
+static const str_t OP_NAMES[] = {
+    CL_OPCODES(__CL_OP_NAME)
+};
+
+static const BytecodeFormat OP_FORMATS[] = {
+    CL_OPCODES(__CL_OP_FORMAT)
+};
+
+
+str_t bytecode_op_name(Opcode op) {
+    return ((unsigned)op < __CL_OP_MAX) ? OP_NAMES[op] : "?";
+}
+
+
+BytecodeFormat bytecode_op_format(Opcode op) {
+    return ((unsigned)op < __CL_OP_MAX) ? OP_FORMATS[op] : CL_FMT_NONE;
+}
+
+
+/**
+ * Spells an instruction the way the comments of CL_OPCODES
+ * do, `ADD r0, r1, r2`, with the value of the constant it uses
+ * when it is one of the `count` in `constants`. Returns what
+ * snprintf returns.
+ */
+int bytecode_disassemble(Instruction insn, const uint64_t *constants,
+    uint32_t count, char *out, size_t size) {
+    Opcode op = CL_OP(insn);
+    str_t name = bytecode_op_name(op);
+    uint32_t a = CL_A(insn), b = CL_B(insn), c = CL_C(insn);
+    uint32_t bx = CL_BX(insn);
+
+    switch (bytecode_op_format(op)) {
+        case CL_FMT_R:
+            return snprintf(out, size, "%-6s r%u", name, a);
+        case CL_FMT_RR:
+            return snprintf(out, size, "%-6s r%u, r%u", name, a, b);
+        case CL_FMT_RRR:
+            return snprintf(out, size, "%-6s r%u, r%u, r%u", name, a, b, c);
+        case CL_FMT_RRI:
+            return snprintf(out, size, "%-6s r%u, r%u, %u", name, a, b, c);
+        case CL_FMT_RIR:
+            return snprintf(out, size, "%-6s r%u, %u, r%u", name, a, b, c);
+        case CL_FMT_RRS:
+            return snprintf(out, size, "%-6s r%u, r%u, %d", name, a, b,
+                CL_SC(insn));
+        case CL_FMT_RII:
+            return snprintf(out, size, "%-6s r%u, %u, %u", name, a, b, c);
+        case CL_FMT_RSBX:
+            return snprintf(out, size, "%-6s r%u, %d", name, a, CL_SBX(insn));
+        case CL_FMT_RBX:
+            return snprintf(out, size, "%-6s r%u, %u", name, a, bx);
+        case CL_FMT_RG:
+            return snprintf(out, size, "%-6s r%u, g%u", name, a, bx);
+        case CL_FMT_RK:
+        case CL_FMT_RS:
+        case CL_FMT_RF:
+            if (!constants || bx >= count) {
+                return snprintf(out, size, "%-6s r%u, k%u", name, a, bx);
+            }
+
+            return snprintf(out, size, "%-6s r%u, k%u  ; %#" PRIx64, name, a,
+                bx, constants[bx]);
+        case CL_FMT_TEST_RR:
+            return snprintf(out, size, "%-6s r%u, r%u, %u", name, a, b, c);
+        case CL_FMT_TEST_R:
+            return snprintf(out, size, "%-6s r%u, %u", name, a, b);
+        case CL_FMT_J:
+            return snprintf(out, size, "%-6s %+d", name, CL_SJ(insn));
+        case CL_FMT_EMPTY:
+        default:
+            return snprintf(out, size, "%s", name);
+    }
+}
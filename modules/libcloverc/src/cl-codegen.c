@@ -0,0 +1,3394 @@
+#define CL_LOG_SCOPE "codegen"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+
+#include "cl-log.h"
+#include "cl-bits.h"
+#include "cl-arena.h"
+#include "cl-vector.h"
+#include "cl-types.h"
+#include "cl-number.h"
+#include "cl-diagnostic.h"
+#include "cl-bytecode.h"
+#include "cl-codegen.h"
+
+
+#define CG_NO_JUMP      (-1)
+#define CG_NO_TYPE      UINT32_MAX
+#define CG_NO_REG       UINT32_MAX
+
+/* the builtin types, the first ones of every unit */
+#define TYPE_VOID       0
+#define TYPE_INT        1
+#define TYPE_FLOAT      2
+#define TYPE_BOOL       3
+#define TYPE_STRING     4
+
+/* how far a declaration is resolved */
+#define DECL_UNRESOLVED 0
+#define DECL_RESOLVING  1
+#define DECL_RESOLVED   2
+#define DECL_FAILED     3
+
+/* the most slots a struct, and a copy, may have */
+#define CG_MAX_SLOTS    UINT8_MAX
+
+
+CL_ENUM(TypeKind) {
+    KIND_VOID,
+    KIND_INT,
+    KIND_FLOAT,
+    KIND_BOOL,
+    KIND_STRING,
+    KIND_STRUCT,
+    KIND_ARRAY,
+};
+
+
+CL_TYPE(Type) {
+    uint8_t  kind;      /* TypeKind */
+    uint32_t size;      /* slots of a struct or an array */
+    uint32_t length;    /* of an array */
+    uint32_t elem;      /* of an array */
+    uint32_t decl;      /* of a struct */
+};
+
+
+CL_TYPE(Field) {
+    uint32_t name;
+    uint32_t type;
+    uint32_t offset;    /* slots */
+    AstIndex value;     /* the default, or none */
+};
+
+
+CL_ENUM(DeclKind) {
+    DECL_FN,
+    DECL_VAR,
+    DECL_CONST,
+    DECL_STRUCT,
+    DECL_ENUM,
+    DECL_IMPORT,
+};
+
+
+CL_TYPE(ConstValue) {
+    uint32_t type;
+    union {
+        int64_t integer;
+        double  real;
+    };
+    uint32_t string;    /* the symbol of a string */
+};
+
+
+/**
+ * A top-level declaration of the unit. Everything but its kind
+ * and its symbol is worked out when first needed, so the order
+ * of the declarations does not matter.
+ */
+CL_TYPE(Decl) {
+    uint8_t    kind;    /* DeclKind */
+    uint8_t    state;   /* DECL_ */
+    bool       builtin; /* an import of a builtin module */
+    AstIndex   node;
+    uint32_t   name;
+    uint32_t   symbol;  /* index of its symbol in the object */
+    uint32_t   global;  /* of a var */
+    uint32_t   type;    /* of a var, a struct, or what a fn returns */
+    ConstValue value;   /* of a const */
+
+    uint32_t  *params;  /* types of the parameters of a fn */
+    uint8_t   *byref;   /* which of them are `*T` */
+    uint32_t   param_count;
+    uint8_t    signature;   /* DECL_ */
+
+    Field     *fields;  /* of a struct, or the members of an enum */
+    int64_t   *members; /* values of the members of an enum */
+    uint32_t   field_count;
+
+    bool       compiled;
+    uint64_t   code;    /* offset of a fn in CODE */
+    uint64_t   code_size;
+};
+
+
+CL_TYPE(IdEntry) {
+    uint32_t key;
+    uint32_t value;
+};
+
+
+/**
+ * Maps symbols, which are never 0, to 32-bit values.
+ */
+CL_TYPE(IdMap) {
+    IdEntry *entries;
+    size_t   capacity;
+    size_t   count;
+};
+
+
+CL_TYPE(Local) {
+    uint32_t name;
+    uint32_t type;
+    uint32_t reg;
+    bool     constant;
+};
+
+
+/**
+ * A deferred statement and the locals it can see.
+ */
+CL_TYPE(Defer) {
+    AstIndex node;
+    size_t   locals;
+};
+
+
+CL_TYPE(Loop) {
+    struct __CL_TNAME(Loop) *outer;
+    int32_t  breaks;        /* jump lists */
+    int32_t  continues;
+    size_t   defers;        /* deferred outside of the loop */
+};
+
+
+/**
+ * Where a value lives: a local, a global, a slot of a struct
+ * at `reg`, or an element of the array at `reg`.
+ */
+CL_ENUM(PlaceKind) {
+    PLACE_LOCAL,
+    PLACE_GLOBAL,
+    PLACE_FIELD,
+    PLACE_INDEX,
+};
+
+
+CL_TYPE(Place) {
+    uint8_t  kind;      /* PlaceKind */
+    bool     constant;
+    uint32_t reg;
+    uint32_t index;     /* global, slot, or register of the index */
+    uint32_t type;
+};
+
+
+typedef uint64_t Constant;
+
+CL_VECTOR_DEFINE(Type, type)
+CL_VECTOR_DEFINE(Local, local)
+CL_VECTOR_DEFINE(Defer, defer)
+CL_VECTOR_DEFINE(Instruction, instruction)
+CL_VECTOR_DEFINE(Constant, constant)
+
+
+/**
+ * The function being compiled. Locals take the registers from
+ * the bottom up, in the order they are declared; temporaries
+ * go above them and are released after every statement.
+ */
+CL_TYPE(FnState) {
+    AstIndex          node;
+    InstructionVector code;
+    ConstantVector    constants;
+    LocalVector       locals;
+    DeferVector       defers;
+    Loop             *loop;
+    size_t            hidden_start; /* locals deferred code cannot see */
+    size_t            hidden_end;
+    uint32_t          params;
+    uint32_t          free_reg;
+    uint32_t          max_reg;
+    uint32_t          floor;    /* kept while running deferred code */
+    uint32_t          frame_top;
+    uint32_t          frame_size;
+    uint32_t          return_type;
+    uint32_t          last_target;
+    bool              in_defer;
+    bool              failed;
+};
+
+
+struct __CL_TNAME(CodeGen) {
+    ObjectWriter *writer;
+    Arena        *arena;        /* reset for every unit */
+    IdMap         strings;      /* string symbol to offset in CONSTANTS */
+    uint32_t      symbol_count;
+    uint32_t      global_count;
+    uint32_t      entry;
+
+    /* the unit being compiled */
+    Source       *src;
+    TokenStream  *tokens;
+    Ast          *ast;
+    Interner     *symbols;
+    Decl         *decls;
+    size_t        decl_count;
+    IdMap         names;
+    TypeVector    types;
+    uint32_t      file;
+    uint32_t      errors;
+    bool          failed;
+
+    FnState       fn;
+    uint8_t      *blob;
+    size_t        blob_capacity;
+
+    PassManager  *passes;       /* NULL leaves the bytecode as written */
+    IdMap         arities;      /* symbol + 1 to the parameters of a fn */
+};
+
+
+/* == helpers == */
+
+
+static bool _out_of_memory(CodeGen *self) {
+    if (!self->failed) {
+        cl_error("out of memory!\n");
+    }
+
+    self->failed = true;
+
+    return false;
+}
+
+
+static bool _error(CodeGen *self, AstIndex node, str_t msg, ...)
+    __Format(3, 4);
+
+/**
+ * Reports a mistake at the main token of a node.
+ */
+static bool _error(CodeGen *self, AstIndex node, str_t msg, ...) {
+    uint32_t token = self->ast->nodes[node].token;
+    DiagLocation loc = {
+        .offset = self->tokens->offsets[token],
+        .length = self->tokens->lengths[token],
+        .caret = 0,
+        .src = self->src,
+    };
+    char text[256];
+    va_list args;
+
+    va_start(args, msg);
+    vsnprintf(text, sizeof(text), msg, args);
+    va_end(args);
+
+    diag_error(loc, "%s", text);
+    self->errors++;
+    self->failed = true;
+
+    return false;
+}
+
+
+static __Inline AstNode *_node(CodeGen *self, AstIndex node) {
+    return &self->ast->nodes[node];
+}
+
+
+static __Inline TokenType _op(CodeGen *self, AstIndex node) {
+    return (TokenType)self->tokens->kinds[self->ast->nodes[node].token];
+}
+
+
+static __Inline uint32_t _symbol(CodeGen *self, AstIndex node) {
+    return tokens_value(self->tokens, self->ast->nodes[node].token);
+}
+
+
+/**
+ * The name of a node, for messages.
+ */
+static str_t _name(CodeGen *self, AstIndex node, int *length) {
+    uint32_t size = 0;
+    str_t name = interner_name(self->symbols, _symbol(self, node), &size);
+
+    *length = name ? (int)size : 1;
+
+    return name ? name : "?";
+}
+
+
+static bool _is_named(CodeGen *self, uint32_t symbol, str_t name) {
+    uint32_t length = 0;
+    str_t text = interner_name(self->symbols, symbol, &length);
+
+    return text && length == strlen(name) && memcmp(text, name, length) == 0;
+}
+
+
+
+
+/* == symbol maps == */
+
+
+/**
+ * The entry of `key`, or the empty one where it would go.
+ */
+static IdEntry *_map_slot(IdMap *self, uint32_t key) {
+    size_t mask = self->capacity - 1;
+    size_t i = (size_t)(((uint64_t)key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+
+    while (self->entries[i].key != 0 && self->entries[i].key != key) {
+        i = (i + 1) & mask;
+    }
+
+    return &self->entries[i];
+}
+
+
+static uint32_t *_map_get(IdMap *self, uint32_t key) {
+    if (self->count == 0) {
+        return NULL;
+    }
+
+    IdEntry *entry = _map_slot(self, key);
+
+    return entry->key ? &entry->value : NULL;
+}
+
+
+static bool _map_put(IdMap *self, uint32_t key, uint32_t value) {
+    if ((self->count + 1) * 2 > self->capacity) {
+        size_t capacity = self->capacity ? self->capacity * 2 : 64;
+        IdMap grown = {
+            .entries = calloc(capacity, sizeof(IdEntry)),
+            .capacity = capacity,
+            .count = self->count,
+        };
+
+        if (!grown.entries) {
+            cl_debug("%s: %s\n", __func__, strerror(errno));
+            return false;
+        }
+
+        for (size_t i = 0; i < self->capacity; i++) {
+            if (self->entries[i].key != 0) {
+                *_map_slot(&grown, self->entries[i].key) = self->entries[i];
+            }
+        }
+
+        free(self->entries);
+        *self = grown;
+    }
+
+    IdEntry *entry = _map_slot(self, key);
+
+    self->count += (entry->key == 0);
+    entry->key = key;
+    entry->value = value;
+
+    return true;
+}
+
+
+static void _map_clear(IdMap *self) {
+    if (self->entries) {
+        memset(self->entries, 0, self->capacity * sizeof(IdEntry));
+    }
+
+    self->count = 0;
+}
+
+
+/* == types == */
+
+
+static __Inline Type *_type(CodeGen *self, uint32_t type) {
+    return &self->types.data[type];
+}
+
+
+static __Inline bool _is_aggregate(CodeGen *self, uint32_t type) {
+    uint8_t kind = self->types.data[type].kind;
+
+    return kind == KIND_STRUCT || kind == KIND_ARRAY;
+}
+
+
+static str_t _type_name(CodeGen *self, uint32_t type) {
+    switch (self->types.data[type].kind) {
+        case KIND_VOID:   return "nothing";
+        case KIND_INT:    return "int";
+        case KIND_FLOAT:  return "float";
+        case KIND_BOOL:   return "bool";
+        case KIND_STRING: return "string";
+        case KIND_STRUCT: return "a struct";
+        case KIND_ARRAY:  return "an array";
+        default:          return "?";
+    }
+}
+
+
+static uint32_t _type_add(CodeGen *self, Type type) {
+    if (!type_vector_push(&self->types, type)) {
+        _out_of_memory(self);
+        return CG_NO_TYPE;
+    }
+
+    return (uint32_t)self->types.count - 1;
+}
+
+
+static uint32_t _type_array(CodeGen *self, uint32_t elem, uint32_t length) {
+    for (size_t i = 0; i < self->types.count; i++) {
+        Type *type = &self->types.data[i];
+
+        if (type->kind == KIND_ARRAY && type->elem == elem &&
+            type->length == length) {
+            return (uint32_t)i;
+        }
+    }
+
+    return _type_add(self, (Type){
+        .kind = KIND_ARRAY,
+        .size = length + 1,
+        .length = length,
+        .elem = elem,
+    });
+}
+
+
+/**
+ * The type a name stands for when it is not a declaration.
+ */
+static uint32_t _builtin_type(CodeGen *self, uint32_t name) {
+    static const struct { str_t name; uint32_t type; } BUILTINS[] = {
+        { "int", TYPE_INT }, { "uint", TYPE_INT },
+        { "i8", TYPE_INT }, { "i16", TYPE_INT },
+        { "i32", TYPE_INT }, { "i64", TYPE_INT },
+        { "u8", TYPE_INT }, { "u16", TYPE_INT },
+        { "u32", TYPE_INT }, { "u64", TYPE_INT },
+        { "isize", TYPE_INT }, { "usize", TYPE_INT },
+        { "char", TYPE_INT },
+        { "f32", TYPE_FLOAT }, { "f64", TYPE_FLOAT },
+        { "float", TYPE_FLOAT },
+        { "bool", TYPE_BOOL },
+        { "str", TYPE_STRING }, { "string", TYPE_STRING },
+    };
+
+    for (size_t i = 0; i < CL_N_ELEMS(BUILTINS); i++) {
+        if (_is_named(self, name, BUILTINS[i].name)) {
+            return BUILTINS[i].type;
+        }
+    }
+
+    return CG_NO_TYPE;
+}
+
+
+static bool _resolve(CodeGen *self, Decl *decl);
+static bool _fold(CodeGen *self, AstIndex node, ConstValue *value);
+
+
+static Decl *_decl(CodeGen *self, uint32_t name) {
+    uint32_t *index = _map_get(&self->names, name);
+
+    return index ? &self->decls[*index] : NULL;
+}
+
+
+/**
+ * Folds a node that must be a constant integer.
+ */
+static bool _fold_int(CodeGen *self, AstIndex node, int64_t *value) {
+    uint32_t errors = self->errors;
+    ConstValue folded;
+
+    if (!_fold(self, node, &folded)) {
+        return (self->errors == errors)
+            ? _error(self, node, "expected a constant") : false;
+    }
+
+    if (folded.type != TYPE_INT) {
+        return _error(self, node, "expected int, found %s",
+            _type_name(self, folded.type));
+    }
+
+    *value = folded.integer;
+
+    return true;
+}
+
+
+static uint32_t _resolve_type(CodeGen *self, AstIndex node) {
+    AstNode *type = _node(self, node);
+    int length;
+    str_t name;
+
+    switch (type->kind) {
+        case AST_NAME: {
+            uint32_t symbol = _symbol(self, node);
+            Decl *decl = _decl(self, symbol);
+
+            if (!decl) {
+                uint32_t builtin = _builtin_type(self, symbol);
+
+                if (builtin == CG_NO_TYPE) {
+                    name = _name(self, node, &length);
+                    _error(self, node, "unknown type '%.*s'", length, name);
+                }
+
+                return builtin;
+            }
+
+            if (decl->kind == DECL_ENUM) {
+                return _resolve(self, decl) ? TYPE_INT : CG_NO_TYPE;
+            }
+
+            if (decl->kind == DECL_STRUCT) {
+                return _resolve(self, decl) ? decl->type : CG_NO_TYPE;
+            }
+
+            name = _name(self, node, &length);
+            _error(self, node, "'%.*s' is not a type", length, name);
+            return CG_NO_TYPE;
+        }
+        case AST_TYPE_ARRAY: {
+            int64_t count = 0;
+
+            if (type->lhs == CL_AST_NONE) {
+                _error(self, node, "slices are not supported yet");
+                return CG_NO_TYPE;
+            }
+
+            AstIndex of = type->rhs;
+            uint32_t elem = _resolve_type(self, of);
+
+            if (elem == CG_NO_TYPE || !_fold_int(self, type->lhs, &count)) {
+                return CG_NO_TYPE;
+            }
+
+            if (_is_aggregate(self, elem)) {
+                _error(self, of, "arrays of %s are not supported yet",
+                    _type_name(self, elem));
+                return CG_NO_TYPE;
+            }
+
+            if (count < 1 || count > UINT16_MAX) {
+                _error(self, type->lhs, "arrays have 1 to %u elements",
+                    UINT16_MAX);
+                return CG_NO_TYPE;
+            }
+
+            return _type_array(self, elem, (uint32_t)count);
+        }
+        case AST_TYPE_POINTER:
+            _error(self, node, "pointers are only supported as parameters");
+            return CG_NO_TYPE;
+        case AST_TYPE_OPTIONAL:
+            _error(self, node, "optionals are not supported yet");
+            return CG_NO_TYPE;
+        default:
+            _error(self, node, "types of imported modules are not supported "
+                "yet");
+            return CG_NO_TYPE;
+    }
+}
+
+
+/* == declarations == */
+
+
+static bool _resolve_struct(CodeGen *self, Decl *decl) {
+    AstNode *node = _node(self, decl->node);
+    uint32_t count = node->rhs - node->lhs;
+    uint32_t offset = 0;
+
+    decl->fields = arena_calloc(self->arena, count ? count : 1,
+        sizeof(Field));
+
+    if (!decl->fields) {
+        return _out_of_memory(self);
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        AstIndex at = self->ast->extra[node->lhs + i];
+        AstNode *field = _node(self, at);
+        uint32_t name = _symbol(self, at);
+        uint32_t type = _resolve_type(self, field->lhs);
+
+        if (type == CG_NO_TYPE) {
+            return false;
+        }
+
+        for (uint32_t j = 0; j < i; j++) {
+            if (decl->fields[j].name == name) {
+                int length;
+                str_t text = _name(self, at, &length);
+
+                return _error(self, at, "field '%.*s' is already declared",
+                    length, text);
+            }
+        }
+
+        uint32_t size = _is_aggregate(self, type) ? _type(self, type)->size : 1;
+
+        decl->fields[i] = (Field){
+            .name = name,
+            .type = type,
+            .offset = offset,
+            .value = field->rhs,
+        };
+
+        if (field->rhs != CL_AST_NONE && _is_aggregate(self, type)) {
+            return _error(self, field->rhs, "%s field cannot have a default",
+                _type_name(self, type));
+        }
+
+        offset += size;
+
+        if (offset > CG_MAX_SLOTS) {
+            return _error(self, decl->node, "struct is larger than %u slots",
+                CG_MAX_SLOTS);
+        }
+    }
+
+    decl->field_count = count;
+    decl->type = _type_add(self, (Type){
+        .kind = KIND_STRUCT,
+        .size = offset,
+        .decl = (uint32_t)(decl - self->decls),
+    });
+
+    return decl->type != CG_NO_TYPE;
+}
+
+
+static bool _resolve_enum(CodeGen *self, Decl *decl) {
+    AstNode *node = _node(self, decl->node);
+    uint32_t count = node->rhs - node->lhs;
+    int64_t next = 0;
+
+    decl->fields = arena_calloc(self->arena, count ? count : 1,
+        sizeof(Field));
+    decl->members = arena_calloc(self->arena, count ? count : 1,
+        sizeof(int64_t));
+
+    if (!decl->fields || !decl->members) {
+        return _out_of_memory(self);
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        AstIndex at = self->ast->extra[node->lhs + i];
+        AstNode *member = _node(self, at);
+        uint32_t name = _symbol(self, at);
+
+        for (uint32_t j = 0; j < i; j++) {
+            if (decl->fields[j].name == name) {
+                int length;
+                str_t text = _name(self, at, &length);
+
+                return _error(self, at, "member '%.*s' is already declared",
+                    length, text);
+            }
+        }
+
+        if (member->lhs != CL_AST_NONE &&
+            !_fold_int(self, member->lhs, &next)) {
+            return false;
+        }
+
+        decl->fields[i] = (Field){ .name = name, .type = TYPE_INT };
+        decl->members[i] = next;
+        next = (int64_t)((uint64_t)next + 1);
+    }
+
+    decl->field_count = count;
+    decl->type = TYPE_INT;
+
+    return true;
+}
+
+
+static bool _resolve_const(CodeGen *self, Decl *decl) {
+    AstNode *node = _node(self, decl->node);
+    uint32_t type = CG_NO_TYPE;
+    uint32_t errors = self->errors;
+
+    if (node->lhs != CL_AST_NONE &&
+        (type = _resolve_type(self, node->lhs)) == CG_NO_TYPE) {
+        return false;
+    }
+
+    if (node->rhs == CL_AST_NONE) {
+        return _error(self, decl->node, "constant needs a value");
+    }
+
+    if (!_fold(self, node->rhs, &decl->value)) {
+        return (self->errors == errors)
+            ? _error(self, node->rhs, "expected a constant") : false;
+    }
+
+    if (type != CG_NO_TYPE && type != decl->value.type) {
+        if (type == TYPE_FLOAT && decl->value.type == TYPE_INT) {
+            decl->value.real = (double)decl->value.integer;
+            decl->value.type = TYPE_FLOAT;
+        } else {
+            return _error(self, node->rhs, "expected %s, found %s",
+                _type_name(self, type), _type_name(self, decl->value.type));
+        }
+    }
+
+    decl->type = decl->value.type;
+
+    return true;
+}
+
+
+/**
+ * The type of a global: the declared one, or the one of the
+ * constant it starts with.
+ */
+static bool _resolve_var(CodeGen *self, Decl *decl) {
+    AstNode *node = _node(self, decl->node);
+
+    if (node->lhs != CL_AST_NONE) {
+        decl->type = _resolve_type(self, node->lhs);
+        return decl->type != CG_NO_TYPE;
+    }
+
+    ConstValue value;
+    uint32_t errors = self->errors;
+
+    if (node->rhs == CL_AST_NONE || !_fold(self, node->rhs, &value)) {
+        return (self->errors == errors)
+            ? _error(self, decl->node, "global needs a type") : false;
+    }
+
+    decl->type = value.type;
+
+    return true;
+}
+
+
+static bool _resolve_fn(CodeGen *self, Decl *decl) {
+    AstNode *node = _node(self, decl->node);
+    AstIndex *proto = &self->ast->extra[node->lhs];
+    uint32_t count = proto[1] - proto[0];
+
+    if (count > CL_BYTECODE_MAX_REGISTERS - 1) {
+        return _error(self, decl->node, "too many parameters");
+    }
+
+    decl->params = arena_calloc(self->arena, count ? count : 1,
+        sizeof(uint32_t));
+    decl->byref = arena_calloc(self->arena, count ? count : 1, 1);
+
+    if (!decl->params || !decl->byref) {
+        return _out_of_memory(self);
+    }
+
+    decl->param_count = count;
+
+    for (uint32_t i = 0; i < count; i++) {
+        AstIndex param = self->ast->extra[proto[0] + i];
+        AstIndex type = _node(self, param)->lhs;
+
+        if (_node(self, type)->kind == AST_TYPE_POINTER) {
+            decl->byref[i] = 1;
+            type = _node(self, type)->lhs;
+        }
+
+        decl->params[i] = _resolve_type(self, type);
+
+        if (decl->params[i] == CG_NO_TYPE) {
+            return false;
+        }
+
+        if (decl->byref[i] && !_is_aggregate(self, decl->params[i])) {
+            return _error(self, type, "pointers to %s are not supported yet",
+                _type_name(self, decl->params[i]));
+        }
+    }
+
+    decl->type = TYPE_VOID;
+
+    if (proto[2] != CL_AST_NONE) {
+        decl->type = _resolve_type(self, proto[2]);
+
+        if (decl->type == CG_NO_TYPE) {
+            return false;
+        }
+
+        if (_is_aggregate(self, decl->type)) {
+            return _error(self, proto[2], "returning %s is not supported yet",
+                _type_name(self, decl->type));
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * Works out what a declaration needs before it can be used,
+ * once; a declaration that needs itself is a mistake.
+ */
+static bool _resolve(CodeGen *self, Decl *decl) {
+    switch (decl->state) {
+        case DECL_RESOLVED:
+            return true;
+        case DECL_FAILED:
+            return false;
+        case DECL_RESOLVING: {
+            int length;
+            str_t name = _name(self, decl->node, &length);
+
+            return _error(self, decl->node, "'%.*s' depends on itself",
+                length, name);
+        }
+        default:
+            break;
+    }
+
+    bool ok = true;
+
+    decl->state = DECL_RESOLVING;
+
+    switch (decl->kind) {
+        case DECL_FN:     ok = _resolve_fn(self, decl); break;
+        case DECL_VAR:    ok = _resolve_var(self, decl); break;
+        case DECL_CONST:  ok = _resolve_const(self, decl); break;
+        case DECL_STRUCT: ok = _resolve_struct(self, decl); break;
+        case DECL_ENUM:   ok = _resolve_enum(self, decl); break;
+        default:          break;
+    }
+
+    decl->state = ok ? DECL_RESOLVED : DECL_FAILED;
+
+    return ok;
+}
+
+
+/* == constants == */
+
+
+static int64_t _codepoint(const uint8_t *text, uint32_t length) {
+    if (length == 0) {
+        return 0;
+    }
+
+    uint32_t extra = (text[0] >= 0xF0) ? 3 : (text[0] >= 0xE0) ? 2
+        : (text[0] >= 0xC0) ? 1 : 0;
+    int64_t point = text[0] & (0x7F >> extra);
+
+    for (uint32_t i = 1; i <= extra && i < length; i++) {
+        point = (point << 6) | (text[i] & 0x3F);
+    }
+
+    return point;
+}
+
+
+static __Inline Literal _number(CodeGen *self, uint32_t token) {
+    return cl_number_value((TokenType)self->tokens->kinds[token],
+        source_get(self->src, self->tokens->offsets[token]),
+        self->tokens->lengths[token]);
+}
+
+
+static bool _fold_literal(CodeGen *self, AstIndex node, ConstValue *value) {
+    uint32_t token = _node(self, node)->token;
+    uint32_t data = tokens_value(self->tokens, token);
+    uint32_t length = 0;
+    str_t text;
+
+    switch (self->tokens->kinds[token]) {
+        case TK_STRING:
+            value->type = TYPE_STRING;
+            value->string = interner_unique(self->symbols, data);
+            return true;
+        case TK_CHAR:
+            text = interner_name(self->symbols, data, &length);
+            value->type = TYPE_INT;
+            value->integer = _codepoint((const uint8_t *)text, length);
+            return true;
+        case TK_FLOAT:
+            value->type = TYPE_FLOAT;
+            value->real = _number(self, token).real;
+            return true;
+        case TK_BIN:
+        case TK_HEX:
+        case TK_INT:
+            value->type = TYPE_INT;
+            value->integer = (int64_t)_number(self, token).integer;
+            return true;
+        case KW_TRUE:
+        case KW_FALSE:
+            value->type = TYPE_BOOL;
+            value->integer = (self->tokens->kinds[token] == KW_TRUE);
+            return true;
+        default:
+            return false;
+    }
+}
+
+
+/**
+ * The member of an enum that `node` names, when it is one.
+ */
+static bool _enum_member(CodeGen *self, AstIndex node, Decl *decl,
+    int64_t *value) {
+    uint32_t name = _symbol(self, node);
+
+    if (!_resolve(self, decl)) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < decl->field_count; i++) {
+        if (decl->fields[i].name == name) {
+            *value = decl->members[i];
+            return true;
+        }
+    }
+
+    int length;
+    str_t text = _name(self, node, &length);
+
+    return _error(self, node, "enum has no member '%.*s'", length, text);
+}
+
+
+static bool _fold_binary(CodeGen *self, AstIndex node, ConstValue *a,
+    ConstValue *b) {
+    TokenType op = _op(self, node);
+    uint64_t x = (uint64_t)a->integer, y = (uint64_t)b->integer;
+
+    if (a->type != b->type) {
+        return _error(self, node, "mismatched types %s and %s",
+            _type_name(self, a->type), _type_name(self, b->type));
+    }
+
+    if (op == OP_EQ || op == OP_NE) {
+        bool equal = (a->type == TYPE_STRING) ? a->string == b->string
+            : (a->type == TYPE_FLOAT) ? a->real == b->real : x == y;
+
+        a->type = TYPE_BOOL;
+        a->integer = (equal == (op == OP_EQ));
+        return true;
+    }
+
+    if (a->type == TYPE_FLOAT) {
+        double p = a->real, q = b->real;
+
+        switch (op) {
+            case OP_PLUS:     a->real = p + q; return true;
+            case OP_MINUS:    a->real = p - q; return true;
+            case OP_MULTIPLY: a->real = p * q; return true;
+            case OP_DIVIDE:   a->real = p / q; return true;
+            case OP_LT: a->type = TYPE_BOOL; a->integer = p < q; return true;
+            case OP_GT: a->type = TYPE_BOOL; a->integer = p > q; return true;
+            case OP_LE: a->type = TYPE_BOOL; a->integer = p <= q; return true;
+            case OP_GE: a->type = TYPE_BOOL; a->integer = p >= q; return true;
+            default: break;
+        }
+    } else if (a->type == TYPE_BOOL) {
+        switch (op) {
+            case OP_AND: a->integer = x && y; return true;
+            case OP_OR:  a->integer = x || y; return true;
+            default: break;
+        }
+    } else if (a->type == TYPE_INT) {
+        int64_t p = a->integer, q = b->integer;
+
+        if ((op == OP_DIVIDE || op == OP_REMAINDER) && q == 0) {
+            return _error(self, node, "division by zero");
+        }
+
+        switch (op) {
+            case OP_PLUS:      a->integer = (int64_t)(x + y); return true;
+            case OP_MINUS:     a->integer = (int64_t)(x - y); return true;
+            case OP_MULTIPLY:  a->integer = (int64_t)(x * y); return true;
+            case OP_DIVIDE:    a->integer = cl_div(p, q); return true;
+            case OP_REMAINDER: a->integer = cl_mod(p, q); return true;
+            case OP_BIT_AND:   a->integer = (int64_t)(x & y); return true;
+            case OP_BIT_OR:    a->integer = (int64_t)(x | y); return true;
+            case OP_BIT_XOR:   a->integer = (int64_t)(x ^ y); return true;
+            case OP_BIT_SHL:
+                a->integer = (int64_t)(x << (y & 63));
+                return true;
+            case OP_BIT_SHR:   a->integer = p >> (y & 63); return true;
+            case OP_LT: a->type = TYPE_BOOL; a->integer = p < q; return true;
+            case OP_GT: a->type = TYPE_BOOL; a->integer = p > q; return true;
+            case OP_LE: a->type = TYPE_BOOL; a->integer = p <= q; return true;
+            case OP_GE: a->type = TYPE_BOOL; a->integer = p >= q; return true;
+            default: break;
+        }
+    }
+
+    return _error(self, node, "operator does not apply to %s",
+        _type_name(self, a->type));
+}
+
+
+/**
+ * Evaluates a constant expression. Returns false without a
+ * diagnostic when `node` is valid but not a constant.
+ */
+static bool _fold(CodeGen *self, AstIndex node, ConstValue *value) {
+    AstNode *expr = _node(self, node);
+    ConstValue other;
+    Decl *decl;
+
+    switch (expr->kind) {
+        case AST_LITERAL:
+            return _fold_literal(self, node, value);
+        case AST_NAME:
+            decl = _decl(self, _symbol(self, node));
+
+            if (!decl || decl->kind != DECL_CONST || !_resolve(self, decl)) {
+                return false;
+            }
+
+            *value = decl->value;
+            return true;
+        case AST_ACCESS:
+            if (_node(self, expr->lhs)->kind != AST_NAME ||
+                !(decl = _decl(self, _symbol(self, expr->lhs))) ||
+                decl->kind != DECL_ENUM) {
+                return false;
+            }
+
+            value->type = TYPE_INT;
+            return _enum_member(self, node, decl, &value->integer);
+        case AST_UNARY:
+            if (!_fold(self, expr->lhs, value)) {
+                return false;
+            }
+
+            switch (_op(self, node)) {
+                case OP_MINUS:
+                    if (value->type == TYPE_FLOAT) {
+                        value->real = -value->real;
+                        return true;
+                    }
+
+                    if (value->type == TYPE_INT) {
+                        uint64_t bits = (uint64_t)value->integer;
+
+                        value->integer = (int64_t)(0 - bits);
+                        return true;
+                    }
+
+                    break;
+                case OP_NOT:
+                    if (value->type == TYPE_BOOL) {
+                        value->integer = !value->integer;
+                        return true;
+                    }
+
+                    break;
+                default:
+                    if (value->type == TYPE_INT) {
+                        value->integer = ~value->integer;
+                        return true;
+                    }
+
+                    break;
+            }
+
+            return _error(self, node, "operator does not apply to %s",
+                _type_name(self, value->type));
+        case AST_BINARY:
+            return _fold(self, expr->lhs, value) &&
+                _fold(self, expr->rhs, &other) &&
+                _fold_binary(self, node, value, &other);
+        case AST_TERNARY: {
+            AstIndex *branches = &self->ast->extra[expr->rhs];
+
+            if (!_fold(self, expr->lhs, &other)) {
+                return false;
+            }
+
+            if (other.type != TYPE_BOOL) {
+                return _error(self, expr->lhs, "expected bool, found %s",
+                    _type_name(self, other.type));
+            }
+
+            return _fold(self, branches[other.integer ? 0 : 1], value);
+        }
+        case AST_CAST: {
+            uint32_t type = _resolve_type(self, expr->rhs);
+
+            if (type == CG_NO_TYPE || !_fold(self, expr->lhs, value)) {
+                return false;
+            }
+
+            if (type == value->type) {
+                return true;
+            }
+
+            if (type == TYPE_FLOAT && value->type == TYPE_INT) {
+                value->real = (double)value->integer;
+            } else if (type == TYPE_INT && value->type == TYPE_FLOAT) {
+                value->integer = cl_ftoi(value->real);
+            } else if (type == TYPE_INT && value->type == TYPE_BOOL) {
+                /* already 0 or 1 */
+            } else {
+                return _error(self, node, "cannot convert %s to %s",
+                    _type_name(self, value->type), _type_name(self, type));
+            }
+
+            value->type = type;
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+
+/* == emitting == */
+
+
+/**
+ * Appends an instruction and returns its index, or UINT32_MAX
+ * when out of memory.
+ */
+static uint32_t _emit(CodeGen *self, Instruction insn) {
+    FnState *fs = &self->fn;
+
+    if (!instruction_vector_push(&fs->code, insn)) {
+        fs->failed = true;
+        _out_of_memory(self);
+        return UINT32_MAX;
+    }
+
+    return (uint32_t)fs->code.count - 1;
+}
+
+
+static __Inline uint32_t _here(CodeGen *self) {
+    return (uint32_t)self->fn.code.count;
+}
+
+
+/**
+ * A JMP to be patched later. Pending jumps are chained through
+ * their offset, the index of the next one of the list, so a
+ * list is the index of its last jump.
+ */
+static int32_t _jump(CodeGen *self) {
+    uint32_t at = _emit(self, cl_sj(CL_OP_JMP, CG_NO_JUMP));
+
+    return (at == UINT32_MAX) ? CG_NO_JUMP : (int32_t)at;
+}
+
+
+static void _concat(CodeGen *self, int32_t *list, int32_t jumps) {
+    Instruction *code = self->fn.code.data;
+    int32_t at = jumps;
+
+    if (jumps == CG_NO_JUMP) {
+        return;
+    }
+
+    while (CL_SJ(code[at]) != CG_NO_JUMP) {
+        at = CL_SJ(code[at]);
+    }
+
+    code[at] = cl_sj(CL_OP_JMP, *list);
+    *list = jumps;
+}
+
+
+/**
+ * Points every jump of a list at `target`.
+ */
+static void _patch(CodeGen *self, int32_t list, uint32_t target) {
+    FnState *fs = &self->fn;
+
+    while (list != CG_NO_JUMP) {
+        int32_t next = CL_SJ(fs->code.data[list]);
+        int64_t offset = (int64_t)target - list - 1;
+
+        if (offset < -CL_BYTECODE_SJ_BIAS || offset > CL_BYTECODE_SJ_BIAS) {
+            if (!fs->failed) {
+                _error(self, fs->node, "function is too large");
+            }
+
+            fs->failed = true;
+            return;
+        }
+
+        fs->code.data[list] = cl_sj(CL_OP_JMP, (int32_t)offset);
+        list = next;
+    }
+
+    if (target > fs->last_target) {
+        fs->last_target = target;
+    }
+}
+
+
+static __Inline void _patch_here(CodeGen *self, int32_t list) {
+    if (list != CG_NO_JUMP) {
+        _patch(self, list, _here(self));
+    }
+}
+
+
+/**
+ * A JMP straight to an instruction that is already there.
+ */
+static void _jump_back(CodeGen *self, uint32_t target) {
+    _patch(self, _jump(self), target);
+}
+
+
+static uint32_t _reg(CodeGen *self) {
+    FnState *fs = &self->fn;
+
+    if (fs->free_reg >= CL_BYTECODE_MAX_REGISTERS) {
+        if (!fs->failed) {
+            _error(self, fs->node, "function needs more than %u registers",
+                CL_BYTECODE_MAX_REGISTERS);
+        }
+
+        fs->failed = true;
+        return CL_BYTECODE_MAX_REGISTERS - 1;
+    }
+
+    uint32_t reg = fs->free_reg++;
+
+    if (fs->free_reg > fs->max_reg) {
+        fs->max_reg = fs->free_reg;
+    }
+
+    return reg;
+}
+
+
+/**
+ * The first register above the locals, where temporaries go.
+ */
+static uint32_t _locals_top(CodeGen *self) {
+    FnState *fs = &self->fn;
+    uint32_t top = fs->floor;
+
+    if (fs->locals.count > 0) {
+        uint32_t last = fs->locals.data[fs->locals.count - 1].reg + 1;
+
+        top = (last > top) ? last : top;
+    }
+
+    return top;
+}
+
+
+static uint32_t _constant(CodeGen *self, uint64_t value) {
+    FnState *fs = &self->fn;
+
+    for (size_t i = 0; i < fs->constants.count; i++) {
+        if (fs->constants.data[i] == value) {
+            return (uint32_t)i;
+        }
+    }
+
+    if (fs->constants.count == CL_BYTECODE_MAX_CONSTANTS) {
+        if (!fs->failed) {
+            _error(self, fs->node, "function has more than %u constants",
+                CL_BYTECODE_MAX_CONSTANTS);
+        }
+
+        fs->failed = true;
+        return 0;
+    }
+
+    if (!constant_vector_push(&fs->constants, value)) {
+        fs->failed = true;
+        _out_of_memory(self);
+        return 0;
+    }
+
+    return (uint32_t)fs->constants.count - 1;
+}
+
+
+/**
+ * The constant holding the offset of a string, which goes in
+ * CONSTANTS the first time any function uses it.
+ */
+static uint32_t _string(CodeGen *self, uint32_t symbol) {
+    uint32_t *known = _map_get(&self->strings, symbol);
+
+    if (known) {
+        return _constant(self, *known);
+    }
+
+    uint32_t length = 0;
+    str_t text = interner_name(self->symbols, symbol, &length);
+    size_t size = sizeof(BytecodeString) + length + 1;
+    BytecodeString *string = calloc(1, size);
+
+    if (!string) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        _out_of_memory(self);
+        return 0;
+    }
+
+    string->length = length;
+    memcpy(string->bytes, text, length);
+
+    uint64_t offset = object_writer_constant(self->writer, string, size);
+
+    free(string);
+
+    if (offset > UINT32_MAX || !_map_put(&self->strings, symbol,
+            (uint32_t)offset)) {
+        _out_of_memory(self);
+        return 0;
+    }
+
+    return _constant(self, offset);
+}
+
+
+static void _load_int(CodeGen *self, uint32_t dst, int64_t value) {
+    if (value >= -CL_BYTECODE_SBX_BIAS &&
+        value <= UINT16_MAX - CL_BYTECODE_SBX_BIAS) {
+        _emit(self, cl_asbx(CL_OP_LOADI, dst, (int32_t)value));
+    } else {
+        _emit(self, cl_abx(CL_OP_LOADK, dst,
+            _constant(self, (uint64_t)value)));
+    }
+}
+
+
+static void _load_const(CodeGen *self, uint32_t dst, ConstValue *value) {
+    uint64_t bits;
+
+    switch (value->type) {
+        case TYPE_FLOAT:
+            memcpy(&bits, &value->real, sizeof(bits));
+            _emit(self, cl_abx(CL_OP_LOADK, dst, _constant(self, bits)));
+            break;
+        case TYPE_STRING:
+            _emit(self, cl_abx(CL_OP_LOADS, dst,
+                _string(self, value->string)));
+            break;
+        default:
+            _load_int(self, dst, value->integer);
+            break;
+    }
+}
+
+
+/* == expressions == */
+
+
+static uint32_t _expr(CodeGen *self, AstIndex node, uint32_t dst);
+static bool     _cond(CodeGen *self, AstIndex node, bool jump_if,
+                      int32_t *list);
+
+
+static Local *_local(CodeGen *self, uint32_t name) {
+    FnState *fs = &self->fn;
+
+    for (size_t i = fs->locals.count; i-- > 0;) {
+        if (i < fs->hidden_end && i >= fs->hidden_start) {
+            continue;
+        }
+
+        if (fs->locals.data[i].name == name) {
+            return &fs->locals.data[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+static uint32_t _mismatch(CodeGen *self, AstIndex node, uint32_t expected,
+    uint32_t found) {
+    if (expected == found || found == CG_NO_TYPE) {
+        return found;
+    }
+
+    if (_is_aggregate(self, expected) && _is_aggregate(self, found)) {
+        _error(self, node, "expected another %s",
+            _type(self, expected)->kind == KIND_STRUCT ? "struct" : "array");
+    } else {
+        _error(self, node, "expected %s, found %s",
+            _type_name(self, expected), _type_name(self, found));
+    }
+
+    return CG_NO_TYPE;
+}
+
+
+/**
+ * Evaluates a node into any register: the one of a local as it
+ * is, or a new temporary.
+ */
+static uint32_t _expr_any(CodeGen *self, AstIndex node, uint32_t *reg) {
+    if (_node(self, node)->kind == AST_NAME) {
+        Local *local = _local(self, _symbol(self, node));
+
+        if (local) {
+            *reg = local->reg;
+            return local->type;
+        }
+    }
+
+    *reg = _reg(self);
+
+    return _expr(self, node, *reg);
+}
+
+
+static uint32_t _unknown(CodeGen *self, AstIndex node) {
+    int length;
+    str_t name = _name(self, node, &length);
+
+    _error(self, node, "unknown name '%.*s'", length, name);
+
+    return CG_NO_TYPE;
+}
+
+
+/**
+ * The struct or array that a place holds, as a register with
+ * its address and an offset in slots.
+ */
+static void _address(CodeGen *self, Place *place, uint32_t *reg,
+    uint32_t *offset) {
+    *offset = 0;
+
+    switch (place->kind) {
+        case PLACE_GLOBAL:
+            *reg = _reg(self);
+            _emit(self, cl_abx(CL_OP_GETG, *reg, place->index));
+            break;
+        case PLACE_FIELD:
+            *reg = place->reg;
+            *offset = place->index;
+            break;
+        default:
+            *reg = place->reg;
+            break;
+    }
+}
+
+
+static uint32_t _place(CodeGen *self, AstIndex node, Place *place);
+
+
+static uint32_t _place_access(CodeGen *self, AstIndex node, Place *place) {
+    AstNode *access = _node(self, node);
+    Place base;
+    uint32_t type = _place(self, access->lhs, &base);
+
+    if (type == CG_NO_TYPE) {
+        return CG_NO_TYPE;
+    }
+
+    if (_type(self, type)->kind != KIND_STRUCT) {
+        _error(self, node, "%s has no fields", _type_name(self, type));
+        return CG_NO_TYPE;
+    }
+
+    Decl *decl = &self->decls[_type(self, type)->decl];
+    uint32_t name = _symbol(self, node);
+
+    for (uint32_t i = 0; i < decl->field_count; i++) {
+        Field *field = &decl->fields[i];
+
+        if (field->name == name) {
+            uint32_t offset;
+
+            _address(self, &base, &place->reg, &offset);
+            place->kind = PLACE_FIELD;
+            place->index = offset + field->offset;
+            place->type = field->type;
+            place->constant = base.constant;
+            return field->type;
+        }
+    }
+
+    int length;
+    str_t text = _name(self, node, &length);
+
+    _error(self, node, "struct has no field '%.*s'", length, text);
+
+    return CG_NO_TYPE;
+}
+
+
+static uint32_t _place_index(CodeGen *self, AstIndex node, Place *place) {
+    AstNode *index = _node(self, node);
+    Place base;
+    uint32_t type = _place(self, index->lhs, &base);
+    uint32_t reg, offset, at;
+
+    if (type == CG_NO_TYPE) {
+        return CG_NO_TYPE;
+    }
+
+    if (_type(self, type)->kind != KIND_ARRAY) {
+        _error(self, node, "%s cannot be indexed", _type_name(self, type));
+        return CG_NO_TYPE;
+    }
+
+    _address(self, &base, &reg, &offset);
+
+    if (offset != 0) {
+        uint32_t array = _reg(self);
+
+        _emit(self, cl_abc(CL_OP_REF, array, reg, offset));
+        reg = array;
+    }
+
+    if (_mismatch(self, index->rhs, TYPE_INT,
+            _expr_any(self, index->rhs, &at)) == CG_NO_TYPE) {
+        return CG_NO_TYPE;
+    }
+
+    place->kind = PLACE_INDEX;
+    place->reg = reg;
+    place->index = at;
+    place->type = _type(self, type)->elem;
+    place->constant = base.constant;
+
+    return place->type;
+}
+
+
+/**
+ * Works out where the value a node names lives, emitting what
+ * it takes to get there.
+ */
+static uint32_t _place(CodeGen *self, AstIndex node, Place *place) {
+    AstNode *expr = _node(self, node);
+
+    *place = (Place){ 0 };
+
+    switch (expr->kind) {
+        case AST_NAME: {
+            uint32_t name = _symbol(self, node);
+            Local *local = _local(self, name);
+            Decl *decl;
+
+            if (local) {
+                place->kind = PLACE_LOCAL;
+                place->reg = local->reg;
+                place->type = local->type;
+                place->constant = local->constant;
+                return local->type;
+            }
+
+            if (!(decl = _decl(self, name))) {
+                return _unknown(self, node);
+            }
+
+            if (decl->kind == DECL_VAR) {
+                if (!_resolve(self, decl)) {
+                    return CG_NO_TYPE;
+                }
+
+                place->kind = PLACE_GLOBAL;
+                place->index = decl->global;
+                place->type = decl->type;
+                return decl->type;
+            }
+
+            break;
+        }
+        case AST_ACCESS:
+            return _place_access(self, node, place);
+        case AST_INDEX:
+            return _place_index(self, node, place);
+        default:
+            break;
+    }
+
+    _error(self, node, "expected a variable");
+
+    return CG_NO_TYPE;
+}
+
+
+static void _load(CodeGen *self, Place *place, uint32_t dst) {
+    switch (place->kind) {
+        case PLACE_LOCAL:
+            if (dst != place->reg) {
+                _emit(self, cl_abc(CL_OP_MOVE, dst, place->reg, 0));
+            }
+
+            break;
+        case PLACE_GLOBAL:
+            _emit(self, cl_abx(CL_OP_GETG, dst, place->index));
+            break;
+        case PLACE_FIELD:
+            if (!_is_aggregate(self, place->type)) {
+                _emit(self, cl_abc(CL_OP_GETF, dst, place->reg, place->index));
+            } else if (place->index != 0) {
+                _emit(self, cl_abc(CL_OP_REF, dst, place->reg, place->index));
+            } else if (dst != place->reg) {
+                _emit(self, cl_abc(CL_OP_MOVE, dst, place->reg, 0));
+            }
+
+            break;
+        case PLACE_INDEX:
+            _emit(self, cl_abc(CL_OP_GETI, dst, place->reg, place->index));
+            break;
+    }
+}
+
+
+/**
+ * Copies the struct or array at `from` over the one at `to`.
+ */
+static bool _copy(CodeGen *self, AstIndex node, uint32_t to, uint32_t from,
+    uint32_t type) {
+    uint32_t size = _type(self, type)->size;
+
+    if (size > CG_MAX_SLOTS) {
+        return _error(self, node, "cannot copy more than %u slots",
+            CG_MAX_SLOTS);
+    }
+
+    _emit(self, cl_abc(CL_OP_COPY, to, from, size));
+
+    return true;
+}
+
+
+static bool _store(CodeGen *self, AstIndex node, Place *place,
+    uint32_t value) {
+    if (_is_aggregate(self, place->type)) {
+        uint32_t reg, offset;
+
+        _address(self, place, &reg, &offset);
+
+        if (offset != 0) {
+            uint32_t at = _reg(self);
+
+            _emit(self, cl_abc(CL_OP_REF, at, reg, offset));
+            reg = at;
+        }
+
+        return _copy(self, node, reg, value, place->type);
+    }
+
+    switch (place->kind) {
+        case PLACE_LOCAL:
+            if (value != place->reg) {
+                _emit(self, cl_abc(CL_OP_MOVE, place->reg, value, 0));
+            }
+
+            break;
+        case PLACE_GLOBAL:
+            _emit(self, cl_abx(CL_OP_SETG, value, place->index));
+            break;
+        case PLACE_FIELD:
+            _emit(self, cl_abc(CL_OP_SETF, place->reg, place->index, value));
+            break;
+        case PLACE_INDEX:
+            _emit(self, cl_abc(CL_OP_SETI, place->reg, place->index, value));
+            break;
+    }
+
+    return true;
+}
+
+
+static uint32_t _expr_assign(CodeGen *self, AstIndex node, uint32_t dst) {
+    AstNode *assign = _node(self, node);
+    Place place;
+    uint32_t type = _place(self, assign->lhs, &place);
+    uint32_t value;
+
+    if (type == CG_NO_TYPE) {
+        return CG_NO_TYPE;
+    }
+
+    if (place.constant) {
+        _error(self, assign->lhs, "cannot assign to a constant");
+        return CG_NO_TYPE;
+    }
+
+    if (place.kind == PLACE_LOCAL && !_is_aggregate(self, type)) {
+        value = place.reg;
+        type = _mismatch(self, assign->rhs, type,
+            _expr(self, assign->rhs, value));
+    } else {
+        type = _mismatch(self, assign->rhs, type,
+            _expr_any(self, assign->rhs, &value));
+
+        if (type != CG_NO_TYPE && !_store(self, assign->lhs, &place, value)) {
+            return CG_NO_TYPE;
+        }
+    }
+
+    if (type != CG_NO_TYPE && dst != CG_NO_REG && dst != value) {
+        _emit(self, cl_abc(CL_OP_MOVE, dst, value, 0));
+    }
+
+    return type;
+}
+
+
+/**
+ * A condition as a bool value: 1 unless it jumps away to 0.
+ */
+static uint32_t _expr_bool(CodeGen *self, AstIndex node, uint32_t dst) {
+    int32_t no = CG_NO_JUMP;
+
+    if (!_cond(self, node, false, &no)) {
+        return CG_NO_TYPE;
+    }
+
+    _emit(self, cl_asbx(CL_OP_LOADI, dst, 1));
+
+    if (no != CG_NO_JUMP) {
+        int32_t end = _jump(self);
+
+        _patch_here(self, no);
+        _emit(self, cl_asbx(CL_OP_LOADI, dst, 0));
+        _patch_here(self, end);
+    }
+
+    return TYPE_BOOL;
+}
+
+
+static bool _is_comparison(TokenType op) {
+    return op == OP_EQ || op == OP_NE || op == OP_LT || op == OP_GT ||
+        op == OP_LE || op == OP_GE || op == OP_AND || op == OP_OR;
+}
+
+
+/**
+ * An int literal small enough for the immediate of ADDI.
+ */
+static bool _small_int(CodeGen *self, AstIndex node, int64_t *value) {
+    ConstValue literal;
+
+    if (_node(self, node)->kind != AST_LITERAL ||
+        !_fold_literal(self, node, &literal) || literal.type != TYPE_INT) {
+        return false;
+    }
+
+    *value = literal.integer;
+
+    return literal.integer >= -CL_BYTECODE_SC_BIAS &&
+        literal.integer < CL_BYTECODE_SC_BIAS;
+}
+
+
+static uint32_t _expr_binary(CodeGen *self, AstIndex node, uint32_t dst) {
+    AstNode *binary = _node(self, node);
+    TokenType op = _op(self, node);
+    uint32_t a, b;
+    int64_t imm;
+
+    if (_is_comparison(op)) {
+        return _expr_bool(self, node, dst);
+    }
+
+    uint32_t type = _expr_any(self, binary->lhs, &a);
+
+    if (type == CG_NO_TYPE) {
+        return CG_NO_TYPE;
+    }
+
+    if (type == TYPE_INT && (op == OP_PLUS || op == OP_MINUS) &&
+        _small_int(self, binary->rhs, &imm) &&
+        (op == OP_PLUS || imm != -CL_BYTECODE_SC_BIAS)) {
+        imm = (op == OP_PLUS) ? imm : -imm;
+        _emit(self, cl_abc(CL_OP_ADDI, dst, a,
+            (uint32_t)(imm + CL_BYTECODE_SC_BIAS)));
+        return TYPE_INT;
+    }
+
+    if (_mismatch(self, binary->rhs, type,
+            _expr_any(self, binary->rhs, &b)) == CG_NO_TYPE) {
+        return CG_NO_TYPE;
+    }
+
+    Opcode opcode = __CL_OP_MAX;
+
+    if (type == TYPE_INT) {
+        switch (op) {
+            case OP_PLUS:       opcode = CL_OP_ADD; break;
+            case OP_MINUS:      opcode = CL_OP_SUB; break;
+            case OP_MULTIPLY:   opcode = CL_OP_MUL; break;
+            case OP_DIVIDE:     opcode = CL_OP_DIV; break;
+            case OP_REMAINDER:  opcode = CL_OP_MOD; break;
+            case OP_BIT_AND:    opcode = CL_OP_BAND; break;
+            case OP_BIT_OR:     opcode = CL_OP_BOR; break;
+            case OP_BIT_XOR:    opcode = CL_OP_BXOR; break;
+            case OP_BIT_SHL:    opcode = CL_OP_SHL; break;
+            case OP_BIT_SHR:    opcode = CL_OP_SHR; break;
+            default: break;
+        }
+    } else if (type == TYPE_FLOAT) {
+        switch (op) {
+            case OP_PLUS:       opcode = CL_OP_FADD; break;
+            case OP_MINUS:      opcode = CL_OP_FSUB; break;
+            case OP_MULTIPLY:   opcode = CL_OP_FMUL; break;
+            case OP_DIVIDE:     opcode = CL_OP_FDIV; break;
+            default: break;
+        }
+    }
+
+    if (opcode == __CL_OP_MAX) {
+        _error(self, node, "operator does not apply to %s",
+            _type_name(self, type));
+        return CG_NO_TYPE;
+    }
+
+    _emit(self, cl_abc(opcode, dst, a, b));
+
+    return type;
+}
+
+
+static uint32_t _expr_unary(CodeGen *self, AstIndex node, uint32_t dst) {
+    TokenType op = _op(self, node);
+    uint32_t reg;
+    uint32_t type = _expr_any(self, _node(self, node)->lhs, &reg);
+    Opcode opcode = __CL_OP_MAX;
+
+    if (type == CG_NO_TYPE) {
+        return CG_NO_TYPE;
+    }
+
+    if (op == OP_MINUS && type == TYPE_INT) {
+        opcode = CL_OP_NEG;
+    } else if (op == OP_MINUS && type == TYPE_FLOAT) {
+        opcode = CL_OP_FNEG;
+    } else if (op == OP_NOT && type == TYPE_BOOL) {
+        opcode = CL_OP_NOT;
+    } else if (op == OP_BIT_NOT && type == TYPE_INT) {
+        opcode = CL_OP_BNOT;
+    } else {
+        _error(self, node, "operator does not apply to %s",
+            _type_name(self, type));
+        return CG_NO_TYPE;
+    }
+
+    _emit(self, cl_abc(opcode, dst, reg, 0));
+
+    return type;
+}
+
+
+static uint32_t _expr_cast(CodeGen *self, AstIndex node, uint32_t dst) {
+    AstNode *cast = _node(self, node);
+    uint32_t to = _resolve_type(self, cast->rhs);
+    uint32_t from = (to == CG_NO_TYPE) ? CG_NO_TYPE
+        : _expr(self, cast->lhs, dst);
+
+    if (from == CG_NO_TYPE || from == to) {
+        return from;
+    }
+
+    if (to == TYPE_FLOAT && from == TYPE_INT) {
+        _emit(self, cl_abc(CL_OP_ITOF, dst, dst, 0));
+    } else if (to == TYPE_INT && from == TYPE_FLOAT) {
+        _emit(self, cl_abc(CL_OP_FTOI, dst, dst, 0));
+    } else if (!(to == TYPE_INT && from == TYPE_BOOL)) {
+        _error(self, node, "cannot convert %s to %s",
+            _type_name(self, from), _type_name(self, to));
+        return CG_NO_TYPE;
+    }
+
+    return to;
+}
+
+
+static uint32_t _expr_ternary(CodeGen *self, AstIndex node, uint32_t dst) {
+    AstNode *ternary = _node(self, node);
+    AstIndex *branches = &self->ast->extra[ternary->rhs];
+    int32_t otherwise = CG_NO_JUMP;
+
+    if (!_cond(self, ternary->lhs, false, &otherwise)) {
+        return CG_NO_TYPE;
+    }
+
+    uint32_t top = self->fn.free_reg;
+    uint32_t type = _expr(self, branches[0], dst);
+    int32_t end = _jump(self);
+
+    self->fn.free_reg = top;
+    _patch_here(self, otherwise);
+
+    uint32_t other = _expr(self, branches[1], dst);
+
+    _patch_here(self, end);
+
+    return (type == CG_NO_TYPE) ? CG_NO_TYPE
+        : _mismatch(self, branches[1], type, other);
+}
+
+
+/**
+ * `io.print` and `io.println`, with at most one value.
+ */
+static uint32_t _expr_print(CodeGen *self, AstIndex node, bool newline) {
+    AstIndex *args = &self->ast->extra[_node(self, node)->rhs];
+    uint32_t kind = CL_PRINT_STRING;
+    uint32_t reg;
+
+    if (args[1] - args[0] > 1) {
+        _error(self, node, "print takes at most one value");
+        return CG_NO_TYPE;
+    }
+
+    if (args[1] == args[0]) {
+        if (!newline) {
+            return TYPE_VOID;
+        }
+
+        reg = _reg(self);
+        _emit(self, cl_asbx(CL_OP_LOADI, reg, 0));
+    } else {
+        AstIndex arg = self->ast->extra[args[0]];
+        uint32_t type = _expr_any(self, arg, &reg);
+
+        switch (type) {
+            case CG_NO_TYPE:    return CG_NO_TYPE;
+            case TYPE_INT:      kind = CL_PRINT_INT; break;
+            case TYPE_FLOAT:    kind = CL_PRINT_FLOAT; break;
+            case TYPE_BOOL:     kind = CL_PRINT_BOOL; break;
+            case TYPE_STRING:   kind = CL_PRINT_STRING; break;
+            default:
+                _error(self, arg, "cannot print %s", _type_name(self, type));
+                return CG_NO_TYPE;
+        }
+    }
+
+    _emit(self, cl_abc(CL_OP_PRINT, reg, kind, newline));
+
+    return TYPE_VOID;
+}
+
+
+/**
+ * What a call calls: a function of the unit, or a builtin.
+ */
+static Decl *_callee(CodeGen *self, AstIndex node, int *builtin) {
+    AstNode *callee = _node(self, node);
+    int length;
+    str_t name;
+    Decl *decl;
+
+    *builtin = -1;
+
+    if (callee->kind == AST_NAME && !_local(self, _symbol(self, node))) {
+        if (!(decl = _decl(self, _symbol(self, node)))) {
+            _unknown(self, node);
+            return NULL;
+        }
+
+        if (decl->kind == DECL_FN) {
+            return decl;
+        }
+    } else if (callee->kind == AST_ACCESS &&
+               _node(self, callee->lhs)->kind == AST_NAME &&
+               !_local(self, _symbol(self, callee->lhs))) {
+        if (!(decl = _decl(self, _symbol(self, callee->lhs)))) {
+            _unknown(self, callee->lhs);
+            return NULL;
+        }
+
+        if (decl->kind != DECL_IMPORT) {
+            _error(self, node, "expected a function");
+            return NULL;
+        }
+
+        if (!decl->builtin) {
+            _error(self, node, "calling functions of imported modules is "
+                "not supported yet");
+            return NULL;
+        }
+
+        if (_is_named(self, _symbol(self, node), "print")) {
+            *builtin = 0;
+            return NULL;
+        }
+
+        if (_is_named(self, _symbol(self, node), "println")) {
+            *builtin = 1;
+            return NULL;
+        }
+
+        name = _name(self, node, &length);
+        _error(self, node, "io has no function '%.*s'", length, name);
+        return NULL;
+    }
+
+    _error(self, node, "expected a function");
+
+    return NULL;
+}
+
+
+/**
+ * Arguments go in the registers right above the one the result
+ * ends in, which is `dst` when nothing lives above it.
+ */
+static uint32_t _expr_call(CodeGen *self, AstIndex node, uint32_t dst) {
+    FnState *fs = &self->fn;
+    AstNode *call = _node(self, node);
+    AstIndex *args = &self->ast->extra[call->rhs];
+    uint32_t count = args[1] - args[0];
+    int builtin;
+    Decl *decl = _callee(self, call->lhs, &builtin);
+
+    if (builtin >= 0) {
+        return _expr_print(self, node, builtin == 1);
+    }
+
+    if (!decl || !_resolve(self, decl)) {
+        return CG_NO_TYPE;
+    }
+
+    if (_node(self, decl->node)->rhs == CL_AST_NONE) {
+        int length;
+        str_t name = _name(self, decl->node, &length);
+
+        _error(self, node, "'%.*s' has no body", length, name);
+        return CG_NO_TYPE;
+    }
+
+    if (count != decl->param_count) {
+        _error(self, node, "expected %u arguments, found %u",
+            decl->param_count, count);
+        return CG_NO_TYPE;
+    }
+
+    uint32_t base = (dst != CG_NO_REG && dst + 1 == fs->free_reg &&
+        dst >= _locals_top(self)) ? dst : _reg(self);
+
+    for (uint32_t i = 0; i < count; i++) {
+        AstIndex arg = self->ast->extra[args[0] + i];
+        uint32_t reg = (i == 0) ? base : _reg(self);
+
+        if (_mismatch(self, arg, decl->params[i],
+                _expr(self, arg, reg)) == CG_NO_TYPE) {
+            return CG_NO_TYPE;
+        }
+
+        fs->free_reg = reg + 1;
+    }
+
+    _emit(self, cl_abx(CL_OP_CALL, base, _constant(self, decl->symbol)));
+    fs->free_reg = base + 1;
+
+    if (dst != CG_NO_REG && dst != base && decl->type != TYPE_VOID) {
+        _emit(self, cl_abc(CL_OP_MOVE, dst, base, 0));
+    }
+
+    return decl->type;
+}
+
+
+static uint32_t _expr_name(CodeGen *self, AstIndex node, uint32_t dst) {
+    uint32_t name = _symbol(self, node);
+    Decl *decl = _local(self, name) ? NULL : _decl(self, name);
+    int length;
+    str_t text;
+
+    if (!decl || decl->kind == DECL_VAR) {
+        Place place;
+        uint32_t type = _place(self, node, &place);
+
+        if (type != CG_NO_TYPE) {
+            _load(self, &place, dst);
+        }
+
+        return type;
+    }
+
+    if (decl->kind == DECL_CONST) {
+        if (!_resolve(self, decl)) {
+            return CG_NO_TYPE;
+        }
+
+        _load_const(self, dst, &decl->value);
+        return decl->type;
+    }
+
+    text = _name(self, node, &length);
+    _error(self, node, "'%.*s' is not a value", length, text);
+
+    return CG_NO_TYPE;
+}
+
+
+static uint32_t _expr_access(CodeGen *self, AstIndex node, uint32_t dst) {
+    AstIndex lhs = _node(self, node)->lhs;
+    Decl *decl = NULL;
+    Place place;
+
+    if (_node(self, lhs)->kind == AST_NAME &&
+        !_local(self, _symbol(self, lhs))) {
+        decl = _decl(self, _symbol(self, lhs));
+    }
+
+    if (decl && decl->kind == DECL_ENUM) {
+        int64_t value;
+
+        if (!_enum_member(self, node, decl, &value)) {
+            return CG_NO_TYPE;
+        }
+
+        _load_int(self, dst, value);
+        return TYPE_INT;
+    }
+
+    if (decl && decl->kind == DECL_IMPORT) {
+        _error(self, node, "expected a call");
+        return CG_NO_TYPE;
+    }
+
+    uint32_t type = _place(self, node, &place);
+
+    if (type != CG_NO_TYPE) {
+        _load(self, &place, dst);
+    }
+
+    return type;
+}
+
+
+/**
+ * Evaluates a node into `dst`, or into a temporary when `dst`
+ * is CG_NO_REG, and returns its type. Structs and arrays are
+ * evaluated to their address. Temporaries above `dst` are
+ * released.
+ */
+static uint32_t _expr(CodeGen *self, AstIndex node, uint32_t dst) {
+    AstNode *expr = _node(self, node);
+    uint32_t top = self->fn.free_reg;
+    uint32_t type = CG_NO_TYPE;
+    ConstValue literal;
+    Place place;
+
+    if (dst == CG_NO_REG && expr->kind != AST_ASSIGN &&
+        expr->kind != AST_CALL) {
+        dst = _reg(self);
+        top = self->fn.free_reg;
+    }
+
+    switch (expr->kind) {
+        case AST_LITERAL:
+            if (_fold_literal(self, node, &literal)) {
+                _load_const(self, dst, &literal);
+                type = literal.type;
+            }
+
+            break;
+        case AST_NAME:
+            type = _expr_name(self, node, dst);
+            break;
+        case AST_ACCESS:
+            type = _expr_access(self, node, dst);
+            break;
+        case AST_INDEX:
+            if ((type = _place(self, node, &place)) != CG_NO_TYPE) {
+                _load(self, &place, dst);
+            }
+
+            break;
+        case AST_ASSIGN:
+            type = _expr_assign(self, node, dst);
+            break;
+        case AST_UNARY:
+            type = _expr_unary(self, node, dst);
+            break;
+        case AST_BINARY:
+            type = _expr_binary(self, node, dst);
+            break;
+        case AST_TERNARY:
+            type = _expr_ternary(self, node, dst);
+            break;
+        case AST_CAST:
+            type = _expr_cast(self, node, dst);
+            break;
+        case AST_CALL:
+            type = _expr_call(self, node, dst);
+            break;
+        default:
+            _error(self, node, "expected an expression");
+            break;
+    }
+
+    if (self->fn.free_reg > top) {
+        self->fn.free_reg = top;
+    }
+
+    return type;
+}
+
+
+static bool _cond_compare(CodeGen *self, AstIndex node, bool jump_if,
+    int32_t *list) {
+    AstNode *binary = _node(self, node);
+    TokenType op = _op(self, node);
+    uint32_t a, b;
+    uint32_t type = _expr_any(self, binary->lhs, &a);
+
+    if (type == CG_NO_TYPE || _mismatch(self, binary->rhs, type,
+            _expr_any(self, binary->rhs, &b)) == CG_NO_TYPE) {
+        return false;
+    }
+
+    bool ordered = (op != OP_EQ && op != OP_NE);
+
+    if (_is_aggregate(self, type) || type == TYPE_VOID ||
+        (ordered && type != TYPE_INT && type != TYPE_FLOAT)) {
+        return _error(self, node, "cannot compare %s",
+            _type_name(self, type));
+    }
+
+    bool real = (type == TYPE_FLOAT);
+    bool negate = (op == OP_NE);
+    Opcode opcode = real ? CL_OP_FEQ : CL_OP_EQ;
+
+    if (op == OP_LT || op == OP_GT) {
+        opcode = real ? CL_OP_FLT : CL_OP_LT;
+    } else if (op == OP_LE || op == OP_GE) {
+        opcode = real ? CL_OP_FLE : CL_OP_LE;
+    }
+
+    if (op == OP_GT || op == OP_GE) {
+        uint32_t swap = a;
+
+        a = b;
+        b = swap;
+    }
+
+    _emit(self, cl_abc(opcode, a, b, jump_if != negate));
+    _concat(self, list, _jump(self));
+
+    return true;
+}
+
+
+/**
+ * Emits a condition that jumps to `list` when it is `jump_if`
+ * and falls through otherwise, without making a bool of it.
+ */
+static bool _cond(CodeGen *self, AstIndex node, bool jump_if,
+    int32_t *list) {
+    AstNode *expr = _node(self, node);
+    uint32_t top = self->fn.free_reg;
+    bool ok = true;
+
+    if (expr->kind == AST_BINARY && _is_comparison(_op(self, node))) {
+        TokenType op = _op(self, node);
+
+        if (op == OP_AND || op == OP_OR) {
+            /* the left side decides alone when it is what stops */
+            bool stop = (op == OP_OR);
+
+            if (jump_if == stop) {
+                ok = _cond(self, expr->lhs, stop, list) &&
+                    _cond(self, expr->rhs, stop, list);
+            } else {
+                int32_t skip = CG_NO_JUMP;
+
+                ok = _cond(self, expr->lhs, stop, &skip) &&
+                    _cond(self, expr->rhs, jump_if, list);
+                _patch_here(self, skip);
+            }
+        } else {
+            ok = _cond_compare(self, node, jump_if, list);
+        }
+    } else if (expr->kind == AST_UNARY && _op(self, node) == OP_NOT) {
+        ok = _cond(self, expr->lhs, !jump_if, list);
+    } else if (expr->kind == AST_LITERAL &&
+               (_op(self, node) == KW_TRUE || _op(self, node) == KW_FALSE)) {
+        if ((_op(self, node) == KW_TRUE) == jump_if) {
+            _concat(self, list, _jump(self));
+        }
+    } else {
+        uint32_t reg;
+        uint32_t type = _expr_any(self, node, &reg);
+
+        ok = (_mismatch(self, node, TYPE_BOOL, type) != CG_NO_TYPE);
+
+        if (ok) {
+            _emit(self, cl_abc(CL_OP_TEST, reg, jump_if, 0));
+            _concat(self, list, _jump(self));
+        }
+    }
+
+    self->fn.free_reg = top;
+
+    return ok;
+}
+
+
+/* == statements == */
+
+
+static bool _statement(CodeGen *self, AstIndex node);
+
+
+CL_TYPE(Scope) {
+    size_t   locals;
+    size_t   defers;
+    uint32_t frame_top;
+};
+
+
+static Scope _scope_enter(CodeGen *self) {
+    return (Scope){
+        .locals = self->fn.locals.count,
+        .defers = self->fn.defers.count,
+        .frame_top = self->fn.frame_top,
+    };
+}
+
+
+/**
+ * Runs what was deferred since `from`, the last first, with
+ * only the locals each one could see when it was deferred.
+ */
+static void _run_defers(CodeGen *self, size_t from) {
+    FnState *fs = &self->fn;
+
+    for (size_t i = fs->defers.count; i-- > from;) {
+        Defer defer = fs->defers.data[i];
+        FnState saved = *fs;
+
+        fs->hidden_start = defer.locals;
+        fs->hidden_end = fs->locals.count;
+        fs->floor = fs->free_reg;
+        fs->loop = NULL;
+        fs->in_defer = true;
+
+        _statement(self, defer.node);
+
+        fs->hidden_start = saved.hidden_start;
+        fs->hidden_end = saved.hidden_end;
+        fs->floor = saved.floor;
+        fs->loop = saved.loop;
+        fs->in_defer = saved.in_defer;
+        fs->locals.count = saved.locals.count;
+        fs->defers.count = saved.defers.count;
+        fs->free_reg = saved.free_reg;
+    }
+}
+
+
+static void _scope_leave(CodeGen *self, Scope *scope) {
+    FnState *fs = &self->fn;
+
+    _run_defers(self, scope->defers);
+
+    fs->defers.count = scope->defers;
+    fs->locals.count = scope->locals;
+    fs->frame_top = scope->frame_top;
+    fs->free_reg = _locals_top(self);
+}
+
+
+static bool _block(CodeGen *self, AstIndex node) {
+    AstNode *block = _node(self, node);
+    Scope scope = _scope_enter(self);
+    bool ok = true;
+
+    for (AstIndex i = block->lhs; i < block->rhs; i++) {
+        ok &= _statement(self, self->ast->extra[i]);
+    }
+
+    _scope_leave(self, &scope);
+
+    return ok;
+}
+
+
+/**
+ * Takes `size` slots of the frame and points `reg` at them.
+ */
+static bool _frame(CodeGen *self, AstIndex node, uint32_t reg,
+    uint32_t size) {
+    FnState *fs = &self->fn;
+    uint32_t offset = fs->frame_top;
+
+    if (offset > UINT16_MAX) {
+        return _error(self, node, "function has too many structs and "
+            "arrays");
+    }
+
+    fs->frame_top += size;
+
+    if (fs->frame_top > fs->frame_size) {
+        fs->frame_size = fs->frame_top;
+    }
+
+    _emit(self, cl_abx(CL_OP_FRAME, reg, offset));
+
+    return true;
+}
+
+
+/**
+ * Sets up zeroed slots at `reg` as a value of `type`: the
+ * lengths of its arrays and the defaults of its fields, which
+ * see the declarations of the unit and no local.
+ */
+static bool _initialize(CodeGen *self, uint32_t reg, uint32_t offset,
+    uint32_t type) {
+    FnState *fs = &self->fn;
+    Type *info = _type(self, type);
+    bool ok = true;
+
+    if (info->kind == KIND_ARRAY) {
+        uint32_t length = _reg(self);
+
+        _load_int(self, length, info->length);
+        _emit(self, cl_abc(CL_OP_SETF, reg, offset, length));
+        fs->free_reg = length;
+        return true;
+    }
+
+    Decl *decl = &self->decls[info->decl];
+
+    for (uint32_t i = 0; i < decl->field_count; i++) {
+        Field *field = &decl->fields[i];
+
+        if (_is_aggregate(self, field->type)) {
+            ok &= _initialize(self, reg, offset + field->offset, field->type);
+        } else if (field->value != CL_AST_NONE) {
+            size_t start = fs->hidden_start, end = fs->hidden_end;
+            uint32_t value = _reg(self);
+
+            fs->hidden_start = 0;
+            fs->hidden_end = fs->locals.count;
+
+            if (_mismatch(self, field->value, field->type,
+                    _expr(self, field->value, value)) == CG_NO_TYPE) {
+                ok = false;
+            } else {
+                _emit(self, cl_abc(CL_OP_SETF, reg, offset + field->offset,
+                    value));
+            }
+
+            fs->hidden_start = start;
+            fs->hidden_end = end;
+            fs->free_reg = value;
+        }
+    }
+
+    return ok;
+}
+
+
+/**
+ * A new struct or array in the frame, a copy of the one at
+ * `from` or, with CG_NO_REG, a fresh one.
+ */
+static bool _new_aggregate(CodeGen *self, AstIndex node, uint32_t reg,
+    uint32_t type, uint32_t from) {
+    uint32_t size = _type(self, type)->size;
+
+    if (!_frame(self, node, reg, size)) {
+        return false;
+    }
+
+    if (from != CG_NO_REG) {
+        return _copy(self, node, reg, from, type);
+    }
+
+    _emit(self, cl_abx(CL_OP_ZERO, reg, size));
+
+    return _initialize(self, reg, 0, type);
+}
+
+
+static bool _local_var(CodeGen *self, AstIndex node) {
+    FnState *fs = &self->fn;
+    AstNode *var = _node(self, node);
+    uint32_t type = CG_NO_TYPE;
+    uint32_t reg = _reg(self);
+
+    if (var->lhs != CL_AST_NONE &&
+        (type = _resolve_type(self, var->lhs)) == CG_NO_TYPE) {
+        return false;
+    }
+
+    if (var->rhs != CL_AST_NONE) {
+        uint32_t found = _expr(self, var->rhs, reg);
+
+        type = (type == CG_NO_TYPE) ? found
+            : _mismatch(self, var->rhs, type, found);
+
+        if (type == CG_NO_TYPE) {
+            return false;
+        }
+
+        if (type == TYPE_VOID) {
+            return _error(self, var->rhs, "expected a value");
+        }
+
+        if (_is_aggregate(self, type)) {
+            uint32_t copy = _reg(self);
+
+            if (!_new_aggregate(self, node, copy, type, reg)) {
+                return false;
+            }
+
+            _emit(self, cl_abc(CL_OP_MOVE, reg, copy, 0));
+        }
+    } else if (var->kind == AST_CONST) {
+        return _error(self, node, "constant needs a value");
+    } else if (type == CG_NO_TYPE) {
+        return _error(self, node, "variable needs a type or a value");
+    } else if (_is_aggregate(self, type)) {
+        if (!_new_aggregate(self, node, reg, type, CG_NO_REG)) {
+            return false;
+        }
+    } else {
+        _emit(self, cl_asbx(CL_OP_LOADI, reg, 0));
+    }
+
+    Local local = {
+        .name = _symbol(self, node),
+        .type = type,
+        .reg = reg,
+        .constant = (var->kind == AST_CONST),
+    };
+
+    if (!local_vector_push(&fs->locals, local)) {
+        return _out_of_memory(self);
+    }
+
+    return true;
+}
+
+
+static bool _return(CodeGen *self, AstIndex node) {
+    FnState *fs = &self->fn;
+    AstIndex value = _node(self, node)->lhs;
+    uint32_t reg;
+
+    if (fs->in_defer) {
+        return _error(self, node, "cannot return from deferred code");
+    }
+
+    if (value == CL_AST_NONE) {
+        if (fs->return_type != TYPE_VOID) {
+            return _error(self, node, "expected a %s to return",
+                _type_name(self, fs->return_type));
+        }
+
+        _run_defers(self, 0);
+        _emit(self, cl_abc(CL_OP_RET0, 0, 0, 0));
+        return true;
+    }
+
+    if (fs->return_type == TYPE_VOID) {
+        return _error(self, value, "function returns nothing");
+    }
+
+    /* deferred code may change the locals, so the value is kept aside */
+    uint32_t type;
+
+    if (fs->defers.count > 0) {
+        reg = _reg(self);
+        type = _expr(self, value, reg);
+    } else {
+        type = _expr_any(self, value, &reg);
+    }
+
+    if (_mismatch(self, value, fs->return_type, type) == CG_NO_TYPE) {
+        return false;
+    }
+
+    _run_defers(self, 0);
+    _emit(self, cl_abc(CL_OP_RET, reg, 0, 0));
+
+    return true;
+}
+
+
+static bool _jump_out(CodeGen *self, AstIndex node, bool is_break) {
+    FnState *fs = &self->fn;
+    Loop *loop = fs->loop;
+
+    if (!loop) {
+        return _error(self, node, "%s outside of a loop",
+            is_break ? "break" : "continue");
+    }
+
+    _run_defers(self, loop->defers);
+    _concat(self, is_break ? &loop->breaks : &loop->continues,
+        _jump(self));
+
+    return true;
+}
+
+
+/**
+ * Loops test their condition at the bottom, after one jump to
+ * it on the way in, so every iteration takes a single jump.
+ */
+static bool _loop(CodeGen *self, AstIndex cond, AstIndex step,
+    AstIndex body) {
+    FnState *fs = &self->fn;
+    Loop loop = {
+        .outer = fs->loop,
+        .breaks = CG_NO_JUMP,
+        .continues = CG_NO_JUMP,
+        .defers = fs->defers.count,
+    };
+    int32_t enter = (cond != CL_AST_NONE) ? _jump(self) : CG_NO_JUMP;
+    uint32_t start = _here(self);
+    bool ok;
+
+    fs->loop = &loop;
+    ok = _block(self, body);
+    fs->loop = loop.outer;
+
+    _patch_here(self, loop.continues);
+
+    if (step != CL_AST_NONE) {
+        ok &= _statement(self, step);
+    }
+
+    _patch_here(self, enter);
+
+    if (cond != CL_AST_NONE) {
+        int32_t back = CG_NO_JUMP;
+
+        ok &= _cond(self, cond, true, &back);
+
+        if (back != CG_NO_JUMP) {
+            _patch(self, back, start);
+        }
+    } else {
+        _jump_back(self, start);
+    }
+
+    _patch_here(self, loop.breaks);
+
+    return ok;
+}
+
+
+static bool _for(CodeGen *self, AstIndex node) {
+    AstNode *loop = _node(self, node);
+    AstIndex *parts = &self->ast->extra[loop->lhs];
+    Scope scope = _scope_enter(self);
+    bool ok = true;
+
+    if (parts[0] != CL_AST_NONE) {
+        ok = _statement(self, parts[0]);
+    }
+
+    ok &= _loop(self, parts[1], parts[2], loop->rhs);
+    _scope_leave(self, &scope);
+
+    return ok;
+}
+
+
+static bool _if(CodeGen *self, AstIndex node) {
+    AstNode *branch = _node(self, node);
+    AstIndex *branches = &self->ast->extra[branch->rhs];
+    int32_t otherwise = CG_NO_JUMP;
+    bool ok = _cond(self, branch->lhs, false, &otherwise);
+
+    ok &= _block(self, branches[0]);
+
+    if (branches[1] != CL_AST_NONE) {
+        int32_t end = _jump(self);
+
+        _patch_here(self, otherwise);
+        ok &= _statement(self, branches[1]);
+        _patch_here(self, end);
+    } else {
+        _patch_here(self, otherwise);
+    }
+
+    return ok;
+}
+
+
+/**
+ * Compares the subject with the values of every arm in turn,
+ * then has the bodies one after the other; there is no falling
+ * from one arm into the next.
+ */
+static bool _switch(CodeGen *self, AstIndex node) {
+    FnState *fs = &self->fn;
+    AstNode *sw = _node(self, node);
+    AstIndex *items = &self->ast->extra[sw->lhs];
+    uint32_t count = sw->rhs - sw->lhs - 1;
+    int32_t *arms = arena_calloc(self->arena, count ? count : 1,
+        sizeof(int32_t));
+    int32_t end = CG_NO_JUMP;
+    uint32_t otherwise = UINT32_MAX;
+    uint32_t top = fs->free_reg;
+    uint32_t subject;
+
+    if (!arms) {
+        return _out_of_memory(self);
+    }
+
+    uint32_t type = _expr_any(self, items[0], &subject);
+
+    if (type == CG_NO_TYPE) {
+        return false;
+    }
+
+    if (_is_aggregate(self, type) || type == TYPE_VOID) {
+        return _error(self, items[0], "cannot switch on %s",
+            _type_name(self, type));
+    }
+
+    uint32_t after = fs->free_reg;
+    bool ok = true;
+
+    for (uint32_t i = 0; i < count; i++) {
+        AstNode *arm = _node(self, items[1 + i]);
+
+        arms[i] = CG_NO_JUMP;
+
+        if (arm->rhs == CL_AST_NONE) {
+            otherwise = i;
+            continue;
+        }
+
+        AstIndex *values = &self->ast->extra[arm->rhs];
+
+        for (AstIndex v = values[0]; v < values[1]; v++) {
+            AstIndex at = self->ast->extra[v];
+            uint32_t value;
+
+            if (_mismatch(self, at, type,
+                    _expr_any(self, at, &value)) == CG_NO_TYPE) {
+                ok = false;
+                continue;
+            }
+
+            _emit(self, cl_abc(type == TYPE_FLOAT ? CL_OP_FEQ : CL_OP_EQ,
+                subject, value, 1));
+            _concat(self, &arms[i], _jump(self));
+            fs->free_reg = after;
+        }
+    }
+
+    /* the else arm is only taken after all the others were tried */
+    _concat(self, (otherwise != UINT32_MAX) ? &arms[otherwise] : &end,
+        _jump(self));
+
+    fs->free_reg = top;
+
+    for (uint32_t i = 0; i < count; i++) {
+        Scope scope = _scope_enter(self);
+
+        _patch_here(self, arms[i]);
+        ok &= _statement(self, _node(self, items[1 + i])->lhs);
+        _scope_leave(self, &scope);
+
+        if (i + 1 < count) {
+            _concat(self, &end, _jump(self));
+        }
+    }
+
+    _patch_here(self, end);
+
+    return ok;
+}
+
+
+static bool _statement(CodeGen *self, AstIndex node) {
+    FnState *fs = &self->fn;
+    AstNode *stmt = _node(self, node);
+    bool ok = true;
+
+    switch (stmt->kind) {
+        case AST_BLOCK:
+            return _block(self, node);
+        case AST_VAR:
+        case AST_CONST:
+            ok = _local_var(self, node);
+            break;
+        case AST_IF:
+            ok = _if(self, node);
+            break;
+        case AST_WHILE:
+            ok = _loop(self, stmt->lhs, CL_AST_NONE, stmt->rhs);
+            break;
+        case AST_FOR:
+            ok = _for(self, node);
+            break;
+        case AST_SWITCH:
+            ok = _switch(self, node);
+            break;
+        case AST_DEFER:
+            if (!defer_vector_push(&fs->defers,
+                    (Defer){ stmt->lhs, fs->locals.count })) {
+                return _out_of_memory(self);
+            }
+
+            break;
+        case AST_RETURN:
+            ok = _return(self, node);
+            break;
+        case AST_BREAK:
+        case AST_CONTINUE:
+            ok = _jump_out(self, node, stmt->kind == AST_BREAK);
+            break;
+        default:
+            ok = (_expr(self, node, CG_NO_REG) != CG_NO_TYPE);
+            break;
+    }
+
+    fs->free_reg = _locals_top(self);
+
+    return ok;
+}
+
+
+/* == functions == */
+
+
+static void _fn_begin(CodeGen *self, AstIndex node, uint32_t return_type) {
+    FnState *fs = &self->fn;
+
+    fs->node = node;
+    fs->code.count = 0;
+    fs->constants.count = 0;
+    fs->locals.count = 0;
+    fs->defers.count = 0;
+    fs->loop = NULL;
+    fs->hidden_start = fs->hidden_end = 0;
+    fs->params = 0;
+    fs->free_reg = fs->max_reg = fs->floor = 0;
+    fs->frame_top = fs->frame_size = 0;
+    fs->return_type = return_type;
+    fs->last_target = 0;
+    fs->in_defer = false;
+    fs->failed = false;
+}
+
+
+/**
+ * How many parameters a function of the unit takes, for the
+ * optimizer to know what a call reads.
+ */
+static int _arity(uint32_t symbol, void *user_data) {
+    CodeGen *self = user_data;
+    uint32_t *count = _map_get(&self->arities, symbol + 1);
+
+    return count ? (int)*count : -1;
+}
+
+
+/**
+ * Ends the function with a RET0, unless it ends with a return
+ * that nothing jumps past, and adds it to CODE, through the
+ * optimizer when there is one.
+ */
+static bool _fn_end(CodeGen *self, str_t name, int length, uint64_t *offset,
+    uint64_t *size) {
+    FnState *fs = &self->fn;
+    size_t count = fs->code.count;
+    Opcode last = count ? CL_OP(fs->code.data[count - 1]) : CL_OP_JMP;
+
+    if ((last != CL_OP_RET && last != CL_OP_RET0) ||
+        fs->last_target >= count) {
+        _emit(self, cl_abc(CL_OP_RET0, 0, 0, 0));
+    }
+
+    if (fs->failed) {
+        return false;
+    }
+
+    BytecodeFunction header = {
+        .code_count = (uint32_t)fs->code.count,
+        .constant_count = (uint32_t)fs->constants.count,
+        .register_count = (uint16_t)(fs->max_reg ? fs->max_reg : 1),
+        .param_count = (uint8_t)fs->params,
+        .flags = (fs->return_type != TYPE_VOID)
+            ? CL_BIT(CL_BYTECODE_RETURNS) : 0,
+        .frame_size = fs->frame_size,
+    };
+    size_t constants = fs->constants.count * sizeof(Constant);
+    size_t code = fs->code.count * sizeof(Instruction);
+    size_t bytes = sizeof(header) + constants + code;
+
+    if (bytes > self->blob_capacity) {
+        uint8_t *blob = realloc(self->blob, bytes);
+
+        if (!blob) {
+            cl_debug("%s: %s\n", __func__, strerror(errno));
+            return _out_of_memory(self);
+        }
+
+        self->blob = blob;
+        self->blob_capacity = bytes;
+    }
+
+    memcpy(self->blob, &header, sizeof(header));
+
+    /* the constants are only allocated by the first one */
+    if (constants > 0) {
+        memcpy(self->blob + sizeof(header), fs->constants.data, constants);
+    }
+
+    memcpy(self->blob + sizeof(header) + constants, fs->code.data, code);
+
+    uint8_t *optimized = NULL;
+    size_t optimized_size = 0;
+    char label[128];
+
+    snprintf(label, sizeof(label), "%.*s", length, name);
+
+    /* a function the optimizer gives up on stays as it is */
+    if (self->passes && pass_manager_optimize(self->passes,
+        (const BytecodeFunction *)self->blob, label, _arity, self,
+        &optimized, &optimized_size)) {
+        *offset = object_writer_code(self->writer, optimized, optimized_size);
+        *size = optimized_size;
+        free(optimized);
+        return true;
+    }
+
+    *offset = object_writer_code(self->writer, self->blob, bytes);
+    *size = bytes;
+
+    return true;
+}
+
+
+static bool _function(CodeGen *self, Decl *decl) {
+    FnState *fs = &self->fn;
+    AstNode *fn = _node(self, decl->node);
+    AstIndex *proto = &self->ast->extra[fn->lhs];
+    uint32_t count = decl->param_count;
+    bool ok = true;
+
+    _fn_begin(self, decl->node, decl->type);
+
+    for (uint32_t i = 0; i < count; i++) {
+        AstIndex param = self->ast->extra[proto[0] + i];
+        Local local = {
+            .name = _symbol(self, param),
+            .type = decl->params[i],
+            .reg = i,
+        };
+
+        for (uint32_t j = 0; j < i; j++) {
+            if (fs->locals.data[j].name == local.name) {
+                int length;
+                str_t name = _name(self, param, &length);
+
+                ok = _error(self, param, "parameter '%.*s' is already "
+                    "declared", length, name);
+            }
+        }
+
+        if (!local_vector_push(&fs->locals, local)) {
+            return _out_of_memory(self);
+        }
+    }
+
+    fs->params = count;
+    fs->floor = fs->free_reg = fs->max_reg = count;
+
+    /* structs and arrays passed by value get a copy of their own */
+    for (uint32_t i = 0; i < count; i++) {
+        if (!decl->byref[i] && _is_aggregate(self, decl->params[i])) {
+            uint32_t copy = _reg(self);
+            AstIndex param = self->ast->extra[proto[0] + i];
+
+            ok &= _new_aggregate(self, param, copy, decl->params[i], i);
+            _emit(self, cl_abc(CL_OP_MOVE, i, copy, 0));
+            fs->free_reg = count;
+        }
+    }
+
+    int length;
+    str_t name = _name(self, decl->node, &length);
+
+    ok &= _block(self, fn->rhs);
+    ok = _fn_end(self, name, length, &decl->code, &decl->code_size) && ok;
+    decl->compiled = ok;
+
+    return ok;
+}
+
+
+/**
+ * The function that sets the globals of the unit that start
+ * with a value, or are structs and arrays, in the order they
+ * are declared. Returns false when there is none to write.
+ */
+static bool _init_function(CodeGen *self, uint64_t *offset, uint64_t *size,
+    AstIndex *first) {
+    FnState *fs = &self->fn;
+    bool any = false;
+
+    for (size_t i = 0; i < self->decl_count; i++) {
+        Decl *decl = &self->decls[i];
+        AstNode *var = _node(self, decl->node);
+        uint32_t reg;
+
+        if (decl->kind != DECL_VAR || decl->state != DECL_RESOLVED ||
+            (var->rhs == CL_AST_NONE && !_is_aggregate(self, decl->type))) {
+            continue;
+        }
+
+        if (!any) {
+            _fn_begin(self, decl->node, TYPE_VOID);
+            *first = decl->node;
+            any = true;
+        }
+
+        if (_is_aggregate(self, decl->type)) {
+            uint32_t from = CG_NO_REG;
+
+            reg = _reg(self);
+
+            if (var->rhs != CL_AST_NONE) {
+                from = _reg(self);
+
+                if (_mismatch(self, var->rhs, decl->type,
+                        _expr(self, var->rhs, from)) == CG_NO_TYPE) {
+                    continue;
+                }
+            }
+
+            if (!_new_aggregate(self, decl->node, reg, decl->type, from)) {
+                continue;
+            }
+        } else if (_mismatch(self, var->rhs, decl->type,
+                       _expr_any(self, var->rhs, &reg)) == CG_NO_TYPE) {
+            continue;
+        }
+
+        _emit(self, cl_abx(CL_OP_SETG, reg, decl->global));
+        fs->free_reg = 0;
+    }
+
+    return any && _fn_end(self, ".init", 5, offset, size);
+}
+
+
+/* == units == */
+
+
+/**
+ * Makes a declaration of every top-level node, numbering the
+ * symbols and globals they will have.
+ */
+static bool _collect(CodeGen *self) {
+    AstNode *root = &self->ast->nodes[0];
+    size_t count = root->rhs - root->lhs;
+    uint32_t symbol = self->symbol_count;
+    uint32_t global = self->global_count;
+
+    self->decl_count = 0;
+    self->decls = arena_calloc(self->arena, count ? count : 1, sizeof(Decl));
+
+    if (!self->decls) {
+        return _out_of_memory(self);
+    }
+
+    for (AstIndex i = root->lhs; i < root->rhs; i++) {
+        AstIndex at = self->ast->extra[i];
+        AstNode *node = _node(self, at);
+        Decl decl = { .node = at, .name = _symbol(self, at) };
+
+        switch (node->kind) {
+            case AST_FN:     decl.kind = DECL_FN; break;
+            case AST_VAR:    decl.kind = DECL_VAR; break;
+            case AST_CONST:  decl.kind = DECL_CONST; break;
+            case AST_STRUCT: decl.kind = DECL_STRUCT; break;
+            case AST_ENUM:   decl.kind = DECL_ENUM; break;
+            default:         decl.kind = DECL_IMPORT; break;
+        }
+
+        if (decl.kind == DECL_IMPORT) {
+            AstNode *path = _node(self, node->lhs);
+
+            if (node->rhs != 0) {
+                decl.name = tokens_value(self->tokens, node->rhs);
+            } else if (path->kind != AST_LITERAL) {
+                decl.name = _symbol(self, node->lhs);
+            } else {
+                continue;
+            }
+
+            decl.node = node->lhs;
+            decl.builtin = (path->kind == AST_NAME &&
+                _is_named(self, _symbol(self, node->lhs), "io"));
+            decl.state = DECL_RESOLVED;
+        } else {
+            decl.symbol = symbol++;
+            decl.global = (decl.kind == DECL_VAR) ? global++ : 0;
+        }
+
+        if (_map_get(&self->names, decl.name)) {
+            int length;
+            str_t name = _name(self, decl.node, &length);
+
+            _error(self, decl.node, "'%.*s' is already declared", length,
+                name);
+            continue;
+        }
+
+        if (!_map_put(&self->names, decl.name, (uint32_t)self->decl_count)) {
+            return _out_of_memory(self);
+        }
+
+        self->decls[self->decl_count++] = decl;
+    }
+
+    return !self->failed;
+}
+
+
+/**
+ * Stores the value of a constant, as its 8 bytes or the bytes
+ * of a string.
+ */
+static void _const_symbol(CodeGen *self, Decl *decl, ObjectSymbol *symbol) {
+    ConstValue *value = &decl->value;
+    const void *bytes = &value->integer;
+    uint32_t size = sizeof(value->integer);
+
+    if (value->type == TYPE_STRING) {
+        bytes = interner_name(self->symbols, value->string, &size);
+    } else if (value->type == TYPE_FLOAT) {
+        symbol->flags |= CL_BIT(CL_OBJECT_SYM_FLOAT);
+    }
+
+    if (bytes) {
+        symbol->section = CL_OBJECT_SECTION_CONSTANTS;
+        symbol->value = object_writer_constant(self->writer, bytes, size);
+        symbol->size = size;
+    }
+}
+
+
+static ObjectSymbol _symbol_of(CodeGen *self, AstIndex node,
+    uint8_t kind) {
+    AstNode *decl = _node(self, node);
+    ObjectSymbol symbol = { .file = self->file, .kind = kind };
+    uint32_t length = 0;
+    str_t name = interner_name(self->symbols, _symbol(self, node), &length);
+    uint32_t column;
+
+    if (CL_BIT_ISSET(CL_AST_PUB, decl->flags)) {
+        symbol.flags |= CL_BIT(CL_OBJECT_SYM_PUB);
+    }
+
+    if (CL_BIT_ISSET(CL_AST_STATIC, decl->flags)) {
+        symbol.flags |= CL_BIT(CL_OBJECT_SYM_STATIC);
+    }
+
+    symbol.name = object_writer_string(self->writer, name ? name : "",
+        name ? length : 0);
+    source_locate(self->src, self->tokens->offsets[decl->token],
+        &symbol.line, &column);
+
+    return symbol;
+}
+
+
+/**
+ * Adds the symbols of the unit, in the order they were
+ * numbered, and the one of its init function.
+ */
+static bool _add_symbols(CodeGen *self, bool has_init, uint64_t init_code,
+    uint64_t init_size, AstIndex init_node) {
+    static const uint8_t KINDS[] = {
+        [DECL_FN] = CL_OBJECT_SYM_FN,
+        [DECL_VAR] = CL_OBJECT_SYM_VAR,
+        [DECL_CONST] = CL_OBJECT_SYM_CONST,
+        [DECL_STRUCT] = CL_OBJECT_SYM_STRUCT,
+        [DECL_ENUM] = CL_OBJECT_SYM_ENUM,
+    };
+
+    for (size_t i = 0; i < self->decl_count; i++) {
+        Decl *decl = &self->decls[i];
+
+        if (decl->kind == DECL_IMPORT) {
+            continue;
+        }
+
+        ObjectSymbol symbol = _symbol_of(self, decl->node, KINDS[decl->kind]);
+
+        if (decl->kind == DECL_CONST) {
+            _const_symbol(self, decl, &symbol);
+        } else if (decl->kind == DECL_FN && decl->compiled) {
+            symbol.section = CL_OBJECT_SECTION_CODE;
+            symbol.value = decl->code;
+            symbol.size = decl->code_size;
+        }
+
+        if (object_writer_symbol(self->writer, symbol) != decl->symbol) {
+            return _out_of_memory(self);
+        }
+
+        if (decl->kind == DECL_FN && self->entry == CL_OBJECT_NO_ENTRY &&
+            _is_named(self, decl->name, "main")) {
+            self->entry = decl->symbol;
+        }
+
+        self->symbol_count++;
+        self->global_count += (decl->kind == DECL_VAR);
+    }
+
+    if (has_init) {
+        ObjectSymbol symbol = _symbol_of(self, init_node, CL_OBJECT_SYM_FN);
+
+        symbol.name = object_writer_string(self->writer, ".init", 5);
+        symbol.flags = CL_BIT(CL_OBJECT_SYM_INIT);
+        symbol.section = CL_OBJECT_SECTION_CODE;
+        symbol.value = init_code;
+        symbol.size = init_size;
+
+        if (object_writer_symbol(self->writer, symbol) != self->symbol_count) {
+            return _out_of_memory(self);
+        }
+
+        self->symbol_count++;
+    }
+
+    return true;
+}
+
+
+/* == code generator == */
+
+
+CodeGen *codegen_new(ObjectWriter *writer, PassManager *passes) {
+    CodeGen *self = calloc(1, sizeof(CodeGen));
+
+    if (!self) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    self->arena = arena_new(0);
+
+    if (!self->arena) {
+        free(self);
+        return NULL;
+    }
+
+    self->writer = writer;
+    self->passes = passes;
+    self->entry = CL_OBJECT_NO_ENTRY;
+
+    return self;
+}
+
+
+/**
+ * Compiles one unit. Its symbols are only added when all of it
+ * compiled, so a failed unit leaves the numbering of the next
+ * ones as it was.
+ */
+bool codegen_unit(CodeGen *self, Source *src, TokenStream *tokens, Ast *ast,
+    Interner *symbols) {
+    static const Type BUILTINS[] = {
+        [TYPE_VOID] = { .kind = KIND_VOID },
+        [TYPE_INT] = { .kind = KIND_INT },
+        [TYPE_FLOAT] = { .kind = KIND_FLOAT },
+        [TYPE_BOOL] = { .kind = KIND_BOOL },
+        [TYPE_STRING] = { .kind = KIND_STRING },
+    };
+
+    arena_reset(self->arena);
+    _map_clear(&self->names);
+
+    self->src = src;
+    self->tokens = tokens;
+    self->ast = ast;
+    self->symbols = symbols;
+    self->types.count = 0;
+    self->errors = 0;
+    self->failed = false;
+    self->file = object_writer_string(self->writer, src->path,
+        strlen(src->path));
+
+    for (size_t i = 0; i < CL_N_ELEMS(BUILTINS); i++) {
+        _type_add(self, BUILTINS[i]);
+    }
+
+    if (!_collect(self)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < self->decl_count; i++) {
+        _resolve(self, &self->decls[i]);
+    }
+
+    /* what the optimizer needs to know of a call */
+    _map_clear(&self->arities);
+
+    for (size_t i = 0; i < self->decl_count && self->passes; i++) {
+        Decl *decl = &self->decls[i];
+
+        if (decl->kind == DECL_FN && decl->state == DECL_RESOLVED &&
+            !_map_put(&self->arities, decl->symbol + 1, decl->param_count)) {
+            return _out_of_memory(self);
+        }
+    }
+
+    for (size_t i = 0; i < self->decl_count; i++) {
+        Decl *decl = &self->decls[i];
+
+        if (decl->kind == DECL_FN && decl->state == DECL_RESOLVED &&
+            _node(self, decl->node)->rhs != CL_AST_NONE) {
+            _function(self, decl);
+        }
+    }
+
+    uint64_t init_code = 0, init_size = 0;
+    AstIndex init_node = CL_AST_NONE;
+    bool has_init = _init_function(self, &init_code, &init_size, &init_node);
+
+    if (self->failed) {
+        return false;
+    }
+
+    return _add_symbols(self, has_init, init_code, init_size, init_node);
+}
+
+
+uint32_t codegen_entry(CodeGen *self) {
+    return self->entry;
+}
+
+
+void codegen_free(CodeGen *self) {
+    if (!self) {
+        return;
+    }
+
+    FnState *fs = &self->fn;
+
+    instruction_vector_free(&fs->code);
+    constant_vector_free(&fs->constants);
+    local_vector_free(&fs->locals);
+    defer_vector_free(&fs->defers);
+    type_vector_free(&self->types);
+    free(self->names.entries);
+    free(self->strings.entries);
+    free(self->arities.entries);
+    free(self->blob);
+    arena_free(self->arena);
+    free(self);
+}
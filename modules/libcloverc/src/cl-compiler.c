@@ -1,109 +1,1527 @@
+#define _XOPEN_SOURCE 700 /* realpath */
+
+#define CL_LOG_SCOPE "compiler"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
 #include "cl-compiler.h"
 #include "cl-source.h"
 #include "cl-log.h"
+#include "cl-arena.h"
+#include "cl-pool.h"
 #include "cl-types.h"
+#include "cl-tokens.h"
+#include "cl-intern.h"
+#include "cl-lexer.h"
+#include "cl-ast.h"
+#include "cl-parser.h"
+#include "cl-interface.h"
+#include "cl-object.h"
+#include "cl-codegen.h"
+#include "cl-diagnostic.h"
 
 #ifdef DEBUG
 #include <stdio.h>
 #endif
 
 
-bool cl_lex(Source *src, Vector *tokens);
+/**
+ * Modules that come with the compiler and have no file.
+ */
+static const str_t BUILTIN_MODULES[] = {
+    "io",
+};
+
+
+/**
+ * A module imported by a unit: the real path of its file, NULL
+ * for a builtin module, and the unit compiling it once it has
+ * been scheduled.
+ */
+CL_TYPE(UnitImport) {
+    char                    *key;
+    uint32_t                 token;     /* the import keyword */
+    struct __CL_TNAME(Unit) *unit;
+};
 
 
+/**
+ * A single input file, or a module imported by one. Units are
+ * loaded and compiled by the worker pool; everything a unit
+ * prints or reports is kept in its buffers until all units are
+ * done, and then written out in import order, so the output
+ * does not depend on the number of jobs.
+ *
+ * Everything a unit loads lives in its own arena, released at
+ * once when the unit is done. A unit kept in a UnitCache also
+ * keeps its output and its imports, which are used again when
+ * the unit is reused as is.
+ */
 CL_TYPE(Unit) {
-    Source *src;
-    Vector *tokens;
+    char        *path;
+    char        *key;       /* real path, NULL when not cacheable */
+    bool         heap;      /* allocated with malloc, not from an arena */
+
+    Arena       *arena;
+    Source      *src;
+    TokenStream *tokens;
+    Ast         *ast;
+    Interner    *symbols;   /* shared by all units */
+
+    /* the tokens and the tree when read from the interface */
+    ModuleInterface *interface;
+
+    UnitImport  *imports;
+    size_t       import_count;
+
+    struct __CL_TNAME(Compilation) *comp;
+
+    bool imported;  /* not given on the command line */
+    bool loaded;
+    bool compiled;
+    bool clean;     /* compiled without printing anything */
+
+    bool stale;     /* the file changed since it was loaded */
+    bool reused;    /* taken from the cache as is */
+    bool in_use;
+
+    uint8_t mark;   /* while sorting the import graph */
+
+    LogBuffer   load_log;
+    LogBuffer   compile_log;
+    DiagBuffer *diags;
+};
+
+
+typedef Unit *UnitRef;
+
+CL_VECTOR_DEFINE(UnitRef, unit_ref)
+
+
+/**
+ * State of one cl_compile call. The command line units come
+ * first in `units`, then the imported ones as workers find
+ * them; `table` finds a unit by real path so that a module is
+ * compiled once however many units import it. Anything that
+ * lives as long as the compilation comes from its arena, which
+ * like the table is only used under the lock while workers run.
+ */
+CL_TYPE(Compilation) {
+    Arena      *arena;
+    Interner   *symbols;
+    UnitCache  *cache;
+    TokenCache *token_cache;
+    Vector     *import_paths;
+    ThreadPool *pool;
+    bool        interfaces;
+
+    pthread_mutex_t lock;
+    UnitRefVector   units;
+    size_t          root_count;
+    Unit          **table;
+    size_t          table_capacity;
+    bool            failed;     /* ran out of memory */
+    PassManager    *passes;     /* NULL writes the bytecode as is */
+
+    Unit      **order;      /* every module before its importers */
+    DiagBuffer *diags;      /* import cycles */
+};
+
+
+struct __CL_TNAME(UnitCache) {
+    UnitRefVector  units;
+    Interner      *symbols; /* outlives the compilations */
+    UnitCacheAddFn on_add;
+    void          *user_data;
 };
 
 
-static bool unit_init(Unit *self, str_t file) {
-    self->tokens = vector_new(sizeof(Token));
+/**
+ * Creates a unit from the arena, or with malloc when there is
+ * none, so it can outlive the compilation in a cache.
+ */
+static Unit *unit_new(Arena *arena, str_t path, Interner *symbols) {
+    Unit *self = arena ? arena_calloc(arena, 1, sizeof(Unit))
+                       : calloc(1, sizeof(Unit));
+
+    if (!self) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    self->heap = (arena == NULL);
+    self->symbols = symbols;
+    self->path = arena ? arena_strdup(arena, path) : strdup(path);
+    self->diags = diag_buffer_new();
+
+    if (!self->path || !self->diags) {
+        if (self->heap) {
+            free(self->path);
+            diag_buffer_free(self->diags);
+            free(self);
+        }
+
+        return NULL;
+    }
+
+    return self;
+}
+
+
+static bool unit_load(Unit *self) {
+    self->imports = NULL;
+    self->import_count = 0;
+
+    interface_free(self->interface);
+    self->interface = NULL;
+
+    if (!self->arena) {
+        self->arena = arena_new(0);
+    } else {
+        arena_reset(self->arena);
+    }
 
-    if (!self->tokens) {
+    if (!self->arena) {
         return false;
     }
 
-    self->src = source_new(file);
+    self->tokens = tokens_new(self->arena);
+    self->ast = self->tokens ? ast_new(self->arena) : NULL;
+
+    /* a cached unit outlives the compile, and its file may be
+       truncated by an edit before the change is noticed */
+    if (self->ast) {
+        self->src = self->heap ? source_read(self->arena, self->path)
+                               : source_new(self->arena, self->path);
+    } else {
+        self->src = NULL;
+    }
+
+    return self->src != NULL;
+}
+
+
+/**
+ * Spells an imported module path, `a.b.c` with `sep` between
+ * the names and `suffix` after them, into a new string.
+ */
+static char *_module_name(Unit *self, AstIndex node, char sep,
+    str_t suffix) {
+    AstNode *nodes = self->ast->nodes;
+    TokenStream *tokens = self->tokens;
+    size_t suffix_length = strlen(suffix);
+    size_t length = suffix_length;
+
+    for (AstIndex i = node; ; i = nodes[i].lhs) {
+        length += tokens->lengths[nodes[i].token] + 1;
+
+        if (nodes[i].kind != AST_ACCESS) {
+            break;
+        }
+    }
+
+    char *name = malloc(length);
+
+    if (!name) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    /* the names come last to first, so fill in from the end */
+    size_t end = length - suffix_length - 1;
+
+    memcpy(&name[end], suffix, suffix_length + 1);
+
+    for (AstIndex i = node; ; i = nodes[i].lhs) {
+        uint32_t token = nodes[i].token;
+        uint32_t token_length = tokens->lengths[token];
+
+        end -= token_length;
+        memcpy(&name[end], source_get(self->src, tokens->offsets[token]),
+            token_length);
+
+        if (nodes[i].kind != AST_ACCESS) {
+            break;
+        }
+
+        name[--end] = sep;
+    }
+
+    return name;
+}
+
+
+/**
+ * Returns the real path of `name` in `dir` when it is a file.
+ */
+static char *_find_file(str_t dir, str_t name) {
+    size_t length = strlen(dir) + strlen(name) + 2;
+    char *path = malloc(length);
+
+    if (!path) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    if (*name == '/') {
+        snprintf(path, length, "%s", name);
+    } else {
+        snprintf(path, length, "%s/%s", dir, name);
+    }
+
+    char *key = realpath(path, NULL);
+    struct stat st;
+
+    free(path);
+
+    if (key && (stat(key, &st) != 0 || !S_ISREG(st.st_mode))) {
+        free(key);
+        return NULL;
+    }
+
+    return key;
+}
+
+
+/**
+ * Looks for the file of a module next to the importing file,
+ * then in every import path, in order.
+ */
+static char *_find_module(Unit *self, str_t file) {
+    str_t slash = strrchr(self->path, '/');
+    char *key;
+
+    if (!slash) {
+        key = _find_file(".", file);
+    } else {
+        size_t length = (size_t)(slash - self->path);
+        char *dir = strndup(self->path, length ? length : 1);
+
+        key = dir ? _find_file(dir, file) : NULL;
+        free(dir);
+    }
+
+    Vector *paths = self->comp->import_paths;
+
+    for (size_t i = 0; !key && paths && i < paths->count; i++) {
+        key = _find_file(*vector_getp(paths, i), file);
+    }
+
+    return key;
+}
+
+
+static bool _is_builtin(str_t name) {
+    for (size_t i = 0; i < CL_N_ELEMS(BUILTIN_MODULES); i++) {
+        if (strcmp(BUILTIN_MODULES[i], name) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 
-    if (!self->src) {
-        vector_free(self->tokens);
+/**
+ * Finds the file of one import: `import a.b;` is the builtin
+ * module a.b or the file a/b.cl, `import "x.cl";` is the file
+ * x.cl. `*key` is the real path of the file, NULL for a builtin
+ * module or a file that is not found.
+ */
+static bool _locate_import(Unit *self, AstNode *node, char **name,
+    char **key) {
+    AstNode path = self->ast->nodes[node->lhs];
+    char *file;
+
+    if (path.kind == AST_LITERAL) {
+        *name = strdup(interner_name(self->symbols,
+            tokens_value(self->tokens, path.token), NULL));
+        file = *name ? strdup(*name) : NULL;
+    } else {
+        *name = _module_name(self, node->lhs, '.', "");
+        file = _module_name(self, node->lhs, '/', ".cl");
+    }
+
+    if (!*name || !file) {
+        free(*name);
+        free(file);
+        *name = NULL;
+        cl_error("out of memory!\n");
         return false;
     }
 
+    bool builtin = (path.kind != AST_LITERAL) && _is_builtin(*name);
+
+    *key = builtin ? NULL : _find_module(self, file);
+    free(file);
+
     return true;
 }
 
 
-static bool unit_compile(Unit *self) {
-    if (!cl_lex(self->src, self->tokens)) {
+/**
+ * Resolves one import, reporting a module that is not found.
+ */
+static bool unit_resolve_import(Unit *self, AstNode *node,
+    UnitImport *import) {
+    AstNode path = self->ast->nodes[node->lhs];
+    char *name;
+    char *key;
+
+    import->token = node->token;
+    import->key = NULL;
+    import->unit = NULL;
+
+    if (!_locate_import(self, node, &name, &key)) {
+        return false;
+    }
+
+    bool found = (path.kind != AST_LITERAL) && _is_builtin(name);
+
+    if (key) {
+        import->key = arena_strdup(self->arena, key);
+        found = (import->key != NULL);
+
+        if (!found) {
+            cl_error("out of memory!\n");
+        }
+    } else if (!found) {
+        DiagLocation loc = {
+            .offset = self->tokens->offsets[path.token],
+            .length = self->tokens->lengths[path.token],
+            .caret = 0,
+            .src = self->src,
+        };
+
+        diag_error(loc, "cannot find module '%s'", name);
+    }
+
+    free(key);
+    free(name);
+
+    return found;
+}
+
+
+/**
+ * Finds the modules the unit imports, in source order.
+ */
+static bool unit_find_imports(Unit *self) {
+    AstNode *nodes = self->ast->nodes;
+    AstIndex *extra = self->ast->extra;
+    size_t count = 0;
+
+    for (AstIndex i = nodes[0].lhs; i < nodes[0].rhs; i++) {
+        count += (nodes[extra[i]].kind == AST_IMPORT);
+    }
+
+    if (count == 0) {
+        return true;
+    }
+
+    self->imports = arena_calloc(self->arena, count, sizeof(UnitImport));
+
+    if (!self->imports) {
+        cl_error("out of memory!\n");
+        return false;
+    }
+
+    bool resolved = true;
+
+    for (AstIndex i = nodes[0].lhs; i < nodes[0].rhs; i++) {
+        AstNode *node = &nodes[extra[i]];
+
+        if (node->kind == AST_IMPORT) {
+            UnitImport *import = &self->imports[self->import_count++];
+
+            resolved &= unit_resolve_import(self, node, import);
+        }
+    }
+
+    return resolved;
+}
+
+
+/**
+ * Whether an import of a unit taken from the cache would now
+ * find another file, or none: a module was created, deleted or
+ * moved, or the import paths are not the ones the unit was
+ * compiled with.
+ */
+static bool unit_imports_moved(Unit *self) {
+    AstNode *nodes = self->ast->nodes;
+    AstIndex *extra = self->ast->extra;
+    size_t index = 0;
+    bool moved = false;
+
+    if (self->import_count == 0) {
         return false;
     }
 
+    for (AstIndex i = nodes[0].lhs; i < nodes[0].rhs && !moved &&
+         index < self->import_count; i++) {
+        AstNode *node = &nodes[extra[i]];
+
+        if (node->kind != AST_IMPORT) {
+            continue;
+        }
+
+        str_t old_key = self->imports[index++].key;
+        char *name;
+        char *key;
+
+        if (!_locate_import(self, node, &name, &key)) {
+            return true;
+        }
+
+        moved = (key == NULL) != (old_key == NULL) ||
+            (key && strcmp(key, old_key) != 0);
+
+        free(key);
+        free(name);
+    }
+
+    return moved;
+}
+
+
+/**
+ * Everything that follows lexing.
+ */
+static bool unit_process(Unit *self) {
+    self->imports = NULL;
+    self->import_count = 0;
+
+    bool parsed = cl_parse(self->src, self->tokens, self->ast);
+
 #ifdef DEBUG
     /* dump tokens */
+    FILE *out = cl_log_stream(STDOUT_FILENO);
+
     for (size_t i = 0; i < self->tokens->count; i++) {
-        Token *tk = vector_get(self->tokens, i);
+        Token tk = tokens_get(self->tokens, i);
+        uint32_t line, column;
+
+        source_locate(self->src, tk.offset, &line, &column);
 
-        fwrite(source_get(self->src, tk->offset), 1, tk->length, stdout);
-        putchar('\n');
+        fprintf(out, "%u:%u: ", line, column);
+        fwrite(source_get(self->src, tk.offset), 1, tk.length, out);
+        fputc('\n', out);
+    }
+
+    if (parsed) {
+        ast_dump(self->ast, self->tokens, self->src, out);
     }
 #endif /* !DEBUG */
 
+    return parsed && unit_find_imports(self);
+}
+
+
+/**
+ * The lexer and the diagnostics take the text to be UTF-8, so
+ * anything else is reported at its first malformed sequence
+ * and not compiled.
+ */
+static bool unit_check_utf8(Unit *self) {
+    Source *src = self->src;
+
+    if (source_is_utf8(src)) {
+        return true;
+    }
+
+    DiagLocation loc = {
+        .offset = (uint32_t)src->utf8_error,
+        .length = 1,
+        .caret = 0,
+        .src = src,
+    };
+
+    diag_error(loc, "invalid UTF-8 byte 0x%02X",
+        (uint8_t)src->text[src->utf8_error]);
+
+    return false;
+}
+
+
+/**
+ * Lexes the unit, or takes its tokens from the token cache when
+ * the same text was lexed before. Only streams lexed without a
+ * single diagnostic are stored, so a hit never hides one.
+ */
+static bool unit_lex(Unit *self) {
+    TokenCache *cache = self->comp->token_cache;
+
+    if (cache &&
+        token_cache_load(cache, self->src, self->tokens, self->symbols)) {
+        return true;
+    }
+
+    size_t reported = self->diags->items.count;
+
+    if (!cl_lex(self->src, self->tokens, self->symbols)) {
+        return false;
+    }
+
+    if (cache && self->diags->items.count == reported) {
+        token_cache_store(cache, self->src, self->tokens, self->symbols);
+    }
+
     return true;
 }
 
 
-static void unit_deinit(Unit *self) {
-    source_free(self->src);
-    vector_free(self->tokens);
+static bool unit_compile(Unit *self) {
+    if (!unit_check_utf8(self)) {
+        return false;
+    }
+
+    if (!unit_lex(self)) {
+        return false;
+    }
+
+    return unit_process(self);
 }
 
 
-static bool _compile_all_units(Vector *units) {
-    for (size_t i = 0; i < units->count; i++) {
-        Unit *unit = vector_get(units, i);
+/**
+ * Takes the tokens and the tree of an imported module from its
+ * interface, when there is one made from the same text, so the
+ * module is neither lexed nor parsed. Its imports are resolved
+ * as usual, and its diagnostics point into the loaded text.
+ */
+static bool unit_read_interface(Unit *self) {
+    char *path = interface_path(self->path);
+    ModuleInterface *interface = path
+        ? interface_load(path, self->src, self->symbols) : NULL;
 
-        if (!unit_compile(unit)) {
-            return false;
-        }
+    free(path);
+
+    if (!interface) {
+        return false;
     }
 
+    self->interface = interface;
+    self->tokens = &interface->tokens;
+    self->ast = &interface->ast;
+
+#ifdef DEBUG
+    ast_dump(self->ast, self->tokens, self->src,
+        cl_log_stream(STDOUT_FILENO));
+#endif /* !DEBUG */
+
     return true;
 }
 
 
-bool cl_compile(Vector *files, str_t output_file) {
-    Vector *units = vector_new(sizeof(Unit));
+static void unit_write_interface(Unit *self) {
+    char *path = interface_path(self->path);
+
+    if (path && !interface_write(path, self->src, self->tokens, self->ast,
+        self->symbols)) {
+        cl_debug("no interface written for %s\n", self->path);
+    }
+
+    free(path);
+}
+
 
-    if (!units) {
+/**
+ * Brings a cached unit whose file changed up to date by diffing
+ * the old and the new text and re-lexing only the changed part.
+ * Only done for units that compiled without any output, where
+ * the result cannot differ from a full compile, and whose text
+ * is a copy rather than a mapping of the file; returns false
+ * when the unit must be loaded from scratch instead.
+ */
+static bool unit_relex(Unit *self) {
+    if (!self->loaded || !self->clean) {
         return false;
     }
 
-    Unit unit;
-    bool success = true;
+    /* a mapping may already show the new text, or part of it */
+    if (CL_BIT_ISSET(CL_SOURCE_MAPPED, self->src->flags)) {
+        return false;
+    }
 
-    for (size_t i = 0; i < files->count; i++) {
-        str_t path = *vector_getp(files, i);
+    Source *fresh = source_read(NULL, self->path);
 
-        if (!unit_init(&unit, path)) {
-            success = false;
-            goto cleanup;
+    if (!fresh) {
+        return false;
+    }
+
+    size_t old_length = self->src->length;
+    size_t new_length = fresh->length;
+    size_t prefix = 0;
+    size_t suffix = 0;
+
+    while (prefix < old_length && prefix < new_length &&
+           self->src->text[prefix] == fresh->text[prefix]) {
+        prefix++;
+    }
+
+    while (suffix < old_length - prefix && suffix < new_length - prefix &&
+           self->src->text[old_length - suffix - 1] ==
+           fresh->text[new_length - suffix - 1]) {
+        suffix++;
+    }
+
+    SourceEdit edit = {
+        .offset = (uint32_t)prefix,
+        .removed = (uint32_t)(old_length - prefix - suffix),
+        .text = fresh->text + prefix,
+        .length = (uint32_t)(new_length - prefix - suffix),
+    };
+
+    bool relexed = new_length <= UINT32_MAX &&
+        cl_relex(self->src, self->tokens, edit, self->symbols) &&
+        source_is_utf8(self->src) && self->diags->items.count == 0;
+
+    source_free(fresh);
+
+    return relexed;
+}
+
+
+/**
+ * Prepares the output buffers for a new run of the unit.
+ */
+static bool unit_reset_output(Unit *self) {
+    log_buffer_discard(&self->load_log);
+    log_buffer_discard(&self->compile_log);
+    diag_buffer_clear(self->diags);
+
+    return log_buffer_init(&self->load_log) &&
+           log_buffer_init(&self->compile_log);
+}
+
+
+static void unit_free(Unit *self) {
+    if (self->loaded) {
+        source_free(self->src);
+    }
+
+    interface_free(self->interface);
+
+    arena_free(self->arena);
+
+    log_buffer_discard(&self->load_log);
+    log_buffer_discard(&self->compile_log);
+    diag_buffer_free(self->diags);
+
+    if (self->heap) {
+        free(self->path);
+        free(self->key);
+        free(self);
+    }
+}
+
+
+/* == import graph == */
+
+
+#define UNIT_UNSEEN     0
+#define UNIT_VISITING   1
+#define UNIT_DONE       2
+
+
+static Unit *unit_cache_take(UnitCache *self, str_t path);
+static void unit_cache_put(UnitCache *self, Unit *unit);
+static void _start_unit(Compilation *comp, Unit *unit);
+
+
+static uint64_t _hash_key(str_t key) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+
+    for (; *key; key++) {
+        hash = (hash ^ (uint8_t)*key) * 0x100000001B3ULL;
+    }
+
+    return hash;
+}
+
+
+/**
+ * Returns the slot of a real path in the table: the unit with
+ * that path, or the empty slot where it goes.
+ */
+static Unit **_table_slot(Unit **table, size_t capacity, str_t key) {
+    size_t mask = capacity - 1;
+
+    for (size_t i = _hash_key(key) & mask; ; i = (i + 1) & mask) {
+        if (!table[i] || strcmp(table[i]->key, key) == 0) {
+            return &table[i];
         }
+    }
+}
 
-        if (!vector_push(units, &unit)) {
-            success = false;
-            goto cleanup;
+
+/**
+ * Adds a unit to the table, which is kept at most half full.
+ * A path already in there keeps its first unit.
+ */
+static bool _table_add(Compilation *comp, Unit *unit) {
+    if (2 * (comp->units.count + 1) > comp->table_capacity) {
+        size_t capacity = comp->table_capacity ? 2 * comp->table_capacity
+                                               : 64;
+        Unit **table = calloc(capacity, sizeof(Unit *));
+
+        if (!table) {
+            cl_debug("%s: %s\n", __func__, strerror(errno));
+            return false;
+        }
+
+        for (size_t i = 0; i < comp->table_capacity; i++) {
+            if (comp->table[i]) {
+                *_table_slot(table, capacity, comp->table[i]->key) =
+                    comp->table[i];
+            }
         }
+
+        free(comp->table);
+        comp->table = table;
+        comp->table_capacity = capacity;
     }
 
-    if (!_compile_all_units(units)) {
-        success = false;
+    Unit **slot = _table_slot(comp->table, comp->table_capacity, unit->key);
+
+    if (!*slot) {
+        *slot = unit;
     }
 
-cleanup:
-    vector_iter(units, (VectorCallbackFn)unit_deinit);
-    vector_free(units);
+    return true;
+}
+
+
+/**
+ * Creates the unit of a file given on the command line, or of
+ * an imported module, and adds it to the compilation. Called
+ * with the lock held once workers run.
+ */
+static Unit *_add_unit(Compilation *comp, str_t path, __Nullable str_t key) {
+    Unit *unit = comp->cache ? unit_cache_take(comp->cache, path)
+                             : unit_new(comp->arena, path, comp->symbols);
+
+    if (!unit) {
+        return NULL;
+    }
+
+    if (!comp->cache) {
+        char *real = key ? NULL : realpath(path, NULL);
+
+        if (key || real) {
+            unit->key = arena_strdup(comp->arena, key ? key : real);
+        }
+
+        free(real);
+    }
+
+    unit->comp = comp;
+    unit->imported = (key != NULL);
+    unit->mark = UNIT_UNSEEN;
+
+    bool added = (unit->reused || unit_reset_output(unit)) &&
+        unit_ref_vector_push(&comp->units, unit);
+
+    if (!added) {
+        if (comp->cache) {
+            unit_cache_put(comp->cache, unit);
+        } else {
+            unit_free(unit);
+        }
+
+        return NULL;
+    }
+
+    if (unit->key && !_table_add(comp, unit)) {
+        return NULL;
+    }
+
+    return unit;
+}
+
+
+/**
+ * Returns the unit of an imported module, creating and starting
+ * it the first time the module is seen.
+ */
+static Unit *_require_module(Compilation *comp, str_t key) {
+    pthread_mutex_lock(&comp->lock);
+
+    Unit *unit = comp->table_capacity
+        ? *_table_slot(comp->table, comp->table_capacity, key) : NULL;
+    bool found = (unit != NULL);
+
+    if (!found) {
+        unit = _add_unit(comp, key, key);
+        comp->failed |= (unit == NULL);
+    }
+
+    pthread_mutex_unlock(&comp->lock);
+
+    if (unit && !found) {
+        _start_unit(comp, unit);
+    }
+
+    return unit;
+}
+
+
+/**
+ * Starts the modules a unit imports as soon as the unit has been
+ * parsed, so a module is loaded while its importer is still
+ * waiting on others, and the front end takes about as long as
+ * the longest chain of imports.
+ */
+static void _schedule_imports(Unit *self) {
+    for (size_t i = 0; i < self->import_count; i++) {
+        UnitImport *import = &self->imports[i];
+
+        import->unit = import->key
+            ? _require_module(self->comp, import->key) : NULL;
+    }
+}
+
+
+/**
+ * Worker job: loads and compiles one unit.
+ */
+static void _unit_job(Unit *self) {
+    bool relexed = false;
+
+    log_buffer_capture(&self->load_log);
+    diag_buffer_capture(self->diags);
+
+    if (self->stale) {
+        relexed = unit_relex(self);
+
+        if (!relexed && !unit_reset_output(self)) {
+            cl_debug("%s: %s\n", __func__, strerror(errno));
+        }
+    }
+
+    if (relexed) {
+        log_buffer_capture(&self->compile_log);
+        self->compiled = unit_process(self);
+    } else {
+        if (self->loaded) {
+            source_free(self->src);
+        }
+
+        self->compiled = false;
+        self->loaded = unit_load(self);
+
+        if (self->loaded) {
+            log_buffer_capture(&self->compile_log);
+
+            if (self->imported && self->comp->interfaces &&
+                unit_read_interface(self)) {
+                self->compiled = unit_find_imports(self);
+            } else {
+                self->compiled = unit_compile(self);
+            }
+        }
+    }
+
+    log_buffer_capture(NULL);
+    diag_buffer_capture(NULL);
+
+    log_buffer_close(&self->load_log);
+    log_buffer_close(&self->compile_log);
+
+    self->stale = false;
+    self->clean = self->compiled && self->diags->items.count == 0 &&
+        log_buffer_empty(&self->load_log) &&
+        log_buffer_empty(&self->compile_log);
+
+    /*
+     * Only imported modules are ever read from an interface, so
+     * the files named on the command line get none. What a debug
+     * build dumps does not keep an interface out.
+     */
+    if (self->comp->interfaces && self->imported && !self->interface &&
+        self->compiled && self->diags->items.count == 0) {
+        unit_write_interface(self);
+    }
+
+    _schedule_imports(self);
+}
+
+
+static void _start_unit(Compilation *comp, Unit *unit) {
+    if (unit->reused && !unit_imports_moved(unit)) {
+        _schedule_imports(unit);
+        return;
+    }
+
+    /* the output of the last compile names the old modules */
+    if (unit->reused) {
+        unit->reused = false;
+        unit->stale = true;
+
+        if (!unit_reset_output(unit)) {
+            cl_debug("%s: %s\n", __func__, strerror(errno));
+        }
+    }
+
+    if (!pool_submit(comp->pool, (PoolJobFn)_unit_job, unit)) {
+        /* run it here instead, the order is restored anyway */
+        _unit_job(unit);
+    }
+}
+
+
+CL_TYPE(UnitVisit) {
+    Unit  *unit;
+    size_t next;    /* the import to follow next */
+};
+
+
+/**
+ * Reports the import that leads back to a unit on the stack,
+ * with a note for every other import of the cycle.
+ */
+static void _report_cycle(Compilation *comp, UnitVisit *stack, size_t depth,
+    UnitImport *import) {
+    size_t start = depth - 1;
+
+    while (stack[start].unit != import->unit) {
+        start--;
+    }
+
+    Unit *unit = stack[depth - 1].unit;
+    TokenStream *tokens = unit->tokens;
+    DiagLocation loc = {
+        .offset = tokens->offsets[import->token],
+        .length = tokens->lengths[import->token],
+        .caret = 0,
+        .src = unit->src,
+    };
+
+    diag_buffer_capture(comp->diags);
+    diag_error(loc, "import cycle: '%s' imports itself", import->unit->path);
+
+    for (size_t i = start; i + 1 < depth; i++) {
+        Unit *from = stack[i].unit;
+        UnitImport *edge = &from->imports[stack[i].next - 1];
+
+        loc.offset = from->tokens->offsets[edge->token];
+        loc.length = from->tokens->lengths[edge->token];
+        loc.src = from->src;
+
+        diag_note(loc, "'%s' imports '%s'", from->path, edge->unit->path);
+    }
+
+    diag_buffer_capture(NULL);
+}
+
+
+/**
+ * Orders the units so that every module comes before the units
+ * importing it. The command line is visited in order, and the
+ * imports of a unit in source order, so the order does not
+ * depend on which worker finished first. Returns false when
+ * the imports form a cycle.
+ */
+static bool _sort_units(Compilation *comp) {
+    size_t count = comp->units.count;
+    UnitVisit *stack = arena_calloc(comp->arena, count, sizeof(UnitVisit));
+    size_t ordered = 0;
+    bool acyclic = true;
+
+    comp->order = arena_calloc(comp->arena, count, sizeof(Unit *));
+
+    if (!stack || !comp->order) {
+        cl_error("out of memory!\n");
+        return false;
+    }
+
+    for (size_t i = 0; i < comp->root_count; i++) {
+        Unit *root = comp->units.data[i];
+        size_t depth = 0;
+
+        if (root->mark != UNIT_UNSEEN) {
+            continue;
+        }
+
+        root->mark = UNIT_VISITING;
+        stack[depth++] = (UnitVisit){ .unit = root, .next = 0 };
+
+        while (depth > 0) {
+            UnitVisit *top = &stack[depth - 1];
+
+            if (top->next == top->unit->import_count) {
+                top->unit->mark = UNIT_DONE;
+                comp->order[ordered++] = top->unit;
+                depth--;
+                continue;
+            }
+
+            UnitImport *import = &top->unit->imports[top->next++];
+            Unit *next = import->unit;
+
+            if (!next || next->mark == UNIT_DONE) {
+                continue;
+            }
+
+            if (next->mark == UNIT_VISITING) {
+                _report_cycle(comp, stack, depth, import);
+                acyclic = false;
+                continue;
+            }
+
+            next->mark = UNIT_VISITING;
+            stack[depth++] = (UnitVisit){ .unit = next, .next = 0 };
+        }
+    }
+
+    return acyclic;
+}
+
+
+/**
+ * Writes out what the units printed, in the same order and up
+ * to the same point a serial run would have: all the loads
+ * first, up to the first one that failed, then the compiles,
+ * up to the first one that failed, modules before the units
+ * importing them.
+ */
+static bool _flush_units(Compilation *comp, DiagSink *sink) {
+    size_t count = comp->units.count;
+
+    for (size_t i = 0; i < count; i++) {
+        Unit *unit = comp->order[i];
+
+        log_buffer_write(&unit->load_log);
+
+        if (!unit->loaded) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        Unit *unit = comp->order[i];
+
+        diag_buffer_write(unit->diags, sink);
+        log_buffer_write(&unit->compile_log);
+
+        if (!unit->compiled) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+static bool _compile_all_units(Compilation *comp, uint32_t jobs,
+    DiagSink *sink) {
+    comp->pool = pool_new(jobs);
+
+    if (!comp->pool) {
+        cl_error("failed to start %u jobs\n", jobs);
+        return false;
+    }
+
+    /* the first roots started import modules, which grow units */
+    for (size_t i = 0; i < comp->root_count; i++) {
+        pthread_mutex_lock(&comp->lock);
+        Unit *root = comp->units.data[i];
+        pthread_mutex_unlock(&comp->lock);
+
+        _start_unit(comp, root);
+    }
+
+    pool_wait(comp->pool);
+    pool_free(comp->pool);
+    comp->pool = NULL;
+
+    if (comp->failed) {
+        cl_error("out of memory!\n");
+        return false;
+    }
+
+    bool acyclic = _sort_units(comp);
+
+    if (!comp->order) {
+        return false;
+    }
+
+    diag_buffer_write(comp->diags, sink);
+
+    return _flush_units(comp, sink) && acyclic;
+}
+
+
+#ifdef DEBUG
+static void _report_memory(Compilation *comp) {
+    size_t total = 0;
+    size_t largest = 0;
+
+    for (size_t i = 0; i < comp->units.count; i++) {
+        Arena *arena = comp->units.data[i]->arena;
+
+        if (!arena) {
+            continue;
+        }
+
+        total += arena->stats.high_water;
+
+        if (arena->stats.high_water > largest) {
+            largest = arena->stats.high_water;
+        }
+    }
+
+    cl_debug("arenas: compilation %zu bytes, units %zu bytes "
+        "(largest %zu bytes)\n", comp->arena->stats.high_water, total,
+        largest);
+
+    InternerStats symbols;
+
+    interner_stats(comp->symbols, &symbols);
+
+    cl_debug("symbols: %zu, %zu bytes of names, %zu bytes in total, "
+        "%zu probes in %zu lookups (longest %zu)\n", symbols.symbols,
+        symbols.string_bytes, symbols.memory_bytes, symbols.probes,
+        symbols.lookups, symbols.max_probe);
+}
+#endif /* DEBUG */
+
+
+/* == unit cache == */
+
+
+UnitCache *unit_cache_new(UnitCacheAddFn on_add, void *user_data) {
+    UnitCache *new_cache = calloc(1, sizeof(UnitCache));
+
+    if (!new_cache) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    new_cache->symbols = interner_new();
+    new_cache->on_add = on_add;
+    new_cache->user_data = user_data;
+
+    if (!new_cache->symbols) {
+        free(new_cache);
+        return NULL;
+    }
+
+    return new_cache;
+}
+
+
+/**
+ * Takes the unit of a file out of the cache for one compile,
+ * or creates a new one that can go in afterwards. The same
+ * file given twice gets a second, uncached unit.
+ */
+static Unit *unit_cache_take(UnitCache *self, str_t path) {
+    char *key = realpath(path, NULL);
+
+    for (size_t i = 0; key && i < self->units.count; i++) {
+        Unit *unit = self->units.data[i];
+
+        if (!unit->in_use && strcmp(unit->key, key) == 0 &&
+            strcmp(unit->path, path) == 0) {
+            free(key);
+            unit->in_use = true;
+            unit->reused = !unit->stale;
+            return unit;
+        }
+    }
+
+    Unit *unit = unit_new(NULL, path, self->symbols);
+
+    if (!unit) {
+        free(key);
+        return NULL;
+    }
+
+    unit->key = key;
+    unit->in_use = true;
+
+    return unit;
+}
+
+
+/**
+ * Gives a unit back after a compile. Units that did not load
+ * are not worth keeping.
+ */
+static void unit_cache_put(UnitCache *self, Unit *unit) {
+    size_t index = self->units.count;
+
+    for (size_t i = 0; i < self->units.count; i++) {
+        if (self->units.data[i] == unit) {
+            index = i;
+            break;
+        }
+    }
+
+    bool cached = index < self->units.count;
+
+    if (!unit->loaded || !unit->key) {
+        if (cached) {
+            self->units.data[index] = self->units.data[--self->units.count];
+        }
+
+        unit_free(unit);
+        return;
+    }
+
+    unit->in_use = false;
+    unit->reused = false;
+
+    if (cached) {
+        return;
+    }
+
+    if (!unit_ref_vector_push(&self->units, unit)) {
+        unit_free(unit);
+        return;
+    }
+
+    if (self->on_add) {
+        self->on_add(unit->key, self->user_data);
+    }
+}
+
+
+/**
+ * Marks the units of a file as changed. `path` is a real path.
+ */
+void unit_cache_invalidate(UnitCache *self, str_t path) {
+    for (size_t i = 0; i < self->units.count; i++) {
+        Unit *unit = self->units.data[i];
+
+        if (strcmp(unit->key, path) == 0) {
+            unit->stale = true;
+        }
+    }
+}
+
+
+/**
+ * Whether `path` names a file right in `dir`, which is `length`
+ * bytes long and has no trailing slash.
+ */
+static bool _in_dir(str_t path, str_t dir, size_t length) {
+    return strncmp(path, dir, length) == 0 && path[length] == '/' &&
+        !strchr(&path[length + 1], '/');
+}
+
+
+/**
+ * Marks as changed the units a file that was created, deleted or
+ * moved may have changed the imports of: those that import a
+ * file in its directory, those in its directory that import
+ * anything, as the importing file's directory is searched first,
+ * and those that did not compile cleanly, which includes every
+ * unit with a module that was not found. `path` is a real path.
+ */
+void unit_cache_invalidate_importers(UnitCache *self, str_t path) {
+    str_t slash = strrchr(path, '/');
+    size_t length = slash ? (size_t)(slash - path) : 0;
+
+    for (size_t i = 0; slash && i < self->units.count; i++) {
+        Unit *unit = self->units.data[i];
+        bool moved = !unit->clean || (unit->import_count > 0 &&
+            _in_dir(unit->key, path, length));
+
+        for (size_t k = 0; !moved && k < unit->import_count; k++) {
+            str_t key = unit->imports[k].key;
+
+            moved = key && _in_dir(key, path, length);
+        }
+
+        unit->stale |= moved;
+    }
+
+    unit_cache_invalidate(self, path);
+}
+
+
+void unit_cache_invalidate_all(UnitCache *self) {
+    for (size_t i = 0; i < self->units.count; i++) {
+        self->units.data[i]->stale = true;
+    }
+}
+
+
+size_t unit_cache_count(UnitCache *self) {
+    return self->units.count;
+}
+
+
+void unit_cache_free(UnitCache *self) {
+    for (size_t i = 0; i < self->units.count; i++) {
+        unit_free(self->units.data[i]);
+    }
+
+    unit_ref_vector_free(&self->units);
+    interner_free(self->symbols);
+    free(self);
+}
+
+
+/* == object output == */
+
+
+/**
+ * Compiles the files given to cl_compile to bytecode and writes
+ * their object. Imported modules are left out, they have their
+ * own. Mistakes go to the sink like those of the units, and
+ * leave no object behind.
+ */
+static bool _write_object(Compilation *comp, str_t path, DiagSink *sink) {
+    ObjectWriter *writer = object_writer_new();
+    CodeGen *gen = writer ? codegen_new(writer, comp->passes) : NULL;
+
+    if (!gen) {
+        if (writer) {
+            object_writer_free(writer);
+        }
+
+        cl_error("out of memory!\n");
+        return false;
+    }
+
+    bool compiled = true;
+
+    diag_buffer_clear(comp->diags);
+    diag_buffer_capture(comp->diags);
+
+    for (size_t i = 0; i < comp->root_count; i++) {
+        Unit *unit = comp->units.data[i];
+
+        compiled &= codegen_unit(gen, unit->src, unit->tokens, unit->ast,
+            unit->symbols);
+    }
+
+    diag_buffer_capture(NULL);
+    diag_buffer_write(comp->diags, sink);
+
+    bool written = false;
+
+    if (compiled) {
+        object_writer_set_entry(writer, codegen_entry(gen));
+        written = object_writer_write(writer, path);
+    }
+
+    codegen_free(gen);
+    object_writer_free(writer);
+
+    return written;
+}
+
+
+/* == compiler == */
+
+
+bool cl_compile(Vector *files, CompileOptions *options) {
+    UnitCache *cache = options->cache;
+    Compilation comp = {
+        .cache = cache,
+        .token_cache = options->token_cache,
+        .import_paths = options->import_paths,
+        .interfaces = options->interfaces && !cache,
+        .root_count = files->count,
+    };
+
+    comp.arena = arena_new(0);
+    comp.symbols = cache ? cache->symbols : interner_new();
+    comp.diags = diag_buffer_new();
+
+    if (!comp.arena || !comp.symbols || !comp.diags) {
+        if (!cache) {
+            interner_free(comp.symbols);
+        }
+
+        diag_buffer_free(comp.diags);
+        arena_free(comp.arena);
+        return false;
+    }
+
+    pthread_mutex_init(&comp.lock, NULL);
+
+    bool success = true;
+
+    /* a wrong list of passes fails before anything is compiled */
+    if (options->optimize) {
+        comp.passes = pass_manager_new(options->passes);
+
+        if (!comp.passes) {
+            success = false;
+            goto cleanup;
+        }
+
+        pass_manager_dump(comp.passes, options->dump_ir ? stdout : NULL);
+        pass_manager_time(comp.passes, options->time_passes);
+    }
+
+    /* all of the command line goes in the table before any import */
+    for (size_t i = 0; i < comp.root_count; i++) {
+        if (!_add_unit(&comp, *vector_getp(files, i), NULL)) {
+            success = false;
+            goto cleanup;
+        }
+    }
+
+    /* imports are only known once the units are parsed */
+    uint32_t jobs = options->jobs ? options->jobs : cl_cpu_count();
+    DiagSink sink;
+
+    diag_sink_init(&sink, options->diag_format, stdout, STDOUT_FILENO);
+    diag_sink_begin(&sink);
+
+    if (!_compile_all_units(&comp, jobs, &sink)) {
+        success = false;
+    }
+
+    if (success && !options->parse_only) {
+        success = _write_object(&comp, options->output_file
+            ? options->output_file : CL_OBJECT_DEFAULT_OUTPUT, &sink);
+    }
+
+    diag_sink_end(&sink);
+
+    if (comp.passes && options->time_passes) {
+        pass_manager_report(comp.passes, stderr);
+    }
+
+#ifdef DEBUG
+    _report_memory(&comp);
+#endif
+
+cleanup:
+    for (size_t i = 0; i < comp.units.count; i++) {
+        if (cache) {
+            unit_cache_put(cache, comp.units.data[i]);
+        } else {
+            unit_free(comp.units.data[i]);
+        }
+    }
+
+    if (!cache) {
+        interner_free(comp.symbols);
+    }
+
+    if (comp.passes) {
+        pass_manager_free(comp.passes);
+    }
+
+    unit_ref_vector_free(&comp.units);
+    free(comp.table);
+    pthread_mutex_destroy(&comp.lock);
+    diag_buffer_free(comp.diags);
+    arena_free(comp.arena);
 
     return success;
 }
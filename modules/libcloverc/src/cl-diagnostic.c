@@ -1,5 +1,8 @@
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <math.h>
 
@@ -7,42 +10,333 @@
 #include "cl-colors.h"
 #include "cl-diagnostic.h"
 
+#define CL_SARIF_SCHEMA \
+    "https://json.schemastore.org/sarif-2.1.0.json"
+
 
 CL_TYPE(DiagInfo) {
     str_t str;
     str_t fmt;
+    str_t level;    /* SARIF result level */
 };
 
 
 static const DiagInfo TYPES[] = {
-    [CL_DIAG_NOTE]    = { .str = "note",    .fmt = "1;30" },
-    [CL_DIAG_INFO]    = { .str = "info",    .fmt = "1;37" },
-    [CL_DIAG_WARNING] = { .str = "warning", .fmt = "1;33" },
-    [CL_DIAG_ERROR]   = { .str = "error",   .fmt = "1;31" },
+    [CL_DIAG_NOTE]    = { .str = "note",    .fmt = "1;30", .level = "note" },
+    [CL_DIAG_INFO]    = { .str = "info",    .fmt = "1;37", .level = "note" },
+    [CL_DIAG_WARNING] = { .str = "warning", .fmt = "1;33", .level = "warning" },
+    [CL_DIAG_ERROR]   = { .str = "error",   .fmt = "1;31", .level = "error" },
+};
+
+
+static const str_t FORMATS[] = {
+    [CL_DIAG_FORMAT_HUMAN] = "human",
+    [CL_DIAG_FORMAT_JSON]  = "json",
+    [CL_DIAG_FORMAT_SARIF] = "sarif",
 };
 
 
-static void write_snippet(DiagLocation loc) {
-    int width = (int)fmax(log10(loc.line) + 1, 4);
-    int caret_length = (int)fmax(loc.length, 1);
+static _Thread_local DiagBuffer *capture = NULL;
+
+
+static void diagnostic_deinit(Diagnostic *self) {
+    free(self->message);
+
+    for (size_t i = 0; i < self->notes.count; i++) {
+        diagnostic_deinit(&self->notes.data[i]);
+    }
+
+    diagnostic_vector_free(&self->notes);
+}
+
+
+/* == human format == */
+
+
+/**
+ * Counts the characters in `length` bytes of UTF-8 text: every
+ * byte that does not continue a sequence starts one.
+ */
+static size_t count_chars(str_t text, size_t length) {
+    size_t count = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        count += ((uint8_t)text[i] & 0xC0) != 0x80;
+    }
+
+    return count;
+}
+
+
+/**
+ * Columns are byte offsets, so the caret line is indented and
+ * sized in characters instead when the source is not plain
+ * ASCII, to stay under the text it points at.
+ */
+static void write_snippet(FILE *out, DiagLocation loc, uint32_t line,
+    uint32_t column) {
+    int width = (int)fmax(log10(line) + 1, 4);
+    int indent = (int)column - 1;
+    uint32_t caret_length = (uint32_t)fmax(loc.length, loc.caret + 1);
+
+    size_t line_offset = 0;
+    size_t line_length = 0;
+
+    source_line(loc.src, line, &line_offset, &line_length);
+
+    if (CL_BIT_ISCLR(CL_SOURCE_ASCII, loc.src->flags)) {
+        size_t span = (loc.offset < loc.src->length)
+            ? (size_t)fmin(loc.length, loc.src->length - loc.offset)
+            : 0;
+
+        indent = (int)count_chars(&loc.src->text[line_offset], column - 1);
+        caret_length = (uint32_t)fmax(
+            count_chars(&loc.src->text[loc.offset], span), loc.caret + 1);
+    }
 
     /* error line */
-    printf("%*d | ", width, loc.line);
-    fwrite(source_get(loc.src, loc.line_offset), 1, loc.line_length, stdout);
-    putchar('\n');
+    fprintf(out, "%*d | ", width, line);
+    fwrite(&loc.src->text[line_offset], 1, line_length, out);
+    fputc('\n', out);
 
     /* caret */
-    printf(" %*s | ", width, "");
-    printf("%*s", loc.column - 1, "");
+    fprintf(out, " %*s | ", width, "");
+    fprintf(out, "%*s", indent, "");
+
+    for (uint32_t i = 0; i < caret_length; i++) {
+        fputc((i == loc.caret) ? '^' : '~', out);
+    }
+
+    fputc('\n', out);
+}
+
+
+static void write_human(DiagSink *sink, Diagnostic *diag) {
+    DiagInfo info = TYPES[diag->type];
+    DiagLocation loc = diag->loc;
+    FILE *out = sink->out;
+
+    uint32_t line, column;
+
+    source_locate(loc.src, loc.offset, &line, &column);
+
+    if (sink->colors) {
+        fprintf(out, "\e[1m%s:%u:%u-%u\e[0m: \e[%sm%s:\e[0m %s\n",
+            loc.src->path, line, column,
+            (column + loc.length), info.fmt, info.str, diag->message);
+    } else {
+        fprintf(out, "%s:%u:%u-%u: %s: %s\n", loc.src->path,
+            line, column, (column + loc.length), info.str, diag->message);
+    }
+
+    if (diag->type > CL_DIAG_NOTE) {
+        write_snippet(out, loc, line, column);
+    }
+
+    for (size_t i = 0; i < diag->notes.count; i++) {
+        write_human(sink, &diag->notes.data[i]);
+    }
+}
+
 
-    for (int i = 0; i < caret_length; i++) {
-        putchar((i == loc.caret) ? '^' : '~');
+/* == machine readable formats == */
+
+
+static void write_json_string(FILE *out, str_t str) {
+    fputc('"', out);
+
+    for (; *str; str++) {
+        unsigned char ch = *str;
+
+        switch (ch) {
+            case '"':  fputs("\\\"", out); break;
+            case '\\': fputs("\\\\", out); break;
+            case '\n': fputs("\\n", out);  break;
+            case '\r': fputs("\\r", out);  break;
+            case '\t': fputs("\\t", out);  break;
+            default:
+                if (ch < 0x20) {
+                    fprintf(out, "\\u%04x", ch);
+                } else {
+                    fputc(ch, out);
+                }
+        }
+    }
+
+    fputc('"', out);
+}
+
+
+static void write_json(DiagSink *sink, Diagnostic *diag) {
+    DiagLocation loc = diag->loc;
+    FILE *out = sink->out;
+
+    uint32_t line, column;
+
+    source_locate(loc.src, loc.offset, &line, &column);
+
+    fprintf(out, "{\"severity\":\"%s\",\"file\":", TYPES[diag->type].str);
+    write_json_string(out, loc.src->path);
+    fprintf(out, ",\"line\":%u,\"column\":%u,\"end_column\":%u"
+        ",\"offset\":%u,\"length\":%u,\"message\":",
+        line, column, column + loc.length, loc.offset, loc.length);
+    write_json_string(out, diag->message);
+
+    if (diag->notes.count > 0) {
+        fputs(",\"notes\":[", out);
+
+        for (size_t i = 0; i < diag->notes.count; i++) {
+            if (i > 0) {
+                fputc(',', out);
+            }
+
+            write_json(sink, &diag->notes.data[i]);
+        }
+
+        fputc(']', out);
+    }
+
+    fputc('}', out);
+}
+
+
+/**
+ * Writes a path as a URI reference: relative paths stay
+ * relative, absolute ones become file URIs, and every byte
+ * outside the unreserved characters and '/' is percent-encoded,
+ * so nothing in it needs escaping for JSON either.
+ */
+static void write_sarif_uri(FILE *out, str_t path) {
+    fputs(path[0] == '/' ? "\"file://" : "\"", out);
+
+    for (; *path; path++) {
+        unsigned char ch = *path;
+
+        if ((ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') ||
+            (ch >= '0' && ch <= '9') || strchr("-._~/", ch)) {
+            fputc(ch, out);
+        } else {
+            fprintf(out, "%%%02X", ch);
+        }
     }
 
-    putchar('\n');
+    fputc('"', out);
 }
 
 
+/**
+ * Counts the code points in `length` bytes of a source from
+ * `offset`, clipped to its end. The run declares its columns
+ * in code points, where the source stores them in bytes.
+ */
+static uint32_t count_source_chars(Source *src, size_t offset,
+    size_t length) {
+    if (offset >= src->length) {
+        return 0;
+    }
+
+    length = (size_t)fmin(length, src->length - offset);
+
+    if (CL_BIT_ISSET(CL_SOURCE_ASCII, src->flags)) {
+        return (uint32_t)length;
+    }
+
+    return (uint32_t)count_chars(&src->text[offset], length);
+}
+
+
+/**
+ * Writes a SARIF location object, notes carry their own message.
+ */
+static void write_sarif_location(FILE *out, DiagLocation loc,
+    __Nullable str_t message) {
+    uint32_t line, column;
+
+    source_locate(loc.src, loc.offset, &line, &column);
+
+    uint32_t start = count_source_chars(loc.src, loc.src->lines[line - 1],
+        column - 1) + 1;
+    uint32_t span = count_source_chars(loc.src, loc.offset, loc.length);
+
+    fputc('{', out);
+
+    if (message) {
+        fputs("\"message\":{\"text\":", out);
+        write_json_string(out, message);
+        fputs("},", out);
+    }
+
+    fputs("\"physicalLocation\":{\"artifactLocation\":{\"uri\":", out);
+    write_sarif_uri(out, loc.src->path);
+    fprintf(out, "},\"region\":{\"startLine\":%u,\"startColumn\":%u"
+        ",\"endColumn\":%u,\"charOffset\":%u,\"charLength\":%u}}}",
+        line, start, start + span,
+        count_source_chars(loc.src, 0, loc.offset), span);
+}
+
+
+static void write_sarif(DiagSink *sink, Diagnostic *diag) {
+    FILE *out = sink->out;
+
+    fprintf(out, "{\"level\":\"%s\",\"message\":{\"text\":",
+        TYPES[diag->type].level);
+    write_json_string(out, diag->message);
+    fputs("},\"locations\":[", out);
+    write_sarif_location(out, diag->loc, NULL);
+    fputc(']', out);
+
+    if (diag->notes.count > 0) {
+        fputs(",\"relatedLocations\":[", out);
+
+        for (size_t i = 0; i < diag->notes.count; i++) {
+            Diagnostic *note = &diag->notes.data[i];
+
+            if (i > 0) {
+                fputc(',', out);
+            }
+
+            write_sarif_location(out, note->loc, note->message);
+        }
+
+        fputc(']', out);
+    }
+
+    fputc('}', out);
+}
+
+
+static void diag_sink_write(DiagSink *self, Diagnostic *diag) {
+    switch (self->format) {
+        case CL_DIAG_FORMAT_HUMAN:
+            write_human(self, diag);
+            break;
+        case CL_DIAG_FORMAT_JSON:
+            write_json(self, diag);
+            fputc('\n', self->out);
+            break;
+        case CL_DIAG_FORMAT_SARIF:
+            if (self->written > 0) {
+                fputc(',', self->out);
+            }
+
+            write_sarif(self, diag);
+            break;
+        default:
+            cl_debug("%s: invalid format: %d\n", __func__, self->format);
+            return;
+    }
+
+    self->written++;
+}
+
+
+/* == public interface == */
+
+
+/**
+ * Records the diagnostic in the captured buffer of the calling
+ * thread, or prints it right away when there is none.
+ */
 void __cl_diag(DiagType type, DiagLocation loc, str_t msg, ...) {
     if (type < 0 || type >= __CL_DIAG_MAX) {
         printf("%s: invalid diag type: %d\n", __func__, type);
@@ -50,24 +344,167 @@ void __cl_diag(DiagType type, DiagLocation loc, str_t msg, ...) {
     }
 
     va_list args;
+    Diagnostic diag = { .type = type, .loc = loc };
 
-    DiagInfo info = TYPES[type];
+    va_start(args, msg);
+    int length = vsnprintf(NULL, 0, msg, args);
+    va_end(args);
 
-    if (cl_fd_use_colors(STDOUT_FILENO)) {
-        printf("\e[1m%s:%u:%u-%u\e[0m: \e[%sm%s:\e[0m ",
-            loc.src->path, loc.line, loc.column,
-            (loc.column + loc.length), info.fmt, info.str);
-    } else {
-        printf("%s:%u:%u-%u: %s: ", loc.src->path,
-            loc.line, loc.column, (loc.column + loc.length), info.str);
+    diag.message = malloc(length + 1);
+
+    if (length < 0 || !diag.message) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        free(diag.message);
+        return;
     }
 
     va_start(args, msg);
-    vprintf(msg, args);
+    vsnprintf(diag.message, length + 1, msg, args);
     va_end(args);
-    putchar('\n');
 
-    if (type > CL_DIAG_NOTE) {
-        write_snippet(loc);
+    if (!capture) {
+        DiagSink sink;
+
+        diag_sink_init(&sink, CL_DIAG_FORMAT_HUMAN,
+            cl_log_stream(STDOUT_FILENO), STDOUT_FILENO);
+        diag_sink_write(&sink, &diag);
+        diagnostic_deinit(&diag);
+        return;
+    }
+
+    DiagnosticVector *target = &capture->items;
+    Diagnostic *last = diagnostic_vector_last(&capture->items);
+
+    if (type == CL_DIAG_NOTE && last) {
+        target = &last->notes;
     }
+
+    if (!diagnostic_vector_push(target, diag)) {
+        cl_debug("%s: failed to record diagnostic\n", __func__);
+        diagnostic_deinit(&diag);
+        return;
+    }
+
+    capture->counts[type]++;
+}
+
+
+DiagBuffer *diag_buffer_new(void) {
+    DiagBuffer *new_buffer = calloc(1, sizeof(DiagBuffer));
+
+    if (!new_buffer) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    return new_buffer;
+}
+
+
+/**
+ * Makes the calling thread record its diagnostics into the
+ * given buffer, or print them right away again when it is NULL.
+ */
+void diag_buffer_capture(DiagBuffer *self) {
+    capture = self;
+}
+
+
+/**
+ * Renders the recorded diagnostics in the order they were
+ * reported, and keeps them.
+ */
+void diag_buffer_write(DiagBuffer *self, DiagSink *sink) {
+    for (size_t i = 0; i < self->items.count; i++) {
+        diag_sink_write(sink, &self->items.data[i]);
+    }
+
+    fflush(sink->out);
+}
+
+
+/**
+ * Drops the recorded diagnostics and resets the counts.
+ */
+void diag_buffer_clear(DiagBuffer *self) {
+    for (size_t i = 0; i < self->items.count; i++) {
+        diagnostic_deinit(&self->items.data[i]);
+    }
+
+    self->items.count = 0;
+    memset(self->counts, 0, sizeof(self->counts));
+}
+
+
+/**
+ * Renders the recorded diagnostics and empties the buffer. The
+ * counts are kept.
+ */
+void diag_buffer_flush(DiagBuffer *self, DiagSink *sink) {
+    diag_buffer_write(self, sink);
+
+    for (size_t i = 0; i < self->items.count; i++) {
+        diagnostic_deinit(&self->items.data[i]);
+    }
+
+    self->items.count = 0;
+}
+
+
+void diag_buffer_free(DiagBuffer *self) {
+    if (!self) {
+        return;
+    }
+
+    for (size_t i = 0; i < self->items.count; i++) {
+        diagnostic_deinit(&self->items.data[i]);
+    }
+
+    diagnostic_vector_free(&self->items);
+    free(self);
+}
+
+
+void diag_sink_init(DiagSink *self, DiagFormat format, FILE *out, int fd) {
+    self->format = format;
+    self->out = out;
+    self->colors = (format == CL_DIAG_FORMAT_HUMAN) && cl_fd_use_colors(fd);
+    self->written = 0;
+}
+
+
+/**
+ * Writes what goes before the first diagnostic, only SARIF
+ * needs it.
+ */
+void diag_sink_begin(DiagSink *self) {
+    if (self->format != CL_DIAG_FORMAT_SARIF) {
+        return;
+    }
+
+    fputs("{\"version\":\"2.1.0\",\"$schema\":\"" CL_SARIF_SCHEMA "\","
+        "\"runs\":[{\"tool\":{\"driver\":{\"name\":\"cloverc\","
+        "\"version\":\"" CL_VERSION "\"}},"
+        "\"columnKind\":\"unicodeCodePoints\",\"results\":[", self->out);
+}
+
+
+void diag_sink_end(DiagSink *self) {
+    if (self->format == CL_DIAG_FORMAT_SARIF) {
+        fputs("]}]}\n", self->out);
+    }
+
+    fflush(self->out);
+}
+
+
+bool diag_format_parse(str_t name, DiagFormat *format) {
+    for (int i = 0; i < __CL_DIAG_FORMAT_MAX; i++) {
+        if (strcmp(name, FORMATS[i]) == 0) {
+            *format = i;
+            return true;
+        }
+    }
+
+    return false;
 }
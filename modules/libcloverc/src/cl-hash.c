@@ -0,0 +1,109 @@
+#include <string.h>
+
+#include "cl-hash.h"
+
+
+#define PRIME64_1   0x9E3779B185EBCA87ULL
+#define PRIME64_2   0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3   0x165667B19E3779F9ULL
+#define PRIME64_4   0x85EBCA77C2B2AE63ULL
+#define PRIME64_5   0x27D4EB2F165667C5ULL
+
+
+static __Inline uint64_t _rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+
+static __Inline uint64_t _read64(const uint8_t *p) {
+    uint64_t value;
+
+    memcpy(&value, p, sizeof(value));
+
+    return value;
+}
+
+
+static __Inline uint32_t _read32(const uint8_t *p) {
+    uint32_t value;
+
+    memcpy(&value, p, sizeof(value));
+
+    return value;
+}
+
+
+static __Inline uint64_t _round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = _rotl(acc, 31);
+
+    return acc * PRIME64_1;
+}
+
+
+static __Inline uint64_t _merge(uint64_t acc, uint64_t value) {
+    acc ^= _round(0, value);
+
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+
+/**
+ * Reads little-endian words, which is what every supported
+ * target is, so the hash of a file is the same everywhere.
+ */
+uint64_t cl_hash64(const void *data, size_t length, uint64_t seed) {
+    const uint8_t *p = data;
+    const uint8_t *end = p + length;
+    uint64_t hash;
+
+    if (length >= 32) {
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+
+        /* four independent lanes of 8 bytes each */
+        do {
+            v1 = _round(v1, _read64(p));
+            v2 = _round(v2, _read64(p + 8));
+            v3 = _round(v3, _read64(p + 16));
+            v4 = _round(v4, _read64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+
+        hash = _rotl(v1, 1) + _rotl(v2, 7) + _rotl(v3, 12) + _rotl(v4, 18);
+        hash = _merge(hash, v1);
+        hash = _merge(hash, v2);
+        hash = _merge(hash, v3);
+        hash = _merge(hash, v4);
+    } else {
+        hash = seed + PRIME64_5;
+    }
+
+    hash += (uint64_t)length;
+
+    for (; p + 8 <= end; p += 8) {
+        hash ^= _round(0, _read64(p));
+        hash = _rotl(hash, 27) * PRIME64_1 + PRIME64_4;
+    }
+
+    if (p + 4 <= end) {
+        hash ^= (uint64_t)_read32(p) * PRIME64_1;
+        hash = _rotl(hash, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+
+    for (; p < end; p++) {
+        hash ^= (*p) * PRIME64_5;
+        hash = _rotl(hash, 11) * PRIME64_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
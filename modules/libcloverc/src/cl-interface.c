@@ -0,0 +1,782 @@
+#define CL_LOG_SCOPE "interface"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cl-log.h"
+#include "cl-hash.h"
+#include "cl-interface.h"
+
+
+#define INTERFACE_MAGIC     "CLMI"
+#define INTERFACE_FORMAT    2
+
+
+/**
+ * The fixed part of an interface file, in the byte order of
+ * the machine that wrote it. The sections follow in an order
+ * that keeps every one of them aligned: the nodes, then the
+ * offsets, lengths and values of the tokens,
+ * `extra` and the `count + 1` offsets of the names, and last
+ * the token kinds and the name bytes. The value of a symbol
+ * token is the index of its name.
+ */
+CL_TYPE(InterfaceHeader) {
+    char     magic[4];
+    uint32_t format;
+    char     version[16];
+    uint64_t source_hash;
+    uint64_t source_length;
+    uint64_t payload_hash;
+    uint32_t token_count;
+    uint32_t node_count;
+    uint32_t extra_count;
+    uint32_t name_count;
+    uint32_t names_size;
+    uint32_t reserved;      /* zero */
+};
+
+_Static_assert(sizeof(InterfaceHeader) == 72, "the header has no padding");
+
+
+/**
+ * Where every section starts in a file with the counts of a
+ * header, and how long the file is.
+ */
+CL_TYPE(InterfaceLayout) {
+    size_t nodes;
+    size_t offsets;
+    size_t lengths;
+    size_t values;
+    size_t extra;
+    size_t name_offsets;
+    size_t kinds;
+    size_t names;
+    size_t size;
+};
+
+
+static void _layout(const InterfaceHeader *header, InterfaceLayout *layout) {
+    size_t tokens = header->token_count * sizeof(uint32_t);
+
+    layout->nodes = sizeof(InterfaceHeader);
+    layout->offsets = layout->nodes + header->node_count * sizeof(AstNode);
+    layout->lengths = layout->offsets + tokens;
+    layout->values = layout->lengths + tokens;
+    layout->extra = layout->values + tokens;
+    layout->name_offsets = layout->extra +
+        header->extra_count * sizeof(AstIndex);
+    layout->kinds = layout->name_offsets +
+        (header->name_count + (size_t)1) * sizeof(uint32_t);
+    layout->names = layout->kinds + header->token_count;
+    layout->size = layout->names + header->names_size;
+}
+
+
+static __Inline bool _has_symbol(uint8_t kind) {
+    return kind == TK_ID || kind == TK_STRING || kind == TK_CHAR;
+}
+
+
+char *interface_path(str_t module_path) {
+    size_t length = strlen(module_path);
+
+    /* `x.cl` becomes `x.cli`, any other name gets the suffix */
+    if (length > 3 && strcmp(&module_path[length - 3], ".cl") == 0) {
+        length -= 3;
+    }
+
+    size_t size = length + sizeof(CL_INTERFACE_SUFFIX);
+    char *path = malloc(size);
+
+    if (!path) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    memcpy(path, module_path, length);
+    memcpy(&path[length], CL_INTERFACE_SUFFIX, sizeof(CL_INTERFACE_SUFFIX));
+
+    return path;
+}
+
+
+/**
+ * Maps a whole file, returning MAP_FAILED when it cannot be or
+ * is too short to hold a header.
+ */
+static void *_map(str_t path, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    void *map = MAP_FAILED;
+
+    if (fd < 0) {
+        return MAP_FAILED;
+    }
+
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(InterfaceHeader)) {
+        *size = (size_t)st.st_size;
+        map = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+
+    close(fd);
+
+    return map;
+}
+
+
+/**
+ * Tells whether a mapped file is an intact interface made from
+ * the text of `src` by this version of the compiler.
+ */
+static bool _is_valid(const uint8_t *data, size_t size, Source *src,
+    InterfaceHeader *header, InterfaceLayout *layout) {
+    memcpy(header, data, sizeof(*header));
+    _layout(header, layout);
+
+    return memcmp(header->magic, INTERFACE_MAGIC, 4) == 0 &&
+        header->format == INTERFACE_FORMAT &&
+        strncmp(header->version, CL_VERSION, sizeof(header->version)) == 0 &&
+        header->source_length == src->length &&
+        layout->size == size &&
+        header->source_hash == cl_hash64(src->text, src->length, 0) &&
+        header->payload_hash == cl_hash64(&data[sizeof(*header)],
+            size - sizeof(*header), 0);
+}
+
+
+/* == writing == */
+
+
+/**
+ * Copies the public part of a tree into a new one, with the
+ * tokens it refers to copied into a new stream.
+ */
+CL_TYPE(Pruner) {
+    TokenStream *from_tokens;
+    Ast         *from;
+    TokenStream *tokens;
+    Ast         *ast;
+    uint32_t    *token_map;     /* old index to new index + 1 */
+    bool         failed;
+};
+
+
+static uint32_t _copy_token(Pruner *self, uint32_t token) {
+    if (self->token_map[token] != 0) {
+        return self->token_map[token] - 1;
+    }
+
+    if (!tokens_push(self->tokens, tokens_get(self->from_tokens, token))) {
+        self->failed = true;
+        return 0;
+    }
+
+    self->token_map[token] = (uint32_t)self->tokens->count;
+
+    return (uint32_t)self->tokens->count - 1;
+}
+
+
+static AstIndex _copy_node(Pruner *self, AstIndex index);
+
+
+/**
+ * Copies the nodes listed in `from->extra[start, end)` and
+ * returns where their copies are listed in the new `extra`.
+ */
+static size_t _copy_list(Pruner *self, size_t start, size_t end) {
+    size_t at = ast_push_extra(self->ast, &self->from->extra[start],
+        end - start);
+
+    if (at == SIZE_MAX) {
+        self->failed = true;
+        return 0;
+    }
+
+    for (size_t i = start; i < end && !self->failed; i++) {
+        /* copying may move `extra`, so index it again every time */
+        AstIndex copy = _copy_node(self, self->from->extra[i]);
+
+        self->ast->extra[at + i - start] = copy;
+    }
+
+    return at;
+}
+
+
+/**
+ * Pushes `count` entries to the new `extra` and returns where
+ * they start.
+ */
+static AstIndex _push_extra(Pruner *self, const AstIndex *items,
+    size_t count) {
+    size_t at = ast_push_extra(self->ast, items, count);
+
+    if (at == SIZE_MAX) {
+        self->failed = true;
+        return CL_AST_NONE;
+    }
+
+    return (AstIndex)at;
+}
+
+
+/**
+ * Copies a declaration, a type or a constant expression. Bodies
+ * and the values of variables are left out, anything else that
+ * only occurs in bodies fails the copy.
+ */
+static AstIndex _copy_node(Pruner *self, AstIndex index) {
+    if (index == CL_AST_NONE || self->failed) {
+        return CL_AST_NONE;
+    }
+
+    AstNode node = self->from->nodes[index];
+    AstIndex *extra = self->from->extra;
+
+    node.token = _copy_token(self, node.token);
+
+    switch (node.kind) {
+        case AST_IMPORT:
+            node.lhs = _copy_node(self, node.lhs);
+            node.rhs = node.rhs ? _copy_token(self, node.rhs) : 0;
+            break;
+        case AST_FN: {
+            size_t start = _copy_list(self, extra[node.lhs],
+                extra[node.lhs + 1]);
+            AstIndex type = _copy_node(self, extra[node.lhs + 2]);
+            AstIndex proto[3] = {
+                (AstIndex)start,
+                (AstIndex)(start + extra[node.lhs + 1] - extra[node.lhs]),
+                type,
+            };
+
+            node.lhs = _push_extra(self, proto, 3);
+            node.rhs = CL_AST_NONE;
+            break;
+        }
+        case AST_STRUCT:
+        case AST_ENUM: {
+            size_t start = _copy_list(self, node.lhs, node.rhs);
+
+            node.rhs = (AstIndex)(start + node.rhs - node.lhs);
+            node.lhs = (AstIndex)start;
+            break;
+        }
+        case AST_VAR:
+            node.lhs = _copy_node(self, node.lhs);
+            node.rhs = CL_AST_NONE;
+            break;
+        case AST_PARAM:
+        case AST_ENUM_MEMBER:
+        case AST_TYPE_OPTIONAL:
+        case AST_TYPE_POINTER:
+        case AST_UNARY:
+        case AST_ACCESS:
+            node.lhs = _copy_node(self, node.lhs);
+            break;
+        case AST_FIELD:
+        case AST_CONST:
+        case AST_TYPE_ARRAY:
+        case AST_BINARY:
+        case AST_CAST:
+        case AST_INDEX:
+            node.lhs = _copy_node(self, node.lhs);
+            node.rhs = _copy_node(self, node.rhs);
+            break;
+        case AST_TERNARY: {
+            AstIndex branches[2];
+
+            node.lhs = _copy_node(self, node.lhs);
+            branches[0] = _copy_node(self, extra[node.rhs]);
+            branches[1] = _copy_node(self, extra[node.rhs + 1]);
+            node.rhs = _push_extra(self, branches, 2);
+            break;
+        }
+        case AST_CALL: {
+            size_t start = _copy_list(self, extra[node.rhs],
+                extra[node.rhs + 1]);
+            AstIndex args[2] = {
+                (AstIndex)start,
+                (AstIndex)(start + extra[node.rhs + 1] - extra[node.rhs]),
+            };
+
+            node.lhs = _copy_node(self, node.lhs);
+            node.rhs = _push_extra(self, args, 2);
+            break;
+        }
+        case AST_NAME:
+        case AST_LITERAL:
+            break;
+        default:
+            self->failed = true;
+            return CL_AST_NONE;
+    }
+
+    AstIndex copy = ast_push(self->ast, node);
+
+    self->failed |= (copy == CL_AST_NONE);
+
+    return copy;
+}
+
+
+/**
+ * Copies the imports and the `pub` declarations of a tree, in
+ * source order.
+ */
+static bool _prune(Pruner *self) {
+    AstNode *nodes = self->from->nodes;
+    AstIndex none = CL_AST_NONE;
+    AstIndex *decls = malloc((nodes[0].rhs - nodes[0].lhs + (size_t)1) *
+        sizeof(AstIndex));
+    size_t count = 0;
+
+    /* the root is node 0, which ast_push cannot tell from failing */
+    if (!decls || ast_push_extra(self->ast, &none, 1) == SIZE_MAX ||
+        !ast_reserve(self->ast, 1, 0)) {
+        free(decls);
+        return false;
+    }
+
+    ast_push(self->ast, (AstNode){ .kind = AST_FILE });
+
+    for (AstIndex i = nodes[0].lhs; i < nodes[0].rhs && !self->failed; i++) {
+        AstIndex decl = self->from->extra[i];
+
+        if (nodes[decl].kind == AST_IMPORT ||
+            CL_BIT_ISSET(CL_AST_PUB, nodes[decl].flags)) {
+            decls[count++] = _copy_node(self, decl);
+        }
+    }
+
+    /* the list goes in last, the copies added lists of their own */
+    size_t start = self->failed ? SIZE_MAX
+        : ast_push_extra(self->ast, decls, count);
+
+    free(decls);
+
+    if (start == SIZE_MAX) {
+        return false;
+    }
+
+    self->ast->nodes[0].lhs = (AstIndex)start;
+    self->ast->nodes[0].rhs = (AstIndex)(start + count);
+
+    return true;
+}
+
+
+static int _compare_ids(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+/**
+ * Lays the pruned tree out as a file, with the symbols of the
+ * tokens replaced by the index of their name. Returns NULL when
+ * out of memory.
+ */
+static uint8_t *_serialize(Source *src, TokenStream *tokens, Ast *ast,
+    Interner *symbols, size_t *size) {
+    size_t count = tokens->count;
+    uint32_t *ids = malloc((count + 1) * sizeof(uint32_t));
+    uint32_t name_count = 0;
+
+    if (!ids) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (_has_symbol(tokens->kinds[i])) {
+            ids[name_count++] = tokens_value(tokens, i);
+        }
+    }
+
+    qsort(ids, name_count, sizeof(uint32_t), _compare_ids);
+
+    uint32_t unique = 0;
+    size_t names_size = 0;
+
+    for (uint32_t i = 0; i < name_count; i++) {
+        if (unique == 0 || ids[unique - 1] != ids[i]) {
+            uint32_t length = 0;
+
+            interner_name(symbols, ids[i], &length);
+            ids[unique++] = ids[i];
+            names_size += length;
+        }
+    }
+
+    InterfaceHeader header = {
+        .magic = INTERFACE_MAGIC,
+        .format = INTERFACE_FORMAT,
+        .version = CL_VERSION,
+        .source_hash = cl_hash64(src->text, src->length, 0),
+        .source_length = src->length,
+        .token_count = (uint32_t)count,
+        .node_count = (uint32_t)ast->node_count,
+        .extra_count = (uint32_t)ast->extra_count,
+        .name_count = unique,
+        .names_size = (uint32_t)names_size,
+    };
+    InterfaceLayout layout;
+
+    _layout(&header, &layout);
+
+    uint8_t *data = (names_size <= UINT32_MAX) ? calloc(1, layout.size)
+                                               : NULL;
+
+    if (!data) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        free(ids);
+        return NULL;
+    }
+
+    uint32_t *values = (uint32_t *)&data[layout.values];
+    uint32_t *name_offsets = (uint32_t *)&data[layout.name_offsets];
+    size_t names_end = 0;
+
+    memcpy(&data[layout.nodes], ast->nodes, ast->node_count * sizeof(AstNode));
+    memcpy(&data[layout.offsets], tokens->offsets, count * sizeof(uint32_t));
+    memcpy(&data[layout.lengths], tokens->lengths, count * sizeof(uint32_t));
+    memcpy(&data[layout.extra], ast->extra,
+        ast->extra_count * sizeof(AstIndex));
+    memcpy(&data[layout.kinds], tokens->kinds, count);
+
+    for (size_t i = 0; i < count; i++) {
+        values[i] = tokens_value(tokens, i);
+
+        if (_has_symbol(tokens->kinds[i])) {
+            uint32_t *found = bsearch(&values[i], ids, unique,
+                sizeof(uint32_t), _compare_ids);
+
+            values[i] = (uint32_t)(found - ids);
+        }
+    }
+
+    for (uint32_t i = 0; i < unique; i++) {
+        uint32_t length = 0;
+        str_t name = interner_name(symbols, ids[i], &length);
+
+        name_offsets[i] = (uint32_t)names_end;
+        memcpy(&data[layout.names + names_end], name, length);
+        names_end += length;
+    }
+
+    name_offsets[unique] = (uint32_t)names_end;
+
+    header.payload_hash = cl_hash64(&data[sizeof(header)],
+        layout.size - sizeof(header), 0);
+    memcpy(data, &header, sizeof(header));
+
+    free(ids);
+    *size = layout.size;
+
+    return data;
+}
+
+
+
+
+static bool _write_file(str_t path, const uint8_t *data, size_t size) {
+    size_t length = strlen(path) + sizeof(".XXXXXX");
+    char *temp = malloc(length);
+
+    if (!temp) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return false;
+    }
+
+    snprintf(temp, length, "%s.XXXXXX", path);
+
+    int fd = mkstemp(temp);
+    bool written = (fd >= 0);
+
+    while (written && size > 0) {
+        ssize_t n = write(fd, data, size);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        written = (n > 0);
+        data += written ? n : 0;
+        size -= written ? (size_t)n : 0;
+    }
+
+    if (fd >= 0) {
+        written &= (close(fd) == 0);
+
+        /* readers see the old file or the new one, never a part */
+        written = written && fchmodat(AT_FDCWD, temp, 0644, 0) == 0 &&
+            rename(temp, path) == 0;
+
+        if (!written) {
+            unlink(temp);
+        }
+    }
+
+    if (!written) {
+        cl_debug("%s: %s: %s\n", __func__, path, strerror(errno));
+    }
+
+    free(temp);
+
+    return written;
+}
+
+
+/**
+ * Writes the interface of a parsed module to `path`, unless it
+ * is there already. The module must have parsed cleanly.
+ */
+bool interface_write(str_t path, Source *src, TokenStream *tokens, Ast *ast,
+    Interner *symbols) {
+    if (ast->node_count == 0 || src->length > UINT32_MAX) {
+        return false;
+    }
+
+    size_t size = 0;
+    void *map = _map(path, &size);
+
+    if (map != MAP_FAILED) {
+        InterfaceHeader header;
+        InterfaceLayout layout;
+        bool current = _is_valid(map, size, src, &header, &layout);
+
+        munmap(map, size);
+
+        if (current) {
+            return true;
+        }
+    }
+
+    Pruner pruner = {
+        .from_tokens = tokens,
+        .from = ast,
+        .tokens = tokens_new(NULL),
+        .ast = ast_new(NULL),
+        .token_map = calloc(tokens->count + 1, sizeof(uint32_t)),
+        .failed = false,
+    };
+    bool written = false;
+
+    if (pruner.tokens && pruner.ast && pruner.token_map &&
+        _prune(&pruner)) {
+        uint8_t *data = _serialize(src, pruner.tokens, pruner.ast, symbols,
+            &size);
+
+        written = data && _write_file(path, data, size);
+        free(data);
+    }
+
+    if (pruner.tokens) {
+        tokens_free(pruner.tokens);
+    }
+
+    if (pruner.ast) {
+        ast_free(pruner.ast);
+    }
+
+    free(pruner.token_map);
+
+    return written;
+}
+
+
+/* == loading == */
+
+
+/**
+ * Checks what the views will be used for: every token within
+ * the source, with a known kind and a value within its table,
+ * and every node with a known kind and token. The rest of the
+ * payload is covered by its hash.
+ */
+static bool _check(const InterfaceHeader *header, const uint8_t *data,
+    const InterfaceLayout *layout) {
+    const uint32_t *offsets = (const uint32_t *)&data[layout->offsets];
+    const uint32_t *lengths = (const uint32_t *)&data[layout->lengths];
+    const uint32_t *values = (const uint32_t *)&data[layout->values];
+    const uint32_t *name_offsets =
+        (const uint32_t *)&data[layout->name_offsets];
+    const uint8_t *kinds = &data[layout->kinds];
+    const AstNode *nodes = (const AstNode *)&data[layout->nodes];
+
+    for (size_t i = 0; i < header->token_count; i++) {
+        uint8_t kind = kinds[i];
+        uint32_t limit = _has_symbol(kind) ? header->name_count : 1;
+
+        if (kind > SYM_RBRACE || values[i] >= limit ||
+            (uint64_t)offsets[i] + lengths[i] > header->source_length) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < header->name_count; i++) {
+        if (name_offsets[i] > name_offsets[i + 1]) {
+            return false;
+        }
+    }
+
+    if (name_offsets[header->name_count] != header->names_size ||
+        header->node_count == 0 || nodes[0].kind != AST_FILE ||
+        nodes[0].lhs > nodes[0].rhs || nodes[0].rhs > header->extra_count) {
+        return false;
+    }
+
+    for (size_t i = 1; i < header->node_count; i++) {
+        if (nodes[i].kind >= __AST_KIND_MAX ||
+            nodes[i].token >= header->token_count) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * Maps the interface at `path` if it was made from the text of
+ * `src` by this version of the compiler, and interns its names.
+ * Returns NULL when there is no such interface, or when it is
+ * stale or damaged.
+ */
+ModuleInterface *interface_load(str_t path, Source *src, Interner *symbols) {
+    size_t size = 0;
+    void *map = _map(path, &size);
+
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    const uint8_t *data = map;
+    InterfaceHeader header;
+    InterfaceLayout layout;
+    bool valid = _is_valid(data, size, src, &header, &layout) &&
+        _check(&header, data, &layout);
+
+    const uint32_t *name_offsets = (const uint32_t *)&data[layout.name_offsets];
+    const uint32_t *file_values = (const uint32_t *)&data[layout.values];
+    const uint8_t *kinds = &data[layout.kinds];
+    size_t value_count = 0;
+    size_t blocks = header.token_count / CL_TOKENS_BLOCK + (size_t)1;
+
+    for (size_t i = 0; valid && i < header.token_count; i++) {
+        value_count += cl_has_value((TokenType)kinds[i]);
+    }
+
+    ModuleInterface *self = valid ? calloc(1, sizeof(ModuleInterface)) : NULL;
+    uint32_t *values = self
+        ? malloc((value_count + 1) * sizeof(uint32_t)) : NULL;
+    uint32_t *bases = values ? malloc(blocks * sizeof(uint32_t)) : NULL;
+    uint64_t *masks = bases ? malloc(blocks * sizeof(uint64_t)) : NULL;
+    uint32_t *ids = masks
+        ? malloc((header.name_count + (size_t)1) * sizeof(uint32_t)) : NULL;
+
+    if (!ids) {
+        if (valid) {
+            cl_debug("%s: %s\n", __func__, strerror(errno));
+        }
+
+        free(masks);
+        free(bases);
+        free(values);
+        free(self);
+        munmap(map, size);
+        return NULL;
+    }
+
+    memset(ids, 0, (header.name_count + (size_t)1) * sizeof(uint32_t));
+
+    /*
+     * The file keeps a value for every token, the stream does
+     * not. A name is either a symbol or the contents of a
+     * literal, which the first token that refers to it tells.
+     */
+    for (size_t i = 0, v = 0; valid && i < header.token_count; i++) {
+        if (!cl_has_value((TokenType)kinds[i])) {
+            continue;
+        }
+
+        uint32_t index = file_values[i];
+
+        if (ids[index] == CL_SYMBOL_NONE && _has_symbol(kinds[i])) {
+            str_t name = (str_t)&data[layout.names + name_offsets[index]];
+            uint32_t length = name_offsets[index + 1] - name_offsets[index];
+
+            ids[index] = (kinds[i] == TK_ID)
+                ? interner_intern(symbols, name, length)
+                : interner_add_literal(symbols, name, length);
+            valid = (ids[index] != CL_SYMBOL_NONE);
+        }
+
+        values[v++] = ids[index];
+    }
+
+    free(ids);
+
+    if (!valid) {
+        free(masks);
+        free(bases);
+        free(values);
+        free(self);
+        munmap(map, size);
+        return NULL;
+    }
+
+    self->tokens = (TokenStream){
+        .kinds = (uint8_t *)kinds,
+        .offsets = (uint32_t *)&data[layout.offsets],
+        .lengths = (uint32_t *)&data[layout.lengths],
+        .count = header.token_count,
+        .capacity = header.token_count,
+        .values = values,
+        .value_count = value_count,
+        .value_capacity = value_count,
+        .value_bases = bases,
+        .value_masks = masks,
+    };
+
+    tokens_index_values(&self->tokens);
+
+    self->ast = (Ast){
+        .nodes = (AstNode *)&data[layout.nodes],
+        .node_count = header.node_count,
+        .node_capacity = header.node_count,
+        .extra = (AstIndex *)&data[layout.extra],
+        .extra_count = header.extra_count,
+        .extra_capacity = header.extra_count,
+    };
+
+    self->source_hash = header.source_hash;
+    self->map = map;
+    self->map_size = size;
+
+    return self;
+}
+
+
+void interface_free(ModuleInterface *self) {
+    if (!self) {
+        return;
+    }
+
+    munmap(self->map, self->map_size);
+    free(self->tokens.values);
+    free(self->tokens.value_bases);
+    free(self->tokens.value_masks);
+    free(self);
+}
@@ -0,0 +1,796 @@
+#define CL_LOG_SCOPE "intern"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "cl-log.h"
+#include "cl-arena.h"
+#include "cl-intern.h"
+
+
+#define CL_INTERN_INITIAL_SLOTS 64
+#define CL_INTERN_STRING_BLOCK  4096
+
+/**
+ * Literals are copied into blocks from an arena of their own;
+ * an InternCache starts with a small block and doubles it up
+ * to CL_INTERN_LITERAL_BLOCK, so a short unit wastes little.
+ * Blocks are made of units of 2^CL_INTERN_UNIT_BITS bytes, the
+ * steps the directory of the literals finds them in.
+ */
+#define CL_INTERN_LITERAL_CHUNK (64 * 1024)
+#define CL_INTERN_LITERAL_BLOCK (CL_INTERN_LITERAL_CHUNK / 4)
+#define CL_INTERN_UNIT_BITS     8
+#define CL_INTERN_UNIT          (1u << CL_INTERN_UNIT_BITS)
+
+/**
+ * The names of the symbols are found by id in a directory of
+ * chunks, chunk k holding 2^(CL_INTERN_CHUNK_BITS + k) names,
+ * so it grows without ever moving a name that was handed out.
+ */
+#define CL_INTERN_CHUNK_BITS    10
+#define CL_INTERN_CHUNKS        (32 - CL_INTERN_CHUNK_BITS + 1)
+
+
+_Static_assert((CL_INTERN_SHARDS & (CL_INTERN_SHARDS - 1)) == 0,
+    "the number of shards must be a power of two");
+
+
+/**
+ * The name is kept next to the id, so finding a name costs no
+ * trip through the directory.
+ */
+CL_TYPE(InternSlot) {
+    uint32_t    hash;
+    uint32_t    id;     /* CL_SYMBOL_NONE when empty */
+    const char *name;
+};
+
+
+CL_TYPE(SymbolName) {
+    const char *text;
+    uint32_t    length;
+};
+
+
+/**
+ * One part of the table. The names are packed one after the
+ * other, NUL terminated, into blocks from the shard's arena.
+ * Shards are cache line aligned so threads working on
+ * different shards do not slow each other down.
+ */
+CL_TYPE(InternShard) {
+    _Alignas(64) pthread_mutex_t lock;
+
+    InternSlot *slots;
+    uint32_t    capacity;
+    uint32_t    count;
+
+    Arena *strings;
+    char  *cursor;
+    char  *end;
+    size_t string_bytes;
+
+    size_t lookups;
+    size_t probes;
+    size_t max_probe;
+};
+
+
+/**
+ * The literals. The id of a literal is where it starts in the
+ * blocks taken one after the other, so a literal needs nothing
+ * but its length before its contents, and `units` finds the
+ * block by the unit the id falls into. `unique` maps the
+ * contents of the literals used so far to the first id they
+ * had, see interner_unique.
+ */
+CL_TYPE(LiteralPool) {
+    _Alignas(64) pthread_mutex_t lock;
+
+    Arena   *strings;
+    char    *cursor;    /* block of interner_add_literal */
+    char    *end;
+    uint32_t offset;    /* where `cursor` is among the blocks */
+
+    InternSlot *unique;
+    uint32_t    capacity;
+    uint32_t    count;
+
+    _Atomic uint32_t size;
+    char *_Atomic   *_Atomic units[CL_INTERN_CHUNKS];
+};
+
+
+struct __CL_TNAME(Interner) {
+    InternShard shards[CL_INTERN_SHARDS];
+    LiteralPool literals;
+
+    _Atomic uint32_t next_id;
+    SymbolName *_Atomic chunks[CL_INTERN_CHUNKS];
+};
+
+
+static __Inline uint64_t _mix(uint64_t a, uint64_t b) {
+    __uint128_t product = (__uint128_t)a * b;
+
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+
+/**
+ * Hashes 8 bytes at a time; most names fit in one or two
+ * rounds.
+ */
+static __Inline uint64_t _hash(const char *text, uint32_t length) {
+    uint64_t hash = 0x9E3779B97F4A7C15ULL ^ length;
+    uint64_t word;
+
+    while (length >= 8) {
+        memcpy(&word, text, 8);
+        hash = _mix(hash ^ word, 0xA0761D6478BD642FULL);
+        text += 8;
+        length -= 8;
+    }
+
+    word = 0;
+    memcpy(&word, text, length);
+
+    return _mix(hash ^ word, 0xE7037ED1A0B428DBULL);
+}
+
+
+/**
+ * Returns entry `id` of a chunk directory whose entries take
+ * `size` bytes, creating its chunk when asked to, or NULL.
+ */
+static __Inline void *_chunk_slot(void *_Atomic *chunks, uint32_t id,
+    size_t size, bool create) {
+    uint64_t index = (uint64_t)id + (1u << CL_INTERN_CHUNK_BITS);
+    uint32_t chunk = 63 - (uint32_t)__builtin_clzll(index) - CL_INTERN_CHUNK_BITS;
+    uint64_t base = (uint64_t)1 << (CL_INTERN_CHUNK_BITS + chunk);
+
+    void *entries = atomic_load_explicit(&chunks[chunk], memory_order_acquire);
+
+    if (!entries && create) {
+        void *fresh = calloc(base, size);
+
+        if (!fresh) {
+            cl_debug("%s: %s\n", __func__, strerror(errno));
+            return NULL;
+        }
+
+        /* another shard may have created it meanwhile */
+        if (atomic_compare_exchange_strong(&chunks[chunk], &entries, fresh)) {
+            entries = fresh;
+        } else {
+            free(fresh);
+        }
+    }
+
+    return entries ? (char *)entries + (index - base) * size : NULL;
+}
+
+
+static __Inline SymbolName *_name_slot(Interner *self, uint32_t id,
+    bool create) {
+    return _chunk_slot((void *_Atomic *)self->chunks, id, sizeof(SymbolName),
+        create);
+}
+
+
+static __Inline char *_Atomic *_unit_slot(LiteralPool *pool, uint32_t unit,
+    bool create) {
+    return _chunk_slot((void *_Atomic *)pool->units, unit, sizeof(char *),
+        create);
+}
+
+
+Interner *interner_new(void) {
+    Interner *new_interner = calloc(1, sizeof(Interner));
+
+    if (!new_interner) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    LiteralPool *literals = &new_interner->literals;
+
+    atomic_init(&new_interner->next_id, CL_SYMBOL_NONE + 1);
+    atomic_init(&literals->size, 0);
+    pthread_mutex_init(&literals->lock, NULL);
+
+    for (size_t i = 0; i < CL_INTERN_SHARDS; i++) {
+        pthread_mutex_init(&new_interner->shards[i].lock, NULL);
+    }
+
+    literals->strings = arena_new(CL_INTERN_LITERAL_CHUNK);
+    literals->unique = calloc(CL_INTERN_INITIAL_SLOTS, sizeof(InternSlot));
+    literals->capacity = CL_INTERN_INITIAL_SLOTS;
+
+    if (!literals->strings || !literals->unique) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        interner_free(new_interner);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < CL_INTERN_SHARDS; i++) {
+        InternShard *shard = &new_interner->shards[i];
+
+        shard->strings = arena_new(CL_INTERN_STRING_BLOCK);
+        shard->slots = calloc(CL_INTERN_INITIAL_SLOTS, sizeof(InternSlot));
+        shard->capacity = CL_INTERN_INITIAL_SLOTS;
+
+        if (!shard->strings || !shard->slots) {
+            cl_debug("%s: %s\n", __func__, strerror(errno));
+            interner_free(new_interner);
+            return NULL;
+        }
+    }
+
+    return new_interner;
+}
+
+
+static InternSlot *_slots_grow(InternSlot *old, uint32_t old_capacity,
+    uint32_t capacity) {
+    InternSlot *slots = calloc(capacity, sizeof(InternSlot));
+
+    if (!slots) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        InternSlot slot = old[i];
+
+        if (slot.id == CL_SYMBOL_NONE) {
+            continue;
+        }
+
+        uint32_t at = slot.hash & (capacity - 1);
+
+        while (slots[at].id != CL_SYMBOL_NONE) {
+            at = (at + 1) & (capacity - 1);
+        }
+
+        slots[at] = slot;
+    }
+
+    free(old);
+
+    return slots;
+}
+
+
+static bool _shard_grow(InternShard *shard) {
+    uint32_t capacity = shard->capacity * 2;
+    InternSlot *slots = _slots_grow(shard->slots, shard->capacity, capacity);
+
+    if (!slots) {
+        return false;
+    }
+
+    shard->slots = slots;
+    shard->capacity = capacity;
+
+    return true;
+}
+
+
+/**
+ * Each name is stored after its length, so a slot can be
+ * compared without looking up the length anywhere else.
+ */
+static __Inline uint32_t _stored_length(const char *name) {
+    uint32_t length;
+
+    memcpy(&length, name - sizeof(length), sizeof(length));
+
+    return length;
+}
+
+
+static const char *_shard_store(InternShard *shard, const char *text,
+    uint32_t length) {
+    size_t needed = sizeof(length) + length + 1;
+
+    if ((size_t)(shard->end - shard->cursor) < needed) {
+        size_t size = needed > CL_INTERN_STRING_BLOCK ? needed
+                                                      : CL_INTERN_STRING_BLOCK;
+        char *block = arena_alloc(shard->strings, size);
+
+        if (!block) {
+            return NULL;
+        }
+
+        shard->cursor = block;
+        shard->end = block + size;
+    }
+
+    char *copy = shard->cursor + sizeof(length);
+
+    memcpy(shard->cursor, &length, sizeof(length));
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    shard->cursor += needed;
+    shard->string_bytes += length + 1;
+
+    return copy;
+}
+
+
+static uint32_t _shard_add(Interner *self, InternShard *shard, uint32_t at,
+    uint32_t hash, const char *text, uint32_t length) {
+    uint32_t id = atomic_fetch_add(&self->next_id, 1);
+
+    if (id == CL_SYMBOL_NONE || id == UINT32_MAX) {
+        cl_error("too many symbols\n");
+        return CL_SYMBOL_NONE;
+    }
+
+    SymbolName *name = _name_slot(self, id, true);
+    const char *copy = name ? _shard_store(shard, text, length) : NULL;
+
+    if (!copy) {
+        return CL_SYMBOL_NONE;
+    }
+
+    name->text = copy;
+    name->length = length;
+
+    shard->slots[at] = (InternSlot){ hash, id, copy };
+    shard->count++;
+
+    return id;
+}
+
+
+static uint32_t _intern_hashed(Interner *self, uint64_t hash64,
+    const char *text, uint32_t length) {
+    uint32_t hash = (uint32_t)hash64;
+    InternShard *shard = &self->shards[hash64 >> (64 - __builtin_ctz(CL_INTERN_SHARDS))];
+    uint32_t id = CL_SYMBOL_NONE;
+
+    pthread_mutex_lock(&shard->lock);
+
+    /* keep the table at most 3/4 full */
+    if ((shard->count + 1) * 4 > shard->capacity * 3 && !_shard_grow(shard)) {
+        pthread_mutex_unlock(&shard->lock);
+        return CL_SYMBOL_NONE;
+    }
+
+    uint32_t mask = shard->capacity - 1;
+    uint32_t at = hash & mask;
+    size_t probes = 0;
+
+    for (;; at = (at + 1) & mask, probes++) {
+        InternSlot slot = shard->slots[at];
+
+        if (slot.id == CL_SYMBOL_NONE) {
+            id = _shard_add(self, shard, at, hash, text, length);
+            break;
+        }
+
+        if (slot.hash == hash && _stored_length(slot.name) == length &&
+            memcmp(slot.name, text, length) == 0) {
+            id = slot.id;
+            break;
+        }
+    }
+
+    shard->lookups++;
+    shard->probes += probes;
+
+    if (probes > shard->max_probe) {
+        shard->max_probe = probes;
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+
+    return id;
+}
+
+
+/**
+ * Returns the id of a name, adding it when it is new, or
+ * CL_SYMBOL_NONE when out of memory.
+ */
+uint32_t interner_intern(Interner *self, const char *text, uint32_t length) {
+    return _intern_hashed(self, _hash(text, length), text, length);
+}
+
+
+/**
+ * Takes a block of at least `size` bytes for literals, the
+ * first at `*offset` among the blocks, and lets the directory
+ * find its units. Returns its size through `size`, or NULL.
+ * The pool's lock must be held.
+ */
+static char *_literal_block(LiteralPool *pool, size_t *size,
+    uint32_t *offset) {
+    size_t units = (*size + CL_INTERN_UNIT - 1) >> CL_INTERN_UNIT_BITS;
+    char *block = NULL;
+    uint32_t start = atomic_load_explicit(&pool->size, memory_order_relaxed);
+
+    if (units > (CL_SYMBOL_LITERAL - start) >> CL_INTERN_UNIT_BITS) {
+        cl_error("too many literals\n");
+    } else {
+        block = arena_alloc(pool->strings, units << CL_INTERN_UNIT_BITS);
+    }
+
+    for (size_t i = 0; block && i < units; i++) {
+        char *_Atomic *unit = _unit_slot(pool,
+            (start >> CL_INTERN_UNIT_BITS) + (uint32_t)i, true);
+
+        if (!unit) {
+            block = NULL;
+            break;
+        }
+
+        atomic_store_explicit(unit, block + (i << CL_INTERN_UNIT_BITS),
+            memory_order_relaxed);
+    }
+
+    if (block) {
+        *size = units << CL_INTERN_UNIT_BITS;
+        *offset = start;
+        atomic_store_explicit(&pool->size, start + (uint32_t)*size,
+            memory_order_release);
+    }
+
+    return block;
+}
+
+
+/**
+ * Copies the few bytes most literals have with two moves of
+ * fixed size, which overlap rather than run past either end;
+ * a call to memcpy costs more than such a copy.
+ */
+static __Inline void _copy_short(char *to, const char *from, uint32_t length) {
+    if (length > 32) {
+        memcpy(to, from, length);
+    } else if (length >= 16) {
+        memcpy(to, from, 16);
+        memcpy(to + length - 16, from + length - 16, 16);
+    } else if (length >= 8) {
+        memcpy(to, from, 8);
+        memcpy(to + length - 8, from + length - 8, 8);
+    } else if (length >= 4) {
+        memcpy(to, from, 4);
+        memcpy(to + length - 4, from + length - 4, 4);
+    } else {
+        for (uint32_t i = 0; i < length; i++) {
+            to[i] = from[i];
+        }
+    }
+}
+
+
+/**
+ * Stores a literal at `cursor` the way a shard stores a name:
+ * its length, its contents and a NUL. Returns the room it took.
+ */
+static __Inline size_t _literal_store(char *cursor, const char *text,
+    uint32_t length) {
+    memcpy(cursor, &length, sizeof(length));
+    _copy_short(cursor + sizeof(length), text, length);
+    cursor[sizeof(length) + length] = '\0';
+
+    return sizeof(length) + length + 1;
+}
+
+
+/**
+ * Adds the contents of a string or character literal to the
+ * pool, without looking for an equal one, and returns its id
+ * or CL_SYMBOL_NONE when out of memory. Lexers go through
+ * intern_cache_literal instead, which does not take the lock
+ * for every literal.
+ */
+uint32_t interner_add_literal(Interner *self, const char *text,
+    uint32_t length) {
+    LiteralPool *pool = &self->literals;
+    size_t needed = sizeof(length) + (size_t)length + 1;
+
+    pthread_mutex_lock(&pool->lock);
+
+    if ((size_t)(pool->end - pool->cursor) < needed) {
+        size_t size = needed > CL_INTERN_STRING_BLOCK ? needed
+                                                      : CL_INTERN_STRING_BLOCK;
+        uint32_t offset;
+        char *block = _literal_block(pool, &size, &offset);
+
+        if (!block) {
+            pthread_mutex_unlock(&pool->lock);
+            return CL_SYMBOL_NONE;
+        }
+
+        pool->cursor = block;
+        pool->end = block + size;
+        pool->offset = offset;
+    }
+
+    uint32_t id = pool->offset | CL_SYMBOL_LITERAL;
+    size_t stored = _literal_store(pool->cursor, text, length);
+
+    pool->cursor += stored;
+    pool->offset += (uint32_t)stored;
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return id;
+}
+
+
+/**
+ * Returns the first literal id handed to the contents of
+ * literal `id`, so equal literals compare equal by id once
+ * both went through here. Names are unique already and come
+ * back as they are.
+ */
+uint32_t interner_unique(Interner *self, uint32_t id) {
+    uint32_t length;
+    str_t text = interner_name(self, id, &length);
+
+    if (!(id & CL_SYMBOL_LITERAL) || !text) {
+        return id;
+    }
+
+    LiteralPool *pool = &self->literals;
+    uint32_t hash = (uint32_t)_hash(text, length);
+
+    pthread_mutex_lock(&pool->lock);
+
+    if ((pool->count + 1) * 4 > pool->capacity * 3) {
+        InternSlot *unique = _slots_grow(pool->unique, pool->capacity,
+            pool->capacity * 2);
+
+        if (!unique) {
+            pthread_mutex_unlock(&pool->lock);
+            return id;
+        }
+
+        pool->unique = unique;
+        pool->capacity *= 2;
+    }
+
+    uint32_t mask = pool->capacity - 1;
+    uint32_t at = hash & mask;
+
+    for (;; at = (at + 1) & mask) {
+        InternSlot slot = pool->unique[at];
+
+        if (slot.id == CL_SYMBOL_NONE) {
+            pool->unique[at] = (InternSlot){ hash, id, text };
+            pool->count++;
+            break;
+        }
+
+        if (slot.hash == hash && _stored_length(slot.name) == length &&
+            memcmp(slot.name, text, length) == 0) {
+            id = slot.id;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return id;
+}
+
+
+static str_t _literal_name(LiteralPool *pool, uint32_t offset,
+    uint32_t *length) {
+    if (offset >= atomic_load_explicit(&pool->size, memory_order_relaxed)) {
+        return NULL;
+    }
+
+    char *_Atomic *unit = _unit_slot(pool, offset >> CL_INTERN_UNIT_BITS,
+        false);
+    char *block = unit ? atomic_load_explicit(unit, memory_order_relaxed)
+                       : NULL;
+
+    if (!block) {
+        return NULL;
+    }
+
+    const char *stored = block + (offset & (CL_INTERN_UNIT - 1));
+
+    if (length) {
+        memcpy(length, stored, sizeof(*length));
+    }
+
+    return stored + sizeof(*length);
+}
+
+
+/**
+ * Returns the NUL terminated name of a symbol, or the contents
+ * of a literal, or NULL for an unknown id. The id must have
+ * been handed out to the calling thread, or to one it
+ * synchronized with since.
+ */
+str_t interner_name(Interner *self, uint32_t id, uint32_t *length) {
+    if (id & CL_SYMBOL_LITERAL) {
+        return _literal_name(&self->literals, id & ~CL_SYMBOL_LITERAL,
+            length);
+    }
+
+    if (id == CL_SYMBOL_NONE ||
+        id >= atomic_load_explicit(&self->next_id, memory_order_relaxed)) {
+        return NULL;
+    }
+
+    SymbolName *name = _name_slot(self, id, false);
+
+    if (!name || !name->text) {
+        return NULL;
+    }
+
+    if (length) {
+        *length = name->length;
+    }
+
+    return name->text;
+}
+
+
+size_t interner_count(Interner *self) {
+    return atomic_load(&self->next_id) - (CL_SYMBOL_NONE + 1);
+}
+
+
+void interner_stats(Interner *self, InternerStats *stats) {
+    *stats = (InternerStats){ 0 };
+
+    for (size_t i = 0; i < CL_INTERN_SHARDS; i++) {
+        InternShard *shard = &self->shards[i];
+
+        pthread_mutex_lock(&shard->lock);
+
+        stats->symbols += shard->count;
+        stats->string_bytes += shard->string_bytes;
+        stats->memory_bytes += shard->strings->stats.reserved +
+            shard->capacity * sizeof(InternSlot);
+        stats->lookups += shard->lookups;
+        stats->probes += shard->probes;
+
+        if (shard->max_probe > stats->max_probe) {
+            stats->max_probe = shard->max_probe;
+        }
+
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    LiteralPool *pool = &self->literals;
+
+    pthread_mutex_lock(&pool->lock);
+
+    stats->memory_bytes += pool->strings->stats.reserved +
+        pool->capacity * sizeof(InternSlot);
+
+    pthread_mutex_unlock(&pool->lock);
+
+    for (uint32_t k = 0; k < CL_INTERN_CHUNKS; k++) {
+        size_t entries = (size_t)1 << (CL_INTERN_CHUNK_BITS + k);
+
+        if (atomic_load(&self->chunks[k])) {
+            stats->memory_bytes += entries * sizeof(SymbolName);
+        }
+
+        if (atomic_load(&pool->units[k])) {
+            stats->memory_bytes += entries * sizeof(char *);
+        }
+    }
+}
+
+
+void intern_cache_init(InternCache *self, Interner *symbols) {
+    self->symbols = symbols;
+    self->literal_cursor = NULL;
+    self->literal_end = NULL;
+    self->literal_block = CL_INTERN_UNIT;
+    self->literal_offset = 0;
+
+    memset(self->entries, 0, sizeof(self->entries));
+}
+
+
+/**
+ * Same as interner_intern, through the cache. The cache keeps
+ * pointers to the interned names, never to `text`.
+ */
+uint32_t intern_cache_intern(InternCache *self, const char *text,
+    uint32_t length) {
+    uint64_t hash = _hash(text, length);
+    InternCacheEntry *entry = &self->entries[(hash >> 32) &
+        (CL_INTERN_CACHE_SIZE - 1)];
+
+    if (entry->length == length && entry->name &&
+        memcmp(entry->name, text, length) == 0) {
+        return entry->id;
+    }
+
+    uint32_t id = _intern_hashed(self->symbols, hash, text, length);
+
+    if (id != CL_SYMBOL_NONE) {
+        entry->name = interner_name(self->symbols, id, NULL);
+        entry->length = length;
+        entry->id = id;
+    }
+
+    return id;
+}
+
+
+/**
+ * Same as interner_add_literal, copying into the cache's own
+ * block, so only a full block takes the lock.
+ */
+uint32_t intern_cache_literal(InternCache *self, const char *text,
+    uint32_t length) {
+    size_t needed = sizeof(length) + (size_t)length + 1;
+
+    if (__builtin_expect((size_t)(self->literal_end - self->literal_cursor) <
+        needed, 0)) {
+        size_t size = needed > self->literal_block ? needed
+                                                   : self->literal_block;
+        LiteralPool *pool = &self->symbols->literals;
+        uint32_t offset;
+
+        pthread_mutex_lock(&pool->lock);
+        char *block = _literal_block(pool, &size, &offset);
+        pthread_mutex_unlock(&pool->lock);
+
+        if (!block) {
+            return CL_SYMBOL_NONE;
+        }
+
+        self->literal_cursor = block;
+        self->literal_end = block + size;
+        self->literal_offset = offset;
+
+        if (self->literal_block < CL_INTERN_LITERAL_BLOCK) {
+            self->literal_block *= 2;
+        }
+    }
+
+    uint32_t id = self->literal_offset | CL_SYMBOL_LITERAL;
+    size_t stored = _literal_store(self->literal_cursor, text, length);
+
+    self->literal_cursor += stored;
+    self->literal_offset += (uint32_t)stored;
+
+    return id;
+}
+
+
+void interner_free(Interner *self) {
+    if (!self) {
+        return;
+    }
+
+    for (size_t i = 0; i < CL_INTERN_SHARDS; i++) {
+        InternShard *shard = &self->shards[i];
+
+        pthread_mutex_destroy(&shard->lock);
+        arena_free(shard->strings);
+        free(shard->slots);
+    }
+
+    pthread_mutex_destroy(&self->literals.lock);
+    arena_free(self->literals.strings);
+    free(self->literals.unique);
+
+    for (uint32_t k = 0; k < CL_INTERN_CHUNKS; k++) {
+        free(atomic_load(&self->chunks[k]));
+        free(atomic_load(&self->literals.units[k]));
+    }
+
+    free(self);
+}
@@ -0,0 +1,1526 @@
+#define CL_LOG_SCOPE "ir"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "cl-log.h"
+#include "cl-ir.h"
+
+
+CL_TYPE(IrOpInfo) {
+    str_t    name;
+    int      operands;
+    uint32_t flags;
+};
+
+
+#define __CL_IR_INFO(name, operands, flags) { #name, operands, flags },
+
+static const IrOpInfo OPS[] = {
+    CL_IR_OPS(__CL_IR_INFO)
+};
+
+
+int ir_op_operands(IrOp op) {
+    return (op < __CL_IR_MAX) ? OPS[op].operands : 0;
+}
+
+
+uint32_t ir_op_flags(IrOp op) {
+    return (op < __CL_IR_MAX) ? OPS[op].flags : 0;
+}
+
+
+str_t ir_op_name(IrOp op) {
+    return (op < __CL_IR_MAX) ? OPS[op].name : "?";
+}
+
+
+/* == instructions == */
+
+
+static IrValue _new(IrFunction *self, IrInstr instr) {
+    if (!ir_instr_vector_push(&self->instrs, instr)) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        self->failed = true;
+        return CL_IR_NONE;
+    }
+
+    return (IrValue)(self->instrs.count - 1);
+}
+
+
+IrBlockId ir_block_add(IrFunction *self) {
+    IrBlock block = { .idom = CL_IR_NO_BLOCK, .order = UINT32_MAX };
+
+    if (!ir_block_vector_push(&self->blocks, block)) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        self->failed = true;
+        return CL_IR_NO_BLOCK;
+    }
+
+    return (IrBlockId)(self->blocks.count - 1);
+}
+
+
+/**
+ * Adds an instruction to a block, before the one at `at`.
+ */
+IrValue ir_insert(IrFunction *self, IrBlockId block, size_t at,
+    IrInstr instr) {
+    instr.block = block;
+
+    IrValue value = _new(self, instr);
+    IrValueVector *list = &ir_block(self, block)->instrs;
+
+    if (value == CL_IR_NONE || !ir_value_vector_push(list, value)) {
+        self->failed = true;
+        return CL_IR_NONE;
+    }
+
+    if (at < list->count - 1) {
+        memmove(&list->data[at + 1], &list->data[at],
+            (list->count - 1 - at) * sizeof(IrValue));
+        list->data[at] = value;
+    }
+
+    return value;
+}
+
+
+IrValue ir_append(IrFunction *self, IrBlockId block, IrInstr instr) {
+    return ir_insert(self, block, ir_block(self, block)->instrs.count, instr);
+}
+
+
+/**
+ * Adds a phi with `count` operands, all CL_IR_NONE, in front
+ * of a block.
+ */
+IrValue ir_phi_new(IrFunction *self, IrBlockId block, uint32_t count) {
+    size_t start = self->extra.count;
+
+    if (!ir_value_vector_reserve(&self->extra, start + count + 1)) {
+        self->failed = true;
+        return CL_IR_NONE;
+    }
+
+    memset(&self->extra.data[start], 0, count * sizeof(IrValue));
+    self->extra.count += count;
+
+    IrInstr phi = {
+        .op = CL_IR_PHI,
+        .args = { (IrValue)start, count },
+    };
+
+    return ir_insert(self, block, 0, phi);
+}
+
+
+/**
+ * The operands of a value, which may be written through as long
+ * as nothing is added to the function.
+ */
+IrValue *ir_operands(IrFunction *self, IrValue value, uint32_t *count) {
+    IrInstr *instr = ir_instr(self, value);
+    int operands = ir_op_operands(instr->op);
+
+    if (operands == CL_IR_VARIADIC) {
+        *count = instr->args[1];
+        return &self->extra.data[instr->args[0]];
+    }
+
+    *count = (uint32_t)operands;
+
+    return instr->args;
+}
+
+
+/**
+ * What a value stands for, once the aliases are followed.
+ */
+IrValue ir_resolve(IrFunction *self, IrValue value) {
+    IrValue target = value;
+
+    while (ir_instr(self, target)->op == CL_IR_ALIAS) {
+        target = ir_instr(self, target)->args[0];
+    }
+
+    /* shorten the chain for the next time */
+    while (ir_instr(self, value)->op == CL_IR_ALIAS) {
+        IrValue next = ir_instr(self, value)->args[0];
+
+        ir_instr(self, value)->args[0] = target;
+        value = next;
+    }
+
+    return target;
+}
+
+
+void ir_replace(IrFunction *self, IrValue value, IrValue by) {
+    by = ir_resolve(self, by);
+
+    if (by == value) {
+        return;
+    }
+
+    IrInstr *instr = ir_instr(self, value);
+
+    instr->op = CL_IR_ALIAS;
+    instr->args[0] = by;
+}
+
+
+void ir_remove(IrFunction *self, IrValue value) {
+    ir_instr(self, value)->op = CL_IR_NOP;
+}
+
+
+/* == blocks == */
+
+
+IrValue ir_terminator(IrFunction *self, IrBlockId block) {
+    IrValueVector *list = &ir_block(self, block)->instrs;
+
+    for (size_t i = list->count; i > 0; i--) {
+        IrValue value = list->data[i - 1];
+
+        if (ir_op_flags(ir_instr(self, value)->op) & CL_IR_TERM) {
+            return value;
+        }
+    }
+
+    return CL_IR_NONE;
+}
+
+
+uint32_t ir_succs(IrFunction *self, IrBlockId block, IrBlockId succs[2]) {
+    IrValue term = ir_terminator(self, block);
+    IrInstr *instr = ir_instr(self, term);
+
+    switch (term ? instr->op : CL_IR_NOP) {
+        case CL_IR_JMP:
+            succs[0] = ir_target(instr, 0);
+            return 1;
+
+        case CL_IR_BR:
+            succs[0] = ir_target(instr, 0);
+            succs[1] = ir_target(instr, 1);
+            return 2;
+
+        default:
+            return 0;
+    }
+}
+
+
+size_t ir_pred_index(IrFunction *self, IrBlockId block, IrBlockId pred) {
+    IrBlockIdVector *preds = &ir_block(self, block)->preds;
+
+    for (size_t i = 0; i < preds->count; i++) {
+        if (preds->data[i] == pred) {
+            return i;
+        }
+    }
+
+    return SIZE_MAX;
+}
+
+
+/**
+ * Removes a predecessor of a block, and its operand from every
+ * phi of the block.
+ */
+void ir_pred_remove(IrFunction *self, IrBlockId block, size_t index) {
+    IrBlock *b = ir_block(self, block);
+
+    memmove(&b->preds.data[index], &b->preds.data[index + 1],
+        (b->preds.count - index - 1) * sizeof(IrBlockId));
+    b->preds.count--;
+
+    for (size_t i = 0; i < b->instrs.count; i++) {
+        IrInstr *phi = ir_instr(self, b->instrs.data[i]);
+
+        if (phi->op != CL_IR_PHI) {
+            continue;
+        }
+
+        IrValue *args = &self->extra.data[phi->args[0]];
+
+        memmove(&args[index], &args[index + 1],
+            (phi->args[1] - index - 1) * sizeof(IrValue));
+        phi->args[1]--;
+    }
+}
+
+
+/**
+ * Adds a predecessor to a block. Its operand in every phi of the
+ * block is the one of predecessor `like`, or CL_IR_NONE when
+ * `like` is SIZE_MAX.
+ */
+bool ir_pred_add(IrFunction *self, IrBlockId block, IrBlockId pred,
+    size_t like) {
+    IrBlock *b = ir_block(self, block);
+
+    if (!ir_block_id_vector_push(&b->preds, pred)) {
+        self->failed = true;
+        return false;
+    }
+
+    for (size_t i = 0; i < b->instrs.count; i++) {
+        IrValue value = b->instrs.data[i];
+        IrInstr *phi = ir_instr(self, value);
+
+        if (phi->op != CL_IR_PHI) {
+            continue;
+        }
+
+        /* phis get a new range of operands at the end of `extra` */
+        uint32_t count = phi->args[1];
+        size_t start = self->extra.count;
+
+        if (!ir_value_vector_reserve(&self->extra, start + count + 1)) {
+            self->failed = true;
+            return false;
+        }
+
+        IrValue *args = self->extra.data;
+
+        memcpy(&args[start], &args[phi->args[0]], count * sizeof(IrValue));
+        args[start + count] = (like == SIZE_MAX)
+            ? CL_IR_NONE : args[phi->args[0] + like];
+        self->extra.count += count + 1;
+        phi->args[0] = (IrValue)start;
+        phi->args[1] = count + 1;
+    }
+
+    return true;
+}
+
+
+/**
+ * Removes a block that nothing reaches, and its edges.
+ */
+void ir_block_kill(IrFunction *self, IrBlockId block) {
+    IrBlockId succs[2];
+    uint32_t count = ir_succs(self, block, succs);
+
+    for (uint32_t i = 0; i < count; i++) {
+        size_t index = ir_pred_index(self, succs[i], block);
+
+        if (index != SIZE_MAX) {
+            ir_pred_remove(self, succs[i], index);
+        }
+    }
+
+    IrBlock *b = ir_block(self, block);
+
+    for (size_t i = 0; i < b->instrs.count; i++) {
+        ir_remove(self, b->instrs.data[i]);
+    }
+
+    b->instrs.count = 0;
+    b->preds.count = 0;
+    b->dead = true;
+}
+
+
+/**
+ * Rewrites operands that are aliases into what they stand for
+ * and drops removed instructions and blocks.
+ */
+void ir_settle(IrFunction *self) {
+    for (size_t i = 0; i < self->blocks.count; i++) {
+        IrBlock *block = ir_block(self, (IrBlockId)i);
+        size_t kept = 0;
+
+        for (size_t j = 0; j < block->instrs.count; j++) {
+            IrValue value = block->instrs.data[j];
+            uint8_t op = ir_instr(self, value)->op;
+
+            if (op == CL_IR_NOP || op == CL_IR_ALIAS) {
+                continue;
+            }
+
+            uint32_t count;
+            IrValue *args = ir_operands(self, value, &count);
+
+            for (uint32_t k = 0; k < count; k++) {
+                args[k] = ir_resolve(self, args[k]);
+            }
+
+            block->instrs.data[kept++] = value;
+        }
+
+        block->instrs.count = kept;
+    }
+
+    size_t kept = 0;
+
+    for (size_t i = 0; i < self->layout.count; i++) {
+        if (!ir_block(self, self->layout.data[i])->dead) {
+            self->layout.data[kept++] = self->layout.data[i];
+        }
+    }
+
+    self->layout.count = kept;
+}
+
+
+/* == dominators == */
+
+
+/**
+ * Numbers the blocks reachable from the entry in reverse
+ * postorder, into `rpo` and the `order` of every block; the
+ * others get UINT32_MAX.
+ */
+bool ir_order(IrFunction *self) {
+    size_t count = self->blocks.count;
+    IrBlockId *stack = malloc(count * sizeof(IrBlockId));
+    uint8_t *next = calloc(count, 1);
+
+    if (!stack || !next || !ir_block_id_vector_reserve(&self->rpo, count)) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        free(stack);
+        free(next);
+        self->failed = true;
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        ir_block(self, (IrBlockId)i)->order = UINT32_MAX;
+    }
+
+    /* blocks go to the end of `rpo` in postorder, reversed below */
+    size_t depth = 0, done = 0;
+
+    stack[depth++] = 0;
+    ir_block(self, 0)->order = 0;
+
+    while (depth > 0) {
+        IrBlockId block = stack[depth - 1];
+        IrBlockId succs[2];
+        uint32_t n = ir_succs(self, block, succs);
+
+        if (next[block] < n) {
+            IrBlockId succ = succs[next[block]++];
+
+            if (ir_block(self, succ)->order == UINT32_MAX) {
+                ir_block(self, succ)->order = 0;
+                stack[depth++] = succ;
+            }
+
+            continue;
+        }
+
+        self->rpo.data[done++] = block;
+        depth--;
+    }
+
+    for (size_t i = 0; i < done / 2; i++) {
+        IrBlockId tmp = self->rpo.data[i];
+
+        self->rpo.data[i] = self->rpo.data[done - 1 - i];
+        self->rpo.data[done - 1 - i] = tmp;
+    }
+
+    self->rpo.count = done;
+
+    for (size_t i = 0; i < done; i++) {
+        ir_block(self, self->rpo.data[i])->order = (uint32_t)i;
+    }
+
+    free(stack);
+    free(next);
+
+    return true;
+}
+
+
+static IrBlockId _intersect(IrFunction *self, IrBlockId a, IrBlockId b) {
+    while (a != b) {
+        while (ir_block(self, a)->order > ir_block(self, b)->order) {
+            a = ir_block(self, a)->idom;
+        }
+
+        while (ir_block(self, b)->order > ir_block(self, a)->order) {
+            b = ir_block(self, b)->idom;
+        }
+    }
+
+    return a;
+}
+
+
+/**
+ * Works out the immediate dominator of every reachable block,
+ * the way Cooper, Harvey and Kennedy do, after ir_order. The
+ * entry is its own.
+ */
+bool ir_dominators(IrFunction *self) {
+    if (!ir_order(self)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < self->blocks.count; i++) {
+        ir_block(self, (IrBlockId)i)->idom = CL_IR_NO_BLOCK;
+    }
+
+    ir_block(self, 0)->idom = 0;
+
+    for (bool changed = true; changed; ) {
+        changed = false;
+
+        for (size_t i = 1; i < self->rpo.count; i++) {
+            IrBlock *block = ir_block(self, self->rpo.data[i]);
+            IrBlockId idom = CL_IR_NO_BLOCK;
+
+            for (size_t j = 0; j < block->preds.count; j++) {
+                IrBlockId pred = block->preds.data[j];
+
+                if (ir_block(self, pred)->idom == CL_IR_NO_BLOCK) {
+                    continue;
+                }
+
+                idom = (idom == CL_IR_NO_BLOCK)
+                    ? pred : _intersect(self, pred, idom);
+            }
+
+            if (block->idom != idom) {
+                block->idom = idom;
+                changed = true;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * Whether every path from the entry to `b` goes through `a`,
+ * after ir_dominators.
+ */
+bool ir_dominates(IrFunction *self, IrBlockId a, IrBlockId b) {
+    uint32_t order = ir_block(self, a)->order;
+
+    while (ir_block(self, b)->order > order) {
+        b = ir_block(self, b)->idom;
+    }
+
+    return a == b;
+}
+
+
+/* == lifting == */
+
+
+/**
+ * Turns the registers of the bytecode into SSA values the way
+ * Braun et al. do: a register read in a block that does not
+ * write it comes from its predecessors, through a phi when
+ * there are several, and blocks whose predecessors are not all
+ * lifted yet get phis filled in once they are. Blocks are
+ * lifted in the order of the bytecode, so only loops wait.
+ */
+CL_TYPE(Lifter) {
+    IrFunction             *fn;
+    const BytecodeFunction *bc;
+    const uint64_t         *constants;
+    const Instruction      *code;
+    IrArityFn               arity;
+    void                   *user_data;
+    uint32_t                registers;
+    IrBlockId              *block_at;   /* of the block starting at a pc */
+    uint32_t               *start;      /* pc of every block */
+    IrValue                *defs;       /* registers by blocks */
+    uint32_t               *waiting;    /* predecessors not lifted yet */
+    IrValueVector           incomplete; /* phi, register pairs */
+    IrValue                 undef;
+};
+
+
+static __Inline IrValue *_def(Lifter *self, uint32_t reg, IrBlockId block) {
+    return &self->defs[(size_t)block * self->registers + reg];
+}
+
+
+static __Inline bool _sealed(Lifter *self, IrBlockId block) {
+    return self->waiting[block] == 0;
+}
+
+
+static IrValue _read(Lifter *self, uint32_t reg, IrBlockId block);
+
+
+static void _phi_operands(Lifter *self, uint32_t reg, IrValue phi) {
+    IrFunction *fn = self->fn;
+    IrBlockId block = ir_instr(fn, phi)->block;
+    size_t count = ir_block(fn, block)->preds.count;
+
+    for (size_t i = 0; i < count; i++) {
+        IrValue value = _read(self, reg, ir_block(fn, block)->preds.data[i]);
+
+        fn->extra.data[ir_instr(fn, phi)->args[0] + i] = value;
+    }
+}
+
+
+static IrValue _read(Lifter *self, uint32_t reg, IrBlockId block) {
+    IrFunction *fn = self->fn;
+    IrBlockId at = block;
+
+    /* a chain of single predecessors reads what the top one does */
+    while (*_def(self, reg, at) == CL_IR_NONE && _sealed(self, at) &&
+        ir_block(fn, at)->preds.count == 1) {
+        at = ir_block(fn, at)->preds.data[0];
+    }
+
+    IrValue value = *_def(self, reg, at);
+
+    if (value == CL_IR_NONE) {
+        size_t count = ir_block(fn, at)->preds.count;
+
+        value = ir_phi_new(fn, at, (uint32_t)count);
+
+        if (value == CL_IR_NONE) {
+            return self->undef;
+        }
+
+        *_def(self, reg, at) = value;
+
+        if (!_sealed(self, at)) {
+            if (!ir_value_vector_push(&self->incomplete, value) ||
+                !ir_value_vector_push(&self->incomplete, reg)) {
+                fn->failed = true;
+            }
+        } else {
+            _phi_operands(self, reg, value);
+        }
+    }
+
+    for (IrBlockId b = block; b != at; b = ir_block(fn, b)->preds.data[0]) {
+        *_def(self, reg, b) = value;
+    }
+
+    return value;
+}
+
+
+static __Inline void _write(Lifter *self, uint32_t reg, IrBlockId block,
+    IrValue value) {
+    *_def(self, reg, block) = value;
+}
+
+
+/**
+ * Fills in the phis of a block waiting for its predecessors.
+ */
+static void _seal(Lifter *self, IrBlockId block) {
+    IrValueVector *list = &self->incomplete;
+
+    for (size_t i = 0; i < list->count; ) {
+        IrValue phi = list->data[i];
+
+        if (ir_instr(self->fn, phi)->block != block) {
+            i += 2;
+            continue;
+        }
+
+        uint32_t reg = list->data[i + 1];
+
+        list->data[i] = list->data[list->count - 2];
+        list->data[i + 1] = list->data[list->count - 1];
+        list->count -= 2;
+        _phi_operands(self, reg, phi);
+    }
+}
+
+
+static bool _is_test(Opcode op) {
+    BytecodeFormat format = bytecode_op_format(op);
+
+    return format == CL_FMT_TEST_RR || format == CL_FMT_TEST_R;
+}
+
+
+/* what _find_blocks marks */
+#define LIFT_LEADER     1   /* a block starts here */
+#define LIFT_PAIRED     2   /* the JMP of a test */
+
+
+/**
+ * Finds the blocks of the bytecode, and checks it is the kind
+ * codegen writes: every test followed by its JMP, nothing
+ * jumping between the two, and no way to run past the end.
+ */
+static bool _find_blocks(Lifter *self, uint8_t *marks) {
+    const Instruction *code = self->code;
+    uint32_t count = self->bc->code_count;
+
+    marks[0] |= LIFT_LEADER;
+
+    for (uint32_t pc = 0; pc < count; pc++) {
+        Opcode op = CL_OP(code[pc]);
+
+        if (op >= __CL_OP_MAX) {
+            return false;
+        }
+
+        if (_is_test(op)) {
+            if (pc + 1 >= count || CL_OP(code[pc + 1]) != CL_OP_JMP) {
+                return false;
+            }
+
+            marks[++pc] |= LIFT_PAIRED;
+        }
+
+        bool ends = (op == CL_OP_JMP || op == CL_OP_RET ||
+            op == CL_OP_RET0);
+
+        if (op == CL_OP_JMP || _is_test(op)) {
+            int64_t target = (int64_t)pc + 1 + CL_SJ(code[pc]);
+
+            if (target < 0 || target >= count) {
+                return false;
+            }
+
+            marks[target] |= LIFT_LEADER;
+        }
+
+        if (op == CL_OP_JMP || _is_test(op) || ends) {
+            marks[pc + 1] |= LIFT_LEADER;
+        }
+
+        if (!ends && pc + 1 == count) {
+            return false;
+        }
+    }
+
+    for (uint32_t pc = 0; pc < count; pc++) {
+        if (marks[pc] == (LIFT_LEADER | LIFT_PAIRED)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * Whether the registers an instruction names are ones the
+ * function has, and its constants too.
+ */
+static bool _operands_ok(Lifter *self, Instruction insn) {
+    uint32_t registers = self->registers;
+    bool a = CL_A(insn) < registers;
+    bool b = CL_B(insn) < registers;
+    bool c = CL_C(insn) < registers;
+    bool k = CL_BX(insn) < self->bc->constant_count;
+
+    switch (bytecode_op_format(CL_OP(insn))) {
+        case CL_FMT_EMPTY:
+        case CL_FMT_J:          return true;
+        case CL_FMT_RR:
+        case CL_FMT_RRI:
+        case CL_FMT_RRS:
+        case CL_FMT_TEST_RR:    return a && b;
+        case CL_FMT_RRR:        return a && b && c;
+        case CL_FMT_RIR:        return a && c;
+        case CL_FMT_RK:
+        case CL_FMT_RS:
+        case CL_FMT_RF:         return a && k;
+        default:                return a;
+    }
+}
+
+
+/**
+ * The blocks the bytecode from `pc` to `end` can go to.
+ */
+static uint32_t _block_succs(Lifter *self, uint32_t pc, uint32_t end,
+    IrBlockId succs[2]) {
+    const Instruction *code = self->code;
+    Opcode last = CL_OP(code[end - 1]);
+
+    if (last == CL_OP_RET || last == CL_OP_RET0) {
+        return 0;
+    }
+
+    if (last != CL_OP_JMP) {
+        succs[0] = self->block_at[end];
+        return 1;
+    }
+
+    succs[0] = self->block_at[end + CL_SJ(code[end - 1])];
+
+    if (end - pc >= 2 && _is_test(CL_OP(code[end - 2]))) {
+        succs[1] = self->block_at[end];
+        return 2;
+    }
+
+    return 1;
+}
+
+
+static IrValue _emit(Lifter *self, IrBlockId block, IrInstr instr) {
+    return ir_append(self->fn, block, instr);
+}
+
+
+static IrValue _binary(Lifter *self, IrBlockId block, IrOp op, IrValue a,
+    IrValue b) {
+    IrInstr instr = { .op = op, .args = { a, b } };
+
+    return _emit(self, block, instr);
+}
+
+
+/**
+ * Lifts the bytecode of one block, ending it with a terminator.
+ */
+static bool _lift_block(Lifter *self, IrBlockId block, uint32_t pc,
+    uint32_t end) {
+    const Instruction *code = self->code;
+    const uint64_t *k = self->constants;
+
+    #define R(reg)      _read(self, (reg), block)
+    #define W(reg, v)   _write(self, (reg), block, (v))
+
+    for (; pc < end; pc++) {
+        Instruction insn = code[pc];
+        Opcode op = CL_OP(insn);
+        uint32_t a = CL_A(insn), b = CL_B(insn), c = CL_C(insn);
+        uint32_t bx = CL_BX(insn);
+        IrInstr instr = { 0 };
+
+        if (!_operands_ok(self, insn)) {
+            return false;
+        }
+
+        switch (op) {
+            case CL_OP_MOVE:
+                W(a, R(b));
+                break;
+
+            case CL_OP_LOADI:
+                instr.op = CL_IR_CONST;
+                instr.imm = (uint64_t)(int64_t)CL_SBX(insn);
+                W(a, _emit(self, block, instr));
+                break;
+
+            case CL_OP_LOADK:
+            case CL_OP_LOADS:
+                instr.op = (op == CL_OP_LOADK) ? CL_IR_CONST : CL_IR_STRING;
+                instr.imm = k[bx];
+                W(a, _emit(self, block, instr));
+                break;
+
+            case CL_OP_GETG:
+                instr.op = CL_IR_GETG;
+                instr.imm = bx;
+                W(a, _emit(self, block, instr));
+                break;
+
+            case CL_OP_SETG:
+                instr.op = CL_IR_SETG;
+                instr.args[0] = R(a);
+                instr.imm = bx;
+                _emit(self, block, instr);
+                break;
+
+            case CL_OP_ADD: case CL_OP_SUB: case CL_OP_MUL: case CL_OP_DIV:
+            case CL_OP_MOD: case CL_OP_BAND: case CL_OP_BOR: case CL_OP_BXOR:
+            case CL_OP_SHL: case CL_OP_SHR: case CL_OP_FADD: case CL_OP_FSUB:
+            case CL_OP_FMUL: case CL_OP_FDIV: {
+                IrOp ir = CL_IR_ADD + (op - CL_OP_ADD) -
+                    (op > CL_OP_ADDI ? 1 : 0);
+
+                W(a, _binary(self, block, ir, R(b), R(c)));
+                break;
+            }
+
+            case CL_OP_ADDI:
+                instr.op = CL_IR_CONST;
+                instr.imm = (uint64_t)(int64_t)CL_SC(insn);
+                W(a, _binary(self, block, CL_IR_ADD, R(b),
+                    _emit(self, block, instr)));
+                break;
+
+            case CL_OP_NEG: case CL_OP_FNEG: case CL_OP_NOT: case CL_OP_BNOT:
+            case CL_OP_ITOF: case CL_OP_FTOI:
+                instr.op = CL_IR_NEG + (op - CL_OP_NEG);
+                instr.args[0] = R(b);
+                W(a, _emit(self, block, instr));
+                break;
+
+            case CL_OP_EQ: case CL_OP_LT: case CL_OP_LE: case CL_OP_FEQ:
+            case CL_OP_FLT: case CL_OP_FLE:
+            case CL_OP_TEST: {
+                IrValue cond = (op == CL_OP_TEST) ? R(a) : _binary(self,
+                    block, CL_IR_EQ + (op - CL_OP_EQ), R(a), R(b));
+                bool taken_if = (op == CL_OP_TEST) ? b : c;
+                int32_t sj = CL_SJ(code[pc + 1]);
+                IrBlockId jump = self->block_at[pc + 2 + sj];
+                IrBlockId next = self->block_at[pc + 2];
+
+                instr.op = CL_IR_BR;
+                instr.args[0] = cond;
+                ir_set_target(&instr, 0, taken_if ? jump : next);
+                ir_set_target(&instr, 1, taken_if ? next : jump);
+                _emit(self, block, instr);
+
+                return true;
+            }
+
+            case CL_OP_JMP:
+                instr.op = CL_IR_JMP;
+                ir_set_target(&instr, 0,
+                    self->block_at[pc + 1 + CL_SJ(insn)]);
+                _emit(self, block, instr);
+                return true;
+
+            case CL_OP_FRAME:
+                instr.op = CL_IR_FRAME;
+                instr.imm = bx;
+                W(a, _emit(self, block, instr));
+                break;
+
+            case CL_OP_ZERO:
+                instr.op = CL_IR_ZERO;
+                instr.args[0] = R(a);
+                instr.imm = bx;
+                _emit(self, block, instr);
+                break;
+
+            case CL_OP_REF:
+            case CL_OP_GETF:
+                instr.op = (op == CL_OP_REF) ? CL_IR_REF : CL_IR_GETF;
+                instr.args[0] = R(b);
+                instr.imm = c;
+                W(a, _emit(self, block, instr));
+                break;
+
+            case CL_OP_COPY:
+                instr.op = CL_IR_COPY;
+                instr.args[0] = R(a);
+                instr.args[1] = R(b);
+                instr.imm = c;
+                _emit(self, block, instr);
+                break;
+
+            case CL_OP_SETF:
+                instr.op = CL_IR_SETF;
+                instr.args[0] = R(a);
+                instr.args[1] = R(c);
+                instr.imm = b;
+                _emit(self, block, instr);
+                break;
+
+            case CL_OP_GETI:
+                W(a, _binary(self, block, CL_IR_GETI, R(b), R(c)));
+                break;
+
+            case CL_OP_SETI:
+                instr.op = CL_IR_SETI;
+                instr.args[0] = R(a);
+                instr.args[1] = R(b);
+                instr.args[2] = R(c);
+                _emit(self, block, instr);
+                break;
+
+            case CL_OP_CALL: {
+                uint64_t symbol = k[bx];
+                int arity = (symbol <= UINT32_MAX)
+                    ? self->arity((uint32_t)symbol, self->user_data) : -1;
+
+                if (arity < 0 || a + (uint32_t)arity > self->registers) {
+                    return false;
+                }
+
+                IrValueVector *extra = &self->fn->extra;
+                IrValue args[CL_BYTECODE_MAX_REGISTERS];
+
+                /* the reads may add phis to extra, so they go first */
+                for (int i = 0; i < arity; i++) {
+                    args[i] = R(a + (uint32_t)i);
+                }
+
+                size_t start = extra->count;
+
+                for (int i = 0; i < arity; i++) {
+                    if (!ir_value_vector_push(extra, args[i])) {
+                        return false;
+                    }
+                }
+
+                instr.op = CL_IR_CALL;
+                instr.args[0] = (IrValue)start;
+                instr.args[1] = (IrValue)arity;
+                instr.imm = symbol;
+                W(a, _emit(self, block, instr));
+                break;
+            }
+
+            case CL_OP_RET:
+                instr.op = CL_IR_RET;
+                instr.args[0] = R(a);
+                _emit(self, block, instr);
+                return true;
+
+            case CL_OP_RET0:
+                instr.op = CL_IR_RET0;
+                _emit(self, block, instr);
+                return true;
+
+            case CL_OP_PRINT:
+                instr.op = CL_IR_PRINT;
+                instr.args[0] = R(a);
+                instr.imm = b | (c << 8);
+                _emit(self, block, instr);
+                break;
+
+            default:
+                return false;
+        }
+    }
+
+    #undef R
+    #undef W
+
+    /* the block runs into the next one */
+    IrInstr jmp = { .op = CL_IR_JMP };
+
+    ir_set_target(&jmp, 0, self->block_at[end]);
+    _emit(self, block, jmp);
+
+    return true;
+}
+
+
+/**
+ * Replaces the phis whose operands are all one value, or the
+ * phi itself, by that value, until none is left. Construction
+ * leaves them where a register is the same on every path.
+ */
+static void _remove_trivial_phis(Lifter *self) {
+    IrFunction *fn = self->fn;
+
+    for (bool changed = true; changed; ) {
+        changed = false;
+
+        for (IrValue value = 1; value < fn->instrs.count; value++) {
+            if (ir_instr(fn, value)->op != CL_IR_PHI) {
+                continue;
+            }
+
+            uint32_t count;
+            IrValue *args = ir_operands(fn, value, &count);
+            IrValue same = CL_IR_NONE;
+            bool trivial = true;
+
+            for (uint32_t i = 0; i < count && trivial; i++) {
+                IrValue arg = ir_resolve(fn, args[i]);
+
+                if (arg == value || arg == same) {
+                    continue;
+                }
+
+                trivial = (same == CL_IR_NONE);
+                same = arg;
+            }
+
+            if (trivial) {
+                ir_replace(fn, value, same ? same : self->undef);
+                changed = true;
+            }
+        }
+    }
+}
+
+
+/**
+ * Adds the entry block, which defines the parameters, and the
+ * blocks of the bytecode after it, with their edges. Blocks no
+ * path reaches are left dead.
+ */
+static bool _make_blocks(Lifter *self, uint8_t *marks) {
+    IrFunction *fn = self->fn;
+    uint32_t count = self->bc->code_count;
+    IrBlockId blocks = 1;
+
+    for (uint32_t pc = 0; pc < count; pc++) {
+        self->block_at[pc] = (marks[pc] & LIFT_LEADER) ? blocks++ : 0;
+    }
+
+    self->start = malloc(blocks * sizeof(uint32_t));
+    bool *reached = calloc(blocks, sizeof(bool));
+    IrBlockId *stack = malloc(blocks * sizeof(IrBlockId));
+    bool ok = self->start && reached && stack &&
+        ir_block_vector_reserve(&fn->blocks, blocks) &&
+        ir_block_id_vector_reserve(&fn->layout, blocks);
+
+    for (uint32_t pc = 0; ok && pc < count; pc++) {
+        if (self->block_at[pc]) {
+            self->start[self->block_at[pc]] = pc;
+        }
+    }
+
+    for (IrBlockId b = 0; ok && b < blocks; b++) {
+        ok = ir_block_add(fn) == b &&
+            ir_block_id_vector_push(&fn->layout, b);
+    }
+
+    size_t depth = 0;
+
+    if (ok) {
+        reached[1] = true;
+        stack[depth++] = 1;
+    }
+
+    while (depth > 0) {
+        IrBlockId block = stack[--depth];
+        IrBlockId next = block + 1;
+        uint32_t end = (next < blocks) ? self->start[next] : count;
+        IrBlockId succs[2];
+        uint32_t n = _block_succs(self, self->start[block], end, succs);
+
+        for (uint32_t i = 0; i < n; i++) {
+            if (!reached[succs[i]]) {
+                reached[succs[i]] = true;
+                stack[depth++] = succs[i];
+            }
+        }
+    }
+
+    /* predecessors in the order of the bytecode */
+    ok = ok && ir_block_id_vector_push(&ir_block(fn, 1)->preds, 0);
+
+    for (IrBlockId block = 1; ok && block < blocks; block++) {
+        IrBlockId next = block + 1;
+        uint32_t end = (next < blocks) ? self->start[next] : count;
+        IrBlockId succs[2];
+        uint32_t n = _block_succs(self, self->start[block], end, succs);
+
+        ir_block(fn, block)->dead = !reached[block];
+
+        for (uint32_t i = 0; ok && reached[block] && i < n; i++) {
+            ok = ir_block_id_vector_push(&ir_block(fn, succs[i])->preds,
+                block);
+        }
+    }
+
+    free(reached);
+    free(stack);
+
+    return ok;
+}
+
+
+static bool _lift(Lifter *self) {
+    IrFunction *fn = self->fn;
+    uint32_t count = self->bc->code_count;
+    uint8_t *marks = calloc(count + 1, 1);
+
+    self->block_at = calloc(count + 1, sizeof(IrBlockId));
+
+    if (!marks || !self->block_at || !_find_blocks(self, marks) ||
+        !_make_blocks(self, marks)) {
+        free(marks);
+        return false;
+    }
+
+    free(marks);
+
+    IrBlockId blocks = (IrBlockId)fn->blocks.count;
+
+    self->defs = calloc((size_t)blocks * self->registers, sizeof(IrValue));
+    self->waiting = calloc(blocks, sizeof(uint32_t));
+
+    if (!self->defs || !self->waiting) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return false;
+    }
+
+    for (IrBlockId b = 0; b < blocks; b++) {
+        self->waiting[b] = (uint32_t)ir_block(fn, b)->preds.count;
+    }
+
+    /* the entry defines the parameters, and 0 for other registers */
+    for (uint32_t i = 0; i < fn->param_count; i++) {
+        IrInstr param = { .op = CL_IR_PARAM, .imm = i };
+
+        _write(self, i, 0, ir_append(fn, 0, param));
+    }
+
+    IrInstr undef = { .op = CL_IR_CONST };
+    IrInstr jmp = { .op = CL_IR_JMP, .imm = 1 };
+
+    self->undef = ir_append(fn, 0, undef);
+
+    for (uint32_t i = fn->param_count; i < self->registers; i++) {
+        _write(self, i, 0, self->undef);
+    }
+
+    ir_append(fn, 0, jmp);
+
+    for (IrBlockId block = 0; block < blocks && !fn->failed; block++) {
+        IrBlockId next = block + 1;
+        uint32_t end = (next < blocks) ? self->start[next] : count;
+
+        if (ir_block(fn, block)->dead) {
+            continue;
+        }
+
+        if (block > 0 && !_lift_block(self, block, self->start[block], end)) {
+            return false;
+        }
+
+        IrBlockId succs[2];
+        uint32_t n = ir_succs(fn, block, succs);
+
+        for (uint32_t i = 0; i < n; i++) {
+            if (--self->waiting[succs[i]] == 0) {
+                _seal(self, succs[i]);
+            }
+        }
+    }
+
+    _remove_trivial_phis(self);
+    ir_settle(fn);
+
+    return !fn->failed;
+}
+
+
+/**
+ * Lifts a function of bytecode, as codegen writes it, into SSA
+ * form. `arity` tells how many registers a call passes. Returns
+ * NULL when the bytecode is not what codegen writes, or when
+ * out of memory.
+ */
+IrFunction *ir_lift(const BytecodeFunction *function, IrArityFn arity,
+    void *user_data) {
+    IrFunction *fn = calloc(1, sizeof(IrFunction));
+
+    if (!fn) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    const uint64_t *constants = (const uint64_t *)(function + 1);
+    Lifter lifter = {
+        .fn = fn,
+        .bc = function,
+        .constants = constants,
+        .code = (const Instruction *)(constants + function->constant_count),
+        .arity = arity,
+        .user_data = user_data,
+        .registers = function->register_count,
+    };
+
+    fn->param_count = function->param_count;
+    fn->frame_size = function->frame_size;
+    fn->flags = function->flags;
+
+    /* instruction 0 stands for no value */
+    IrInstr none = { .op = CL_IR_NOP, .block = CL_IR_NO_BLOCK };
+    bool ok = function->code_count > 0 &&
+        function->register_count <= CL_BYTECODE_MAX_REGISTERS &&
+        function->param_count <= function->register_count &&
+        _new(fn, none) == CL_IR_NONE && !fn->failed && _lift(&lifter);
+
+    free(lifter.block_at);
+    free(lifter.start);
+    free(lifter.defs);
+    free(lifter.waiting);
+    ir_value_vector_free(&lifter.incomplete);
+
+    if (!ok) {
+        ir_free(fn);
+        return NULL;
+    }
+
+    return fn;
+}
+
+
+void ir_free(IrFunction *self) {
+    if (!self) {
+        return;
+    }
+
+    for (size_t i = 0; i < self->blocks.count; i++) {
+        ir_value_vector_free(&self->blocks.data[i].instrs);
+        ir_block_id_vector_free(&self->blocks.data[i].preds);
+    }
+
+    ir_instr_vector_free(&self->instrs);
+    ir_value_vector_free(&self->extra);
+    ir_block_vector_free(&self->blocks);
+    ir_block_id_vector_free(&self->layout);
+    ir_block_id_vector_free(&self->rpo);
+    free(self);
+}
+
+
+/* == checks == */
+
+
+/**
+ * Checks what the passes rely on: blocks end in their one
+ * terminator and start with their phis, phis have an operand
+ * per predecessor, edges agree both ways and every use is
+ * dominated by its definition. Sets `why` when something is
+ * off. Meant for debug builds, it is not fast.
+ */
+bool ir_verify(IrFunction *self, str_t *why) {
+    uint32_t *position = malloc(self->instrs.count * sizeof(uint32_t));
+
+    if (!position || !ir_dominators(self)) {
+        free(position);
+        *why = "out of memory";
+        return false;
+    }
+
+    memset(position, 0xFF, self->instrs.count * sizeof(uint32_t));
+    *why = NULL;
+
+    for (IrBlockId b = 0; b < self->blocks.count && !*why; b++) {
+        IrBlock *block = ir_block(self, b);
+        bool phis = true;
+
+        if (block->dead) {
+            continue;
+        }
+
+        if (block->instrs.count == 0) {
+            *why = "empty block";
+        }
+
+        for (size_t i = 0; i < block->instrs.count && !*why; i++) {
+            IrValue value = block->instrs.data[i];
+            IrInstr *instr = ir_instr(self, value);
+            bool last = (i + 1 == block->instrs.count);
+
+            position[value] = (uint32_t)i;
+
+            if (instr->block != b) {
+                *why = "instruction in the wrong block";
+            } else if (instr->op == CL_IR_NOP || instr->op == CL_IR_ALIAS) {
+                *why = "removed instruction left in a block";
+            } else if (instr->op == CL_IR_PHI && !phis) {
+                *why = "phi after other instructions";
+            } else if (instr->op == CL_IR_PHI &&
+                instr->args[1] != block->preds.count) {
+                *why = "phi operands do not match predecessors";
+            } else if (!(ir_op_flags(instr->op) & CL_IR_TERM) == last) {
+                *why = "block does not end with its only terminator";
+            }
+
+            phis = phis && instr->op == CL_IR_PHI;
+        }
+
+        IrBlockId succs[2];
+        uint32_t n = *why ? 0 : ir_succs(self, b, succs);
+
+        for (uint32_t i = 0; i < n && !*why; i++) {
+            if (succs[i] >= self->blocks.count ||
+                ir_block(self, succs[i])->dead ||
+                ir_pred_index(self, succs[i], b) == SIZE_MAX) {
+                *why = "successor without the edge back";
+            }
+        }
+
+        for (size_t i = 0; i < block->preds.count && !*why; i++) {
+            IrBlockId pred = block->preds.data[i];
+
+            n = ir_block(self, pred)->dead ? 0 : ir_succs(self, pred, succs);
+
+            if ((n < 1 || succs[0] != b) && (n < 2 || succs[1] != b)) {
+                *why = "predecessor that does not go to the block";
+            }
+        }
+
+        if (b == 0 && block->preds.count > 0 && !*why) {
+            *why = "entry with predecessors";
+        }
+    }
+
+    for (size_t r = 0; r < self->rpo.count && !*why; r++) {
+        IrBlockId b = self->rpo.data[r];
+        IrBlock *block = ir_block(self, b);
+
+        for (size_t i = 0; i < block->instrs.count && !*why; i++) {
+            IrValue value = block->instrs.data[i];
+            bool phi = ir_instr(self, value)->op == CL_IR_PHI;
+            uint32_t count;
+            IrValue *args = ir_operands(self, value, &count);
+
+            for (uint32_t j = 0; j < count && !*why; j++) {
+                IrValue arg = args[j];
+                IrBlockId at = phi ? block->preds.data[j] : b;
+
+                if (arg == CL_IR_NONE || arg >= self->instrs.count ||
+                    position[arg] == UINT32_MAX ||
+                    !(ir_op_flags(ir_instr(self, arg)->op) & CL_IR_VALUE)) {
+                    *why = "operand that is not a value";
+                } else if (ir_block(self, at)->order == UINT32_MAX) {
+                    continue;
+                } else if (!ir_dominates(self, ir_instr(self, arg)->block,
+                    at) || (!phi && ir_instr(self, arg)->block == b &&
+                    position[arg] >= i)) {
+                    *why = "use not dominated by its definition";
+                }
+            }
+        }
+    }
+
+    free(position);
+
+    return *why == NULL;
+}
+
+
+/* == dump == */
+
+
+static void _dump_instr(IrFunction *self, IrValue value, FILE *out) {
+    static const str_t KINDS[] = { "int", "float", "bool", "string" };
+    IrInstr *instr = ir_instr(self, value);
+    uint32_t count;
+    IrValue *args = ir_operands(self, value, &count);
+    str_t name = ir_op_name(instr->op);
+    int64_t imm = (int64_t)instr->imm;
+
+    fputs("    ", out);
+
+    if (ir_op_flags(instr->op) & CL_IR_VALUE) {
+        fprintf(out, "v%u = ", value);
+    }
+
+    if (instr->op == CL_IR_PRINT) {
+        name = (instr->imm >> 8) ? "PRINTLN" : "PRINT";
+    }
+
+    for (str_t c = name; *c; c++) {
+        fputc(*c - 'A' + 'a', out);
+    }
+
+    switch (instr->op) {
+        case CL_IR_CONST:
+            if (imm >= INT32_MIN && imm <= INT32_MAX) {
+                fprintf(out, " %" PRId64 "\n", imm);
+            } else {
+                fprintf(out, " 0x%016" PRIx64 "\n", instr->imm);
+            }
+            return;
+
+        case CL_IR_STRING:
+            fprintf(out, " #%" PRIu64 "\n", instr->imm);
+            return;
+
+        case CL_IR_PARAM:
+        case CL_IR_FRAME:
+            fprintf(out, " %" PRIu64 "\n", instr->imm);
+            return;
+
+        case CL_IR_GETG:
+        case CL_IR_SETG:
+            fprintf(out, " g%" PRIu64, instr->imm);
+            break;
+
+        case CL_IR_PHI:
+            for (uint32_t i = 0; i < count; i++) {
+                fprintf(out, "%s[v%u, b%u]", i ? ", " : " ", args[i],
+                    ir_block(self, instr->block)->preds.data[i]);
+            }
+
+            fputc('\n', out);
+            return;
+
+        case CL_IR_CALL:
+            fprintf(out, " f%" PRIu64 "(", instr->imm);
+
+            for (uint32_t i = 0; i < count; i++) {
+                fprintf(out, "%sv%u", i ? ", " : "", args[i]);
+            }
+
+            fputs(")\n", out);
+            return;
+
+        case CL_IR_PRINT:
+            fprintf(out, " %s", KINDS[(instr->imm & 0xFF) % 4]);
+            break;
+
+        case CL_IR_SETF:
+            fprintf(out, " v%u, %" PRIu64 ", v%u\n", args[0], instr->imm,
+                args[1]);
+            return;
+
+        case CL_IR_JMP:
+            fprintf(out, " b%u\n", ir_target(instr, 0));
+            return;
+
+        case CL_IR_BR:
+            fprintf(out, " v%u, b%u, b%u\n", args[0], ir_target(instr, 0),
+                ir_target(instr, 1));
+            return;
+
+        default:
+            break;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        fprintf(out, "%sv%u", (i || instr->op == CL_IR_SETG ||
+            instr->op == CL_IR_PRINT) ? ", " : " ", args[i]);
+    }
+
+    if (instr->op == CL_IR_REF || instr->op == CL_IR_GETF ||
+        instr->op == CL_IR_ZERO || instr->op == CL_IR_COPY) {
+        fprintf(out, ", %" PRIu64, instr->imm);
+    }
+
+    fputc('\n', out);
+}
+
+
+/**
+ * Writes a function as text, its blocks in the order they are
+ * laid out:
+ *
+ *   fn add (2 params, 0 frame slots)
+ *   b0:
+ *       v1 = param 0
+ *       ...
+ */
+void ir_dump(IrFunction *self, str_t name, FILE *out) {
+    fprintf(out, "fn %s (%u params, %u frame slots)\n", name,
+        self->param_count, self->frame_size);
+
+    for (size_t i = 0; i < self->layout.count; i++) {
+        IrBlockId b = self->layout.data[i];
+        IrBlock *block = ir_block(self, b);
+
+        fprintf(out, "b%u:", b);
+
+        for (size_t j = 0; j < block->preds.count; j++) {
+            fprintf(out, "%sb%u", j ? ", " : "    ; from ",
+                block->preds.data[j]);
+        }
+
+        fputc('\n', out);
+
+        for (size_t j = 0; j < block->instrs.count; j++) {
+            _dump_instr(self, block->instrs.data[j], out);
+        }
+    }
+
+    fputc('\n', out);
+}
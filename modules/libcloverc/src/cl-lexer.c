@@ -1,30 +1,61 @@
+#define CL_LOG_SCOPE "lexer"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <float.h>
+#include <inttypes.h>
+
 #include "cl-annotation.h"
 
 #include "cl-log.h"
 #include "cl-types.h"
+#include "cl-tokens.h"
+#include "cl-intern.h"
+#include "cl-number.h"
+#include "cl-lexer.h"
 #include "cl-vector.h"
 #include "cl-diagnostic.h"
 #include "cl-lexer-consts.h"
+#include "cl-lexer-tables.h"
+
+
+#define CL_LEXER_SHORT_RUN      8
+#define CL_LEXER_LITERAL_INLINE 256
+#define CL_RELEX_INLINE         32
+
 
+CL_VECTOR_DEFINE_SMALL(Token, token, CL_RELEX_INLINE)
 
-CL_TYPE(Lexer) {
-    Source *src;
+
+/**
+ * `ahead` holds the tokens scanned by lexer_peek but not yet
+ * returned by lexer_next, starting at `head`.
+ */
+struct __CL_TNAME(Lexer) {
+    Source     *src;
+    InternCache symbols;
 
     uint32_t offset;
     uint32_t prev_offset;
-    uint32_t line_offset;
-
-    uint32_t line;
-    uint32_t column;
 
     bool error;
+
+    Token    ahead[CL_LEXER_LOOKAHEAD];
+    uint32_t head;
+    uint32_t ahead_count;
 };
 
 
+_Static_assert((CL_LEXER_LOOKAHEAD & (CL_LEXER_LOOKAHEAD - 1)) == 0,
+    "the lookahead must be a power of two");
+
+
 CL_ENUM(LexerRet) {
     LEXER_OK,
     LEXER_EOF,
-    LEXER_NOT_FOUND,
+    LEXER_SKIP,
     LEXER_SYNTAX_ERROR,
 };
 
@@ -35,18 +66,17 @@ typedef LexerRet (*LexerFn)(Lexer *lex, Token *tk);
 /* == lexer checks == */
 
 
-static __Inline bool __isalnum(char ch) {
+static __Inline bool __isidchar(char ch) {
     return ((ch >= '0' && ch <= '9') ||
             (ch >= 'a' && ch <= 'z') ||
-            (ch >= 'A' && ch <= 'Z'));
+            (ch >= 'A' && ch <= 'Z') ||
+            (ch == '_'));
 }
 
 
-static __Inline bool __isname(char ch) {
-    return ((ch >= 'a' && ch <= 'z') ||
-            (ch >= 'A' && ch <= 'Z') ||
-            (ch == '_'));
-};
+static __Inline bool __isspace(char ch) {
+    return (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n');
+}
 
 
 static __Inline bool __isdigit(char ch) {
@@ -85,70 +115,52 @@ static __Inline bool _is_eof(Lexer *lex) {
 }
 
 
-static __Inline bool _has_arity(Lexer *lex, uint32_t length) {
-    return lex->offset + length <= lex->src->length;
-}
-
-
+/*
+ * The source text is always NUL terminated, so peeking one byte
+ * past the end is safe and yields 0, which no scanner accepts.
+ */
 static __Inline char _peek(Lexer *lex) {
-    return source_at(lex->src, lex->offset);
+    return lex->src->text[lex->offset];
 }
 
 
 static __Inline char _getch(Lexer *lex, size_t offset) {
-    return source_at(lex->src, offset);
-}
-
-
-static __Inline bool _equals(Lexer *lex, size_t offset, str_t str,
-    uint32_t str_max) {
-    return source_cmp(lex->src, offset, str_max, str) == 0;
+    return lex->src->text[offset];
 }
 
 
 static __Inline DiagLocation _getloc(Lexer *lex, uint32_t caret_pos) {
     return (DiagLocation){
-        .offset = lex->offset,
-        .line_offset = lex->line_offset,
+        .offset = lex->prev_offset,
         .length = lex->offset - lex->prev_offset,
-        .line_length = source_lnlen(lex->src, lex->line_offset),
-        .line = lex->line,
-        .column = lex->column,
         .caret = caret_pos,
         .src = lex->src,
     };
 }
 
 
-static void _skip_blank(Lexer *lex) {
+/**
+ * Most runs of spaces and names are only a few bytes long, so
+ * the first CL_LEXER_SHORT_RUN bytes are checked in place and
+ * only longer runs, like indentation, go to the vector scanner.
+ */
+static __Inline uint32_t _span(Lexer *lex, CharClass cls, bool (*is)(char)) {
     uint32_t count = 0;
 
-    for (int left = 1; left > 0; left--) {
-        if (_is_eof(lex)) {
-            break;
-        }
-
-        count = source_span(lex->src, lex->offset, "\t ");
-
-        if (count > 0) {
-            lex->offset += count;
-            lex->column += count;
-            left++;
+    while (count < CL_LEXER_SHORT_RUN) {
+        if (!is(_getch(lex, lex->offset + count))) {
+            return count;
         }
 
-        count = source_span(lex->src, lex->offset, "\r\n");
+        count++;
+    }
 
-        if (count > 0) {
-            lex->offset += count;
-            lex->line_offset = lex->offset;
-            lex->line += count;
-            lex->column = 1;
-            left++;
+    return count + source_span_class(lex->src, lex->offset + count, cls);
+}
 
-            continue;
-        }
-    }
 
+static void _skip_blank(Lexer *lex) {
+    lex->offset += _span(lex, CL_CHARS_SPACE, __isspace);
     lex->prev_offset = lex->offset;
 }
 
@@ -157,23 +169,54 @@ static void _commit(Lexer *lex, TokenType type, Token *tk) {
     if (tk != NULL) {
         tk->type = type;
         tk->offset = lex->prev_offset;
-        tk->line_offset = lex->line_offset;
         tk->length = lex->offset - lex->prev_offset;
-        tk->line = lex->line;
-        tk->column = lex->column;
+        tk->value = CL_SYMBOL_NONE;
     }
 
-    lex->column += lex->offset - lex->prev_offset;
     lex->prev_offset = lex->offset;
 }
 
 
-static bool _validate_escape(Lexer *lex) {
+static uint32_t _encode_utf8(uint32_t code, char *out) {
+    if (code < 0x80) {
+        out[0] = (char)code;
+        return 1;
+    }
+
+    if (code < 0x800) {
+        out[0] = (char)(0xC0 | (code >> 6));
+        out[1] = (char)(0x80 | (code & 0x3F));
+        return 2;
+    }
+
+    if (code < 0x10000) {
+        out[0] = (char)(0xE0 | (code >> 12));
+        out[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (code & 0x3F));
+        return 3;
+    }
+
+    out[0] = (char)(0xF0 | (code >> 18));
+    out[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (code & 0x3F));
+    return 4;
+}
+
+
+/**
+ * Decodes the escape sequence right after a backslash into
+ * `out`, which has room for 4 bytes. `\x` gives one byte, `\u`
+ * and `\U` give the UTF-8 of a code point. Returns the number of
+ * bytes written, or -1 after reporting a malformed escape.
+ */
+static int _decode_escape(Lexer *lex, char *out) {
     char ch = _peek(lex);
 
     if (__strcontains(CL_ESCAPE_CHARS, ch)) {
+        out[0] = CL_ESCAPE_PAIRS[strchr(CL_ESCAPE_CHARS, ch) - CL_ESCAPE_CHARS];
         lex->offset += 1;
-        return true;
+        return 1;
     }
 
     int fmt_size = 0;
@@ -190,469 +233,758 @@ static bool _validate_escape(Lexer *lex) {
             break;
         default:
             diag_error(_getloc(lex, 0), "invalid escape sequence");
-            return false;
+            return -1;
     }
 
+    uint32_t code = 0;
+
     for (int i = 0; i < fmt_size; i++) {
-        if (!__isxdigit(_getch(lex, lex->offset + i + 1))) {
+        char hex = _getch(lex, lex->offset + i + 1);
+        uint8_t digit = CL_HEX_VALUES[(uint8_t)hex];
+
+        if (digit >= 16) {
             diag_error(_getloc(lex, 0), "malformed escape sequence");
-            return false;
+            return -1;
         }
+
+        code = (code << 4) | digit;
     }
 
-    return true;
-}
+    if (ch != 'x' && (code > 0x10FFFF || (code >= 0xD800 && code <= 0xDFFF))) {
+        diag_error(_getloc(lex, 0), "invalid code point in escape sequence");
+        return -1;
+    }
 
+    lex->offset += 1 + fmt_size;
 
-static bool _validate_id(Lexer *lex) {
-    if (!__isname(_getch(lex, lex->prev_offset))) {
-        return false;
+    if (ch == 'x') {
+        out[0] = (char)code;
+        return 1;
     }
 
-    uint32_t length = lex->offset - lex->prev_offset - 1;
+    return (int)_encode_utf8(code, out);
+}
+
+
+static bool _validate_id(Lexer *lex) {
+    uint32_t length = lex->offset - lex->prev_offset;
 
     if (length > CL_ID_MAXLEN) {
         DiagLocation loc = _getloc(lex, 0);
-        diag_warning(loc, "identifier is too long: %zu", length);
-        diag_note(loc, "the maximum recommended length is %zu", CL_ID_MAXLEN);
+        diag_warning(loc, "identifier is too long: %u", length);
+        diag_note(loc, "the maximum recommended length is %d", CL_ID_MAXLEN);
         return false;
     }
 
-    for (uint32_t i = 1; i < length; i++) {
-        if (!__isalnum(_getch(lex, lex->prev_offset + i))) {
-            diag_error(_getloc(lex, 0), "invalid syntax");
-            return false;
-        }
-    }
-
     return true;
 }
 
 
-static bool _validate_float(Lexer *lex) {
-    if (!__isdigit(_getch(lex, lex->prev_offset))) {
-        return false;
-    }
+/**
+ * Rejects literals that run straight into a name, like `12ab`
+ * or `0x1g`, after the digits have been consumed.
+ */
+static bool _validate_suffix(Lexer *lex) {
+    uint32_t start = lex->offset;
 
-    uint32_t length = lex->offset - lex->prev_offset;
+    lex->offset += _span(lex, CL_CHARS_NAME, __isidchar);
 
-    bool has_period = false;
+    if (lex->offset != start) {
+        diag_error(_getloc(lex, start - lex->prev_offset), "invalid syntax");
+        return false;
+    }
 
-    for (uint32_t i = 0; i < length; i++) {
-        char ch = _getch(lex, lex->prev_offset + i);
+    return true;
+}
 
-        if (ch == '.') {
-            if (!has_period) {
-                has_period = true;
-                continue;
-            }
 
-            diag_error(_getloc(lex, i), "invalid syntax");
-            return false;
-        }
+/* === Search Functions === */
 
-        if (!__isdigit(ch)) {
-            diag_error(_getloc(lex, i), "invalid syntax");
-            return false;
-        }
-    }
 
-    if (!__isdigit(_getch(lex, lex->prev_offset + length - 1))) {
-        diag_error(_getloc(lex, length - 1), "invalid syntax");
-        return false;
-    }
+static LexerRet skip_comment(Lexer *lex) {
+    lex->offset += source_cspan_eol(lex->src, lex->offset);
 
-    if (!has_period) {
-        diag_error(_getloc(lex, 0),
-            "floats must have the following format: 3.14, 4.0f32");
-        return false;
-    }
+    _commit(lex, TK_COMMENT, NULL);
 
-    return true;
+    return LEXER_SKIP;
 }
 
 
-static bool _validate_bin(Lexer *lex) {
-    if (!_equals(lex, lex->prev_offset, "0b", 2)) {
-        return false;
-    }
+/**
+ * Finds where the quoted literal starting at `offset` ends,
+ * which is at its closing quote or at the end of the source,
+ * stepping over escapes without looking into them.
+ */
+static uint32_t _quoted_end(Lexer *lex, uint32_t offset, char quote,
+    bool *escaped) {
+    for (;;) {
+        offset += source_cspan_quote(lex->src, offset, quote);
+
+        if (offset >= lex->src->length || _getch(lex, offset) == quote) {
+            return offset;
+        }
 
-    uint32_t length = lex->offset - lex->prev_offset - 2;
+        *escaped = true;
+        offset += 2; /* backslash and the character after it */
 
-    for (uint32_t i = 2; i < length; i++) {
-        if (!__isbindigit(_getch(lex, lex->prev_offset + i + 2))) {
-            diag_error(_getloc(lex, 0), "invalid syntax");
-            return false;
+        if (offset > lex->src->length) {
+            return lex->src->length;
         }
     }
-
-    return true;
 }
 
 
-static bool _validate_hex(Lexer *lex) {
-    if (!_equals(lex, lex->prev_offset, "0x", 2)) {
-        return false;
-    }
+/**
+ * Decodes the escapes of a literal up to `end` into `out`,
+ * which has room for as many bytes as the literal has, since
+ * no escape is longer decoded than written.
+ */
+static bool _decode_quoted(Lexer *lex, uint32_t end, char *out,
+    uint32_t *length) {
+    uint32_t count = 0;
 
-    uint32_t length = lex->offset - lex->prev_offset - 2;
+    while (lex->offset < end) {
+        str_t text = source_get(lex->src, lex->offset);
+        str_t slash = memchr(text, '\\', end - lex->offset);
+        uint32_t run = slash ? (uint32_t)(slash - text) : end - lex->offset;
 
-    for (uint32_t i = 2; i < length; i++) {
-        if (!__isxdigit(_getch(lex, lex->prev_offset + i + 2))) {
-            diag_error(_getloc(lex, i + 2), "invalid syntax");
-            return false;
-        }
-    }
+        memcpy(out + count, text, run);
+        count += run;
+        lex->offset += run;
 
-    return true;
-}
+        if (!slash) {
+            break;
+        }
 
+        lex->offset += 1; /* backslash */
 
-static bool _validate_int(Lexer *lex) {
-    uint32_t length = lex->offset - lex->prev_offset;
+        int written = _decode_escape(lex, out + count);
 
-    for (uint32_t i = 0; i < length; i++) {
-        if (!__isdigit(_getch(lex, lex->prev_offset + i))) {
-            diag_error(_getloc(lex, i + 2), "invalid syntax");
+        if (written < 0) {
             return false;
         }
+
+        count += (uint32_t)written;
     }
 
+    *length = count;
+
     return true;
 }
 
 
-/* === Search Functions === */
-
+/**
+ * Counts the characters of UTF-8 text: every byte that does
+ * not continue a sequence starts one.
+ */
+static uint32_t _count_chars(str_t text, uint32_t length) {
+    uint32_t count = 0;
 
-static LexerRet skip_comment(Lexer *lex, Token *tk) {
-    if (!_equals(lex, 0, "//", 2)) {
-        return LEXER_NOT_FOUND;
+    for (uint32_t i = 0; i < length; i++) {
+        count += ((uint8_t)text[i] & 0xC0) != 0x80;
     }
 
-    lex->offset += source_cspan(lex->src, lex->offset, "\r\n");
-
-    _commit(lex, TK_COMMENT, NULL);
-
-    return LEXER_NOT_FOUND; /* always returns NOT FOUND */
+    return count;
 }
 
 
-static LexerRet find_string(Lexer *lex, Token *tk) {
+/**
+ * Commits a literal with its decoded `contents`. `ascii` tells
+ * that they hold a byte per character, as the undecoded text
+ * of an ASCII source does, so they need not be counted.
+ */
+static LexerRet _commit_quoted(Lexer *lex, TokenType type, str_t contents,
+    uint32_t length, bool ascii, Token *tk) {
     if (_is_eof(lex)) {
+        diag_error(_getloc(lex, 0), "unclosed %s literal",
+            (type == TK_STRING) ? "string" : "character");
         return LEXER_EOF;
     }
 
-    if (_peek(lex) != '"') {
-        return LEXER_NOT_FOUND;
-    }
-
     lex->offset += 1;
 
-    while (_peek(lex) != '"') {
-        if (_is_eof(lex)) {
-            diag_error(_getloc(lex, 0), "unclosed string literal");
-            return LEXER_EOF;
-        }
+    if (type == TK_CHAR && length > 1 &&
+        (ascii || _count_chars(contents, length) > 1)) {
+        diag_error(_getloc(lex, 0), "multiple characters in character literal");
+        return LEXER_SYNTAX_ERROR;
+    }
 
-        char ch = _peek(lex);
-        lex->offset += 1;
+    _commit(lex, type, tk);
+
+    if (tk != NULL && lex->symbols.symbols) {
+        tk->value = intern_cache_literal(&lex->symbols, contents, length);
 
-        if (ch == '\\' && !_validate_escape(lex)) {
+        if (tk->value == CL_SYMBOL_NONE) {
+            cl_error("out of memory!\n");
             return LEXER_SYNTAX_ERROR;
         }
     }
 
-    lex->offset += 1;
-
-    _commit(lex, TK_STRING, tk);
-
     return LEXER_OK;
 }
 
 
-static LexerRet find_character(Lexer *lex, Token *tk) {
-    if (_is_eof(lex)) {
-        return LEXER_EOF;
-    }
+/**
+ * Scans a string or character literal and decodes it into the
+ * literal pool of the interner, which codegen dedups once the
+ * literal is used. Literals without escapes, the usual case,
+ * take a single vector scan and are copied straight from the
+ * source.
+ */
+static LexerRet _find_quoted(Lexer *lex, char quote, TokenType type,
+    Token *tk) {
+    lex->offset += 1;
 
-    if (_peek(lex) != '\'') {
-        return LEXER_NOT_FOUND;
-    }
+    uint32_t start = lex->offset;
+    bool escaped = false;
+    uint32_t end = _quoted_end(lex, start, quote, &escaped);
 
-    lex->offset += 1;
+    str_t contents = source_get(lex->src, start);
+    uint32_t length = end - start;
+    char small[CL_LEXER_LITERAL_INLINE];
+    char *decoded = NULL;
 
-    int num_chars = 0;
+    if (escaped) {
+        decoded = (length <= sizeof(small)) ? small : malloc(length);
 
-    while (_peek(lex) != '\'') {
-        if (_is_eof(lex)) {
-            diag_error(_getloc(lex, 0), "unclosed character literal");
-            return LEXER_EOF;
+        if (!decoded) {
+            cl_error("out of memory!\n");
+            return LEXER_SYNTAX_ERROR;
         }
 
-        char ch = _peek(lex);
-        lex->offset += 1;
+        if (!_decode_quoted(lex, end, decoded, &length)) {
+            if (decoded != small) {
+                free(decoded);
+            }
 
-        if (ch == '\\' && !_validate_escape(lex)) {
             return LEXER_SYNTAX_ERROR;
         }
 
-        num_chars += 1;
+        contents = decoded;
     }
 
-    lex->offset += 1;
+    lex->offset = end;
 
-    if (num_chars > 1) {
-        diag_error(_getloc(lex, 0), "multiple characters in character literal");
-        return LEXER_SYNTAX_ERROR;
+    LexerRet ret = _commit_quoted(lex, type, contents, length,
+        !escaped && CL_BIT_ISSET(CL_SOURCE_ASCII, lex->src->flags), tk);
+
+    if (decoded != small) {
+        free(decoded);
     }
 
-    _commit(lex, TK_CHAR, tk);
+    return ret;
+}
 
-    return LEXER_OK;
+
+static LexerRet find_string(Lexer *lex, Token *tk) {
+    return _find_quoted(lex, '"', TK_STRING, tk);
 }
 
 
-static LexerRet find_operator(Lexer *lex, Token *tk) {
-    if (_is_eof(lex)) {
-        return LEXER_EOF;
+static LexerRet find_character(Lexer *lex, Token *tk) {
+    return _find_quoted(lex, '\'', TK_CHAR, tk);
+}
+
+
+static LexerRet find_punctuator(Lexer *lex, Token *tk) {
+    TokenType type;
+    uint32_t length = cl_match_punctuator(source_get(lex->src, lex->offset),
+        &type);
+
+    if (length == 0) {
+        diag_error(_getloc(lex, 0), "unexpected token");
+        return LEXER_SYNTAX_ERROR;
     }
 
-    for (size_t i = 0; i < CL_N_ELEMS(OPERATORS); i++) {
-        LexerPair op = OPERATORS[i];
+    lex->offset += length;
+    _commit(lex, type, tk);
 
-        if (!_has_arity(lex, op.name_length)) {
-            continue;
-        }
+    return LEXER_OK;
+}
 
-        if (_equals(lex, 0, op.name, op.name_length)) {
-            lex->offset += op.name_length;
-            _commit(lex, op.type, tk);
 
-            return LEXER_OK;
-        }
+static LexerRet find_slash(Lexer *lex, Token *tk) {
+    if (_getch(lex, lex->offset + 1) == '/') {
+        return skip_comment(lex);
     }
 
-    return LEXER_NOT_FOUND;
+    return find_punctuator(lex, tk);
 }
 
 
-static LexerRet find_symbol(Lexer *lex, Token *tk) {
-    if (_is_eof(lex)) {
-        return LEXER_EOF;
+/**
+ * Scans a whole name first, then checks whether it is a
+ * keyword, so `format` is an identifier and not `for`.
+ * Identifiers are interned right away, while the name is
+ * still in the cache.
+ */
+static LexerRet find_word(Lexer *lex, Token *tk) {
+    lex->offset += _span(lex, CL_CHARS_NAME, __isidchar);
+
+    uint32_t length = lex->offset - lex->prev_offset;
+    str_t name = source_get(lex->src, lex->prev_offset);
+    TokenType type = cl_lookup_keyword(name, length);
+
+    if (type == TK_ID && !_validate_id(lex)) {
+        return LEXER_SYNTAX_ERROR;
     }
 
-    for (size_t i = 0; i < CL_N_ELEMS(SYMBOLS); i++) {
-        LexerPair sym = SYMBOLS[i];
+    _commit(lex, type, tk);
 
-        if (_peek(lex) == sym.name[0]) {
-            lex->offset += 1;
-            _commit(lex, sym.type, tk);
+    if (type == TK_ID && lex->symbols.symbols) {
+        tk->value = intern_cache_intern(&lex->symbols, name, length);
 
-            return LEXER_OK;
+        if (tk->value == CL_SYMBOL_NONE) {
+            cl_error("out of memory!\n");
+            return LEXER_SYNTAX_ERROR;
         }
     }
 
-    return LEXER_NOT_FOUND;
+    return LEXER_OK;
 }
 
 
-static LexerRet find_keyword(Lexer *lex, Token *tk) {
-    if (_is_eof(lex)) {
-        return LEXER_EOF;
-    }
+__attribute__((noinline, cold))
+static LexerRet _number_too_large(Lexer *lex) {
+    DiagLocation loc = _getloc(lex, 0);
 
-    for (size_t i = 0; i < CL_N_ELEMS(KEYWORDS); i++) {
-        LexerPair kw = KEYWORDS[i];
+    diag_error(loc, "integer literal is too large");
+    diag_note(loc, "the largest integer is %" PRIu64, UINT64_MAX);
 
-        if (!_has_arity(lex, kw.name_length)) {
-            continue;
-        }
+    return LEXER_SYNTAX_ERROR;
+}
 
-        if (_equals(lex, lex->offset, kw.name, kw.name_length)) {
-            lex->offset += kw.name_length;
-            _commit(lex, kw.type, tk);
 
-            return LEXER_OK;
-        }
+/**
+ * Commits a number, or reports that it does not fit once the
+ * whole literal is known to be well formed. Its value is not
+ * kept, cl_number_value decodes it again where it is used.
+ */
+static __Inline LexerRet _commit_number(Lexer *lex, TokenType type,
+    bool overflow, Token *tk) {
+    if (!_validate_suffix(lex)) {
+        return LEXER_SYNTAX_ERROR;
+    }
+
+    if (overflow) {
+        return _number_too_large(lex);
     }
 
-    return LEXER_NOT_FOUND;
+    _commit(lex, type, tk);
+
+    return LEXER_OK;
 }
 
 
-static LexerRet find_identifier(Lexer *lex, Token *tk) {
-    if (_is_eof(lex)) {
-        return LEXER_EOF;
-    }
+__attribute__((noinline))
+static LexerRet find_bin(Lexer *lex, Token *tk) {
+    lex->offset += 2;
 
-    if (!__isname(_peek(lex))) {
-        return LEXER_NOT_FOUND;
+    if (!__isbindigit(_peek(lex))) {
+        diag_error(_getloc(lex, 2), "invalid syntax");
+        return LEXER_SYNTAX_ERROR;
     }
 
-    lex->offset += source_cspan(lex->src, lex->offset, CL_DELIMITERS);
+    uint64_t value;
+    bool overflow = false;
+
+    lex->offset += cl_scan_bin(lex->src->text + lex->offset,
+        lex->src->length - lex->offset, &value, &overflow);
+
+    return _commit_number(lex, TK_BIN, overflow, tk);
+}
+
+
+__attribute__((noinline))
+static LexerRet find_hex(Lexer *lex, Token *tk) {
+    lex->offset += 2;
 
-    if (!_validate_id(lex)) {
+    if (!__isxdigit(_peek(lex))) {
+        diag_error(_getloc(lex, 2), "invalid syntax");
         return LEXER_SYNTAX_ERROR;
     }
 
-    _commit(lex, TK_ID, tk);
+    uint64_t value;
+    bool overflow = false;
 
-    return LEXER_OK;
+    lex->offset += cl_scan_hex(lex->src->text + lex->offset, &value,
+        &overflow);
+
+    return _commit_number(lex, TK_HEX, overflow, tk);
 }
 
 
-static LexerRet find_float(Lexer *lex, Token *tk) {
-    if (_is_eof(lex)) {
-        return LEXER_EOF;
+/**
+ * Reports a float that does not fit in a double. Only a whole
+ * part of more digits than DBL_MAX can make one, so this only
+ * runs for those.
+ */
+__attribute__((noinline, cold))
+static bool _float_out_of_range(Lexer *lex) {
+    double value = cl_float_value(source_get(lex->src, lex->prev_offset),
+        lex->offset - lex->prev_offset);
+
+    if (!isinf(value)) {
+        return false;
+    }
+
+    if (_validate_suffix(lex)) {
+        diag_error(_getloc(lex, 0), "float literal is out of range");
     }
 
-    if (!__isdigit(_peek(lex))) {
-        return LEXER_NOT_FOUND;
+    return true;
+}
+
+
+/**
+ * Scans integers and floats. A period only belongs to the
+ * literal when a digit follows it, `1.5` is a float while
+ * `1.len` is an integer followed by a period.
+ *
+ * Numbers are only checked to fit: their digits are read like
+ * cl_number_value reads them, but the values are not kept,
+ * which would cost more than reading them again where one of
+ * them is used. Hex and binary literals have scanners of their
+ * own, which keeps this one, the most frequent, small.
+ */
+static LexerRet find_number(Lexer *lex, Token *tk) {
+    if (_peek(lex) == '0') {
+        char next = _getch(lex, lex->offset + 1);
+
+        if (next == 'x') {
+            return find_hex(lex, tk);
+        }
+
+        if (next == 'b') {
+            return find_bin(lex, tk);
+        }
     }
 
-    size_t saved_offset = lex->offset;
+    uint64_t mantissa = 0;
+    uint32_t dropped = 0;
 
-    lex->offset += source_cspan(lex->src, lex->offset, CL_DELIMITERS);
+    lex->offset += cl_scan_decimal(lex->src->text + lex->offset,
+        lex->src->length - lex->offset, &mantissa, &dropped);
 
-    if (_peek(lex) != '.') {
-        lex->offset = saved_offset;
-        return LEXER_NOT_FOUND;
+    if (_peek(lex) != '.' || !__isdigit(_getch(lex, lex->offset + 1))) {
+        return _commit_number(lex, TK_INT, dropped != 0, tk);
     }
 
     lex->offset += 1;
-    lex->offset += source_cspan(lex->src, lex->offset, CL_DELIMITERS);
+    lex->offset += cl_span_decimal(lex->src->text + lex->offset,
+        lex->src->length - lex->offset);
 
-    if (!_validate_float(lex)) {
+    /* the kept digits are below 10^20, the dropped ones scale them */
+    if (dropped > DBL_MAX_10_EXP - 20 && _float_out_of_range(lex)) {
         return LEXER_SYNTAX_ERROR;
     }
 
-    _commit(lex, TK_FLOAT, tk);
+    return _commit_number(lex, TK_FLOAT, false, tk);
+}
 
-    return LEXER_OK;
+
+static LexerRet __fallback(Lexer *lex, Token *tk) {
+    (void)tk;
+
+    diag_error(_getloc(lex, 0), "unexpected token");
+    return LEXER_SYNTAX_ERROR;
 }
 
 
-static LexerRet find_bin(Lexer *lex, Token *tk) {
-    if (!_equals(lex, 0, "0b", 2)) {
-        return LEXER_NOT_FOUND;
-    }
+/**
+ * Maps the first byte of a token to the only scanner that
+ * can accept it, so every token costs a single dispatch.
+ * Every byte starts out as __fallback and the scanners
+ * override theirs, which is meant.
+ */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
 
-    lex->offset += source_cspan(lex->src, lex->offset, CL_DELIMITERS);
+static const LexerFn DISPATCH[256] = {
+    [0 ... 255]  = __fallback,
 
-    if (!_validate_bin(lex)) {
-        return LEXER_SYNTAX_ERROR;
+    ['a' ... 'z'] = find_word,
+    ['A' ... 'Z'] = find_word,
+    ['_']         = find_word,
+    ['0' ... '9'] = find_number,
+
+    CL_PUNCTUATOR_DISPATCH(find_punctuator),
+
+    ['"']  = find_string,
+    ['\''] = find_character,
+    ['/']  = find_slash,
+};
+
+#pragma GCC diagnostic pop
+
+
+static bool find_token(Lexer *lex, Token *out_tk) {
+    for (;;) {
+        _skip_blank(lex);
+
+        if (_is_eof(lex)) {
+            return false;
+        }
+
+        LexerRet result = DISPATCH[(uint8_t)_peek(lex)](lex, out_tk);
+
+        switch (result) {
+            case LEXER_OK:
+                return true;
+            case LEXER_EOF:
+                return false;
+            case LEXER_SKIP:
+                break; /* comment, scan again */
+            case LEXER_SYNTAX_ERROR:
+                lex->error = true;
+                return false;
+            default:
+                cl_debug("unexpected result: %d\n", result);
+                return false;
+        }
     }
+}
 
-    _commit(lex, TK_BIN, tk);
 
-    return LEXER_OK;
+/* === Public interface === */
+
+
+/**
+ * Nothing is scanned past the end, or past a malformed token.
+ */
+static __Inline bool _is_done(Lexer *lex) {
+    return _is_eof(lex) || lex->error;
 }
 
 
-static LexerRet find_hex(Lexer *lex, Token *tk) {
-    if (!_equals(lex, 0, "0x", 2)) {
-        return LEXER_NOT_FOUND;
+static void _lexer_init(Lexer *self, Source *src, Interner *symbols) {
+    self->src = src;
+    intern_cache_init(&self->symbols, symbols);
+    self->offset = 0;
+    self->prev_offset = 0;
+    self->error = false;
+    self->head = 0;
+    self->ahead_count = 0;
+}
+
+
+Lexer *lexer_new(Source *src, Interner *symbols) {
+    Lexer *new_lexer = malloc(sizeof(Lexer));
+
+    if (!new_lexer) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return NULL;
     }
 
-    lex->offset += source_cspan(lex->src, lex->offset, CL_DELIMITERS);
+    _lexer_init(new_lexer, src, symbols);
 
-    if (!_validate_hex(lex)) {
-        return LEXER_SYNTAX_ERROR;
+    return new_lexer;
+}
+
+
+static __Inline bool _next(Lexer *self, Token *tk) {
+    if (self->ahead_count == 0) {
+        return !_is_done(self) && find_token(self, tk);
     }
 
-    _commit(lex, TK_HEX, tk);
+    *tk = self->ahead[self->head];
+    self->head = (self->head + 1) & (CL_LEXER_LOOKAHEAD - 1);
+    self->ahead_count--;
 
-    return LEXER_OK;
+    return true;
+}
+
+
+/**
+ * Returns the next token, or false at the end of the source
+ * or after a malformed token; lexer_failed tells them apart.
+ */
+bool lexer_next(Lexer *self, Token *tk) {
+    return _next(self, tk);
 }
 
 
-static LexerRet find_int(Lexer *lex, Token *tk) {
-    if (!__isdigit(_peek(lex))) {
-        return LEXER_NOT_FOUND;
+/**
+ * Looks at the token `k` places ahead without consuming it,
+ * `k = 0` being the one lexer_next returns next. `k` must be
+ * less than CL_LEXER_LOOKAHEAD.
+ */
+bool lexer_peek(Lexer *self, size_t k, Token *tk) {
+    if (k >= CL_LEXER_LOOKAHEAD) {
+        cl_debug("%s: lookahead too far: %zu\n", __func__, k);
+        return false;
     }
 
-    lex->offset += source_cspan(lex->src, lex->offset, CL_DELIMITERS);
+    while (self->ahead_count <= k) {
+        uint32_t tail = (self->head + self->ahead_count) &
+            (CL_LEXER_LOOKAHEAD - 1);
 
-    if (!_validate_int(lex)) {
-        return LEXER_SYNTAX_ERROR;
+        if (_is_done(self) || !find_token(self, &self->ahead[tail])) {
+            return false;
+        }
+
+        self->ahead_count++;
     }
 
-    _commit(lex, TK_INT, tk);
+    *tk = self->ahead[(self->head + k) & (CL_LEXER_LOOKAHEAD - 1)];
 
-    return LEXER_OK;
+    return true;
 }
 
 
-static LexerRet __fallback(Lexer *lex, Token *tk) {
-    diag_error(_getloc(lex, 0), "unexpected token");
-    return LEXER_SYNTAX_ERROR;
+bool lexer_failed(Lexer *self) {
+    return self->error;
 }
 
 
-static bool find_token(Lexer *lex, Token *out_tk) {
-    static const LexerFn find_fns[] = {
-        skip_comment,
-        find_string,
-        find_character,
-        find_operator,
-        find_symbol,
-        find_keyword,
-        find_identifier,
-        find_float,
-        find_bin,
-        find_hex,
-        find_int,
-        __fallback
-    };
+void lexer_free(Lexer *self) {
+    free(CL_VOIDPTR(self));
+}
 
-    _skip_blank(lex);
 
-    if (_is_eof(lex)) {
+bool cl_lex(Source *src, TokenStream *tokens, Interner *symbols) {
+    Lexer lex;
+    Token tk;
+
+    _lexer_init(&lex, src, symbols);
+
+    if (!tokens_reserve(tokens, tokens->count +
+        src->length / CL_TOKENS_BYTES_PER_TOKEN)) {
+        cl_error("out of memory!\n");
         return false;
     }
 
-    Token tmp;
+    while (_next(&lex, &tk)) {
+        if (!tokens_push(tokens, tk)) {
+            cl_error("out of memory!\n");
+            return false;
+        }
+    }
 
-    for (int i = 0; i < CL_N_ELEMS(find_fns); i++) {
-        LexerRet result = find_fns[i](lex, &tmp);
+    tokens->failed = lex.error;
 
-        switch (result) {
-            case LEXER_OK:
-                *out_tk = tmp;
-                return true;
-            case LEXER_EOF:
-                return false;
-            case LEXER_NOT_FOUND:
-                break; /* try next */
-            case LEXER_SYNTAX_ERROR:
-                lex->error = true;
-                return false;
-            default:
-                cl_debug("unexpected result: %d\n", result);
-                break;
+    return !lex.error;
+}
+
+
+/**
+ * Returns how many leading tokens an edit at `offset` cannot
+ * change: those that end, together with what their scanner
+ * peeked at, before the edit.
+ */
+static size_t _relex_keep(TokenStream *tokens, uint32_t offset) {
+    size_t lo = 0;
+    size_t hi = tokens->count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        uint64_t end = (uint64_t)tokens->offsets[mid] + tokens->lengths[mid];
+
+        if (end + CL_LEXER_MAX_PEEK <= offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
     }
 
-    return false;
+    return lo;
 }
 
 
-bool cl_lex(Source *src, Vector *tokens) {
-    Lexer lex = { src, 0, 0, 0, 1, 1, false };
+/**
+ * The lexer carries no state from one token to the next but
+ * its offset. Scanning restarts at the end of the last token
+ * the edit cannot reach, and stops as soon as a new token
+ * starts where an old token past the edit started, shifted by
+ * the size change: from there on both streams are the same.
+ */
+bool cl_relex(Source *src, TokenStream *tokens, SourceEdit edit,
+    Interner *symbols) {
+    size_t keep = _relex_keep(tokens, edit.offset);
+    uint32_t start = keep ? tokens->offsets[keep - 1] + tokens->lengths[keep - 1]
+                          : 0;
+    uint64_t edit_end = (uint64_t)edit.offset + edit.removed;
+    int64_t delta = (int64_t)edit.length - edit.removed;
+
+    if (!source_edit(src, edit)) {
+        return false;
+    }
 
+    Lexer lex;
     Token tk;
+    TokenVector fresh;
+
+    _lexer_init(&lex, src, symbols);
+    token_vector_init(&fresh);
+
+    lex.offset = start;
+    lex.prev_offset = start;
+
+    size_t sync = keep;
+    bool synced = false;
 
-    while (!_is_eof(&lex)) {
-        if (!find_token(&lex, &tk)) {
+    while (_next(&lex, &tk)) {
+        /* old tokens past the edit, up to where the new one starts */
+        while (sync < tokens->count &&
+               (tokens->offsets[sync] < edit_end ||
+                tokens->offsets[sync] + delta < tk.offset)) {
+            sync++;
+        }
+
+        if (sync < tokens->count && tokens->offsets[sync] + delta == tk.offset) {
+            synced = true;
             break;
         }
 
-        if (!vector_push(tokens, &tk)) {
+        if (!token_vector_push(&fresh, tk)) {
             cl_error("out of memory!\n");
+            token_vector_free(&fresh);
             return false;
         }
     }
 
-    return !lex.error;
+    if (!synced) {
+        sync = tokens->count;
+        tokens->failed = lex.error;
+    }
+
+    bool spliced = tokens_splice(tokens, keep, sync, fresh.data, fresh.count,
+        (uint32_t)delta);
+
+    token_vector_free(&fresh);
+
+    if (!spliced) {
+        cl_error("out of memory!\n");
+        return false;
+    }
+
+    return !tokens->failed;
+}
+
+
+/**
+ * Looks the spelling up in the tables the lexer is generated
+ * from. Only used to word diagnostics, so a linear search will
+ * do.
+ */
+str_t cl_token_name(TokenType type) {
+    static const struct {
+        const LexerPair *pairs;
+        size_t           count;
+    } TABLES[] = {
+        { PRIMITIVES, CL_N_ELEMS(PRIMITIVES) },
+        { KEYWORDS,   CL_N_ELEMS(KEYWORDS) },
+        { OPERATORS,  CL_N_ELEMS(OPERATORS) },
+        { SYMBOLS,    CL_N_ELEMS(SYMBOLS) },
+    };
+
+    for (size_t i = 0; i < CL_N_ELEMS(TABLES); i++) {
+        for (size_t k = 0; k < TABLES[i].count; k++) {
+            if (TABLES[i].pairs[k].type == type) {
+                return TABLES[i].pairs[k].name;
+            }
+        }
+    }
+
+    return "?";
 }
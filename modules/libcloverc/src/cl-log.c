@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
 #include <unistd.h>
 
@@ -21,6 +22,27 @@ static const LogInfo LEVELS[] = {
 };
 
 
+static _Thread_local LogBuffer *capture = NULL;
+
+
+static void _vwrite(int fd, str_t fmt, va_list args) {
+    if (capture) {
+        vfprintf(cl_log_stream(fd), fmt, args);
+    } else {
+        vdprintf(fd, fmt, args);
+    }
+}
+
+
+static void _write(int fd, str_t fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    _vwrite(fd, fmt, args);
+    va_end(args);
+}
+
+
 void __cl_log(LogLevel level, str_t scope, str_t msg, ...) {
     if (level < 0 || level >= __CL_LOG_MAX) {
         dprintf(STDERR_FILENO, "%s: invalid log level: %d\n", __func__, level);
@@ -34,19 +56,132 @@ void __cl_log(LogLevel level, str_t scope, str_t msg, ...) {
 
     if (scope) {
         if (cl_fd_use_colors(fd)) {
-            dprintf(fd, "\e[1m%s:\e[0m ", scope);
+            _write(fd, "\e[1m%s:\e[0m ", scope);
         } else {
-            dprintf(fd, "%s: ", scope);
+            _write(fd, "%s: ", scope);
         }
     }
 
     if (cl_fd_use_colors(fd)) {
-        dprintf(fd, "\e[%sm%s:\e[0m ", info.fmt, info.str);
+        _write(fd, "\e[%sm%s:\e[0m ", info.fmt, info.str);
     } else {
-        dprintf(fd, "%s: ", info.str);
+        _write(fd, "%s: ", info.str);
     }
 
     va_start(args, msg);
-    vdprintf(fd, msg, args);
+    _vwrite(fd, msg, args);
     va_end(args);
 }
+
+
+/**
+ * The buffer must not move in memory until it is flushed or
+ * discarded, the streams write back into it.
+ */
+bool log_buffer_init(LogBuffer *self) {
+    self->out_data = NULL;
+    self->err_data = NULL;
+    self->out_size = 0;
+    self->err_size = 0;
+
+    self->out = open_memstream(&self->out_data, &self->out_size);
+    self->err = open_memstream(&self->err_data, &self->err_size);
+
+    if (!self->out || !self->err) {
+        log_buffer_discard(self);
+        return false;
+    }
+
+    return true;
+}
+
+
+/**
+ * Makes the calling thread print into the given buffer, or
+ * straight to stdout and stderr again when it is NULL.
+ */
+void log_buffer_capture(LogBuffer *self) {
+    capture = self;
+}
+
+
+/**
+ * Stops collecting. The collected output stays in the buffer
+ * and can be written any number of times.
+ */
+void log_buffer_close(LogBuffer *self) {
+    if (self->out) {
+        fclose(self->out);
+        self->out = NULL;
+    }
+
+    if (self->err) {
+        fclose(self->err);
+        self->err = NULL;
+    }
+}
+
+
+/**
+ * Writes the collected output of a closed buffer to stdout and
+ * stderr.
+ */
+void log_buffer_write(LogBuffer *self) {
+    if (self->out_data) {
+        fwrite(self->out_data, 1, self->out_size, stdout);
+    }
+
+    if (self->err_data) {
+        fflush(stdout);
+        fwrite(self->err_data, 1, self->err_size, stderr);
+    }
+}
+
+
+/**
+ * Writes the collected output to stdout and stderr and frees
+ * the buffer.
+ */
+void log_buffer_flush(LogBuffer *self) {
+    log_buffer_close(self);
+    log_buffer_write(self);
+    log_buffer_discard(self);
+}
+
+
+/**
+ * Tells whether a closed buffer collected nothing.
+ */
+bool log_buffer_empty(LogBuffer *self) {
+    return self->out_size == 0 && self->err_size == 0;
+}
+
+
+void log_buffer_discard(LogBuffer *self) {
+    if (self->out) {
+        fclose(self->out);
+    }
+
+    if (self->err) {
+        fclose(self->err);
+    }
+
+    free(self->out_data);
+    free(self->err_data);
+
+    self->out = NULL;
+    self->err = NULL;
+    self->out_data = NULL;
+    self->err_data = NULL;
+    self->out_size = 0;
+    self->err_size = 0;
+}
+
+
+FILE *cl_log_stream(int fd) {
+    if (!capture) {
+        return (fd == STDERR_FILENO) ? stderr : stdout;
+    }
+
+    return (fd == STDERR_FILENO) ? capture->err : capture->out;
+}
@@ -0,0 +1,1472 @@
+#define CL_LOG_SCOPE "lower"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "cl-log.h"
+#include "cl-ir.h"
+
+
+/* values that take a register, past which a function is left alone */
+#define LOWER_MAX_VALUES    4096
+
+#define LOWER_NO_REG        UINT32_MAX
+
+
+typedef uint64_t Constant;
+
+CL_TYPE(Jump) {
+    uint32_t  pc;
+    IrBlockId to;
+};
+
+CL_VECTOR_DEFINE(Instruction, instruction)
+CL_VECTOR_DEFINE(Constant, constant)
+CL_VECTOR_DEFINE(Jump, jump)
+
+
+/**
+ * Turns SSA back into registers.
+ *
+ * Values that need a register get an index, and liveness is
+ * worked out over those as bitsets. Values live at the same
+ * time interfere; a phi and its operands that do not share a
+ * class, and go on to be coloured as one, so that the moves
+ * they need mostly go away. Values live across a call take the
+ * lowest colours, since a call clobbers the registers from its
+ * first argument up, and the arguments go right above them.
+ */
+CL_TYPE(Lower) {
+    IrFunction        *fn;
+    bool              *marked;      /* has to be written out */
+    bool              *fused;       /* a comparison its branch does */
+    uint32_t          *uses;        /* in a register */
+    uint32_t          *index;       /* of a value with a register */
+    IrValueVector      values;      /* by index */
+    size_t             words;       /* in a bitset of indexes */
+    uint64_t          *live_in;     /* by block */
+    uint64_t          *live;
+    uint64_t          *graph;       /* interference, a bitset per index */
+    bool              *across;      /* live across a call */
+    uint32_t          *parent;      /* classes, by index */
+    uint32_t          *next;        /* the members of a class, in a ring */
+    uint32_t          *color;       /* by class */
+    uint32_t          *bases;       /* where the arguments of a call go */
+    uint32_t           scratch;     /* free for moves that form a cycle */
+    uint32_t           registers;
+    InstructionVector  code;
+    ConstantVector     constants;
+    JumpVector         jumps;
+    uint32_t          *block_pc;
+    bool               failed;
+};
+
+
+static __Inline bool _bit(const uint64_t *set, uint32_t i) {
+    return (set[i / 64] >> (i % 64)) & 1;
+}
+
+
+static __Inline void _bit_set(uint64_t *set, uint32_t i) {
+    set[i / 64] |= (uint64_t)1 << (i % 64);
+}
+
+
+static __Inline void _bit_clear(uint64_t *set, uint32_t i) {
+    set[i / 64] &= ~((uint64_t)1 << (i % 64));
+}
+
+
+static __Inline IrOp _op(IrFunction *fn, IrValue value) {
+    return (IrOp)ir_instr(fn, value)->op;
+}
+
+
+/**
+ * Whether a value may be loaded straight into the register it
+ * goes to, as a phi operand or an argument.
+ */
+static __Inline bool _is_direct(IrFunction *fn, IrValue value) {
+    IrOp op = _op(fn, value);
+
+    return op == CL_IR_CONST || op == CL_IR_STRING;
+}
+
+
+static bool _failed(Lower *self) {
+    cl_debug("%s: %s\n", __func__, strerror(errno));
+    self->failed = true;
+
+    return false;
+}
+
+
+/* == shape == */
+
+
+/**
+ * Gives every edge into a block with phis from a block that
+ * branches a block of its own, where the moves for the phis go.
+ */
+static bool _split_edges(Lower *self) {
+    IrFunction *fn = self->fn;
+    size_t blocks = fn->blocks.count;
+
+    for (IrBlockId b = 0; b < blocks; b++) {
+        if (ir_block(fn, b)->dead) {
+            continue;
+        }
+
+        for (int t = 0; t < 2; t++) {
+            IrInstr *br = ir_instr(fn, ir_terminator(fn, b));
+            IrBlockId to = ir_target(br, t);
+
+            if (br->op != CL_IR_BR || ir_block(fn, to)->instrs.count == 0 ||
+                _op(fn, ir_block(fn, to)->instrs.data[0]) != CL_IR_PHI) {
+                continue;
+            }
+
+            IrBlockId edge = ir_block_add(fn);
+            IrInstr jmp = { .op = CL_IR_JMP };
+
+            if (edge == CL_IR_NO_BLOCK ||
+                !ir_block_id_vector_push(&ir_block(fn, edge)->preds, b) ||
+                !ir_block_id_vector_push(&fn->layout, edge)) {
+                return _failed(self);
+            }
+
+            ir_set_target(&jmp, 0, to);
+            ir_append(fn, edge, jmp);
+
+            br = ir_instr(fn, ir_terminator(fn, b));
+            ir_set_target(br, t, edge);
+            ir_block(fn, to)->preds.data[ir_pred_index(fn, to, b)] = edge;
+
+            /* right before the block it goes to, which it runs into */
+            size_t at = fn->layout.count - 1;
+
+            while (at > 0 && fn->layout.data[at - 1] != to) {
+                at--;
+            }
+
+            if (at > 0) {
+                memmove(&fn->layout.data[at], &fn->layout.data[at - 1],
+                    (fn->layout.count - at) * sizeof(IrBlockId));
+                fn->layout.data[at - 1] = edge;
+            }
+        }
+    }
+
+    return !fn->failed;
+}
+
+
+/**
+ * Drops the blocks nothing reaches and puts the entry first.
+ */
+static bool _order(Lower *self) {
+    IrFunction *fn = self->fn;
+
+    if (!ir_order(fn)) {
+        return _failed(self);
+    }
+
+    for (IrBlockId b = 0; b < fn->blocks.count; b++) {
+        if (!ir_block(fn, b)->dead && ir_block(fn, b)->order == UINT32_MAX) {
+            ir_block_kill(fn, b);
+        }
+    }
+
+    ir_settle(fn);
+
+    for (size_t i = fn->layout.count; i > 1; i--) {
+        if (fn->layout.data[i - 1] == 0) {
+            fn->layout.data[i - 1] = fn->layout.data[i - 2];
+            fn->layout.data[i - 2] = 0;
+        }
+    }
+
+    return true;
+}
+
+
+/* == what to write == */
+
+
+/**
+ * Whether an ADD or a SUB becomes an ADDI, with the operand that
+ * stays in a register and the immediate.
+ */
+static bool _addi(IrFunction *fn, IrValue value, IrValue *reg, int32_t *imm) {
+    IrInstr *instr = ir_instr(fn, value);
+
+    if (instr->op != CL_IR_ADD && instr->op != CL_IR_SUB) {
+        return false;
+    }
+
+    for (int i = 1; i >= 0; i--) {
+        IrInstr *other = ir_instr(fn, instr->args[i]);
+        int64_t c = (int64_t)other->imm;
+
+        if (other->op != CL_IR_CONST || (instr->op == CL_IR_SUB && i == 0)) {
+            continue;
+        }
+
+        c = (instr->op == CL_IR_SUB) ? (int64_t)(0 - other->imm) : c;
+
+        if (c >= -CL_BYTECODE_SC_BIAS && c < CL_BYTECODE_SC_BIAS) {
+            *reg = instr->args[1 - i];
+            *imm = (int32_t)c;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/**
+ * The operands an instruction reads from registers, into `out`,
+ * which has room for 256. Phis read theirs on the way in.
+ */
+static uint32_t _reads(Lower *self, IrValue value, IrValue *out) {
+    IrFunction *fn = self->fn;
+    IrInstr *instr = ir_instr(fn, value);
+    uint32_t count, n = 0;
+    IrValue *args = ir_operands(fn, value, &count);
+    IrValue reg;
+    int32_t imm;
+
+    switch (instr->op) {
+        case CL_IR_PHI:
+            return 0;
+
+        case CL_IR_CALL:
+            for (uint32_t i = 0; i < count; i++) {
+                if (!_is_direct(fn, args[i])) {
+                    out[n++] = args[i];
+                }
+            }
+            return n;
+
+        case CL_IR_ADD:
+        case CL_IR_SUB:
+            if (_addi(fn, value, &reg, &imm)) {
+                out[0] = reg;
+                return 1;
+            }
+            break;
+
+        case CL_IR_BR:
+            if (self->fused[args[0]]) {
+                out[0] = ir_instr(fn, args[0])->args[0];
+                out[1] = ir_instr(fn, args[0])->args[1];
+                return 2;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    memcpy(out, args, count * sizeof(IrValue));
+
+    return count;
+}
+
+
+/**
+ * Works out what is written out: what has an effect and what it
+ * needs, which comparisons go into their branch, and which
+ * values take a register.
+ */
+static bool _select(Lower *self) {
+    IrFunction *fn = self->fn;
+    size_t count = fn->instrs.count;
+    IrValueVector work = { 0 };
+    IrValue reads[256];
+
+    self->marked = calloc(count, sizeof(bool));
+    self->fused = calloc(count, sizeof(bool));
+    self->uses = calloc(count, sizeof(uint32_t));
+    self->index = malloc(count * sizeof(uint32_t));
+
+    if (!self->marked || !self->fused || !self->uses || !self->index) {
+        return _failed(self);
+    }
+
+    for (size_t b = 0; b < fn->blocks.count; b++) {
+        IrBlock *block = ir_block(fn, (IrBlockId)b);
+
+        for (size_t i = 0; !block->dead && i < block->instrs.count; i++) {
+            IrValue value = block->instrs.data[i];
+            uint32_t flags = ir_op_flags(_op(fn, value));
+
+            if ((flags & (CL_IR_EFFECT | CL_IR_TERM | CL_IR_TRAPS)) &&
+                !ir_value_vector_push(&work, value)) {
+                return _failed(self);
+            }
+
+            self->marked[value] |= (flags &
+                (CL_IR_EFFECT | CL_IR_TERM | CL_IR_TRAPS)) != 0;
+        }
+    }
+
+    while (work.count > 0) {
+        uint32_t n;
+        IrValue *args = ir_operands(fn, work.data[--work.count], &n);
+
+        for (uint32_t i = 0; i < n; i++) {
+            if (!self->marked[args[i]]) {
+                self->marked[args[i]] = true;
+
+                if (!ir_value_vector_push(&work, args[i])) {
+                    ir_value_vector_free(&work);
+                    return _failed(self);
+                }
+            }
+        }
+    }
+
+    ir_value_vector_free(&work);
+
+    /* a comparison only its branch uses moves down to it */
+    for (size_t b = 0; b < fn->blocks.count; b++) {
+        IrBlock *block = ir_block(fn, (IrBlockId)b);
+
+        for (size_t i = 0; !block->dead && i < block->instrs.count; i++) {
+            uint32_t n;
+            IrValue *args = ir_operands(fn, block->instrs.data[i], &n);
+
+            for (uint32_t j = 0; j < n; j++) {
+                self->uses[args[j]]++;
+            }
+        }
+    }
+
+    for (size_t b = 0; b < fn->blocks.count; b++) {
+        IrBlock *block = ir_block(fn, (IrBlockId)b);
+        size_t last = block->instrs.count - 1;
+
+        if (block->dead || _op(fn, block->instrs.data[last]) != CL_IR_BR) {
+            continue;
+        }
+
+        IrValue cond = ir_instr(fn, block->instrs.data[last])->args[0];
+        IrOp op = _op(fn, cond);
+
+        if (op < CL_IR_EQ || op > CL_IR_FLE || self->uses[cond] != 1 ||
+            ir_instr(fn, cond)->block != (IrBlockId)b) {
+            continue;
+        }
+
+        for (size_t i = 0; i < last; i++) {
+            if (block->instrs.data[i] == cond) {
+                memmove(&block->instrs.data[i], &block->instrs.data[i + 1],
+                    (last - 1 - i) * sizeof(IrValue));
+                block->instrs.data[last - 1] = cond;
+                break;
+            }
+        }
+
+        self->fused[cond] = true;
+    }
+
+    /* what is read from a register, phi operands counted */
+    memset(self->uses, 0, count * sizeof(uint32_t));
+
+    for (size_t b = 0; b < fn->blocks.count; b++) {
+        IrBlock *block = ir_block(fn, (IrBlockId)b);
+
+        for (size_t i = 0; !block->dead && i < block->instrs.count; i++) {
+            IrValue value = block->instrs.data[i];
+            uint32_t n;
+
+            if (!self->marked[value] || self->fused[value]) {
+                continue;
+            }
+
+            if (_op(fn, value) == CL_IR_PHI) {
+                IrValue *args = ir_operands(fn, value, &n);
+
+                for (uint32_t j = 0; j < n; j++) {
+                    self->uses[args[j]] += !_is_direct(fn, args[j]);
+                }
+
+                continue;
+            }
+
+            n = _reads(self, value, reads);
+
+            for (uint32_t j = 0; j < n; j++) {
+                self->uses[reads[j]]++;
+            }
+        }
+    }
+
+    for (IrValue value = 0; value < count; value++) {
+        IrOp op = _op(fn, value);
+        bool reg = self->marked[value] && !self->fused[value] &&
+            (ir_op_flags(op) & CL_IR_VALUE) &&
+            ir_instr(fn, value)->block != CL_IR_NO_BLOCK &&
+            !ir_block(fn, ir_instr(fn, value)->block)->dead &&
+            (self->uses[value] > 0 || (op != CL_IR_CONST &&
+            op != CL_IR_STRING && op != CL_IR_CALL && op != CL_IR_PARAM));
+
+        self->index[value] = LOWER_NO_REG;
+
+        if (reg) {
+            self->index[value] = (uint32_t)self->values.count;
+
+            if (!ir_value_vector_push(&self->values, value)) {
+                return _failed(self);
+            }
+        }
+    }
+
+    if (self->values.count > LOWER_MAX_VALUES) {
+        cl_debug("%s: %zu values\n", __func__, self->values.count);
+        self->failed = true;
+        return false;
+    }
+
+    return true;
+}
+
+
+/* == liveness == */
+
+
+static uint32_t _find(Lower *self, uint32_t i);
+
+
+/**
+ * Walks a block backwards from what is live at its end, in
+ * `live`, to what is live at its start. With `build` set, adds
+ * the interferences on the way.
+ */
+static void _walk(Lower *self, IrBlockId b, uint64_t *live, bool build) {
+    IrFunction *fn = self->fn;
+    IrBlock *block = ir_block(fn, b);
+    IrValue reads[256];
+    size_t i = block->instrs.count;
+
+    #define INTERFERE(d)                                                    \
+        for (size_t w = 0; build && w < self->words; w++) {                 \
+            for (uint64_t bits = live[w]; bits; bits &= bits - 1) {         \
+                uint32_t v = (uint32_t)(w * 64 + __builtin_ctzll(bits));    \
+                                                                            \
+                if (v != (d)) {                                             \
+                    _bit_set(&self->graph[(d) * self->words], v);           \
+                    _bit_set(&self->graph[v * self->words], (d));           \
+                }                                                           \
+            }                                                               \
+        }
+
+    for (; i > 0; i--) {
+        IrValue value = block->instrs.data[i - 1];
+        IrOp op = _op(fn, value);
+        uint32_t d = self->index[value];
+
+        if (op == CL_IR_PHI || op == CL_IR_PARAM) {
+            break;
+        }
+
+        if (!self->marked[value] || self->fused[value] ||
+            ((op == CL_IR_CONST || op == CL_IR_STRING) &&
+            d == LOWER_NO_REG)) {
+            continue;
+        }
+
+        if (d != LOWER_NO_REG) {
+            INTERFERE(d)
+            _bit_clear(live, d);
+        }
+
+        if (op == CL_IR_CALL && build) {
+            for (uint32_t v = 0; v < self->values.count; v++) {
+                self->across[v] |= _bit(live, v);
+            }
+        } else if (op == CL_IR_CALL && self->bases) {
+            /* right above what the call has to leave alone */
+            uint32_t base = 0;
+
+            for (uint32_t v = 0; v < self->values.count; v++) {
+                uint32_t color = self->color[_find(self, v)];
+
+                base = (_bit(live, v) && color + 1 > base) ? color + 1 : base;
+            }
+
+            self->bases[value] = base;
+        }
+
+        uint32_t n = _reads(self, value, reads);
+
+        for (uint32_t j = 0; j < n; j++) {
+            if (self->index[reads[j]] != LOWER_NO_REG) {
+                _bit_set(live, self->index[reads[j]]);
+            }
+        }
+    }
+
+    /* phis, and the parameters of the entry, are all set at once */
+    for (size_t j = 0; j < i; j++) {
+        uint32_t d = self->index[block->instrs.data[j]];
+
+        if (d != LOWER_NO_REG) {
+            _bit_set(live, d);
+        }
+    }
+
+    for (size_t j = 0; j < i; j++) {
+        uint32_t d = self->index[block->instrs.data[j]];
+
+        if (d != LOWER_NO_REG) {
+            INTERFERE(d)
+        }
+    }
+
+    for (size_t j = 0; j < i; j++) {
+        uint32_t d = self->index[block->instrs.data[j]];
+
+        if (d != LOWER_NO_REG) {
+            _bit_clear(live, d);
+        }
+    }
+
+    #undef INTERFERE
+}
+
+
+/**
+ * What is live at the end of a block: what its successors need
+ * at their start, and the operands their phis take from it.
+ */
+static void _live_out(Lower *self, IrBlockId b, uint64_t *live) {
+    IrFunction *fn = self->fn;
+    IrBlockId succs[2];
+    uint32_t count = ir_succs(fn, b, succs);
+
+    memset(live, 0, self->words * sizeof(uint64_t));
+
+    for (uint32_t s = 0; s < count; s++) {
+        IrBlock *to = ir_block(fn, succs[s]);
+        uint64_t *in = &self->live_in[succs[s] * self->words];
+        size_t index = ir_pred_index(fn, succs[s], b);
+
+        for (size_t w = 0; w < self->words; w++) {
+            live[w] |= in[w];
+        }
+
+        for (size_t i = 0; i < to->instrs.count; i++) {
+            IrValue phi = to->instrs.data[i];
+            uint32_t n;
+
+            if (_op(fn, phi) != CL_IR_PHI) {
+                break;
+            }
+
+            IrValue arg = ir_operands(fn, phi, &n)[index];
+
+            if (self->index[phi] != LOWER_NO_REG &&
+                self->index[arg] != LOWER_NO_REG && !_is_direct(fn, arg)) {
+                _bit_set(live, self->index[arg]);
+            }
+        }
+    }
+}
+
+
+static bool _liveness(Lower *self) {
+    IrFunction *fn = self->fn;
+    size_t n = self->values.count;
+
+    self->words = (n + 63) / 64 + 1;
+    self->live_in = calloc(fn->blocks.count * self->words, sizeof(uint64_t));
+    self->live = calloc(self->words, sizeof(uint64_t));
+    self->graph = calloc(n * self->words + 1, sizeof(uint64_t));
+    self->across = calloc(n + 1, sizeof(bool));
+
+    if (!self->live_in || !self->live || !self->graph || !self->across) {
+        return _failed(self);
+    }
+
+    /* backwards, so a block mostly sees its successors done */
+    for (bool changed = true; changed; ) {
+        changed = false;
+
+        for (size_t i = fn->rpo.count; i > 0; i--) {
+            IrBlockId b = fn->rpo.data[i - 1];
+            uint64_t *in = &self->live_in[b * self->words];
+
+            _live_out(self, b, self->live);
+            _walk(self, b, self->live, false);
+
+            if (memcmp(in, self->live, self->words * sizeof(uint64_t))) {
+                memcpy(in, self->live, self->words * sizeof(uint64_t));
+                changed = true;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < fn->rpo.count; i++) {
+        _live_out(self, fn->rpo.data[i], self->live);
+        _walk(self, fn->rpo.data[i], self->live, true);
+    }
+
+    return true;
+}
+
+
+/* == registers == */
+
+
+static uint32_t _find(Lower *self, uint32_t i) {
+    while (self->parent[i] != i) {
+        self->parent[i] = self->parent[self->parent[i]];
+        i = self->parent[i];
+    }
+
+    return i;
+}
+
+
+static bool _interfere(Lower *self, uint32_t a, uint32_t b) {
+    const uint64_t *row = &self->graph[a * self->words];
+    uint32_t i = b;
+
+    do {
+        if (_bit(row, i)) {
+            return true;
+        }
+
+        i = self->next[i];
+    } while (i != b);
+
+    return false;
+}
+
+
+/**
+ * The parameter a class holds, or -1.
+ */
+static int _param_of(Lower *self, uint32_t root) {
+    uint32_t i = root;
+
+    do {
+        IrInstr *instr = ir_instr(self->fn, self->values.data[i]);
+
+        if (instr->op == CL_IR_PARAM) {
+            return (int)instr->imm;
+        }
+
+        i = self->next[i];
+    } while (i != root);
+
+    return -1;
+}
+
+
+/**
+ * Puts a phi in the class of its operands wherever they are
+ * never live at the same time.
+ */
+static bool _coalesce(Lower *self) {
+    IrFunction *fn = self->fn;
+    size_t n = self->values.count;
+
+    self->parent = malloc((n + 1) * sizeof(uint32_t));
+    self->next = malloc((n + 1) * sizeof(uint32_t));
+
+    if (!self->parent || !self->next) {
+        return _failed(self);
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        self->parent[i] = self->next[i] = i;
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        IrValue phi = self->values.data[i];
+        uint32_t count;
+
+        if (_op(fn, phi) != CL_IR_PHI) {
+            continue;
+        }
+
+        IrValue *args = ir_operands(fn, phi, &count);
+
+        for (uint32_t j = 0; j < count; j++) {
+            uint32_t other = self->index[args[j]];
+
+            if (other == LOWER_NO_REG || _is_direct(fn, args[j])) {
+                continue;
+            }
+
+            uint32_t a = _find(self, i), b = _find(self, other);
+
+            if (a == b || _interfere(self, a, b) ||
+                (_param_of(self, a) >= 0 && _param_of(self, b) >= 0)) {
+                continue;
+            }
+
+            /* b joins a: its ring, and its interferences */
+            uint32_t tmp = self->next[a];
+
+            self->next[a] = self->next[b];
+            self->next[b] = tmp;
+            self->parent[b] = a;
+
+            for (size_t w = 0; w < self->words; w++) {
+                self->graph[a * self->words + w] |=
+                    self->graph[b * self->words + w];
+            }
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * Colours a class the lowest register its neighbours leave,
+ * `hint` if that is free.
+ */
+static bool _paint(Lower *self, uint32_t root, uint32_t hint) {
+    const uint64_t *row = &self->graph[root * self->words];
+    uint64_t taken[CL_BYTECODE_MAX_REGISTERS / 64] = { 0 };
+
+    for (size_t w = 0; w < self->words; w++) {
+        for (uint64_t bits = row[w]; bits; bits &= bits - 1) {
+            uint32_t v = (uint32_t)(w * 64 + __builtin_ctzll(bits));
+            uint32_t color = self->color[_find(self, v)];
+
+            if (color < CL_BYTECODE_MAX_REGISTERS) {
+                _bit_set(taken, color);
+            }
+        }
+    }
+
+    if (hint < CL_BYTECODE_MAX_REGISTERS && !_bit(taken, hint)) {
+        self->color[root] = hint;
+        return true;
+    }
+
+    for (uint32_t color = 0; color < CL_BYTECODE_MAX_REGISTERS; color++) {
+        if (!_bit(taken, color)) {
+            self->color[root] = color;
+            return true;
+        }
+    }
+
+    cl_debug("%s: out of registers\n", __func__);
+    self->failed = true;
+
+    return false;
+}
+
+
+/**
+ * Where the arguments or the result of a call would like a class
+ * to be, from the first member that has a say, or LOWER_NO_REG.
+ */
+static uint32_t _hint(Lower *self, const uint32_t *hints, uint32_t root) {
+    uint32_t i = root;
+
+    do {
+        if (hints[i] != LOWER_NO_REG) {
+            return hints[i];
+        }
+
+        i = self->next[i];
+    } while (i != root);
+
+    return LOWER_NO_REG;
+}
+
+
+/**
+ * Colours parameters where they come in, then what lives across
+ * calls, then the rest. The arguments of a call go right above
+ * what lives across it.
+ */
+static bool _color(Lower *self) {
+    IrFunction *fn = self->fn;
+    size_t n = self->values.count;
+    uint32_t window = 0;
+
+    uint32_t *hints = malloc((n + 1) * sizeof(uint32_t));
+
+    self->color = malloc((n + 1) * sizeof(uint32_t));
+    self->bases = calloc(fn->instrs.count, sizeof(uint32_t));
+
+    if (!self->color || !self->bases || !hints) {
+        free(hints);
+        return _failed(self);
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        self->color[i] = LOWER_NO_REG;
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        int param = (_find(self, i) == i) ? _param_of(self, i) : -1;
+
+        if (param >= 0) {
+            self->color[i] = (uint32_t)param;
+        }
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t root = _find(self, i);
+
+        if (self->across[i] && self->color[root] == LOWER_NO_REG &&
+            !_paint(self, root, LOWER_NO_REG)) {
+            free(hints);
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < fn->rpo.count; i++) {
+        _live_out(self, fn->rpo.data[i], self->live);
+        _walk(self, fn->rpo.data[i], self->live, false);
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        hints[i] = LOWER_NO_REG;
+    }
+
+    for (size_t b = 0; b < fn->blocks.count; b++) {
+        IrBlock *block = ir_block(fn, (IrBlockId)b);
+
+        for (size_t k = 0; !block->dead && k < block->instrs.count; k++) {
+            IrValue call = block->instrs.data[k];
+            uint32_t count;
+
+            if (_op(fn, call) != CL_IR_CALL) {
+                continue;
+            }
+
+            IrValue *args = ir_operands(fn, call, &count);
+            uint32_t base = self->bases[call];
+
+            window = (base + (count ? count : 1) > window)
+                ? base + (count ? count : 1) : window;
+
+            if (self->index[call] != LOWER_NO_REG) {
+                hints[self->index[call]] = base;
+            }
+
+            for (uint32_t j = 0; j < count; j++) {
+                uint32_t index = self->index[args[j]];
+
+                if (index != LOWER_NO_REG && hints[index] == LOWER_NO_REG &&
+                    !_is_direct(fn, args[j])) {
+                    hints[index] = base + j;
+                }
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t root = _find(self, i);
+
+        if (self->color[root] == LOWER_NO_REG &&
+            !_paint(self, root, _hint(self, hints, root))) {
+            free(hints);
+            return false;
+        }
+    }
+
+    free(hints);
+
+    uint32_t used = 0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t color = self->color[_find(self, i)];
+
+        used = (color + 1 > used) ? color + 1 : used;
+    }
+
+    self->registers = (fn->param_count > used) ? fn->param_count : used;
+    self->registers = (window > self->registers) ? window : self->registers;
+
+    /* above everything, so a cycle of moves into a call is safe too */
+    self->scratch = self->registers;
+
+    if (self->registers > CL_BYTECODE_MAX_REGISTERS) {
+        cl_debug("%s: out of registers\n", __func__);
+        self->failed = true;
+        return false;
+    }
+
+    return true;
+}
+
+
+/* == writing == */
+
+
+static __Inline uint32_t _reg(Lower *self, IrValue value) {
+    return self->color[_find(self, self->index[value])];
+}
+
+
+static void _emit(Lower *self, Instruction insn) {
+    if (!instruction_vector_push(&self->code, insn)) {
+        _failed(self);
+    }
+}
+
+
+static uint32_t _constant(Lower *self, uint64_t value) {
+    for (size_t i = 0; i < self->constants.count; i++) {
+        if (self->constants.data[i] == value) {
+            return (uint32_t)i;
+        }
+    }
+
+    if (self->constants.count == CL_BYTECODE_MAX_CONSTANTS) {
+        self->failed = true;
+        return 0;
+    }
+
+    if (!constant_vector_push(&self->constants, value)) {
+        _failed(self);
+        return 0;
+    }
+
+    return (uint32_t)self->constants.count - 1;
+}
+
+
+static void _jump(Lower *self, IrBlockId to) {
+    Jump jump = { .pc = (uint32_t)self->code.count, .to = to };
+
+    if (!jump_vector_push(&self->jumps, jump)) {
+        _failed(self);
+    }
+
+    _emit(self, cl_sj(CL_OP_JMP, 0));
+}
+
+
+/**
+ * Loads a constant or a string into a register.
+ */
+static void _load(Lower *self, uint32_t reg, IrValue value) {
+    IrInstr *instr = ir_instr(self->fn, value);
+    int64_t imm = (int64_t)instr->imm;
+
+    if (instr->op == CL_IR_STRING) {
+        _emit(self, cl_abx(CL_OP_LOADS, reg, _constant(self, instr->imm)));
+    } else if (imm >= -CL_BYTECODE_SBX_BIAS &&
+        imm <= UINT16_MAX - CL_BYTECODE_SBX_BIAS) {
+        _emit(self, cl_asbx(CL_OP_LOADI, reg, (int32_t)imm));
+    } else {
+        _emit(self, cl_abx(CL_OP_LOADK, reg, _constant(self, instr->imm)));
+    }
+}
+
+
+/**
+ * Moves `count` registers at once: a move waits while another
+ * still reads its destination, and a cycle goes through the
+ * scratch register. Constants load last, as nothing reads them.
+ */
+static void _moves(Lower *self, uint32_t *to, uint32_t *from, size_t count,
+    const uint32_t *load_to, const IrValue *loads, size_t load_count) {
+    size_t left = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (to[i] != from[i]) {
+            to[left] = to[i];
+            from[left++] = from[i];
+        }
+    }
+
+    while (left > 0 && !self->failed) {
+        bool progress = false;
+
+        for (size_t i = 0; i < left; ) {
+            bool read = false;
+
+            for (size_t j = 0; j < left && !read; j++) {
+                read = j != i && from[j] == to[i];
+            }
+
+            if (read) {
+                i++;
+                continue;
+            }
+
+            _emit(self, cl_abc(CL_OP_MOVE, to[i], from[i], 0));
+            to[i] = to[--left];
+            from[i] = from[left];
+            progress = true;
+        }
+
+        if (!progress) {
+            /* only cycles are left: one of them goes aside */
+            uint32_t reg = from[0];
+
+            self->registers = (self->scratch + 1 > self->registers)
+                ? self->scratch + 1 : self->registers;
+            _emit(self, cl_abc(CL_OP_MOVE, self->scratch, reg, 0));
+
+            for (size_t j = 0; j < left; j++) {
+                from[j] = (from[j] == reg) ? self->scratch : from[j];
+            }
+        }
+    }
+
+    for (size_t i = 0; i < load_count; i++) {
+        _load(self, load_to[i], loads[i]);
+    }
+}
+
+
+/**
+ * The moves into the phis of `to` on the way from `from`.
+ */
+static void _edge(Lower *self, IrBlockId from, IrBlockId to) {
+    IrFunction *fn = self->fn;
+    IrBlock *block = ir_block(fn, to);
+    size_t index = ir_pred_index(fn, to, from);
+    uint32_t dst[CL_BYTECODE_MAX_REGISTERS], src[CL_BYTECODE_MAX_REGISTERS];
+    uint32_t load_to[CL_BYTECODE_MAX_REGISTERS];
+    IrValue loads[CL_BYTECODE_MAX_REGISTERS];
+    size_t count = 0, load_count = 0;
+
+    for (size_t i = 0; i < block->instrs.count; i++) {
+        IrValue phi = block->instrs.data[i];
+        uint32_t n;
+
+        if (_op(fn, phi) != CL_IR_PHI) {
+            break;
+        }
+
+        if (self->index[phi] == LOWER_NO_REG) {
+            continue;
+        }
+
+        IrValue arg = ir_operands(fn, phi, &n)[index];
+
+        /* phis that share a register take one move */
+        bool seen = false;
+
+        for (size_t j = 0; j < count && !seen; j++) {
+            seen = dst[j] == _reg(self, phi);
+        }
+
+        for (size_t j = 0; j < load_count && !seen; j++) {
+            seen = load_to[j] == _reg(self, phi);
+        }
+
+        if (seen) {
+            continue;
+        }
+
+        if (_is_direct(fn, arg)) {
+            load_to[load_count] = _reg(self, phi);
+            loads[load_count++] = arg;
+        } else {
+            dst[count] = _reg(self, phi);
+            src[count++] = _reg(self, arg);
+        }
+    }
+
+    _moves(self, dst, src, count, load_to, loads, load_count);
+}
+
+
+static void _call(Lower *self, IrValue value) {
+    IrFunction *fn = self->fn;
+    IrInstr *instr = ir_instr(fn, value);
+    uint32_t n;
+    IrValue *args = ir_operands(fn, value, &n);
+    uint32_t dst[CL_BYTECODE_MAX_REGISTERS], src[CL_BYTECODE_MAX_REGISTERS];
+    uint32_t load_to[CL_BYTECODE_MAX_REGISTERS];
+    IrValue loads[CL_BYTECODE_MAX_REGISTERS];
+    size_t count = 0, load_count = 0;
+    uint32_t base = self->bases[value];
+
+    for (uint32_t i = 0; i < n; i++) {
+        if (_is_direct(fn, args[i])) {
+            load_to[load_count] = base + i;
+            loads[load_count++] = args[i];
+        } else {
+            dst[count] = base + i;
+            src[count++] = _reg(self, args[i]);
+        }
+    }
+
+    _moves(self, dst, src, count, load_to, loads, load_count);
+    _emit(self, cl_abx(CL_OP_CALL, base, _constant(self, instr->imm)));
+
+    if (self->index[value] != LOWER_NO_REG && _reg(self, value) != base) {
+        _emit(self, cl_abc(CL_OP_MOVE, _reg(self, value), base, 0));
+    }
+}
+
+
+/**
+ * A comparison as a value: 1 or 0 into its register, without
+ * writing it before reading the operands.
+ */
+static void _compare(Lower *self, IrValue value) {
+    IrInstr *instr = ir_instr(self->fn, value);
+    Opcode op = CL_OP_EQ + (instr->op - CL_IR_EQ);
+    uint32_t reg = _reg(self, value);
+    uint32_t a = _reg(self, instr->args[0]), b = _reg(self, instr->args[1]);
+
+    if (reg != a && reg != b) {
+        _emit(self, cl_asbx(CL_OP_LOADI, reg, 1));
+        _emit(self, cl_abc(op, a, b, 1));
+        _emit(self, cl_sj(CL_OP_JMP, 1));
+        _emit(self, cl_asbx(CL_OP_LOADI, reg, 0));
+        return;
+    }
+
+    _emit(self, cl_abc(op, a, b, 1));
+    _emit(self, cl_sj(CL_OP_JMP, 2));
+    _emit(self, cl_asbx(CL_OP_LOADI, reg, 0));
+    _emit(self, cl_sj(CL_OP_JMP, 1));
+    _emit(self, cl_asbx(CL_OP_LOADI, reg, 1));
+}
+
+
+/**
+ * A branch: the test and the JMP it takes, and one more JMP
+ * unless the other way is the next block.
+ */
+static void _branch(Lower *self, IrValue value, IrBlockId next) {
+    IrFunction *fn = self->fn;
+    IrInstr *br = ir_instr(fn, value);
+    IrValue cond = br->args[0];
+    IrBlockId yes = ir_target(br, 0), no = ir_target(br, 1);
+    uint32_t when = (yes == next) ? 0 : 1;
+
+    if (self->fused[cond]) {
+        IrInstr *cmp = ir_instr(fn, cond);
+
+        _emit(self, cl_abc(CL_OP_EQ + (cmp->op - CL_IR_EQ),
+            _reg(self, cmp->args[0]), _reg(self, cmp->args[1]), when));
+    } else {
+        _emit(self, cl_abc(CL_OP_TEST, _reg(self, cond), when, 0));
+    }
+
+    _jump(self, when ? yes : no);
+
+    if (yes != next && no != next) {
+        _jump(self, no);
+    }
+}
+
+
+static void _instr(Lower *self, IrValue value, IrBlockId block,
+    IrBlockId next) {
+    IrFunction *fn = self->fn;
+    IrInstr *instr = ir_instr(fn, value);
+    IrOp op = (IrOp)instr->op;
+    uint32_t a = (self->index[value] != LOWER_NO_REG) ? _reg(self, value) : 0;
+    uint32_t r0 = 0, r1 = 0, r2 = 0;
+    IrValue reg;
+    int32_t imm;
+
+    if (op != CL_IR_CALL && op != CL_IR_PHI) {
+        r0 = (instr->args[0] && self->index[instr->args[0]] != LOWER_NO_REG)
+            ? _reg(self, instr->args[0]) : 0;
+        r1 = (instr->args[1] && self->index[instr->args[1]] != LOWER_NO_REG)
+            ? _reg(self, instr->args[1]) : 0;
+        r2 = (instr->args[2] && self->index[instr->args[2]] != LOWER_NO_REG)
+            ? _reg(self, instr->args[2]) : 0;
+    }
+
+    switch (op) {
+        case CL_IR_CONST:
+        case CL_IR_STRING:
+            _load(self, a, value);
+            break;
+
+        case CL_IR_ADD:
+        case CL_IR_SUB:
+            if (_addi(fn, value, &reg, &imm)) {
+                _emit(self, cl_abc(CL_OP_ADDI, a, _reg(self, reg),
+                    (uint32_t)(imm + CL_BYTECODE_SC_BIAS)));
+                break;
+            }
+            /* fall through */
+
+        case CL_IR_MUL: case CL_IR_DIV: case CL_IR_MOD: case CL_IR_BAND:
+        case CL_IR_BOR: case CL_IR_BXOR: case CL_IR_SHL: case CL_IR_SHR:
+        case CL_IR_FADD: case CL_IR_FSUB: case CL_IR_FMUL: case CL_IR_FDIV: {
+            Opcode code = CL_OP_ADD + (op - CL_IR_ADD) +
+                (op > CL_IR_MOD ? 1 : 0);
+
+            _emit(self, cl_abc(code, a, r0, r1));
+            break;
+        }
+
+        case CL_IR_NEG: case CL_IR_FNEG: case CL_IR_NOT: case CL_IR_BNOT:
+        case CL_IR_ITOF: case CL_IR_FTOI:
+            _emit(self, cl_abc(CL_OP_NEG + (op - CL_IR_NEG), a, r0, 0));
+            break;
+
+        case CL_IR_EQ: case CL_IR_LT: case CL_IR_LE: case CL_IR_FEQ:
+        case CL_IR_FLT: case CL_IR_FLE:
+            _compare(self, value);
+            break;
+
+        case CL_IR_FRAME:
+            _emit(self, cl_abx(CL_OP_FRAME, a, (uint32_t)instr->imm));
+            break;
+
+        case CL_IR_REF:
+        case CL_IR_GETF:
+            _emit(self, cl_abc((op == CL_IR_REF) ? CL_OP_REF : CL_OP_GETF, a,
+                r0, (uint32_t)instr->imm));
+            break;
+
+        case CL_IR_GETG:
+            _emit(self, cl_abx(CL_OP_GETG, a, (uint32_t)instr->imm));
+            break;
+
+        case CL_IR_SETG:
+            _emit(self, cl_abx(CL_OP_SETG, r0, (uint32_t)instr->imm));
+            break;
+
+        case CL_IR_SETF:
+            _emit(self, cl_abc(CL_OP_SETF, r0, (uint32_t)instr->imm, r1));
+            break;
+
+        case CL_IR_GETI:
+            _emit(self, cl_abc(CL_OP_GETI, a, r0, r1));
+            break;
+
+        case CL_IR_SETI:
+            _emit(self, cl_abc(CL_OP_SETI, r0, r1, r2));
+            break;
+
+        case CL_IR_ZERO:
+            _emit(self, cl_abx(CL_OP_ZERO, r0, (uint32_t)instr->imm));
+            break;
+
+        case CL_IR_COPY:
+            _emit(self, cl_abc(CL_OP_COPY, r0, r1, (uint32_t)instr->imm));
+            break;
+
+        case CL_IR_CALL:
+            _call(self, value);
+            break;
+
+        case CL_IR_PRINT:
+            _emit(self, cl_abc(CL_OP_PRINT, r0, (uint32_t)(instr->imm & 0xFF),
+                (uint32_t)(instr->imm >> 8)));
+            break;
+
+        case CL_IR_JMP:
+            _edge(self, block, ir_target(instr, 0));
+
+            if (ir_target(instr, 0) != next) {
+                _jump(self, ir_target(instr, 0));
+            }
+            break;
+
+        case CL_IR_BR:
+            _branch(self, value, next);
+            break;
+
+        case CL_IR_RET:
+            _emit(self, cl_abc(CL_OP_RET, r0, 0, 0));
+            break;
+
+        case CL_IR_RET0:
+            _emit(self, cl_abc(CL_OP_RET0, 0, 0, 0));
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+/**
+ * Whether an instruction is written out as code of its own.
+ */
+static bool _written(Lower *self, IrValue value) {
+    IrOp op = _op(self->fn, value);
+
+    return self->marked[value] && !self->fused[value] &&
+        op != CL_IR_PHI && op != CL_IR_PARAM &&
+        ((op != CL_IR_CONST && op != CL_IR_STRING) ||
+        self->index[value] != LOWER_NO_REG);
+}
+
+
+/**
+ * Where a block only jumps to, when it is a JMP whose phi moves
+ * all find their value in place already, or CL_IR_NO_BLOCK.
+ */
+static IrBlockId _through(Lower *self, IrBlockId b) {
+    IrFunction *fn = self->fn;
+    IrBlock *block = ir_block(fn, b);
+    IrInstr *jmp = ir_instr(fn, ir_terminator(fn, b));
+
+    if (jmp->op != CL_IR_JMP) {
+        return CL_IR_NO_BLOCK;
+    }
+
+    for (size_t i = 0; i + 1 < block->instrs.count; i++) {
+        if (_written(self, block->instrs.data[i])) {
+            return CL_IR_NO_BLOCK;
+        }
+    }
+
+    IrBlockId to = ir_target(jmp, 0);
+    IrBlock *target = ir_block(fn, to);
+    size_t index = ir_pred_index(fn, to, b);
+
+    for (size_t i = 0; i < target->instrs.count; i++) {
+        IrValue phi = target->instrs.data[i];
+        uint32_t n;
+
+        if (_op(fn, phi) != CL_IR_PHI) {
+            break;
+        }
+
+        IrValue arg = ir_operands(fn, phi, &n)[index];
+
+        if (self->index[phi] != LOWER_NO_REG && (_is_direct(fn, arg) ||
+            _reg(self, arg) != _reg(self, phi))) {
+            return CL_IR_NO_BLOCK;
+        }
+    }
+
+    return to;
+}
+
+
+static bool _write(Lower *self) {
+    IrFunction *fn = self->fn;
+    size_t count = fn->layout.count;
+
+    self->block_pc = calloc(fn->blocks.count, sizeof(uint32_t));
+
+    /* the block a block runs into, past the ones that write nothing */
+    IrBlockId *into = malloc((count + 1) * sizeof(IrBlockId));
+
+    if (!self->block_pc || !into) {
+        free(into);
+        return _failed(self);
+    }
+
+    into[count] = CL_IR_NO_BLOCK;
+
+    for (size_t l = count; l > 0; l--) {
+        IrBlockId b = fn->layout.data[l - 1];
+
+        into[l - 1] = (into[l] != CL_IR_NO_BLOCK &&
+            _through(self, b) == into[l]) ? into[l] : b;
+    }
+
+    for (size_t l = 0; l < count && !self->failed; l++) {
+        IrBlockId b = fn->layout.data[l];
+        IrBlock *block = ir_block(fn, b);
+        IrBlockId next = into[l + 1];
+
+        self->block_pc[b] = (uint32_t)self->code.count;
+
+        for (size_t i = 0; i < block->instrs.count; i++) {
+            if (_written(self, block->instrs.data[i])) {
+                _instr(self, block->instrs.data[i], b, next);
+            }
+        }
+    }
+
+    free(into);
+
+    for (size_t i = 0; i < self->jumps.count; i++) {
+        Jump *jump = &self->jumps.data[i];
+        int32_t offset = (int32_t)self->block_pc[jump->to] -
+            (int32_t)(jump->pc + 1);
+
+        self->code.data[jump->pc] = cl_sj(CL_OP_JMP, offset);
+    }
+
+    /* what falls off the end is a return nothing takes */
+    Opcode last = self->code.count
+        ? CL_OP(self->code.data[self->code.count - 1]) : CL_OP_JMP;
+
+    if (last != CL_OP_RET && last != CL_OP_RET0 && last != CL_OP_JMP) {
+        _emit(self, cl_abc(CL_OP_RET0, 0, 0, 0));
+    }
+
+    return !self->failed;
+}
+
+
+/**
+ * Turns a function back into bytecode, a BytecodeFunction with
+ * its constants and code in a new block of `*size` bytes at
+ * `*code`, which the caller frees. Fails when the function
+ * needs more registers or constants than bytecode has, or
+ * memory runs out, leaving the function changed.
+ */
+bool ir_lower(IrFunction *self, uint8_t **code, size_t *size) {
+    Lower lower = { .fn = self };
+    bool ok = _split_edges(&lower) && _order(&lower) && _select(&lower) &&
+        _liveness(&lower) && _coalesce(&lower) && _color(&lower) &&
+        _write(&lower) && !self->failed;
+
+    if (ok) {
+        BytecodeFunction header = {
+            .code_count = (uint32_t)lower.code.count,
+            .constant_count = (uint32_t)lower.constants.count,
+            .register_count = (uint16_t)(lower.registers
+                ? lower.registers : 1),
+            .param_count = (uint8_t)self->param_count,
+            .flags = self->flags,
+            .frame_size = self->frame_size,
+        };
+        size_t constants = lower.constants.count * sizeof(Constant);
+        size_t bytes = lower.code.count * sizeof(Instruction);
+
+        *size = sizeof(header) + constants + bytes;
+        *code = malloc(*size);
+        ok = *code != NULL;
+
+        if (ok) {
+            memcpy(*code, &header, sizeof(header));
+
+            if (constants > 0) {
+                memcpy(*code + sizeof(header), lower.constants.data,
+                    constants);
+            }
+
+            memcpy(*code + sizeof(header) + constants, lower.code.data,
+                bytes);
+        }
+    }
+
+    free(lower.marked);
+    free(lower.fused);
+    free(lower.uses);
+    free(lower.index);
+    ir_value_vector_free(&lower.values);
+    free(lower.live_in);
+    free(lower.live);
+    free(lower.graph);
+    free(lower.across);
+    free(lower.parent);
+    free(lower.next);
+    free(lower.color);
+    free(lower.bases);
+    instruction_vector_free(&lower.code);
+    constant_vector_free(&lower.constants);
+    jump_vector_free(&lower.jumps);
+    free(lower.block_pc);
+
+    return ok;
+}
@@ -0,0 +1,246 @@
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+
+#include "cl-number.h"
+#include "cl-pow10-table.h"
+
+
+/* literals longer than this are copied to the heap for strtod */
+#define CL_NUMBER_STACK_COPY    128
+
+
+/* the powers of ten a double holds exactly */
+static const double EXACT_POW10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+
+const uint32_t CL_DIGIT_POW10[9] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+};
+
+
+/* 10^(19 - run): below it, run more digits stay below 10^19 */
+const uint64_t CL_DIGIT_LIMITS[9] = {
+    10000000000000000000ULL, 1000000000000000000ULL, 100000000000000000ULL,
+    10000000000000000ULL, 1000000000000000ULL, 100000000000000ULL,
+    10000000000000ULL, 1000000000000ULL, 100000000000ULL,
+};
+
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+
+const uint8_t CL_HEX_VALUES[256] = {
+    [0 ... 255] = 0xFF,
+    ['0'] = 0,  ['1'] = 1,  ['2'] = 2,  ['3'] = 3,  ['4'] = 4,
+    ['5'] = 5,  ['6'] = 6,  ['7'] = 7,  ['8'] = 8,  ['9'] = 9,
+    ['a'] = 10, ['b'] = 11, ['c'] = 12, ['d'] = 13, ['e'] = 14, ['f'] = 15,
+    ['A'] = 10, ['B'] = 11, ['C'] = 12, ['D'] = 13, ['E'] = 14, ['F'] = 15,
+};
+
+#pragma GCC diagnostic pop
+
+
+static __Inline uint64_t _mul_high(uint64_t a, uint64_t b, uint64_t *low) {
+    __uint128_t product = (__uint128_t)a * b;
+
+    *low = (uint64_t)product;
+
+    return (uint64_t)(product >> 64);
+}
+
+
+/**
+ * Converts mantissa * 10^exp10 to the nearest double, with a
+ * single exact operation when it can, otherwise with the
+ * Eisel-Lemire algorithm: one or two 64x128 bit products with
+ * a precomputed power of ten. Returns false for the few inputs
+ * it cannot round with certainty, for results that would be
+ * subnormal or infinite, and for out of range exponents; the
+ * caller then falls back to cl_parse_double.
+ */
+bool cl_decimal_to_double(uint64_t mantissa, int64_t exp10, double *out) {
+    if (mantissa == 0) {
+        *out = 0.0;
+        return true;
+    }
+
+#if FLT_EVAL_METHOD == 0
+    /*
+     * Both operands are exact, so the one rounding of the
+     * division or multiplication gives the right result. This
+     * covers most literals, like 0.5 or 3.14.
+     */
+    if (mantissa <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22) {
+        double value = (double)mantissa;
+
+        *out = (exp10 < 0) ? value / EXACT_POW10[-exp10]
+                           : value * EXACT_POW10[exp10];
+        return true;
+    }
+#endif
+
+    if (exp10 < CL_POW10_MIN_EXP || exp10 > CL_POW10_MAX_EXP) {
+        return false;
+    }
+
+    const uint64_t *pow10 = CL_POW10_TABLE[exp10 - CL_POW10_MIN_EXP];
+    uint32_t clz = (uint32_t)__builtin_clzll(mantissa);
+
+    mantissa <<= clz;
+
+    /* floor(log2(10) * exp10) + 64 + bias, less the normalization */
+    uint64_t exp2 = (uint64_t)(((217706 * exp10) >> 16) + 64 + 1023) - clz;
+
+    uint64_t low;
+    uint64_t high = _mul_high(mantissa, pow10[0], &low);
+
+    /* the 64 bit product may be off by one in the rounding bits */
+    if ((high & 0x1FF) == 0x1FF && low + mantissa < mantissa) {
+        uint64_t extra_low;
+        uint64_t extra_high = _mul_high(mantissa, pow10[1], &extra_low);
+        uint64_t merged_high = high;
+        uint64_t merged_low = low + extra_high;
+
+        if (merged_low < low) {
+            merged_high++;
+        }
+
+        if ((merged_high & 0x1FF) == 0x1FF && merged_low + 1 == 0 &&
+            extra_low + mantissa < mantissa) {
+            return false;
+        }
+
+        high = merged_high;
+        low = merged_low;
+    }
+
+    uint64_t msb = high >> 63;
+    uint64_t result = high >> (msb + 9);
+
+    exp2 -= 1 ^ msb;
+
+    /* exactly halfway between two doubles */
+    if (low == 0 && (high & 0x1FF) == 0 && (result & 3) == 1) {
+        return false;
+    }
+
+    result += result & 1;
+    result >>= 1;
+
+    if (result >> 53) {
+        result >>= 1;
+        exp2++;
+    }
+
+    /* subnormal, infinite or NaN */
+    if (exp2 - 1 >= 0x7FF - 1) {
+        return false;
+    }
+
+    uint64_t bits = (exp2 << 52) | (result & 0x000FFFFFFFFFFFFFULL);
+
+    memcpy(out, &bits, sizeof(*out));
+
+    return true;
+}
+
+
+/**
+ * The slow path: converts `length` bytes of a decimal literal,
+ * which need not be NUL terminated, with strtod.
+ */
+double cl_parse_double(const char *text, size_t length) {
+    char stack[CL_NUMBER_STACK_COPY];
+    char *copy = length < sizeof(stack) ? stack : malloc(length + 1);
+
+    if (!copy) {
+        return 0.0;
+    }
+
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+
+    double value = strtod(copy, NULL);
+
+    if (copy != stack) {
+        free(copy);
+    }
+
+    return value;
+}
+
+
+/**
+ * Converts a float literal that was read as mantissa * 10^exp10.
+ * A `truncated` mantissa lost digits that did not fit; the value
+ * then lies between mantissa and mantissa + 1, and when both
+ * round to the same double so does the literal. Anything else
+ * goes to strtod with the `length` bytes of `text`.
+ */
+double cl_make_double(uint64_t mantissa, int64_t exp10, bool truncated,
+    const char *text, size_t length) {
+    double value, above;
+
+    if (!cl_decimal_to_double(mantissa, exp10, &value)) {
+        return cl_parse_double(text, length);
+    }
+
+    if (truncated && (mantissa == UINT64_MAX ||
+        !cl_decimal_to_double(mantissa + 1, exp10, &above) || above != value)) {
+        return cl_parse_double(text, length);
+    }
+
+    return value;
+}
+
+
+/**
+ * Converts the `length` bytes of a float literal, digits, a
+ * period and digits, followed by a byte that is no digit.
+ */
+double cl_float_value(const char *text, size_t length) {
+    uint64_t mantissa = 0;
+    uint32_t dropped = 0;
+    uint32_t whole = cl_scan_decimal(text, length, &mantissa, &dropped);
+    uint32_t whole_dropped = dropped;
+    uint32_t fraction = cl_scan_decimal(text + whole + 1,
+        length - whole - 1, &mantissa, &dropped);
+
+    /* left out digits of the whole part scale the mantissa up */
+    uint32_t kept = fraction - (dropped - whole_dropped);
+    int64_t exp10 = (int64_t)whole_dropped - kept;
+
+    return cl_make_double(mantissa, exp10, dropped != 0, text, length);
+}
+
+
+/**
+ * Decodes the value of a number token from the `length` bytes
+ * of its text, which the lexer accepted, so it fits. The text
+ * is followed by a byte that is no digit, as in a source.
+ */
+Literal cl_number_value(TokenType type, const char *text, size_t length) {
+    uint64_t value = 0;
+    uint32_t dropped = 0;
+    bool overflow = false;
+
+    switch (type) {
+        case TK_FLOAT:
+            return (Literal){ .real = cl_float_value(text, length) };
+        case TK_HEX:
+            cl_scan_hex(text + 2, &value, &overflow);
+            break;
+        case TK_BIN:
+            cl_scan_bin(text + 2, length - 2, &value, &overflow);
+            break;
+        default:
+            cl_scan_decimal(text, length, &value, &dropped);
+            break;
+    }
+
+    return (Literal){ .integer = value };
+}
@@ -0,0 +1,541 @@
+#define CL_LOG_SCOPE "object"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cl-log.h"
+#include "cl-vector.h"
+#include "cl-object.h"
+
+
+_Static_assert(sizeof(ObjectHeader) == 64, "object headers are 64 bytes");
+_Static_assert(sizeof(ObjectSection) == 32, "sections are 32 bytes");
+_Static_assert(sizeof(ObjectSymbol) == 32, "symbols are 32 bytes");
+
+
+#define OBJECT_CODE_ALIGN       16
+#define OBJECT_CONSTANT_ALIGN   8
+
+
+static const str_t SECTION_NAMES[] = {
+    [CL_OBJECT_SECTION_NONE]      = "none",
+    [CL_OBJECT_SECTION_STRINGS]   = "strings",
+    [CL_OBJECT_SECTION_SYMBOLS]   = "symbols",
+    [CL_OBJECT_SECTION_CODE]      = "code",
+    [CL_OBJECT_SECTION_CONSTANTS] = "constants",
+};
+
+
+static const str_t SYMBOL_KINDS[] = {
+    [CL_OBJECT_SYM_FN]     = "fn",
+    [CL_OBJECT_SYM_VAR]    = "var",
+    [CL_OBJECT_SYM_CONST]  = "const",
+    [CL_OBJECT_SYM_STRUCT] = "struct",
+    [CL_OBJECT_SYM_ENUM]   = "enum",
+};
+
+
+str_t object_section_name(uint32_t kind) {
+    return (kind < __CL_OBJECT_SECTION_MAX) ? SECTION_NAMES[kind] : "?";
+}
+
+
+str_t object_symbol_kind(uint32_t kind) {
+    return (kind < __CL_OBJECT_SYM_MAX) ? SYMBOL_KINDS[kind] : "?";
+}
+
+
+static __Inline size_t _align(size_t offset, size_t align) {
+    return (offset + align - 1) & ~(align - 1);
+}
+
+
+/* == writer == */
+
+
+CL_TYPE(ObjectBuffer) {
+    uint8_t *data;
+    size_t   size;
+    size_t   capacity;
+};
+
+CL_VECTOR_DEFINE(ObjectSymbol, object_symbol)
+
+
+struct __CL_TNAME(ObjectWriter) {
+    ObjectBuffer       strings;
+    ObjectBuffer       code;
+    ObjectBuffer       constants;
+    ObjectSymbolVector symbols;
+    uint32_t           entry;
+    bool               failed;
+};
+
+
+/**
+ * Appends `size` bytes at the next multiple of `align` and
+ * returns where they went.
+ */
+static size_t _append(ObjectWriter *self, ObjectBuffer *buffer,
+    const void *data, size_t size, size_t align) {
+    size_t offset = _align(buffer->size, align);
+
+    if (offset + size > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 256;
+
+        while (capacity < offset + size) {
+            capacity *= 2;
+        }
+
+        uint8_t *grown = realloc(buffer->data, capacity);
+
+        if (!grown) {
+            cl_debug("%s: %s\n", __func__, strerror(errno));
+            self->failed = true;
+            return 0;
+        }
+
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+
+    memset(&buffer->data[buffer->size], 0, offset - buffer->size);
+    memcpy(&buffer->data[offset], data, size);
+    buffer->size = offset + size;
+
+    return offset;
+}
+
+
+ObjectWriter *object_writer_new(void) {
+    ObjectWriter *new_writer = calloc(1, sizeof(ObjectWriter));
+
+    if (!new_writer) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    new_writer->entry = CL_OBJECT_NO_ENTRY;
+
+    /* offset 0 is the empty name */
+    _append(new_writer, &new_writer->strings, "", 1, 1);
+
+    if (new_writer->failed) {
+        free(new_writer);
+        return NULL;
+    }
+
+    return new_writer;
+}
+
+
+/**
+ * Adds a name to the string table and returns its offset.
+ */
+uint32_t object_writer_string(ObjectWriter *self, const char *str,
+    size_t length) {
+    size_t offset = self->strings.size;
+
+    _append(self, &self->strings, str, length, 1);
+    _append(self, &self->strings, "", 1, 1);
+
+    return (uint32_t)offset;
+}
+
+
+uint64_t object_writer_code(ObjectWriter *self, const void *data,
+    size_t size) {
+    return _append(self, &self->code, data, size, OBJECT_CODE_ALIGN);
+}
+
+
+/**
+ * Adds a constant, aligned to its size up to 8 bytes.
+ */
+uint64_t object_writer_constant(ObjectWriter *self, const void *data,
+    size_t size) {
+    size_t align = 1;
+
+    while (align < size && align < OBJECT_CONSTANT_ALIGN) {
+        align *= 2;
+    }
+
+    return _append(self, &self->constants, data, size, align);
+}
+
+
+/**
+ * Adds a symbol and returns its index.
+ */
+uint32_t object_writer_symbol(ObjectWriter *self, ObjectSymbol symbol) {
+    if (!object_symbol_vector_push(&self->symbols, symbol)) {
+        self->failed = true;
+        return 0;
+    }
+
+    return (uint32_t)self->symbols.count - 1;
+}
+
+
+void object_writer_set_entry(ObjectWriter *self, uint32_t symbol) {
+    self->entry = symbol;
+}
+
+
+static bool _write_all(int fd, const uint8_t *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return false;
+        }
+
+        data += written;
+        size -= (size_t)written;
+    }
+
+    return true;
+}
+
+
+/**
+ * Lays the object out in one buffer and writes it to a new
+ * file that then replaces `path`, so a reader never maps half
+ * an object.
+ */
+bool object_writer_write(ObjectWriter *self, str_t path) {
+    if (self->failed || self->strings.size > UINT32_MAX) {
+        cl_error("out of memory!\n");
+        return false;
+    }
+
+    ObjectSection sections[__CL_OBJECT_SECTION_MAX] = {
+        [CL_OBJECT_SECTION_NONE] = {
+            .align = 1,
+        },
+        [CL_OBJECT_SECTION_STRINGS] = {
+            .size = self->strings.size,
+            .align = 1,
+        },
+        [CL_OBJECT_SECTION_SYMBOLS] = {
+            .size = self->symbols.count * sizeof(ObjectSymbol),
+            .align = _Alignof(ObjectSymbol),
+            .entry_size = sizeof(ObjectSymbol),
+        },
+        [CL_OBJECT_SECTION_CODE] = {
+            .size = self->code.size,
+            .align = OBJECT_CODE_ALIGN,
+        },
+        [CL_OBJECT_SECTION_CONSTANTS] = {
+            .size = self->constants.size,
+            .align = OBJECT_CONSTANT_ALIGN,
+        },
+    };
+    const void *contents[__CL_OBJECT_SECTION_MAX] = {
+        [CL_OBJECT_SECTION_STRINGS] = self->strings.data,
+        [CL_OBJECT_SECTION_SYMBOLS] = self->symbols.data,
+        [CL_OBJECT_SECTION_CODE] = self->code.data,
+        [CL_OBJECT_SECTION_CONSTANTS] = self->constants.data,
+    };
+    size_t size = sizeof(ObjectHeader) + sizeof(sections);
+
+    for (uint32_t i = 0; i < __CL_OBJECT_SECTION_MAX; i++) {
+        sections[i].kind = i;
+
+        if (i != CL_OBJECT_SECTION_NONE) {
+            sections[i].offset = _align(size, sections[i].align);
+            size = sections[i].offset + sections[i].size;
+        }
+    }
+
+    ObjectHeader header = {
+        .magic = CL_OBJECT_MAGIC,
+        .format_major = CL_OBJECT_FORMAT_MAJOR,
+        .format_minor = CL_OBJECT_FORMAT_MINOR,
+        .version = CL_VERSION,
+        .file_size = size,
+        .section_count = __CL_OBJECT_SECTION_MAX,
+        .section_offset = sizeof(ObjectHeader),
+        .entry = self->entry,
+    };
+    uint8_t *image = calloc(1, size);
+
+    if (!image) {
+        cl_error("out of memory!\n");
+        return false;
+    }
+
+    memcpy(image, &header, sizeof(header));
+    memcpy(&image[sizeof(header)], sections, sizeof(sections));
+
+    for (uint32_t i = 1; i < __CL_OBJECT_SECTION_MAX; i++) {
+        if (sections[i].size > 0) {
+            memcpy(&image[sections[i].offset], contents[i], sections[i].size);
+        }
+    }
+
+    size_t length = strlen(path) + sizeof(".XXXXXX");
+    char *temp = malloc(length);
+    int fd = -1;
+
+    if (temp) {
+        snprintf(temp, length, "%s.XXXXXX", path);
+        fd = mkstemp(temp);
+    }
+
+    bool written = fd >= 0 && _write_all(fd, image, size);
+
+    if (fd >= 0) {
+        written &= (close(fd) == 0);
+        written = written && fchmodat(AT_FDCWD, temp, 0644, 0) == 0 &&
+            rename(temp, path) == 0;
+
+        if (!written) {
+            unlink(temp);
+        }
+    }
+
+    if (!written) {
+        cl_error("%s: %s\n", path, strerror(errno));
+    }
+
+    free(temp);
+    free(image);
+
+    return written;
+}
+
+
+void object_writer_free(ObjectWriter *self) {
+    free(self->strings.data);
+    free(self->code.data);
+    free(self->constants.data);
+    object_symbol_vector_free(&self->symbols);
+    free(self);
+}
+
+
+/* == loader == */
+
+
+static bool _invalid(str_t path, str_t reason) {
+    cl_error("%s: %s\n", path, reason);
+    return false;
+}
+
+
+/**
+ * Checks the section table and finds the sections this reader
+ * knows. Unknown kinds are skipped, known ones must be unique.
+ */
+static bool _check_sections(ObjectFile *self, str_t path) {
+    const uint8_t *base = self->map;
+
+    for (size_t i = 0; i < self->section_count; i++) {
+        const ObjectSection *section = &self->sections[i];
+        uint32_t align = section->align;
+
+        if (section->offset > self->map_size ||
+            section->size > self->map_size - section->offset ||
+            align == 0 || (align & (align - 1)) != 0 ||
+            section->offset % align != 0) {
+            return _invalid(path, "malformed section table");
+        }
+
+        if ((i == 0) != (section->kind == CL_OBJECT_SECTION_NONE)) {
+            return _invalid(path, "malformed section table");
+        }
+
+        const uint8_t *data = &base[section->offset];
+        size_t size = section->size;
+        bool twice = false;
+
+        switch (section->kind) {
+            case CL_OBJECT_SECTION_STRINGS:
+                twice = (self->strings != NULL);
+                self->strings = (const char *)data;
+                self->strings_size = size;
+                break;
+            case CL_OBJECT_SECTION_SYMBOLS:
+                if (section->entry_size != sizeof(ObjectSymbol) ||
+                    size % sizeof(ObjectSymbol) != 0 ||
+                    align < _Alignof(ObjectSymbol)) {
+                    return _invalid(path, "malformed symbol table");
+                }
+
+                twice = (self->symbols != NULL);
+                self->symbols = (const ObjectSymbol *)data;
+                self->symbol_count = size / sizeof(ObjectSymbol);
+                break;
+            case CL_OBJECT_SECTION_CODE:
+                twice = (self->code != NULL);
+                self->code = data;
+                self->code_size = size;
+                break;
+            case CL_OBJECT_SECTION_CONSTANTS:
+                if (align < OBJECT_CONSTANT_ALIGN) {
+                    return _invalid(path, "misaligned constants");
+                }
+
+                twice = (self->constants != NULL);
+                self->constants = data;
+                self->constants_size = size;
+                break;
+            default:
+                break;
+        }
+
+        if (twice) {
+            return _invalid(path, "section appears twice");
+        }
+    }
+
+    if (!self->strings || self->strings_size == 0 ||
+        self->strings[0] != '\0' ||
+        self->strings[self->strings_size - 1] != '\0') {
+        return _invalid(path, "malformed string table");
+    }
+
+    return true;
+}
+
+
+static bool _check_symbols(ObjectFile *self, str_t path) {
+    for (size_t i = 0; i < self->symbol_count; i++) {
+        const ObjectSymbol *symbol = &self->symbols[i];
+
+        if (symbol->name >= self->strings_size ||
+            symbol->file >= self->strings_size ||
+            symbol->kind >= __CL_OBJECT_SYM_MAX ||
+            symbol->section >= self->section_count) {
+            return _invalid(path, "malformed symbol");
+        }
+
+        const ObjectSection *section = &self->sections[symbol->section];
+
+        if (symbol->value > section->size ||
+            symbol->size > section->size - symbol->value) {
+            return _invalid(path, "symbol data out of its section");
+        }
+    }
+
+    uint32_t entry = self->header->entry;
+
+    if (entry != CL_OBJECT_NO_ENTRY && entry >= self->symbol_count) {
+        return _invalid(path, "malformed entry point");
+    }
+
+    return true;
+}
+
+
+/**
+ * Maps an object and checks everything the fields of ObjectFile
+ * lead to, so users can follow them without checks of their
+ * own. Reports why an object cannot be used.
+ */
+ObjectFile *object_open(str_t path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        cl_error("%s: %s\n", path, strerror(errno));
+
+        if (fd >= 0) {
+            close(fd);
+        }
+
+        return NULL;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void *map = (size >= sizeof(ObjectHeader))
+        ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        cl_error("%s: not a clover object\n", path);
+        return NULL;
+    }
+
+    ObjectFile *self = calloc(1, sizeof(ObjectFile));
+
+    if (!self) {
+        cl_error("out of memory!\n");
+        munmap(map, size);
+        return NULL;
+    }
+
+    const ObjectHeader *header = map;
+
+    self->header = header;
+    self->map = map;
+    self->map_size = size;
+
+    bool valid;
+
+    if (memcmp(header->magic, CL_OBJECT_MAGIC, 4) != 0) {
+        valid = _invalid(path, "not a clover object");
+    } else if (header->format_major != CL_OBJECT_FORMAT_MAJOR) {
+        cl_error("%s: unsupported object format %u.%u\n", path,
+            header->format_major, header->format_minor);
+        valid = false;
+    } else if (header->file_size != size ||
+               header->section_offset % _Alignof(ObjectSection) != 0 ||
+               header->section_offset < sizeof(ObjectHeader) ||
+               header->section_count == 0 ||
+               header->section_offset > size ||
+               header->section_count >
+                   (size - header->section_offset) / sizeof(ObjectSection)) {
+        valid = _invalid(path, "truncated object");
+    } else {
+        self->sections = (const ObjectSection *)
+            ((const uint8_t *)map + header->section_offset);
+        self->section_count = header->section_count;
+
+        valid = _check_sections(self, path) && _check_symbols(self, path);
+    }
+
+    if (!valid) {
+        object_close(self);
+        return NULL;
+    }
+
+    return self;
+}
+
+
+str_t object_string(ObjectFile *self, uint32_t offset) {
+    return (offset < self->strings_size) ? &self->strings[offset] : "";
+}
+
+
+/**
+ * Returns the data of a symbol, NULL when it has none.
+ */
+const void *object_symbol_data(ObjectFile *self, const ObjectSymbol *symbol) {
+    if (symbol->section == CL_OBJECT_SECTION_NONE) {
+        return NULL;
+    }
+
+    const ObjectSection *section = &self->sections[symbol->section];
+
+    return (const uint8_t *)self->map + section->offset + symbol->value;
+}
+
+
+void object_close(ObjectFile *self) {
+    munmap(self->map, self->map_size);
+    free(self);
+}
@@ -0,0 +1,1071 @@
+#define CL_LOG_SCOPE "parser"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cl-log.h"
+#include "cl-types.h"
+#include "cl-lexer.h"
+#include "cl-vector.h"
+#include "cl-diagnostic.h"
+#include "cl-parser.h"
+
+
+#define CL_PARSER_SCRATCH_INLINE    64
+
+/* longest token text quoted in a diagnostic */
+#define CL_PARSER_QUOTE_MAX         32
+
+/* the kind of the token past the last one */
+#define PARSER_EOF                  UINT8_MAX
+
+
+CL_VECTOR_DEFINE_SMALL(AstIndex, ast_index, CL_PARSER_SCRATCH_INLINE)
+
+
+/**
+ * `scratch` collects the children of the lists being parsed,
+ * nested lists on top of the outer ones, until a list is done
+ * and moves to `extra`.
+ */
+CL_TYPE(Parser) {
+    Source      *src;
+    TokenStream *tokens;
+    Ast         *ast;
+
+    uint32_t pos;
+    uint32_t count;
+    uint32_t depth;
+
+    bool failed;
+
+    AstIndexVector scratch;
+};
+
+
+/**
+ * Binding powers, from the loosest to the tightest. Prefix
+ * operators bind tighter than any infix one, and calls,
+ * indexing and field access tighter still.
+ */
+CL_ENUM(Precedence) {
+    PREC_NONE,
+    PREC_ASSIGN,        /* = */
+    PREC_TERNARY,       /* ? : */
+    PREC_OR,            /* || */
+    PREC_AND,           /* && */
+    PREC_BIT_OR,        /* | */
+    PREC_BIT_XOR,       /* ^ */
+    PREC_BIT_AND,       /* & */
+    PREC_EQUALITY,      /* == != */
+    PREC_COMPARISON,    /* < > <= >= */
+    PREC_SHIFT,         /* << >> */
+    PREC_SUM,           /* + - */
+    PREC_PRODUCT,       /* * / % */
+    PREC_CAST,          /* as */
+    PREC_PREFIX,        /* - ! ~ */
+    PREC_POSTFIX,       /* () [] . */
+};
+
+
+/* the binding power of every token that can follow an operand */
+static const uint8_t PRECEDENCE[UINT8_MAX + 1] = {
+    [OP_ASSIGN]        = PREC_ASSIGN,
+    [SYM_QUESTIONMARK] = PREC_TERNARY,
+    [OP_OR]            = PREC_OR,
+    [OP_AND]           = PREC_AND,
+    [OP_BIT_OR]        = PREC_BIT_OR,
+    [OP_BIT_XOR]       = PREC_BIT_XOR,
+    [OP_BIT_AND]       = PREC_BIT_AND,
+    [OP_EQ]            = PREC_EQUALITY,
+    [OP_NE]            = PREC_EQUALITY,
+    [OP_LT]            = PREC_COMPARISON,
+    [OP_GT]            = PREC_COMPARISON,
+    [OP_LE]            = PREC_COMPARISON,
+    [OP_GE]            = PREC_COMPARISON,
+    [OP_BIT_SHL]       = PREC_SHIFT,
+    [OP_BIT_SHR]       = PREC_SHIFT,
+    [OP_PLUS]          = PREC_SUM,
+    [OP_MINUS]         = PREC_SUM,
+    [OP_MULTIPLY]      = PREC_PRODUCT,
+    [OP_DIVIDE]        = PREC_PRODUCT,
+    [OP_REMAINDER]     = PREC_PRODUCT,
+    [KW_AS]            = PREC_CAST,
+    [SYM_LPARENTHESIS] = PREC_POSTFIX,
+    [SYM_LBRACKET]     = PREC_POSTFIX,
+    [SYM_PERIOD]       = PREC_POSTFIX,
+};
+
+
+typedef AstIndex (*ParseFn)(Parser *p);
+
+
+/* == tokens == */
+
+
+static __Inline uint8_t _peek(Parser *p) {
+    return (p->pos < p->count) ? p->tokens->kinds[p->pos] : PARSER_EOF;
+}
+
+
+static __Inline bool _check(Parser *p, TokenType type) {
+    return _peek(p) == type;
+}
+
+
+static __Inline bool _accept(Parser *p, TokenType type) {
+    if (!_check(p, type)) {
+        return false;
+    }
+
+    p->pos++;
+
+    return true;
+}
+
+
+/* == errors == */
+
+
+static DiagLocation _getloc(Parser *p) {
+    if (p->pos >= p->count) {
+        return (DiagLocation){ .offset = (uint32_t)p->src->length,
+                               .src = p->src };
+    }
+
+    return (DiagLocation){
+        .offset = p->tokens->offsets[p->pos],
+        .length = p->tokens->lengths[p->pos],
+        .caret = 0,
+        .src = p->src,
+    };
+}
+
+
+/**
+ * Reports what was expected at the current token, which is
+ * quoted when it is short.
+ */
+static AstIndex _expected(Parser *p, str_t what) {
+    uint8_t kind = _peek(p);
+
+    p->failed = true;
+
+    if (kind == PARSER_EOF) {
+        diag_error(_getloc(p), "expected %s, found end of file", what);
+        return CL_AST_NONE;
+    }
+
+    uint32_t length = p->tokens->lengths[p->pos];
+    sview_t text = source_get(p->src, p->tokens->offsets[p->pos]);
+
+    if (kind > TK_INT) {
+        diag_error(_getloc(p), "expected %s, found '%s'", what,
+            cl_token_name((TokenType)kind));
+    } else if (length <= CL_PARSER_QUOTE_MAX) {
+        diag_error(_getloc(p), "expected %s, found %s '%.*s'", what,
+            cl_token_name((TokenType)kind), (int)length, text);
+    } else {
+        diag_error(_getloc(p), "expected %s, found %s", what,
+            cl_token_name((TokenType)kind));
+    }
+
+    return CL_AST_NONE;
+}
+
+
+static AstIndex _out_of_memory(Parser *p) {
+    cl_error("out of memory!\n");
+    p->failed = true;
+
+    return CL_AST_NONE;
+}
+
+
+/**
+ * Consumes a token of the given kind, storing its index in
+ * `token` when not NULL, or reports it missing.
+ */
+static bool _expect(Parser *p, TokenType type, __Nullable uint32_t *token) {
+    if (_check(p, type)) {
+        if (token) {
+            *token = p->pos;
+        }
+
+        p->pos++;
+        return true;
+    }
+
+    if (type == TK_ID) {
+        _expected(p, "a name");
+    } else {
+        char what[16];
+
+        snprintf(what, sizeof(what), "'%s'", cl_token_name(type));
+        _expected(p, what);
+    }
+
+    return false;
+}
+
+
+/**
+ * Counts the nesting of statements, types and expressions, so
+ * that no input can exhaust the stack.
+ */
+static bool _enter(Parser *p) {
+    if (++p->depth <= CL_PARSER_MAX_DEPTH) {
+        return true;
+    }
+
+    p->failed = true;
+    diag_error(_getloc(p), "code is nested too deeply");
+
+    return false;
+}
+
+
+/* == nodes == */
+
+
+static AstIndex _node(Parser *p, AstKind kind, uint8_t flags, uint32_t token,
+    AstIndex lhs, AstIndex rhs) {
+    AstIndex index = ast_push(p->ast, (AstNode){
+        .kind = (uint8_t)kind,
+        .flags = flags,
+        .token = token,
+        .lhs = lhs,
+        .rhs = rhs,
+    });
+
+    if (index == CL_AST_NONE) {
+        return _out_of_memory(p);
+    }
+
+    return index;
+}
+
+
+/**
+ * Stores `count` indices in `extra` and gives where they start.
+ */
+static bool _extra(Parser *p, const AstIndex *items, size_t count,
+    AstIndex *at) {
+    size_t start = ast_push_extra(p->ast, items, count);
+
+    if (start == SIZE_MAX) {
+        _out_of_memory(p);
+        return false;
+    }
+
+    *at = (AstIndex)start;
+
+    return true;
+}
+
+
+static bool _scratch_push(Parser *p, AstIndex node) {
+    if (!ast_index_vector_push(&p->scratch, node)) {
+        _out_of_memory(p);
+        return false;
+    }
+
+    return true;
+}
+
+
+/**
+ * Moves the scratch items above `top` to `extra`, giving the
+ * range they end up in.
+ */
+static bool _scratch_pop(Parser *p, size_t top, AstIndex *start,
+    AstIndex *end) {
+    size_t count = p->scratch.count - top;
+    bool stored = _extra(p, &p->scratch.data[top], count, start);
+
+    p->scratch.count = top;
+    *end = *start + (AstIndex)count;
+
+    return stored;
+}
+
+
+/**
+ * Parses items separated by commas up to and including the
+ * `close` token, allowing a trailing comma.
+ */
+static bool _parse_list(Parser *p, TokenType close, ParseFn item,
+    AstIndex *start, AstIndex *end) {
+    size_t top = p->scratch.count;
+
+    while (!_check(p, close)) {
+        AstIndex node = item(p);
+
+        if (node == CL_AST_NONE || !_scratch_push(p, node)) {
+            p->scratch.count = top;
+            return false;
+        }
+
+        if (!_accept(p, SYM_COMMA)) {
+            break;
+        }
+    }
+
+    if (!_expect(p, close, NULL)) {
+        p->scratch.count = top;
+        return false;
+    }
+
+    return _scratch_pop(p, top, start, end);
+}
+
+
+/* == types == */
+
+
+static AstIndex parse_type(Parser *p);
+
+
+/**
+ * A name, or a name qualified by the modules it is in.
+ */
+static AstIndex parse_path(Parser *p) {
+    uint32_t name;
+
+    if (!_expect(p, TK_ID, &name)) {
+        return CL_AST_NONE;
+    }
+
+    AstIndex node = _node(p, AST_NAME, 0, name, CL_AST_NONE, CL_AST_NONE);
+
+    while (node != CL_AST_NONE && _accept(p, SYM_PERIOD)) {
+        if (!_expect(p, TK_ID, &name)) {
+            return CL_AST_NONE;
+        }
+
+        node = _node(p, AST_ACCESS, 0, name, node, CL_AST_NONE);
+    }
+
+    return node;
+}
+
+
+static AstIndex parse_expression(Parser *p);
+
+
+static AstIndex _parse_type(Parser *p) {
+    uint32_t token = p->pos;
+    AstIndex inner = CL_AST_NONE;
+    AstIndex length = CL_AST_NONE;
+
+    switch (_peek(p)) {
+        case SYM_QUESTIONMARK:
+            p->pos++;
+            inner = parse_type(p);
+
+            return inner ? _node(p, AST_TYPE_OPTIONAL, 0, token, inner,
+                                 CL_AST_NONE)
+                         : CL_AST_NONE;
+        case OP_MULTIPLY:
+            p->pos++;
+            inner = parse_type(p);
+
+            return inner ? _node(p, AST_TYPE_POINTER, 0, token, inner,
+                                 CL_AST_NONE)
+                         : CL_AST_NONE;
+        case SYM_LBRACKET:
+            p->pos++;
+
+            if (!_check(p, SYM_RBRACKET) &&
+                !(length = parse_expression(p))) {
+                return CL_AST_NONE;
+            }
+
+            if (!_expect(p, SYM_RBRACKET, NULL) || !(inner = parse_type(p))) {
+                return CL_AST_NONE;
+            }
+
+            return _node(p, AST_TYPE_ARRAY, 0, token, length, inner);
+        case TK_ID:
+            return parse_path(p);
+        default:
+            return _expected(p, "a type");
+    }
+}
+
+
+static AstIndex parse_type(Parser *p) {
+    AstIndex node = _enter(p) ? _parse_type(p) : CL_AST_NONE;
+
+    p->depth--;
+
+    return node;
+}
+
+
+/* == expressions == */
+
+
+static AstIndex parse_expr(Parser *p, Precedence min_prec);
+
+
+static AstIndex parse_expression(Parser *p) {
+    return parse_expr(p, PREC_ASSIGN);
+}
+
+
+static AstIndex parse_prefix(Parser *p) {
+    uint32_t token = p->pos;
+
+    switch (_peek(p)) {
+        case TK_ID:
+            p->pos++;
+            return _node(p, AST_NAME, 0, token, CL_AST_NONE, CL_AST_NONE);
+        case TK_STRING:
+        case TK_CHAR:
+        case TK_FLOAT:
+        case TK_BIN:
+        case TK_HEX:
+        case TK_INT:
+        case KW_TRUE:
+        case KW_FALSE:
+            p->pos++;
+            return _node(p, AST_LITERAL, 0, token, CL_AST_NONE, CL_AST_NONE);
+        case SYM_LPARENTHESIS: {
+            p->pos++;
+
+            AstIndex inner = parse_expression(p);
+
+            if (!inner || !_expect(p, SYM_RPARENTHESIS, NULL)) {
+                return CL_AST_NONE;
+            }
+
+            return inner;
+        }
+        case OP_MINUS:
+        case OP_NOT:
+        case OP_BIT_NOT: {
+            p->pos++;
+
+            AstIndex operand = parse_expr(p, PREC_PREFIX);
+
+            return operand ? _node(p, AST_UNARY, 0, token, operand,
+                                   CL_AST_NONE)
+                           : CL_AST_NONE;
+        }
+        default:
+            return _expected(p, "an expression");
+    }
+}
+
+
+/**
+ * Parses what follows an operand: `token` is the operator,
+ * already consumed, and `lhs` the operand before it.
+ */
+static AstIndex parse_infix(Parser *p, uint32_t token, AstIndex lhs) {
+    TokenType op = (TokenType)p->tokens->kinds[token];
+    Precedence prec = (Precedence)PRECEDENCE[op];
+    AstIndex rhs = CL_AST_NONE;
+    AstIndex pair[2];
+    AstIndex at;
+    uint32_t name;
+
+    switch (op) {
+        case SYM_LPARENTHESIS:
+            if (!_parse_list(p, SYM_RPARENTHESIS, parse_expression,
+                             &pair[0], &pair[1]) ||
+                !_extra(p, pair, 2, &at)) {
+                return CL_AST_NONE;
+            }
+
+            return _node(p, AST_CALL, 0, token, lhs, at);
+        case SYM_LBRACKET:
+            if (!(rhs = parse_expression(p)) ||
+                !_expect(p, SYM_RBRACKET, NULL)) {
+                return CL_AST_NONE;
+            }
+
+            return _node(p, AST_INDEX, 0, token, lhs, rhs);
+        case SYM_PERIOD:
+            if (!_expect(p, TK_ID, &name)) {
+                return CL_AST_NONE;
+            }
+
+            return _node(p, AST_ACCESS, 0, name, lhs, CL_AST_NONE);
+        case KW_AS:
+            if (!(rhs = parse_type(p))) {
+                return CL_AST_NONE;
+            }
+
+            return _node(p, AST_CAST, 0, token, lhs, rhs);
+        case SYM_QUESTIONMARK:
+            /* right associative: a ? b : c ? d : e */
+            if (!(pair[0] = parse_expr(p, PREC_TERNARY)) ||
+                !_expect(p, SYM_COLON, NULL) ||
+                !(pair[1] = parse_expr(p, PREC_TERNARY)) ||
+                !_extra(p, pair, 2, &at)) {
+                return CL_AST_NONE;
+            }
+
+            return _node(p, AST_TERNARY, 0, token, lhs, at);
+        case OP_ASSIGN:
+            /* right associative: a = b = c */
+            if (!(rhs = parse_expr(p, PREC_ASSIGN))) {
+                return CL_AST_NONE;
+            }
+
+            return _node(p, AST_ASSIGN, 0, token, lhs, rhs);
+        default:
+            if (!(rhs = parse_expr(p, prec + 1))) {
+                return CL_AST_NONE;
+            }
+
+            return _node(p, AST_BINARY, 0, token, lhs, rhs);
+    }
+}
+
+
+/**
+ * Pratt parsing: an operand, then as long as the next token
+ * binds at least as tightly as `min_prec`, the operator and
+ * what follows it. Left associative operators parse their
+ * right side one level tighter, so `a - b - c` groups to the
+ * left.
+ */
+static AstIndex _parse_expr(Parser *p, Precedence min_prec) {
+    AstIndex lhs = parse_prefix(p);
+
+    while (lhs != CL_AST_NONE) {
+        Precedence prec = (Precedence)PRECEDENCE[_peek(p)];
+
+        if (prec == PREC_NONE || prec < min_prec) {
+            break;
+        }
+
+        lhs = parse_infix(p, p->pos++, lhs);
+    }
+
+    return lhs;
+}
+
+
+static AstIndex parse_expr(Parser *p, Precedence min_prec) {
+    AstIndex node = _enter(p) ? _parse_expr(p, min_prec) : CL_AST_NONE;
+
+    p->depth--;
+
+    return node;
+}
+
+
+/* == statements == */
+
+
+static AstIndex parse_statement(Parser *p);
+
+
+static AstIndex _end_statement(Parser *p, AstIndex node) {
+    return (node && _expect(p, SYM_SEMICOLON, NULL)) ? node : CL_AST_NONE;
+}
+
+
+static AstIndex parse_block(Parser *p) {
+    uint32_t token;
+
+    if (!_expect(p, SYM_LBRACE, &token)) {
+        return CL_AST_NONE;
+    }
+
+    size_t top = p->scratch.count;
+
+    while (!_check(p, SYM_RBRACE) && _peek(p) != PARSER_EOF) {
+        AstIndex stmt = parse_statement(p);
+
+        if (stmt == CL_AST_NONE || !_scratch_push(p, stmt)) {
+            p->scratch.count = top;
+            return CL_AST_NONE;
+        }
+    }
+
+    AstIndex start, end;
+
+    if (!_expect(p, SYM_RBRACE, NULL)) {
+        p->scratch.count = top;
+        return CL_AST_NONE;
+    }
+
+    if (!_scratch_pop(p, top, &start, &end)) {
+        return CL_AST_NONE;
+    }
+
+    return _node(p, AST_BLOCK, 0, token, start, end);
+}
+
+
+/**
+ * var or const, with a type, a value or both, but without
+ * the semicolon.
+ */
+static AstIndex parse_var(Parser *p, uint8_t flags) {
+    AstKind kind = _check(p, KW_CONST) ? AST_CONST : AST_VAR;
+    AstIndex type = CL_AST_NONE;
+    AstIndex value = CL_AST_NONE;
+    uint32_t name;
+
+    p->pos++;
+
+    if (!_expect(p, TK_ID, &name)) {
+        return CL_AST_NONE;
+    }
+
+    if (_accept(p, SYM_COLON) && !(type = parse_type(p))) {
+        return CL_AST_NONE;
+    }
+
+    if (_accept(p, OP_ASSIGN) && !(value = parse_expression(p))) {
+        return CL_AST_NONE;
+    }
+
+    return _node(p, kind, flags, name, type, value);
+}
+
+
+static AstIndex parse_if(Parser *p) {
+    uint32_t token = p->pos++;
+    AstIndex branches[2] = { CL_AST_NONE, CL_AST_NONE };
+    AstIndex condition, at;
+
+    if (!(condition = parse_expression(p)) ||
+        !(branches[0] = parse_block(p))) {
+        return CL_AST_NONE;
+    }
+
+    /* else if goes through parse_statement to count the depth */
+    if (_accept(p, KW_ELSE)) {
+        branches[1] = _check(p, KW_IF) ? parse_statement(p) : parse_block(p);
+
+        if (!branches[1]) {
+            return CL_AST_NONE;
+        }
+    }
+
+    if (!_extra(p, branches, 2, &at)) {
+        return CL_AST_NONE;
+    }
+
+    return _node(p, AST_IF, 0, token, condition, at);
+}
+
+
+static AstIndex parse_simple(Parser *p) {
+    if (_check(p, KW_VAR) || _check(p, KW_CONST)) {
+        return parse_var(p, 0);
+    }
+
+    return parse_expression(p);
+}
+
+
+/**
+ * `for init; condition; step { }` with any part left out,
+ * `for condition { }` and `for { }`.
+ */
+static AstIndex parse_for(Parser *p) {
+    uint32_t token = p->pos++;
+    AstIndex parts[3] = { CL_AST_NONE, CL_AST_NONE, CL_AST_NONE };
+    AstIndex body, at;
+
+    if (!_check(p, SYM_LBRACE)) {
+        if (!_check(p, SYM_SEMICOLON) && !(parts[0] = parse_simple(p))) {
+            return CL_AST_NONE;
+        }
+
+        if (_accept(p, SYM_SEMICOLON)) {
+            if (!_check(p, SYM_SEMICOLON) &&
+                !(parts[1] = parse_expression(p))) {
+                return CL_AST_NONE;
+            }
+
+            if (!_expect(p, SYM_SEMICOLON, NULL)) {
+                return CL_AST_NONE;
+            }
+
+            if (!_check(p, SYM_LBRACE) && !(parts[2] = parse_simple(p))) {
+                return CL_AST_NONE;
+            }
+        } else {
+            AstKind kind = (AstKind)p->ast->nodes[parts[0]].kind;
+
+            if (kind == AST_VAR || kind == AST_CONST) {
+                return _expected(p, "';'");
+            }
+
+            parts[1] = parts[0];
+            parts[0] = CL_AST_NONE;
+        }
+    }
+
+    if (!(body = parse_block(p)) || !_extra(p, parts, 3, &at)) {
+        return CL_AST_NONE;
+    }
+
+    return _node(p, AST_FOR, 0, token, at, body);
+}
+
+
+/**
+ * `values: statement`, or `else: statement` for the arm taken
+ * when no other matches.
+ */
+static AstIndex parse_arm(Parser *p) {
+    AstIndex values = CL_AST_NONE;
+    AstIndex body;
+    uint32_t colon;
+
+    if (!_accept(p, KW_ELSE)) {
+        size_t top = p->scratch.count;
+        AstIndex pair[2];
+
+        do {
+            AstIndex value = parse_expression(p);
+
+            if (value == CL_AST_NONE || !_scratch_push(p, value)) {
+                p->scratch.count = top;
+                return CL_AST_NONE;
+            }
+        } while (_accept(p, SYM_COMMA));
+
+        if (!_scratch_pop(p, top, &pair[0], &pair[1]) ||
+            !_extra(p, pair, 2, &values)) {
+            return CL_AST_NONE;
+        }
+    }
+
+    if (!_expect(p, SYM_COLON, &colon) || !(body = parse_statement(p))) {
+        return CL_AST_NONE;
+    }
+
+    return _node(p, AST_SWITCH_ARM, 0, colon, body, values);
+}
+
+
+static AstIndex parse_switch(Parser *p) {
+    uint32_t token = p->pos++;
+    AstIndex subject = parse_expression(p);
+    size_t top = p->scratch.count;
+
+    if (!subject || !_expect(p, SYM_LBRACE, NULL) ||
+        !_scratch_push(p, subject)) {
+        return CL_AST_NONE;
+    }
+
+    while (!_check(p, SYM_RBRACE) && _peek(p) != PARSER_EOF) {
+        AstIndex arm = parse_arm(p);
+
+        if (arm == CL_AST_NONE || !_scratch_push(p, arm)) {
+            p->scratch.count = top;
+            return CL_AST_NONE;
+        }
+    }
+
+    AstIndex start, end;
+
+    if (!_expect(p, SYM_RBRACE, NULL)) {
+        p->scratch.count = top;
+        return CL_AST_NONE;
+    }
+
+    if (!_scratch_pop(p, top, &start, &end)) {
+        return CL_AST_NONE;
+    }
+
+    return _node(p, AST_SWITCH, 0, token, start, end);
+}
+
+
+static AstIndex _parse_statement(Parser *p) {
+    uint32_t token = p->pos;
+    AstIndex node = CL_AST_NONE;
+
+    switch (_peek(p)) {
+        case SYM_LBRACE:
+            return parse_block(p);
+        case KW_VAR:
+        case KW_CONST:
+            return _end_statement(p, parse_var(p, 0));
+        case KW_IF:
+            return parse_if(p);
+        case KW_FOR:
+            return parse_for(p);
+        case KW_SWITCH:
+            return parse_switch(p);
+        case KW_WHILE: {
+            p->pos++;
+
+            AstIndex condition = parse_expression(p);
+
+            if (!condition || !(node = parse_block(p))) {
+                return CL_AST_NONE;
+            }
+
+            return _node(p, AST_WHILE, 0, token, condition, node);
+        }
+        case KW_DEFER:
+            p->pos++;
+
+            if (!(node = parse_statement(p))) {
+                return CL_AST_NONE;
+            }
+
+            return _node(p, AST_DEFER, 0, token, node, CL_AST_NONE);
+        case KW_RETURN:
+            p->pos++;
+
+            if (!_check(p, SYM_SEMICOLON) && !(node = parse_expression(p))) {
+                return CL_AST_NONE;
+            }
+
+            return _end_statement(p,
+                _node(p, AST_RETURN, 0, token, node, CL_AST_NONE));
+        case KW_BREAK:
+        case KW_CONTINUE: {
+            AstKind kind = _check(p, KW_BREAK) ? AST_BREAK : AST_CONTINUE;
+
+            p->pos++;
+
+            return _end_statement(p,
+                _node(p, kind, 0, token, CL_AST_NONE, CL_AST_NONE));
+        }
+        default:
+            return _end_statement(p, parse_expression(p));
+    }
+}
+
+
+static AstIndex parse_statement(Parser *p) {
+    AstIndex node = _enter(p) ? _parse_statement(p) : CL_AST_NONE;
+
+    p->depth--;
+
+    return node;
+}
+
+
+/* == declarations == */
+
+
+static AstIndex parse_param(Parser *p) {
+    AstIndex type;
+    uint32_t name;
+
+    if (!_expect(p, TK_ID, &name) || !_expect(p, SYM_COLON, NULL) ||
+        !(type = parse_type(p))) {
+        return CL_AST_NONE;
+    }
+
+    return _node(p, AST_PARAM, 0, name, type, CL_AST_NONE);
+}
+
+
+static AstIndex parse_field(Parser *p) {
+    AstIndex type;
+    AstIndex value = CL_AST_NONE;
+    uint32_t name;
+
+    if (!_expect(p, TK_ID, &name) || !_expect(p, SYM_COLON, NULL) ||
+        !(type = parse_type(p))) {
+        return CL_AST_NONE;
+    }
+
+    if (_accept(p, OP_ASSIGN) && !(value = parse_expression(p))) {
+        return CL_AST_NONE;
+    }
+
+    return _node(p, AST_FIELD, 0, name, type, value);
+}
+
+
+static AstIndex parse_enum_member(Parser *p) {
+    AstIndex value = CL_AST_NONE;
+    uint32_t name;
+
+    if (!_expect(p, TK_ID, &name)) {
+        return CL_AST_NONE;
+    }
+
+    if (_accept(p, OP_ASSIGN) && !(value = parse_expression(p))) {
+        return CL_AST_NONE;
+    }
+
+    return _node(p, AST_ENUM_MEMBER, 0, name, value, CL_AST_NONE);
+}
+
+
+/**
+ * `import a.b.c;` or `import "path";`, with an optional
+ * `as name`.
+ */
+static AstIndex parse_import(Parser *p) {
+    uint32_t token = p->pos++;
+    uint32_t alias = 0;
+    AstIndex path;
+
+    if (_check(p, TK_STRING)) {
+        path = _node(p, AST_LITERAL, 0, p->pos++, CL_AST_NONE, CL_AST_NONE);
+    } else {
+        path = parse_path(p);
+    }
+
+    if (!path) {
+        return CL_AST_NONE;
+    }
+
+    if (_accept(p, KW_AS) && !_expect(p, TK_ID, &alias)) {
+        return CL_AST_NONE;
+    }
+
+    return _end_statement(p, _node(p, AST_IMPORT, 0, token, path, alias));
+}
+
+
+/**
+ * `fn name(params): type { }`, where the return type is
+ * optional and a semicolon may stand for the body.
+ */
+static AstIndex parse_fn(Parser *p, uint8_t flags) {
+    AstIndex proto[3] = { 0, 0, CL_AST_NONE };
+    AstIndex body = CL_AST_NONE;
+    AstIndex at;
+    uint32_t name;
+
+    p->pos++;
+
+    if (!_expect(p, TK_ID, &name) || !_expect(p, SYM_LPARENTHESIS, NULL) ||
+        !_parse_list(p, SYM_RPARENTHESIS, parse_param, &proto[0],
+                     &proto[1])) {
+        return CL_AST_NONE;
+    }
+
+    if (_accept(p, SYM_COLON) && !(proto[2] = parse_type(p))) {
+        return CL_AST_NONE;
+    }
+
+    if (!_accept(p, SYM_SEMICOLON) && !(body = parse_block(p))) {
+        return CL_AST_NONE;
+    }
+
+    if (!_extra(p, proto, 3, &at)) {
+        return CL_AST_NONE;
+    }
+
+    return _node(p, AST_FN, flags, name, at, body);
+}
+
+
+/**
+ * struct and enum: a name and a braced list.
+ */
+static AstIndex parse_container(Parser *p, uint8_t flags) {
+    AstKind kind = _check(p, KW_STRUCT) ? AST_STRUCT : AST_ENUM;
+    ParseFn item = (kind == AST_STRUCT) ? parse_field : parse_enum_member;
+    AstIndex start, end;
+    uint32_t name;
+
+    p->pos++;
+
+    if (!_expect(p, TK_ID, &name) || !_expect(p, SYM_LBRACE, NULL) ||
+        !_parse_list(p, SYM_RBRACE, item, &start, &end)) {
+        return CL_AST_NONE;
+    }
+
+    return _node(p, kind, flags, name, start, end);
+}
+
+
+static AstIndex parse_declaration(Parser *p) {
+    uint8_t flags = 0;
+
+    for (;;) {
+        if (_accept(p, KW_PUB)) {
+            flags |= CL_BIT(CL_AST_PUB);
+        } else if (_accept(p, KW_STATIC)) {
+            flags |= CL_BIT(CL_AST_STATIC);
+        } else {
+            break;
+        }
+    }
+
+    switch (_peek(p)) {
+        case KW_IMPORT:
+            if (flags == 0) {
+                return parse_import(p);
+            }
+
+            break;
+        case KW_FN:
+            return parse_fn(p, flags);
+        case KW_STRUCT:
+        case KW_ENUM:
+            return parse_container(p, flags);
+        case KW_VAR:
+        case KW_CONST:
+            return _end_statement(p, parse_var(p, flags));
+        default:
+            break;
+    }
+
+    return _expected(p, "a declaration");
+}
+
+
+bool cl_parse(Source *src, TokenStream *tokens, Ast *ast) {
+    Parser p = {
+        .src = src,
+        .tokens = tokens,
+        .ast = ast,
+        .pos = 0,
+        .count = (uint32_t)tokens->count,
+        .depth = 0,
+        .failed = false,
+    };
+
+    ast_reset(ast);
+
+    /*
+     * The root takes node 0 and a dummy takes extra[0], so 0 is
+     * never a child and never where a list starts.
+     */
+    AstIndex none = CL_AST_NONE;
+
+    if (!ast_reserve(ast,
+            1 + tokens->count * CL_AST_NODES_PER_100_TOKENS / 100,
+            1 + tokens->count * CL_AST_EXTRA_PER_100_TOKENS / 100) ||
+        ast_push_extra(ast, &none, 1) == SIZE_MAX) {
+        cl_error("out of memory!\n");
+        return false;
+    }
+
+    ast_push(ast, (AstNode){ .kind = AST_FILE });
+    ast_index_vector_init(&p.scratch);
+
+    while (_peek(&p) != PARSER_EOF) {
+        AstIndex decl = parse_declaration(&p);
+
+        if (decl == CL_AST_NONE || !_scratch_push(&p, decl)) {
+            break;
+        }
+    }
+
+    AstIndex start, end;
+
+    if (!p.failed && _scratch_pop(&p, 0, &start, &end)) {
+        ast->nodes[0].lhs = start;
+        ast->nodes[0].rhs = end;
+    }
+
+    ast_index_vector_free(&p.scratch);
+
+    return !p.failed;
+}
@@ -0,0 +1,2381 @@
+#define CL_LOG_SCOPE "passes"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "cl-log.h"
+#include "cl-ir.h"
+#include "cl-passes.h"
+
+
+#define PASS_MAX            32  /* passes in one list */
+
+/* lattice of sccp */
+#define LAT_TOP             0   /* not known yet */
+#define LAT_CONST           1
+#define LAT_BOTTOM          2   /* not a constant */
+
+/* the loads cse remembers in a block */
+#define CSE_MAX_LOADS       32
+
+/* the longest tail defer compares */
+#define DEFER_MAX_TAIL      64
+
+
+/**
+ * A pass rewrites a function in place. Returns false when it
+ * ran out of memory, which leaves the function unusable.
+ */
+typedef bool (*PassFn)(IrFunction *fn);
+
+CL_TYPE(Pass) {
+    str_t  name;
+    PassFn run;
+};
+
+
+struct __CL_TNAME(PassManager) {
+    const Pass *passes[PASS_MAX];
+    size_t      count;
+    double      seconds[PASS_MAX + 2];  /* lifting, the passes, lowering */
+    FILE       *dump;
+    bool        time;
+    uint64_t    functions;
+    uint64_t    kept;       /* left as codegen wrote them */
+    uint64_t    code_in;
+    uint64_t    code_out;
+};
+
+
+/* == helpers == */
+
+
+static __Inline IrOp _op(IrFunction *fn, IrValue value) {
+    return (IrOp)ir_instr(fn, value)->op;
+}
+
+
+static __Inline uint32_t _flags(IrFunction *fn, IrValue value) {
+    return ir_op_flags(_op(fn, value));
+}
+
+
+static __Inline bool _is_const(IrFunction *fn, IrValue value,
+    uint64_t *bits) {
+    IrInstr *instr = ir_instr(fn, value);
+
+    *bits = instr->imm;
+
+    return instr->op == CL_IR_CONST;
+}
+
+
+static __Inline bool _is_compare(IrOp op) {
+    return op >= CL_IR_EQ && op <= CL_IR_FLE;
+}
+
+
+static __Inline double _f(uint64_t bits) {
+    double value;
+
+    memcpy(&value, &bits, sizeof(value));
+
+    return value;
+}
+
+
+static __Inline uint64_t _bits(double value) {
+    uint64_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+
+    return bits;
+}
+
+
+/**
+ * Computes a pure op, or DIV and MOD, the way the VM does. Fails
+ * when it would divide by zero.
+ */
+static bool _fold(IrOp op, uint64_t a, uint64_t b, uint64_t *result) {
+    int64_t x = (int64_t)a, y = (int64_t)b;
+
+    switch (op) {
+        case CL_IR_ADD:  *result = a + b; break;
+        case CL_IR_SUB:  *result = a - b; break;
+        case CL_IR_MUL:  *result = a * b; break;
+        case CL_IR_BAND: *result = a & b; break;
+        case CL_IR_BOR:  *result = a | b; break;
+        case CL_IR_BXOR: *result = a ^ b; break;
+        case CL_IR_SHL:  *result = a << (b & 63); break;
+        case CL_IR_SHR:  *result = (uint64_t)(x >> (b & 63)); break;
+        case CL_IR_FADD: *result = _bits(_f(a) + _f(b)); break;
+        case CL_IR_FSUB: *result = _bits(_f(a) - _f(b)); break;
+        case CL_IR_FMUL: *result = _bits(_f(a) * _f(b)); break;
+        case CL_IR_FDIV: *result = _bits(_f(a) / _f(b)); break;
+        case CL_IR_NEG:  *result = 0 - a; break;
+        case CL_IR_FNEG: *result = _bits(-_f(a)); break;
+        case CL_IR_NOT:  *result = (x == 0); break;
+        case CL_IR_BNOT: *result = ~a; break;
+        case CL_IR_ITOF: *result = _bits((double)x); break;
+        case CL_IR_FTOI: *result = (uint64_t)cl_ftoi(_f(a)); break;
+        case CL_IR_EQ:   *result = (x == y); break;
+        case CL_IR_LT:   *result = (x < y); break;
+        case CL_IR_LE:   *result = (x <= y); break;
+        case CL_IR_FEQ:  *result = (_f(a) == _f(b)); break;
+        case CL_IR_FLT:  *result = (_f(a) < _f(b)); break;
+        case CL_IR_FLE:  *result = (_f(a) <= _f(b)); break;
+
+        case CL_IR_DIV:
+        case CL_IR_MOD:
+            if (y == 0) {
+                return false;
+            }
+
+            *result = (uint64_t)((op == CL_IR_DIV)
+                ? cl_div(x, y) : cl_mod(x, y));
+            break;
+
+        default:
+            return false;
+    }
+
+    return true;
+}
+
+
+/**
+ * Counts the uses of every value by the instructions of live
+ * blocks. The caller frees the counts.
+ */
+static uint32_t *_use_counts(IrFunction *fn) {
+    uint32_t *counts = calloc(fn->instrs.count, sizeof(uint32_t));
+
+    if (!counts) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        fn->failed = true;
+        return NULL;
+    }
+
+    for (size_t b = 0; b < fn->blocks.count; b++) {
+        IrBlock *block = ir_block(fn, (IrBlockId)b);
+
+        for (size_t i = 0; !block->dead && i < block->instrs.count; i++) {
+            uint32_t count;
+            IrValue *args = ir_operands(fn, block->instrs.data[i], &count);
+
+            for (uint32_t j = 0; j < count; j++) {
+                counts[ir_resolve(fn, args[j])]++;
+            }
+        }
+    }
+
+    return counts;
+}
+
+
+/**
+ * The users of every value, `users[start[v]]` up to
+ * `users[start[v + 1]]`, a user appearing once per use.
+ */
+CL_TYPE(Uses) {
+    uint32_t *start;
+    IrValue  *users;
+};
+
+
+static bool _uses_build(IrFunction *fn, Uses *uses) {
+    size_t count = fn->instrs.count;
+    uint32_t *counts = _use_counts(fn);
+
+    uses->start = calloc(count + 1, sizeof(uint32_t));
+
+    if (!counts || !uses->start) {
+        free(counts);
+        free(uses->start);
+        fn->failed = true;
+        return false;
+    }
+
+    for (size_t v = 0; v < count; v++) {
+        uses->start[v + 1] = uses->start[v] + counts[v];
+        counts[v] = uses->start[v];
+    }
+
+    uses->users = malloc((uses->start[count] + 1) * sizeof(IrValue));
+
+    if (!uses->users) {
+        free(counts);
+        free(uses->start);
+        fn->failed = true;
+        return false;
+    }
+
+    for (size_t b = 0; b < fn->blocks.count; b++) {
+        IrBlock *block = ir_block(fn, (IrBlockId)b);
+
+        for (size_t i = 0; !block->dead && i < block->instrs.count; i++) {
+            IrValue user = block->instrs.data[i];
+            uint32_t n;
+            IrValue *args = ir_operands(fn, user, &n);
+
+            for (uint32_t j = 0; j < n; j++) {
+                uses->users[counts[ir_resolve(fn, args[j])]++] = user;
+            }
+        }
+    }
+
+    free(counts);
+
+    return true;
+}
+
+
+static void _uses_free(Uses *uses) {
+    free(uses->start);
+    free(uses->users);
+}
+
+
+/**
+ * Where the phis of a block end.
+ */
+static size_t _phi_count(IrFunction *fn, IrBlockId block) {
+    IrValueVector *list = &ir_block(fn, block)->instrs;
+    size_t i = 0;
+
+    while (i < list->count && _op(fn, list->data[i]) == CL_IR_PHI) {
+        i++;
+    }
+
+    return i;
+}
+
+
+/**
+ * Turns the terminator of a block into a JMP, dropping the edge
+ * to `other` when the block went there too.
+ */
+static void _jump_only(IrFunction *fn, IrBlockId block, IrBlockId to,
+    IrBlockId other) {
+    IrInstr *term = ir_instr(fn, ir_terminator(fn, block));
+
+    term->op = CL_IR_JMP;
+    term->args[0] = CL_IR_NONE;
+    term->imm = 0;
+    ir_set_target(term, 0, to);
+
+    size_t index = ir_pred_index(fn, other, block);
+
+    if (index != SIZE_MAX) {
+        ir_pred_remove(fn, other, index);
+    }
+}
+
+
+/* == sccp == */
+
+
+/**
+ * Sparse conditional constant propagation, after Wegman and
+ * Zadeck: values start out unknown and only the entry runs;
+ * an edge runs once the branch before it may take it, and a
+ * value is worked out again whenever an operand changes. What
+ * ends up constant is folded, and blocks no edge runs to go.
+ */
+CL_TYPE(Sccp) {
+    IrFunction     *fn;
+    size_t          count;      /* values when it started */
+    Uses            uses;
+    uint8_t        *state;      /* LAT_ */
+    uint64_t       *bits;
+    uint32_t       *edge_start; /* the edges into a block, by pred */
+    bool           *edge;       /* which edges run */
+    bool           *reached;    /* which blocks */
+    IrBlockIdVector flow;       /* edges that may run, from and to */
+    IrValueVector   values;     /* values that changed */
+};
+
+
+static void _sccp_flow(Sccp *self, IrBlockId from, IrBlockId to) {
+    if (!ir_block_id_vector_push(&self->flow, from) ||
+        !ir_block_id_vector_push(&self->flow, to)) {
+        self->fn->failed = true;
+    }
+}
+
+
+static void _sccp_meet(Sccp *self, IrValue value, uint8_t *state,
+    uint64_t *bits) {
+    uint8_t other = self->state[value];
+
+    if (other == LAT_TOP || *state == LAT_BOTTOM) {
+        return;
+    }
+
+    if (other == LAT_BOTTOM ||
+        (*state == LAT_CONST && *bits != self->bits[value])) {
+        *state = LAT_BOTTOM;
+        return;
+    }
+
+    *state = LAT_CONST;
+    *bits = self->bits[value];
+}
+
+
+static void _sccp_visit(Sccp *self, IrValue value) {
+    IrFunction *fn = self->fn;
+    IrInstr *instr = ir_instr(fn, value);
+    IrOp op = (IrOp)instr->op;
+    uint32_t flags = ir_op_flags(op);
+    uint8_t state = LAT_BOTTOM;
+    uint64_t bits = 0;
+    uint32_t count;
+    IrValue *args = ir_operands(fn, value, &count);
+
+    if (op == CL_IR_JMP) {
+        _sccp_flow(self, instr->block, ir_target(instr, 0));
+        return;
+    }
+
+    if (op == CL_IR_BR) {
+        /* an unknown condition runs both ways, to be safe */
+        uint8_t cond = self->state[args[0]];
+
+        if (cond != LAT_CONST || self->bits[args[0]] != 0) {
+            _sccp_flow(self, instr->block, ir_target(instr, 0));
+        }
+
+        if (cond != LAT_CONST || self->bits[args[0]] == 0) {
+            _sccp_flow(self, instr->block, ir_target(instr, 1));
+        }
+
+        return;
+    }
+
+    if (!(flags & CL_IR_VALUE)) {
+        return;
+    }
+
+    if (op == CL_IR_PHI) {
+        uint32_t start = self->edge_start[instr->block];
+
+        state = LAT_TOP;
+
+        for (uint32_t i = 0; i < count; i++) {
+            if (self->edge[start + i]) {
+                _sccp_meet(self, args[i], &state, &bits);
+            }
+        }
+    } else if (op == CL_IR_CONST) {
+        state = LAT_CONST;
+        bits = instr->imm;
+    } else if ((flags & CL_IR_PURE) || op == CL_IR_DIV || op == CL_IR_MOD) {
+        uint64_t a = 0, b = 0;
+
+        /* bottom wins over top, and top over a constant */
+        state = (count > 0) ? LAT_CONST : LAT_BOTTOM;
+
+        for (uint32_t i = 0; i < count && state != LAT_BOTTOM; i++) {
+            uint8_t arg = self->state[args[i]];
+
+            state = (arg == LAT_CONST) ? state : arg;
+        }
+
+        if (count > 0) {
+            a = self->bits[args[0]];
+        }
+
+        if (count > 1) {
+            b = self->bits[args[1]];
+        }
+
+        if (state == LAT_CONST && !_fold(op, a, b, &bits)) {
+            state = LAT_BOTTOM;
+        }
+    }
+
+    if (state > self->state[value]) {
+        self->state[value] = state;
+        self->bits[value] = bits;
+
+        if (!ir_value_vector_push(&self->values, value)) {
+            fn->failed = true;
+        }
+    }
+}
+
+
+static void _sccp_reach(Sccp *self, IrBlockId from, IrBlockId to) {
+    IrFunction *fn = self->fn;
+    IrBlock *block = ir_block(fn, to);
+    bool taken = false;
+
+    for (size_t i = 0; i < block->preds.count; i++) {
+        bool *edge = &self->edge[self->edge_start[to] + i];
+
+        if (block->preds.data[i] == from && !*edge) {
+            *edge = taken = true;
+        }
+    }
+
+    if (!taken) {
+        return;
+    }
+
+    /* a block seen before only has its phis to look at again */
+    size_t count = self->reached[to]
+        ? _phi_count(fn, to) : block->instrs.count;
+
+    self->reached[to] = true;
+
+    for (size_t i = 0; i < count; i++) {
+        _sccp_visit(self, ir_block(fn, to)->instrs.data[i]);
+    }
+}
+
+
+static void _sccp_solve(Sccp *self) {
+    IrFunction *fn = self->fn;
+    IrBlock *entry = ir_block(fn, 0);
+
+    self->reached[0] = true;
+
+    for (size_t i = 0; i < entry->instrs.count; i++) {
+        _sccp_visit(self, entry->instrs.data[i]);
+    }
+
+    while ((self->flow.count > 0 || self->values.count > 0) && !fn->failed) {
+        while (self->flow.count > 0) {
+            IrBlockId to = self->flow.data[--self->flow.count];
+            IrBlockId from = self->flow.data[--self->flow.count];
+
+            _sccp_reach(self, from, to);
+        }
+
+        while (self->values.count > 0) {
+            IrValue value = self->values.data[--self->values.count];
+            Uses *uses = &self->uses;
+
+            for (uint32_t i = uses->start[value];
+                i < uses->start[value + 1]; i++) {
+                IrValue user = uses->users[i];
+
+                if (self->reached[ir_instr(fn, user)->block]) {
+                    _sccp_visit(self, user);
+                }
+            }
+        }
+    }
+}
+
+
+/**
+ * What a pure op comes to when one operand is the constant
+ * that leaves the other as it is, or decides the result:
+ * x + 0, x * 1, x & 0 and the like. Returns the value to use
+ * instead, or CL_IR_NONE. A constant result is written into
+ * the instruction itself.
+ */
+static IrValue _simplify(IrFunction *fn, IrValue value) {
+    IrInstr *instr = ir_instr(fn, value);
+    IrOp op = (IrOp)instr->op;
+    IrValue x, y;
+    uint64_t cx, cy;
+    int64_t result = -1;
+
+    /* floats are left alone: x + 0.0 is not x when x is -0.0 */
+    if (ir_op_operands(op) != 2 || (op >= CL_IR_FADD && op <= CL_IR_FDIV) ||
+        op >= CL_IR_FEQ) {
+        return CL_IR_NONE;
+    }
+
+    x = ir_resolve(fn, instr->args[0]);
+    y = ir_resolve(fn, instr->args[1]);
+
+    bool kx = _is_const(fn, x, &cx), ky = _is_const(fn, y, &cy);
+
+    switch (op) {
+        case CL_IR_DIV:
+            if (ky && cy == 1) {
+                return x;
+            }
+            break;
+
+        case CL_IR_MOD:
+            if (ky && cy == 1) {
+                result = 0;
+            }
+            break;
+
+        case CL_IR_ADD:
+        case CL_IR_BOR:
+        case CL_IR_BXOR:
+            if (ky && cy == 0) {
+                return x;
+            }
+
+            if (kx && cx == 0) {
+                return y;
+            }
+
+            if (x == y && op != CL_IR_ADD) {
+                if (op == CL_IR_BOR) {
+                    return x;
+                }
+
+                result = 0;
+            }
+            break;
+
+        case CL_IR_SUB:
+        case CL_IR_SHL:
+        case CL_IR_SHR:
+            if (ky && cy == 0) {
+                return x;
+            }
+
+            if (x == y && op == CL_IR_SUB) {
+                result = 0;
+            }
+            break;
+
+        case CL_IR_MUL:
+            if ((ky && cy == 1) || (kx && cx == 1)) {
+                return (ky && cy == 1) ? x : y;
+            }
+
+            if ((ky && cy == 0) || (kx && cx == 0)) {
+                result = 0;
+            }
+            break;
+
+        case CL_IR_BAND:
+            if ((ky && cy == UINT64_MAX) || x == y) {
+                return x;
+            }
+
+            if (kx && cx == UINT64_MAX) {
+                return y;
+            }
+
+            if ((ky && cy == 0) || (kx && cx == 0)) {
+                result = 0;
+            }
+            break;
+
+        case CL_IR_EQ:
+        case CL_IR_LE:
+        case CL_IR_LT:
+            if (x == y) {
+                result = (op != CL_IR_LT);
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    if (result >= 0) {
+        instr->op = CL_IR_CONST;
+        instr->imm = (uint64_t)result;
+    }
+
+    return CL_IR_NONE;
+}
+
+
+/**
+ * Folds what the solution made constant: values become CONST,
+ * branches become jumps and blocks left unreached go.
+ */
+static void _sccp_rewrite(Sccp *self) {
+    IrFunction *fn = self->fn;
+    size_t blocks = fn->blocks.count;
+
+    for (IrBlockId b = 0; b < blocks; b++) {
+        IrBlock *block = ir_block(fn, b);
+
+        if (block->dead || !self->reached[b]) {
+            continue;
+        }
+
+        size_t phis = _phi_count(fn, b);
+
+        for (size_t i = 0; i < ir_block(fn, b)->instrs.count; i++) {
+            IrValue value = ir_block(fn, b)->instrs.data[i];
+            IrInstr *instr = ir_instr(fn, value);
+
+            /* the constants put in for phis are not in `state` */
+            if (value >= self->count || self->state[value] != LAT_CONST ||
+                instr->op == CL_IR_CONST) {
+                continue;
+            }
+
+            IrInstr folded = { .op = CL_IR_CONST, .imm = self->bits[value] };
+
+            if (instr->op != CL_IR_PHI) {
+                folded.block = b;
+                *instr = folded;
+                continue;
+            }
+
+            /* a phi turns into a constant right after the phis */
+            IrValue value_const = ir_insert(fn, b, phis, folded);
+
+            if (value_const != CL_IR_NONE) {
+                ir_replace(fn, value, value_const);
+            }
+        }
+
+        IrValue term = ir_terminator(fn, b);
+        IrInstr *br = ir_instr(fn, term);
+
+        if (br->op == CL_IR_BR && self->state[br->args[0]] == LAT_CONST) {
+            int taken = self->bits[br->args[0]] ? 0 : 1;
+            IrBlockId to = ir_target(br, taken);
+
+            _jump_only(fn, b, to, ir_target(br, 1 - taken));
+        }
+    }
+
+    for (IrBlockId b = 0; b < blocks; b++) {
+        if (!ir_block(fn, b)->dead && !self->reached[b]) {
+            ir_block_kill(fn, b);
+        }
+    }
+
+    ir_settle(fn);
+
+    for (IrBlockId b = 0; b < blocks; b++) {
+        IrBlock *block = ir_block(fn, b);
+
+        for (size_t i = 0; !block->dead && i < block->instrs.count; i++) {
+            IrValue value = block->instrs.data[i];
+            IrValue same = _simplify(fn, value);
+
+            if (same != CL_IR_NONE) {
+                ir_replace(fn, value, same);
+            }
+        }
+    }
+}
+
+
+static bool _sccp(IrFunction *fn) {
+    size_t count = fn->instrs.count;
+    size_t blocks = fn->blocks.count;
+    Sccp self = {
+        .fn = fn,
+        .count = count,
+        .state = calloc(count, sizeof(uint8_t)),
+        .bits = calloc(count, sizeof(uint64_t)),
+        .edge_start = calloc(blocks + 1, sizeof(uint32_t)),
+        .reached = calloc(blocks, sizeof(bool)),
+    };
+    bool ok = self.state && self.bits && self.edge_start && self.reached &&
+        _uses_build(fn, &self.uses);
+
+    for (size_t b = 0; ok && b < blocks; b++) {
+        self.edge_start[b + 1] = self.edge_start[b] +
+            (uint32_t)ir_block(fn, (IrBlockId)b)->preds.count;
+    }
+
+    if (ok) {
+        self.edge = calloc(self.edge_start[blocks] + 1, sizeof(bool));
+        ok = self.edge != NULL;
+    }
+
+    if (ok) {
+        _sccp_solve(&self);
+        ok = !fn->failed;
+    }
+
+    if (ok) {
+        _sccp_rewrite(&self);
+    }
+
+    if (self.uses.start) {
+        _uses_free(&self.uses);
+    }
+
+    free(self.state);
+    free(self.bits);
+    free(self.edge_start);
+    free(self.edge);
+    free(self.reached);
+    ir_block_id_vector_free(&self.flow);
+    ir_value_vector_free(&self.values);
+
+    return ok && !fn->failed;
+}
+
+
+/* == cfg == */
+
+
+/**
+ * Branches that go one way only: on a constant, to the same
+ * block both ways, and on NOT x, which branches on x instead.
+ */
+static bool _cfg_branches(IrFunction *fn) {
+    bool changed = false;
+
+    for (IrBlockId b = 0; b < fn->blocks.count; b++) {
+        if (ir_block(fn, b)->dead) {
+            continue;
+        }
+
+        IrInstr *br = ir_instr(fn, ir_terminator(fn, b));
+        uint64_t bits;
+
+        if (br->op != CL_IR_BR) {
+            continue;
+        }
+
+        IrValue cond = ir_resolve(fn, br->args[0]);
+        IrBlockId yes = ir_target(br, 0), no = ir_target(br, 1);
+
+        if (_is_const(fn, cond, &bits)) {
+            _jump_only(fn, b, bits ? yes : no, bits ? no : yes);
+            changed = true;
+            continue;
+        }
+
+        if (yes == no) {
+            IrBlock *to = ir_block(fn, yes);
+            size_t first = ir_pred_index(fn, yes, b), second = first + 1;
+            bool same = true;
+
+            while (to->preds.data[second] != b) {
+                second++;
+            }
+
+            /* both edges must bring the same values */
+            for (size_t i = 0; same && i < _phi_count(fn, yes); i++) {
+                uint32_t n;
+                IrValue *args = ir_operands(fn, to->instrs.data[i], &n);
+
+                same = ir_resolve(fn, args[first]) ==
+                    ir_resolve(fn, args[second]);
+            }
+
+            if (same) {
+                _jump_only(fn, b, yes, yes);
+                changed = true;
+            }
+
+            continue;
+        }
+
+        if (_op(fn, cond) == CL_IR_NOT) {
+            br->args[0] = ir_instr(fn, cond)->args[0];
+            ir_set_target(br, 0, no);
+            ir_set_target(br, 1, yes);
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+
+static bool _cfg_unreachable(IrFunction *fn) {
+    bool changed = false;
+
+    if (!ir_order(fn)) {
+        return false;
+    }
+
+    for (IrBlockId b = 0; b < fn->blocks.count; b++) {
+        IrBlock *block = ir_block(fn, b);
+
+        if (!block->dead && block->order == UINT32_MAX) {
+            ir_block_kill(fn, b);
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+
+/**
+ * Whether a block holds nothing but constants and a JMP to
+ * `to`, and has the one predecessor `from`.
+ */
+static bool _is_arm(IrFunction *fn, IrBlockId block, IrBlockId from,
+    IrBlockId to) {
+    IrBlock *b = ir_block(fn, block);
+    IrBlockId succs[2];
+
+    if (b->preds.count != 1 || b->preds.data[0] != from ||
+        ir_succs(fn, block, succs) != 1 || succs[0] != to ||
+        _op(fn, ir_terminator(fn, block)) != CL_IR_JMP) {
+        return false;
+    }
+
+    for (size_t i = 0; i + 1 < b->instrs.count; i++) {
+        if (_op(fn, b->instrs.data[i]) != CL_IR_CONST) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * codegen turns a comparison used as a value into a branch that
+ * writes 1 on one side and 0 on the other. A block joining the
+ * two sides with a phi of 1 and 0 gets the comparison itself,
+ * or its NOT, and the branch goes.
+ */
+static bool _cfg_select(IrFunction *fn) {
+    bool changed = false;
+
+    for (IrBlockId join = 0; join < fn->blocks.count; join++) {
+        IrBlock *j = ir_block(fn, join);
+
+        if (j->dead || j->preds.count != 2 || _phi_count(fn, join) != 1) {
+            continue;
+        }
+
+        IrValue phi = j->instrs.data[0];
+        IrBlockId p0 = j->preds.data[0], p1 = j->preds.data[1];
+        IrBlockId head;
+        bool diamond;
+
+        /* a diamond, or a triangle where the head is a side */
+        if (ir_block(fn, p0)->preds.count == 1 &&
+            _is_arm(fn, p0, ir_block(fn, p0)->preds.data[0], join)) {
+            head = ir_block(fn, p0)->preds.data[0];
+            diamond = _is_arm(fn, p1, head, join);
+
+            if (!diamond && p1 != head) {
+                continue;
+            }
+        } else if (ir_block(fn, p1)->preds.count == 1 &&
+            _is_arm(fn, p1, ir_block(fn, p1)->preds.data[0], join)) {
+            head = ir_block(fn, p1)->preds.data[0];
+            diamond = false;
+
+            if (p0 != head) {
+                continue;
+            }
+        } else {
+            continue;
+        }
+
+        IrValue term = ir_terminator(fn, head);
+        IrInstr *br = ir_instr(fn, term);
+
+        if (br->op != CL_IR_BR || ir_target(br, 0) == ir_target(br, 1)) {
+            continue;
+        }
+
+        /* the edge into the join that the true side comes by */
+        IrBlockId yes = ir_target(br, 0);
+        size_t index = ir_pred_index(fn, join, (yes == join) ? head : yes);
+        uint32_t n;
+        IrValue *args = ir_operands(fn, phi, &n);
+        uint64_t on_true, on_false;
+
+        if (!_is_const(fn, ir_resolve(fn, args[index]), &on_true) ||
+            !_is_const(fn, ir_resolve(fn, args[1 - index]), &on_false) ||
+            (on_true | on_false) != 1 || on_true == on_false) {
+            continue;
+        }
+
+        IrValue cond = ir_resolve(fn, br->args[0]);
+        IrValue result = cond;
+
+        if (on_true == 0) {
+            IrInstr not = { .op = CL_IR_NOT, .args = { cond } };
+
+            result = ir_insert(fn, head, ir_block(fn, head)->instrs.count - 1,
+                not);
+        } else if (!_is_compare(_op(fn, cond)) && _op(fn, cond) != CL_IR_NOT) {
+            continue;   /* only 0 and 1 may take the place of the phi */
+        }
+
+        if (result == CL_IR_NONE) {
+            return false;
+        }
+
+        ir_replace(fn, phi, result);
+
+        br = ir_instr(fn, ir_terminator(fn, head));
+        br->op = CL_IR_JMP;
+        br->args[0] = CL_IR_NONE;
+        br->imm = 0;
+        ir_set_target(br, 0, join);
+
+        if (p0 != head) {
+            ir_block_kill(fn, p0);
+        }
+
+        if (p1 != head) {
+            ir_block_kill(fn, p1);
+        }
+
+        if (diamond && !ir_pred_add(fn, join, head, SIZE_MAX)) {
+            return false;
+        }
+
+        changed = true;
+    }
+
+    return changed;
+}
+
+
+/**
+ * Sends the predecessors of a block that only jumps on to where
+ * it jumps.
+ */
+static bool _cfg_thread(IrFunction *fn) {
+    bool changed = false;
+
+    for (IrBlockId b = 1; b < fn->blocks.count; b++) {
+        IrBlock *block = ir_block(fn, b);
+
+        if (block->dead || block->instrs.count != 1 ||
+            _op(fn, block->instrs.data[0]) != CL_IR_JMP) {
+            continue;
+        }
+
+        IrBlockId to = ir_target(ir_instr(fn, block->instrs.data[0]), 0);
+        bool phis = _phi_count(fn, to) > 0;
+
+        if (to == b) {
+            continue;
+        }
+
+        for (size_t i = 0; i < ir_block(fn, b)->preds.count; ) {
+            IrBlockId pred = ir_block(fn, b)->preds.data[i];
+            size_t like = ir_pred_index(fn, to, b);
+
+            /* the phis of `to` would need two operands for it */
+            if (pred == b ||
+                (phis && ir_pred_index(fn, to, pred) != SIZE_MAX)) {
+                i++;
+                continue;
+            }
+
+            IrInstr *term = ir_instr(fn, ir_terminator(fn, pred));
+            int targets = (term->op == CL_IR_BR) ? 2 : 1;
+            bool moved = false;
+
+            for (int t = 0; t < targets; t++) {
+                if (ir_target(term, t) != b) {
+                    continue;
+                }
+
+                ir_set_target(term, t, to);
+
+                if (!ir_pred_add(fn, to, pred, like)) {
+                    return false;
+                }
+
+                ir_pred_remove(fn, b, ir_pred_index(fn, b, pred));
+                moved = true;
+            }
+
+            i += !moved;
+            changed |= moved;
+        }
+    }
+
+    return changed;
+}
+
+
+/**
+ * Appends a block to the one before it when that one jumps to
+ * it and nothing else does.
+ */
+static bool _cfg_merge(IrFunction *fn) {
+    bool changed = false;
+
+    for (IrBlockId b = 0; b < fn->blocks.count; b++) {
+        IrBlock *block = ir_block(fn, b);
+
+        while (!block->dead) {
+            IrValue term = ir_terminator(fn, b);
+            IrInstr *jmp = ir_instr(fn, term);
+            IrBlockId next = ir_target(jmp, 0);
+
+            if (jmp->op != CL_IR_JMP || next == b || next == 0 ||
+                ir_block(fn, next)->preds.count != 1) {
+                break;
+            }
+
+            IrBlock *from = ir_block(fn, next);
+
+            ir_remove(fn, term);
+            block->instrs.count--;
+
+            if (!ir_value_vector_reserve(&block->instrs,
+                block->instrs.count + from->instrs.count)) {
+                fn->failed = true;
+                return false;
+            }
+
+            for (size_t i = 0; i < from->instrs.count; i++) {
+                IrValue value = from->instrs.data[i];
+                IrInstr *instr = ir_instr(fn, value);
+
+                if (instr->op == CL_IR_PHI) {
+                    ir_replace(fn, value, fn->extra.data[instr->args[0]]);
+                    continue;
+                }
+
+                instr->block = b;
+                block->instrs.data[block->instrs.count++] = value;
+            }
+
+            IrBlockId succs[2];
+            uint32_t count = ir_succs(fn, b, succs);
+
+            for (uint32_t i = 0; i < count; i++) {
+                IrBlockIdVector *preds = &ir_block(fn, succs[i])->preds;
+
+                for (size_t j = 0; j < preds->count; j++) {
+                    preds->data[j] = (preds->data[j] == next)
+                        ? b : preds->data[j];
+                }
+            }
+
+            from->instrs.count = 0;
+            from->preds.count = 0;
+            from->dead = true;
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+
+/**
+ * Returns in place of jumps to a block that only returns, so the
+ * phis of its value need no moves.
+ */
+static bool _cfg_returns(IrFunction *fn) {
+    bool changed = false;
+
+    for (IrBlockId b = 1; b < fn->blocks.count; b++) {
+        IrBlock *block = ir_block(fn, b);
+        size_t phis = _phi_count(fn, b);
+
+        if (block->dead || block->instrs.count != phis + 1) {
+            continue;
+        }
+
+        IrInstr ret = *ir_instr(fn, block->instrs.data[phis]);
+
+        if (ret.op != CL_IR_RET && ret.op != CL_IR_RET0) {
+            continue;
+        }
+
+        IrValue value = ir_resolve(fn, ret.args[0]);
+        bool from_phi = ret.op == CL_IR_RET && _op(fn, value) == CL_IR_PHI &&
+            ir_instr(fn, value)->block == b;
+
+        for (size_t i = 0; i < ir_block(fn, b)->preds.count; ) {
+            IrBlockId pred = ir_block(fn, b)->preds.data[i];
+            IrInstr *term = ir_instr(fn, ir_terminator(fn, pred));
+
+            if (term->op != CL_IR_JMP || pred == b) {
+                i++;
+                continue;
+            }
+
+            term->op = ret.op;
+            term->imm = 0;
+            term->args[0] = from_phi
+                ? fn->extra.data[ir_instr(fn, value)->args[0] + i]
+                : ret.args[0];
+
+            ir_pred_remove(fn, b, i);
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+
+static bool _cfg(IrFunction *fn) {
+    bool (*const steps[])(IrFunction *) = {
+        _cfg_branches, _cfg_unreachable, _cfg_select, _cfg_thread,
+        _cfg_merge, _cfg_returns,
+    };
+
+    for (bool changed = true; changed && !fn->failed; ) {
+        changed = false;
+
+        for (size_t i = 0; i < CL_N_ELEMS(steps) && !fn->failed; i++) {
+            changed |= steps[i](fn);
+            ir_settle(fn);
+        }
+    }
+
+    return !fn->failed;
+}
+
+
+/* == cse == */
+
+
+/**
+ * A load known to hold a value: the op that loads it, its
+ * operands and `imm`, and the value.
+ */
+CL_TYPE(CseLoad) {
+    uint8_t  op;
+    IrValue  args[2];
+    uint64_t imm;
+    IrValue  value;
+};
+
+
+/**
+ * Walks the dominator tree with a table of the pure values
+ * computed on the way down, which a block sees as long as it is
+ * below the one that computed them; the slots a block fills are
+ * emptied again, in reverse, once its subtree is done. Equal
+ * constants stay apart, but operands compare by what they hold:
+ * `consts` has the first CONST of every value, which stands for
+ * the others.
+ */
+CL_TYPE(Cse) {
+    IrFunction   *fn;
+    IrValue      *table;
+    IrValue      *consts;
+    size_t        mask;
+    IrValueVector undo;
+    CseLoad       loads[CSE_MAX_LOADS];
+    size_t        load_count;
+};
+
+
+static __Inline bool _commutes(IrOp op) {
+    return op == CL_IR_ADD || op == CL_IR_MUL || op == CL_IR_BAND ||
+        op == CL_IR_BOR || op == CL_IR_BXOR || op == CL_IR_EQ ||
+        op == CL_IR_FADD || op == CL_IR_FMUL || op == CL_IR_FEQ;
+}
+
+
+static __Inline size_t _cse_slot(Cse *self, uint64_t imm) {
+    uint64_t hash = imm * 0x9E3779B97F4A7C15ULL;
+
+    return (size_t)(hash ^ (hash >> 29)) & self->mask;
+}
+
+
+/**
+ * The CONST that stands for all those holding what `value`
+ * holds, or `value` when it is no CONST.
+ */
+static IrValue _cse_const(Cse *self, IrValue value) {
+    IrFunction *fn = self->fn;
+
+    if (_op(fn, value) != CL_IR_CONST) {
+        return value;
+    }
+
+    uint64_t imm = ir_instr(fn, value)->imm;
+    size_t slot = _cse_slot(self, imm);
+
+    while (self->consts[slot] != CL_IR_NONE) {
+        if (ir_instr(fn, self->consts[slot])->imm == imm) {
+            return self->consts[slot];
+        }
+
+        slot = (slot + 1) & self->mask;
+    }
+
+    self->consts[slot] = value;
+
+    return value;
+}
+
+
+/**
+ * Puts the operands of a commutative op in order, so a + b and
+ * b + a look the same.
+ */
+static void _cse_key(Cse *self, IrValue value, IrValue args[2]) {
+    IrFunction *fn = self->fn;
+    IrInstr *instr = ir_instr(fn, value);
+
+    args[0] = _cse_const(self, ir_resolve(fn, instr->args[0]));
+    args[1] = _cse_const(self, ir_resolve(fn, instr->args[1]));
+
+    if (_commutes((IrOp)instr->op) && args[0] > args[1]) {
+        IrValue tmp = args[0];
+
+        args[0] = args[1];
+        args[1] = tmp;
+    }
+}
+
+
+static uint64_t _cse_hash(Cse *self, IrValue value) {
+    IrInstr *instr = ir_instr(self->fn, value);
+    IrValue args[2];
+
+    _cse_key(self, value, args);
+
+    uint64_t hash = instr->op * 0x9E3779B97F4A7C15ULL;
+
+    hash = (hash ^ args[0]) * 0xBF58476D1CE4E5B9ULL;
+    hash = (hash ^ args[1]) * 0x94D049BB133111EBULL;
+    hash = (hash ^ instr->imm) * 0x9E3779B97F4A7C15ULL;
+
+    return hash ^ (hash >> 31);
+}
+
+
+static bool _cse_same(Cse *self, IrValue a, IrValue b) {
+    IrFunction *fn = self->fn;
+    IrValue ka[2], kb[2];
+
+    if (_op(fn, a) != _op(fn, b) ||
+        ir_instr(fn, a)->imm != ir_instr(fn, b)->imm) {
+        return false;
+    }
+
+    _cse_key(self, a, ka);
+    _cse_key(self, b, kb);
+
+    return ka[0] == kb[0] && ka[1] == kb[1];
+}
+
+
+/**
+ * Whether an op is worth looking up: pure computations with
+ * operands, and divisions, which trap the same way twice.
+ * Constants are cheaper to load again than to keep around.
+ */
+static __Inline bool _cse_candidate(IrOp op) {
+    return ((ir_op_flags(op) & CL_IR_PURE) && ir_op_operands(op) > 0) ||
+        op == CL_IR_DIV || op == CL_IR_MOD;
+}
+
+
+/**
+ * Returns the value an earlier one computes the same way as, or
+ * adds it to the table.
+ */
+static IrValue _cse_find(Cse *self, IrValue value) {
+    size_t slot = _cse_hash(self, value) & self->mask;
+
+    while (self->table[slot] != CL_IR_NONE) {
+        if (_cse_same(self, self->table[slot], value)) {
+            return self->table[slot];
+        }
+
+        slot = (slot + 1) & self->mask;
+    }
+
+    if (!ir_value_vector_push(&self->undo, (IrValue)slot)) {
+        self->fn->failed = true;
+        return CL_IR_NONE;
+    }
+
+    self->table[slot] = value;
+
+    return CL_IR_NONE;
+}
+
+
+static void _cse_forget(Cse *self, bool (*which)(const CseLoad *load,
+    IrValue base, uint64_t key), IrValue base, uint64_t key) {
+    size_t kept = 0;
+
+    for (size_t i = 0; i < self->load_count; i++) {
+        CseLoad *load = &self->loads[i];
+
+        if (!which(load, base, key)) {
+            self->loads[kept++] = *load;
+        }
+    }
+
+    self->load_count = kept;
+}
+
+
+static bool _is_global(const CseLoad *load, IrValue unused, uint64_t global) {
+    (void)unused;
+
+    return load->op == CL_IR_GETG && load->imm == global;
+}
+
+
+static bool _is_memory(const CseLoad *load, IrValue unused, uint64_t key) {
+    (void)unused, (void)key;
+
+    return load->op != CL_IR_GETG;
+}
+
+
+/**
+ * What a store to field `field` of `base` may change: all but
+ * the other fields of the same base, and the globals.
+ */
+static bool _is_field(const CseLoad *load, IrValue base, uint64_t field) {
+    return load->op != CL_IR_GETG && (load->op != CL_IR_GETF ||
+        load->args[0] != base || load->imm == field);
+}
+
+
+static bool _is_any(const CseLoad *load, IrValue unused, uint64_t key) {
+    (void)load, (void)unused, (void)key;
+
+    return true;
+}
+
+
+static void _cse_learn(Cse *self, uint8_t op, IrValue a, IrValue b,
+    uint64_t imm, IrValue value) {
+    if (self->load_count < CSE_MAX_LOADS) {
+        self->loads[self->load_count++] = (CseLoad){
+            .op = op, .args = { a, b }, .imm = imm, .value = value,
+        };
+    }
+}
+
+
+/**
+ * Loads within a block: one that loads what a load or a store
+ * before it did gets its value, until a store that may write
+ * there or a call comes in between.
+ */
+static void _cse_load(Cse *self, IrValue value) {
+    IrFunction *fn = self->fn;
+    IrInstr *instr = ir_instr(fn, value);
+    uint8_t op = instr->op;
+    IrValue a = ir_resolve(fn, instr->args[0]);
+    IrValue b = ir_resolve(fn, instr->args[1]);
+
+    switch (op) {
+        case CL_IR_GETG:
+        case CL_IR_GETF:
+        case CL_IR_GETI:
+            a = (op == CL_IR_GETG) ? CL_IR_NONE : a;
+            b = (op == CL_IR_GETI) ? b : CL_IR_NONE;
+
+            for (size_t i = 0; i < self->load_count; i++) {
+                CseLoad *load = &self->loads[i];
+
+                if (load->op == op && load->args[0] == a &&
+                    load->args[1] == b && load->imm == instr->imm) {
+                    ir_replace(fn, value, load->value);
+                    return;
+                }
+            }
+
+            _cse_learn(self, op, a, b, instr->imm, value);
+            break;
+
+        case CL_IR_SETG:
+            _cse_forget(self, _is_global, CL_IR_NONE, instr->imm);
+            _cse_learn(self, CL_IR_GETG, CL_IR_NONE, CL_IR_NONE, instr->imm,
+                a);
+            break;
+
+        case CL_IR_SETF:
+            _cse_forget(self, _is_field, a, instr->imm);
+            _cse_learn(self, CL_IR_GETF, a, CL_IR_NONE, instr->imm, b);
+            break;
+
+        case CL_IR_SETI:
+            _cse_forget(self, _is_memory, CL_IR_NONE, 0);
+            _cse_learn(self, CL_IR_GETI, a, b, 0,
+                ir_resolve(fn, instr->args[2]));
+            break;
+
+        case CL_IR_ZERO:
+        case CL_IR_COPY:
+            _cse_forget(self, _is_memory, CL_IR_NONE, 0);
+            break;
+
+        case CL_IR_CALL:
+            _cse_forget(self, _is_any, CL_IR_NONE, 0);
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+static void _cse_block(Cse *self, IrBlockId b) {
+    IrFunction *fn = self->fn;
+    IrBlock *block = ir_block(fn, b);
+
+    self->load_count = 0;
+
+    for (size_t i = 0; i < block->instrs.count && !fn->failed; i++) {
+        IrValue value = block->instrs.data[i];
+        IrOp op = _op(fn, value);
+
+        if (!_cse_candidate(op)) {
+            _cse_load(self, value);
+            continue;
+        }
+
+        IrValue same = _cse_find(self, value);
+
+        if (same != CL_IR_NONE) {
+            ir_replace(fn, value, same);
+        }
+    }
+}
+
+
+static bool _cse(IrFunction *fn) {
+    size_t blocks = fn->blocks.count, size = 16;
+
+    if (!ir_dominators(fn)) {
+        return false;
+    }
+
+    while (size < 2 * fn->instrs.count) {
+        size *= 2;
+    }
+
+    /* the children of every block in the dominator tree, in rpo */
+    Cse self = { .fn = fn, .table = calloc(size, sizeof(IrValue)),
+        .consts = calloc(size, sizeof(IrValue)), .mask = size - 1 };
+    uint32_t *start = calloc(blocks + 2, sizeof(uint32_t));
+    IrBlockId *children = malloc((blocks + 1) * sizeof(IrBlockId));
+    IrBlockId *stack = malloc((blocks + 1) * sizeof(IrBlockId));
+    uint32_t *marks = malloc((blocks + 1) * sizeof(uint32_t));
+    uint32_t *next = calloc(blocks + 1, sizeof(uint32_t));
+    bool ok = self.table && self.consts && start && children && stack &&
+        marks && next;
+
+    for (size_t i = 1; ok && i < fn->rpo.count; i++) {
+        start[ir_block(fn, fn->rpo.data[i])->idom + 2]++;
+    }
+
+    for (size_t b = 0; ok && b < blocks; b++) {
+        start[b + 2] += start[b + 1];
+    }
+
+    for (size_t i = 1; ok && i < fn->rpo.count; i++) {
+        IrBlockId b = fn->rpo.data[i];
+
+        children[start[ir_block(fn, b)->idom + 1]++] = b;
+    }
+
+    size_t depth = 0;
+
+    if (ok) {
+        stack[depth] = 0;
+        marks[depth++] = 0;
+        _cse_block(&self, 0);
+    }
+
+    while (depth > 0 && !fn->failed) {
+        IrBlockId b = stack[depth - 1];
+        uint32_t child = start[b] + next[b];
+
+        if (child < start[b + 1]) {
+            IrBlockId to = children[child];
+
+            next[b]++;
+            stack[depth] = to;
+            marks[depth++] = (uint32_t)self.undo.count;
+            _cse_block(&self, to);
+            continue;
+        }
+
+        /* the subtree is done, so what it added goes */
+        while (self.undo.count > marks[depth - 1]) {
+            self.table[self.undo.data[--self.undo.count]] = CL_IR_NONE;
+        }
+
+        depth--;
+    }
+
+    if (!ok) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        fn->failed = true;
+    }
+
+    free(self.table);
+    free(self.consts);
+    free(start);
+    free(children);
+    free(stack);
+    free(marks);
+    free(next);
+    ir_value_vector_free(&self.undo);
+
+    return !fn->failed;
+}
+
+
+/* == dce == */
+
+
+/**
+ * Whether an instruction has to stay when nothing uses it: it
+ * has an effect, ends a block or may fail. A division by a
+ * constant other than 0 cannot.
+ */
+static bool _is_root(IrFunction *fn, IrValue value) {
+    IrInstr *instr = ir_instr(fn, value);
+    uint32_t flags = ir_op_flags(instr->op);
+    uint64_t bits;
+
+    if (instr->op == CL_IR_DIV || instr->op == CL_IR_MOD) {
+        return !_is_const(fn, ir_resolve(fn, instr->args[1]), &bits) ||
+            bits == 0;
+    }
+
+    return (flags & (CL_IR_EFFECT | CL_IR_TERM | CL_IR_TRAPS)) != 0;
+}
+
+
+static bool _dce(IrFunction *fn) {
+    size_t count = fn->instrs.count;
+    bool *live = calloc(count, sizeof(bool));
+    IrValueVector work = { 0 };
+
+    if (!live) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        fn->failed = true;
+        return false;
+    }
+
+    for (size_t b = 0; b < fn->blocks.count; b++) {
+        IrBlock *block = ir_block(fn, (IrBlockId)b);
+
+        for (size_t i = 0; !block->dead && i < block->instrs.count; i++) {
+            IrValue value = block->instrs.data[i];
+
+            if (_is_root(fn, value) && !live[value]) {
+                live[value] = true;
+
+                if (!ir_value_vector_push(&work, value)) {
+                    fn->failed = true;
+                }
+            }
+        }
+    }
+
+    while (work.count > 0 && !fn->failed) {
+        uint32_t n;
+        IrValue *args = ir_operands(fn, work.data[--work.count], &n);
+
+        for (uint32_t i = 0; i < n; i++) {
+            IrValue arg = ir_resolve(fn, args[i]);
+
+            if (!live[arg]) {
+                live[arg] = true;
+
+                if (!ir_value_vector_push(&work, arg)) {
+                    fn->failed = true;
+                }
+            }
+        }
+    }
+
+    for (size_t b = 0; b < fn->blocks.count && !fn->failed; b++) {
+        IrBlock *block = ir_block(fn, (IrBlockId)b);
+
+        for (size_t i = 0; !block->dead && i < block->instrs.count; i++) {
+            if (!live[block->instrs.data[i]]) {
+                ir_remove(fn, block->instrs.data[i]);
+            }
+        }
+    }
+
+    free(live);
+    ir_value_vector_free(&work);
+
+    return !fn->failed;
+}
+
+
+/* == defer == */
+
+
+/**
+ * codegen writes the deferred code of a scope out again at every
+ * exit from it, so the blocks that end a function, or that go
+ * on to the same block, tend to end in the same instructions.
+ * A tail they share moves into the block they go to, or into a
+ * new block the returns jump to, once. Operands that are not
+ * the same in every copy come in through phis.
+ */
+CL_TYPE(Defer) {
+    IrFunction   *fn;
+    IrBlockId    *members;
+    size_t        count;
+    size_t        k;        /* instructions in the tail */
+    IrBlockId     into;     /* the join, or CL_IR_NO_BLOCK for returns */
+    uint32_t     *uses;     /* of every value, for joins */
+    IrValueVector phis;     /* operands of the phis needed, `count` each */
+    IrValueVector values;
+    size_t        cost;     /* phis that take moves */
+};
+
+
+/**
+ * The instruction `p` of the tail of member `i`; `p == k` is its
+ * terminator.
+ */
+static __Inline IrValue _defer_at(Defer *self, size_t i, size_t p) {
+    IrValueVector *list = &ir_block(self->fn, self->members[i])->instrs;
+
+    return list->data[list->count - 1 - self->k + p];
+}
+
+
+static bool _defer_alike(IrFunction *fn, IrValue a, IrValue b) {
+    IrInstr *x = ir_instr(fn, a), *y = ir_instr(fn, b);
+    uint32_t na, nb;
+
+    ir_operands(fn, a, &na);
+    ir_operands(fn, b, &nb);
+
+    return x->op == y->op && x->imm == y->imm && na == nb &&
+        x->op != CL_IR_PHI;
+}
+
+
+/**
+ * How many instructions before the terminators of two blocks
+ * look alike, phis left out.
+ */
+static size_t _defer_common(IrFunction *fn, IrBlockId a, IrBlockId b) {
+    IrValueVector *x = &ir_block(fn, a)->instrs;
+    IrValueVector *y = &ir_block(fn, b)->instrs;
+    size_t end_x = x->count - 1, end_y = y->count - 1;
+    size_t phis_x = _phi_count(fn, a), phis_y = _phi_count(fn, b);
+    size_t k = 0;
+
+    while (k < DEFER_MAX_TAIL && end_x - k > phis_x && end_y - k > phis_y &&
+        _defer_alike(fn, x->data[end_x - k - 1], y->data[end_y - k - 1])) {
+        k++;
+    }
+
+    return k;
+}
+
+
+/**
+ * Where in its tail every member has the value it has in
+ * `self->values`: the same place in each, in `*position`, or
+ * nowhere in any, SIZE_MAX. Fails when the members disagree.
+ */
+static bool _defer_source(Defer *self, size_t *position) {
+    IrFunction *fn = self->fn;
+
+    *position = SIZE_MAX;
+
+    for (size_t i = 0; i < self->count; i++) {
+        IrValue value = self->values.data[i];
+        size_t at = SIZE_MAX;
+
+        if (ir_instr(fn, value)->block == self->members[i]) {
+            for (size_t p = 0; p < self->k && at == SIZE_MAX; p++) {
+                at = (_defer_at(self, i, p) == value) ? p : SIZE_MAX;
+            }
+        }
+
+        if (i > 0 && at != *position) {
+            return false;
+        }
+
+        *position = at;
+    }
+
+    return true;
+}
+
+
+/**
+ * Gathers operand `j` of tail instruction `p` of every member
+ * into `self->values`.
+ */
+static bool _defer_gather(Defer *self, size_t p, uint32_t j) {
+    self->values.count = 0;
+
+    if (!ir_value_vector_reserve(&self->values, self->count)) {
+        self->fn->failed = true;
+        return false;
+    }
+
+    for (size_t i = 0; i < self->count; i++) {
+        uint32_t n;
+        IrValue *args = ir_operands(self->fn, _defer_at(self, i, p), &n);
+
+        self->values.data[self->values.count++] = ir_resolve(self->fn,
+            args[j]);
+    }
+
+    return true;
+}
+
+
+static __Inline bool _defer_uniform(Defer *self) {
+    for (size_t i = 1; i < self->count; i++) {
+        if (self->values.data[i] != self->values.data[0]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * The phi that takes `self->values`, by index, adding it when
+ * `add` is set; SIZE_MAX when there is none.
+ */
+static size_t _defer_phi(Defer *self, bool add) {
+    IrValue *values = self->values.data;
+    size_t n = self->count;
+
+    for (size_t at = 0; at < self->phis.count; at += n) {
+        if (memcmp(&self->phis.data[at], values, n * sizeof(IrValue)) == 0) {
+            return at / n;
+        }
+    }
+
+    if (!add) {
+        return SIZE_MAX;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (!ir_value_vector_push(&self->phis, values[i])) {
+            self->fn->failed = true;
+            return SIZE_MAX;
+        }
+    }
+
+    /* constants load straight into the register of the phi */
+    for (size_t i = 0; i < n; i++) {
+        IrOp op = _op(self->fn, values[i]);
+
+        if (op != CL_IR_CONST && op != CL_IR_STRING) {
+            self->cost++;
+            break;
+        }
+    }
+
+    return self->phis.count / n - 1;
+}
+
+
+/**
+ * Whether the values of the tails of a join are used only by
+ * the tails and by the phis of the join.
+ */
+static bool _defer_used_inside(Defer *self) {
+    IrFunction *fn = self->fn;
+    IrBlock *join = ir_block(fn, self->into);
+    size_t phis = _phi_count(fn, self->into);
+
+    for (size_t i = 0; i < self->count; i++) {
+        for (size_t p = 0; p < self->k; p++) {
+            IrValue value = _defer_at(self, i, p);
+            uint32_t inside = 0, n;
+
+            for (size_t q = p + 1; q < self->k; q++) {
+                IrValue *args = ir_operands(fn, _defer_at(self, i, q), &n);
+
+                for (uint32_t j = 0; j < n; j++) {
+                    inside += (ir_resolve(fn, args[j]) == value);
+                }
+            }
+
+            for (size_t q = 0; q < phis; q++) {
+                IrValue *args = ir_operands(fn, join->instrs.data[q], &n);
+
+                inside += (ir_resolve(fn, args[i]) == value);
+            }
+
+            if (inside != self->uses[value]) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * Whether the members may share their last `self->k`
+ * instructions, and whether that saves any: every copy takes
+ * the place of `count` of them, while the phis take moves and
+ * returns a jump each.
+ */
+static bool _defer_check(Defer *self) {
+    IrFunction *fn = self->fn;
+    bool returns = self->into == CL_IR_NO_BLOCK;
+    size_t saved, spent;
+
+    self->phis.count = 0;
+    self->cost = 0;
+
+    for (size_t p = 0; p <= self->k; p++) {
+        uint32_t n;
+
+        ir_operands(fn, _defer_at(self, 0, p), &n);
+
+        for (uint32_t j = 0; j < n; j++) {
+            size_t position;
+
+            if (!_defer_gather(self, p, j) || !_defer_source(self, &position)) {
+                return false;
+            }
+
+            if (position == SIZE_MAX && !_defer_uniform(self) &&
+                _defer_phi(self, true) == SIZE_MAX) {
+                return false;
+            }
+        }
+    }
+
+    if (!returns) {
+        size_t phis = _phi_count(fn, self->into);
+
+        for (size_t q = 0; q < phis; q++) {
+            uint32_t n;
+            IrValue *args = ir_operands(fn,
+                ir_block(fn, self->into)->instrs.data[q], &n);
+            size_t position;
+
+            self->values.count = 0;
+
+            for (size_t i = 0; i < self->count; i++) {
+                if (!ir_value_vector_push(&self->values,
+                    ir_resolve(fn, args[i]))) {
+                    fn->failed = true;
+                    return false;
+                }
+            }
+
+            if (!_defer_source(self, &position)) {
+                return false;
+            }
+        }
+
+        if (!_defer_used_inside(self)) {
+            return false;
+        }
+    }
+
+    saved = self->count * self->k;
+    spent = self->count * self->cost + self->k + (returns ? 1 : 0);
+
+    return saved > spent;
+}
+
+
+/**
+ * Operand `j` of tail instruction `p`, as the shared copy sees
+ * it.
+ */
+static IrValue _defer_operand(Defer *self, size_t p, uint32_t j,
+    const IrValue *copies, const IrValue *phis) {
+    size_t position;
+
+    _defer_gather(self, p, j);
+    _defer_source(self, &position);
+
+    if (position != SIZE_MAX) {
+        return copies[position];
+    }
+
+    return _defer_uniform(self)
+        ? self->values.data[0] : phis[_defer_phi(self, false)];
+}
+
+
+static bool _defer_apply(Defer *self) {
+    IrFunction *fn = self->fn;
+    IrBlockId into = self->into;
+    size_t n = self->count, k = self->k;
+    size_t phi_count = self->phis.count / n;
+    IrValue *copies = calloc(k + 1, sizeof(IrValue));
+    IrValue *phis = calloc(phi_count + 1, sizeof(IrValue));
+    IrValueVector operands = { 0 };
+
+    if (!copies || !phis) {
+        free(copies);
+        free(phis);
+        fn->failed = true;
+        return false;
+    }
+
+    if (into == CL_IR_NO_BLOCK) {
+        /* the new exit goes after the last of the returns */
+        size_t last = 0;
+
+        into = ir_block_add(fn);
+
+        for (size_t i = 0; i < fn->layout.count; i++) {
+            for (size_t m = 0; m < n; m++) {
+                last = (fn->layout.data[i] == self->members[m]) ? i : last;
+            }
+        }
+
+        if (into == CL_IR_NO_BLOCK ||
+            !ir_block_id_vector_push(&fn->layout, into)) {
+            fn->failed = true;
+        } else {
+            memmove(&fn->layout.data[last + 2], &fn->layout.data[last + 1],
+                (fn->layout.count - last - 2) * sizeof(IrBlockId));
+            fn->layout.data[last + 1] = into;
+        }
+
+        for (size_t m = 0; m < n && !fn->failed; m++) {
+            if (!ir_block_id_vector_push(&ir_block(fn, into)->preds,
+                self->members[m])) {
+                fn->failed = true;
+            }
+        }
+    }
+
+    for (size_t q = 0; q < phi_count && !fn->failed; q++) {
+        uint32_t unused;
+
+        phis[q] = ir_phi_new(fn, into, (uint32_t)n);
+
+        if (phis[q] != CL_IR_NONE) {
+            memcpy(ir_operands(fn, phis[q], &unused),
+                &self->phis.data[q * n], n * sizeof(IrValue));
+        }
+    }
+
+    size_t at = _phi_count(fn, into);
+    size_t end = (self->into == CL_IR_NO_BLOCK) ? k + 1 : k;
+
+    for (size_t p = 0; p < end && !fn->failed; p++) {
+        IrInstr copy = *ir_instr(fn, _defer_at(self, 0, p));
+        uint32_t count;
+
+        ir_operands(fn, _defer_at(self, 0, p), &count);
+        operands.count = 0;
+
+        for (uint32_t j = 0; j < count; j++) {
+            IrValue value = _defer_operand(self, p, j, copies, phis);
+
+            if (!ir_value_vector_push(&operands, value)) {
+                fn->failed = true;
+            }
+        }
+
+        if (ir_op_operands(copy.op) != CL_IR_VARIADIC) {
+            memcpy(copy.args, operands.data, count * sizeof(IrValue));
+        } else if (ir_value_vector_reserve(&fn->extra,
+            fn->extra.count + count + 1)) {
+            copy.args[0] = (IrValue)fn->extra.count;
+            memcpy(&fn->extra.data[fn->extra.count], operands.data,
+                count * sizeof(IrValue));
+            fn->extra.count += count;
+        } else {
+            fn->failed = true;
+        }
+
+        copies[p] = fn->failed ? CL_IR_NONE : ir_insert(fn, into, at + p, copy);
+    }
+
+    if (self->into != CL_IR_NO_BLOCK) {
+        /* the phis of the join that took the tails take the copy */
+        size_t count = _phi_count(fn, into);
+
+        for (size_t q = 0; q < count && !fn->failed; q++) {
+            IrValue phi = ir_block(fn, into)->instrs.data[q];
+            uint32_t unused;
+            IrValue *args = ir_operands(fn, phi, &unused);
+            size_t position;
+
+            self->values.count = 0;
+
+            for (size_t i = 0; i < n; i++) {
+                self->values.data[self->values.count++] =
+                    ir_resolve(fn, args[i]);
+            }
+
+            _defer_source(self, &position);
+
+            if (position != SIZE_MAX) {
+                ir_replace(fn, phi, copies[position]);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < n && !fn->failed; i++) {
+        for (size_t p = 0; p < k; p++) {
+            ir_remove(fn, _defer_at(self, i, p));
+        }
+
+        if (self->into == CL_IR_NO_BLOCK) {
+            IrInstr *term = ir_instr(fn, _defer_at(self, i, k));
+
+            term->op = CL_IR_JMP;
+            term->args[0] = CL_IR_NONE;
+            term->imm = 0;
+            ir_set_target(term, 0, into);
+        }
+    }
+
+    free(copies);
+    free(phis);
+    ir_value_vector_free(&operands);
+
+    return !fn->failed;
+}
+
+
+/**
+ * Tries the longest tail the members share first, then shorter
+ * ones, since a value used past the end of a shorter one only
+ * takes a phi.
+ */
+static bool _defer_try(Defer *self, size_t longest) {
+    for (self->k = longest; self->k > 0 && !self->fn->failed; self->k--) {
+        if (_defer_check(self)) {
+            return _defer_apply(self);
+        }
+    }
+
+    return false;
+}
+
+
+/**
+ * The returns, grouped by what their last instruction looks like.
+ */
+static bool _defer_returns(Defer *self, IrOp kind) {
+    IrFunction *fn = self->fn;
+    size_t blocks = fn->blocks.count;
+    bool *taken = calloc(blocks, sizeof(bool));
+    bool changed = false;
+
+    self->members = malloc(blocks * sizeof(IrBlockId));
+    self->into = CL_IR_NO_BLOCK;
+
+    if (!taken || !self->members) {
+        fn->failed = true;
+    }
+
+    for (IrBlockId b = 0; b < blocks && !fn->failed; b++) {
+        IrBlock *block = ir_block(fn, b);
+
+        if (block->dead || taken[b] || _op(fn, ir_terminator(fn, b)) != kind) {
+            continue;
+        }
+
+        size_t longest = DEFER_MAX_TAIL;
+
+        self->count = 0;
+        self->members[self->count++] = b;
+
+        for (IrBlockId other = b + 1; other < blocks; other++) {
+            size_t common;
+
+            if (ir_block(fn, other)->dead || taken[other] ||
+                _op(fn, ir_terminator(fn, other)) != kind ||
+                (common = _defer_common(fn, b, other)) == 0) {
+                continue;
+            }
+
+            taken[other] = true;
+            longest = (common < longest) ? common : longest;
+            self->members[self->count++] = other;
+        }
+
+        if (self->count > 1) {
+            changed |= _defer_try(self, longest);
+        }
+    }
+
+    free(taken);
+    free(self->members);
+    self->members = NULL;
+
+    return changed;
+}
+
+
+/**
+ * Blocks that jump to the same block and to nothing else.
+ */
+static bool _defer_joins(Defer *self) {
+    IrFunction *fn = self->fn;
+    bool changed = false;
+
+    self->uses = _use_counts(fn);
+
+    for (IrBlockId b = 1; b < fn->blocks.count && self->uses; b++) {
+        IrBlock *join = ir_block(fn, b);
+        size_t longest = DEFER_MAX_TAIL;
+        bool ok = !join->dead && join->preds.count > 1;
+
+        self->members = join->preds.data;
+        self->count = join->preds.count;
+        self->into = b;
+
+        for (size_t i = 0; ok && i < self->count; i++) {
+            IrBlockId pred = self->members[i];
+            IrInstr *term = ir_instr(fn, ir_terminator(fn, pred));
+
+            ok = pred != b && term->op == CL_IR_JMP &&
+                ir_pred_index(fn, b, pred) == i;
+
+            if (ok && i > 0) {
+                size_t common = _defer_common(fn, self->members[0], pred);
+
+                longest = (common < longest) ? common : longest;
+            }
+        }
+
+        /* the members are the preds, which apply does not change */
+        if (ok && longest > 0 && _defer_try(self, longest)) {
+            free(self->uses);
+            ir_settle(fn);
+            self->uses = _use_counts(fn);
+            changed = true;
+        }
+    }
+
+    free(self->uses);
+    self->members = NULL;
+
+    return changed;
+}
+
+
+static bool _defer(IrFunction *fn) {
+    Defer self = { .fn = fn };
+
+    _defer_returns(&self, CL_IR_RET);
+    ir_settle(fn);
+    _defer_returns(&self, CL_IR_RET0);
+    ir_settle(fn);
+    _defer_joins(&self);
+
+    ir_value_vector_free(&self.phis);
+    ir_value_vector_free(&self.values);
+
+    return !fn->failed;
+}
+
+
+/* == pass manager == */
+
+
+static const Pass PASSES[] = {
+    { "sccp",  _sccp  },
+    { "cfg",   _cfg   },
+    { "cse",   _cse   },
+    { "dce",   _dce   },
+    { "defer", _defer },
+};
+
+
+static double _now(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+/**
+ * Makes a PassManager that runs `passes`, a list of pass names
+ * separated by commas, or CL_PASSES_DEFAULT when NULL. Returns
+ * NULL when a name is not one of a pass.
+ */
+PassManager *pass_manager_new(str_t passes) {
+    PassManager *new_manager = calloc(1, sizeof(PassManager));
+
+    if (!new_manager) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    for (str_t at = passes ? passes : CL_PASSES_DEFAULT; *at; ) {
+        size_t length = strcspn(at, ",");
+        const Pass *found = NULL;
+
+        for (size_t i = 0; i < CL_N_ELEMS(PASSES) && !found; i++) {
+            if (strlen(PASSES[i].name) == length &&
+                strncmp(PASSES[i].name, at, length) == 0) {
+                found = &PASSES[i];
+            }
+        }
+
+        if (!found || new_manager->count == PASS_MAX) {
+            cl_error(found ? "too many passes\n" : "no pass named '%.*s'\n",
+                (int)length, at);
+            free(new_manager);
+            return NULL;
+        }
+
+        new_manager->passes[new_manager->count++] = found;
+        at += length + (at[length] == ',');
+    }
+
+    return new_manager;
+}
+
+
+/**
+ * Writes every function to `out` after lifting and after every
+ * pass, or stops when `out` is NULL.
+ */
+void pass_manager_dump(PassManager *self, FILE *out) {
+    self->dump = out;
+}
+
+
+void pass_manager_time(PassManager *self, bool enabled) {
+    self->time = enabled;
+}
+
+
+static bool _checked(IrFunction *fn, str_t name, str_t after) {
+#ifdef DEBUG
+    str_t why;
+
+    if (!ir_verify(fn, &why)) {
+        cl_error("%s: bad IR after %s: %s\n", name, after, why);
+        return false;
+    }
+#else
+    (void)fn, (void)name, (void)after;
+#endif /* DEBUG */
+
+    return true;
+}
+
+
+static void _dumped(PassManager *self, IrFunction *fn, str_t name,
+    str_t after) {
+    if (self->dump) {
+        fprintf(self->dump, ";; %s after %s\n", name, after);
+        ir_dump(fn, name, self->dump);
+        fputc('\n', self->dump);
+    }
+}
+
+
+/**
+ * Optimizes one function of bytecode as codegen wrote it, into a
+ * new one in `*code`, `*size` bytes long, which the caller
+ * frees. Returns false when the function is better left as it
+ * is: it uses bytecode codegen does not write, lowering it needs
+ * too many registers, or memory ran out.
+ */
+bool pass_manager_optimize(PassManager *self,
+    const BytecodeFunction *function, str_t name, IrArityFn arity,
+    void *user_data, uint8_t **code, size_t *size) {
+    double start = self->time ? _now() : 0, end;
+    IrFunction *fn = ir_lift(function, arity, user_data);
+    bool ok = fn && _checked(fn, name, "lift");
+
+    self->functions++;
+    self->code_in += function->code_count;
+
+    if (ok) {
+        _dumped(self, fn, name, "lift");
+    }
+
+    if (self->time) {
+        end = _now();
+        self->seconds[0] += end - start;
+        start = end;
+    }
+
+    for (size_t i = 0; ok && i < self->count; i++) {
+        const Pass *pass = self->passes[i];
+
+        ok = pass->run(fn) && !fn->failed;
+
+        if (ok) {
+            ir_settle(fn);
+            ok = _checked(fn, name, pass->name);
+        }
+
+        if (self->time) {
+            end = _now();
+            self->seconds[i + 1] += end - start;
+            start = end;
+        }
+
+        if (ok) {
+            _dumped(self, fn, name, pass->name);
+        }
+    }
+
+    ok = ok && ir_lower(fn, code, size);
+
+    if (self->time) {
+        self->seconds[self->count + 1] += _now() - start;
+    }
+
+    ir_free(fn);
+
+    if (!ok) {
+        self->kept++;
+        self->code_out += function->code_count;
+        return false;
+    }
+
+    self->code_out += ((const BytecodeFunction *)*code)->code_count;
+
+    return true;
+}
+
+
+/**
+ * Writes where the time went, pass by pass, and how much code
+ * the passes took away.
+ */
+void pass_manager_report(PassManager *self, FILE *out) {
+    double total = 0;
+
+    for (size_t i = 0; i < self->count + 2; i++) {
+        total += self->seconds[i];
+    }
+
+    fprintf(out, "%-12s %12s %8s\n", "pass", "seconds", "share");
+
+    for (size_t i = 0; i < self->count + 2; i++) {
+        str_t name = (i == 0) ? "lift"
+            : (i == self->count + 1) ? "lower" : self->passes[i - 1]->name;
+
+        fprintf(out, "%-12s %12.6f %7.1f%%\n", name, self->seconds[i],
+            total > 0 ? 100 * self->seconds[i] / total : 0);
+    }
+
+    fprintf(out, "%-12s %12.6f\n", "total", total);
+    fprintf(out, "%" PRIu64 " functions, %" PRIu64 " instructions in, "
+        "%" PRIu64 " out, %" PRIu64 " left as written\n", self->functions,
+        self->code_in, self->code_out, self->kept);
+}
+
+
+void pass_manager_free(PassManager *self) {
+    free(self);
+}
@@ -0,0 +1,190 @@
+#define CL_LOG_SCOPE "pool"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "cl-log.h"
+#include "cl-pool.h"
+
+
+CL_TYPE(PoolJob) {
+    PoolJobFn fn;
+    void     *user_data;
+    PoolJob  *next;
+};
+
+
+CL_TYPE(ThreadPool) {
+    pthread_mutex_t lock;
+    pthread_cond_t  has_jobs;   /* signaled when a job is queued */
+    pthread_cond_t  idle;       /* signaled when the last job ends */
+
+    PoolJob *head;
+    PoolJob *tail;
+
+    uint32_t pending;   /* queued and running jobs */
+    bool     stopping;
+
+    pthread_t *workers;
+    uint32_t   worker_count;
+};
+
+
+static void *_pool_worker(void *arg) {
+    ThreadPool *self = arg;
+
+    pthread_mutex_lock(&self->lock);
+
+    for (;;) {
+        while (!self->head && !self->stopping) {
+            pthread_cond_wait(&self->has_jobs, &self->lock);
+        }
+
+        if (!self->head) {
+            break; /* stopping */
+        }
+
+        PoolJob *job = self->head;
+
+        self->head = job->next;
+
+        if (!self->head) {
+            self->tail = NULL;
+        }
+
+        pthread_mutex_unlock(&self->lock);
+
+        job->fn(job->user_data);
+        free(job);
+
+        pthread_mutex_lock(&self->lock);
+
+        if (--self->pending == 0) {
+            pthread_cond_broadcast(&self->idle);
+        }
+    }
+
+    pthread_mutex_unlock(&self->lock);
+
+    return NULL;
+}
+
+
+ThreadPool *pool_new(uint32_t threads) {
+    ThreadPool *new_pool = calloc(1, sizeof(ThreadPool));
+
+    if (!new_pool) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    pthread_mutex_init(&new_pool->lock, NULL);
+    pthread_cond_init(&new_pool->has_jobs, NULL);
+    pthread_cond_init(&new_pool->idle, NULL);
+
+    if (threads <= 1) {
+        return new_pool;
+    }
+
+    new_pool->workers = calloc(threads, sizeof(pthread_t));
+
+    if (!new_pool->workers) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        pool_free(new_pool);
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < threads; i++) {
+        int err = pthread_create(&new_pool->workers[i], NULL, _pool_worker,
+            new_pool);
+
+        if (err != 0) {
+            cl_debug("%s: %s\n", __func__, strerror(err));
+            break;
+        }
+
+        new_pool->worker_count++;
+    }
+
+    if (new_pool->worker_count == 0) {
+        pool_free(new_pool);
+        return NULL;
+    }
+
+    return new_pool;
+}
+
+
+bool pool_submit(ThreadPool *self, PoolJobFn fn, void *user_data) {
+    if (self->worker_count == 0) {
+        fn(user_data);
+        return true;
+    }
+
+    PoolJob *job = malloc(sizeof(PoolJob));
+
+    if (!job) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return false;
+    }
+
+    job->fn = fn;
+    job->user_data = user_data;
+    job->next = NULL;
+
+    pthread_mutex_lock(&self->lock);
+
+    if (self->tail) {
+        self->tail->next = job;
+    } else {
+        self->head = job;
+    }
+
+    self->tail = job;
+    self->pending++;
+
+    pthread_cond_signal(&self->has_jobs);
+    pthread_mutex_unlock(&self->lock);
+
+    return true;
+}
+
+
+void pool_wait(ThreadPool *self) {
+    pthread_mutex_lock(&self->lock);
+
+    while (self->pending > 0) {
+        pthread_cond_wait(&self->idle, &self->lock);
+    }
+
+    pthread_mutex_unlock(&self->lock);
+}
+
+
+void pool_free(ThreadPool *self) {
+    pthread_mutex_lock(&self->lock);
+    self->stopping = true;
+    pthread_cond_broadcast(&self->has_jobs);
+    pthread_mutex_unlock(&self->lock);
+
+    for (uint32_t i = 0; i < self->worker_count; i++) {
+        pthread_join(self->workers[i], NULL);
+    }
+
+    pthread_cond_destroy(&self->idle);
+    pthread_cond_destroy(&self->has_jobs);
+    pthread_mutex_destroy(&self->lock);
+
+    free(CL_VOIDPTR(self->workers));
+    free(CL_VOIDPTR(self));
+}
+
+
+uint32_t cl_cpu_count(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return (count > 0) ? (uint32_t)count : 1;
+}
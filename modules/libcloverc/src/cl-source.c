@@ -4,15 +4,30 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #include "cl-source.h"
 #include "cl-log.h"
 
 
+static __Inline void *_alloc(Arena *arena, size_t size) {
+    return arena ? arena_alloc(arena, size) : malloc(size);
+}
+
+
 /**
- * Reads the text from a file into a malloc'd buffer.
+ * Reads the text from a file into a buffer from the arena, or
+ * from malloc when there is none.
  */
-static bool _read_file(str_t path, char **out_text, size_t *out_size) {
+static bool _read_file(Arena *arena, str_t path, char **out_text,
+    size_t *out_size) {
     FILE *fp = fopen(path, "r");
     size_t size = 0;
     char *text = NULL;
@@ -30,12 +45,28 @@ static bool _read_file(str_t path, char **out_text, size_t *out_size) {
         return false;
     }
 
-    size = ftell(fp);
+    long end = ftell(fp);
+
+    if (end < 0) {
+        cl_error("failed to open file: %s\n", strerror(errno));
+        fclose(fp);
+        return false;
+    }
+
+    /* offsets into the text are 32 bits everywhere past here */
+    size = (size_t)end;
+
+    if (size > UINT32_MAX) {
+        cl_error("source too large: %zu bytes\n", size);
+        fclose(fp);
+        return false;
+    }
+
     rewind(fp);
 
     // allocate text buffer
 
-    text = malloc(size + 1);
+    text = _alloc(arena, size + 1);
 
     if (!text) {
         cl_error("out of memory!\n");
@@ -48,7 +79,10 @@ static bool _read_file(str_t path, char **out_text, size_t *out_size) {
     size_t total = 0;
     size_t count = 0;
 
-    while ((count = fread(&text[total], 1, 1024, fp)) > 0) {
+    /* the file may change while it is read, keep to the buffer
+       and to what was actually read */
+    while (total < size &&
+           (count = fread(&text[total], 1, size - total, fp)) > 0) {
         total += count;
     }
 
@@ -56,6 +90,56 @@ static bool _read_file(str_t path, char **out_text, size_t *out_size) {
 
     fclose(fp);
 
+    *out_text = text;
+    *out_size = total;
+
+    return true;
+}
+
+
+/**
+ * Maps a file straight from the page cache. The bytes between
+ * the end of the file and the end of its last page are zeroed
+ * by the kernel, which gives us the NUL terminator for free,
+ * so files whose size is a multiple of the page size (and
+ * anything that is not a regular file) are left to
+ * _read_file, as are files too large for 32-bit offsets, which
+ * it rejects.
+ */
+static bool _map_file(str_t path, char **out_text, size_t *out_size) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0) {
+        return false;
+    }
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+
+    size_t size = (size_t)st.st_size;
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    if (size < CL_SOURCE_MAP_THRESHOLD || size > UINT32_MAX ||
+        page_size <= 0 || size % (size_t)page_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    void *text = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if (text == MAP_FAILED) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return false;
+    }
+
+    /* the lexer reads the text front to back exactly once */
+    posix_madvise(text, size, POSIX_MADV_SEQUENTIAL);
+
     *out_text = text;
     *out_size = size;
 
@@ -63,30 +147,829 @@ static bool _read_file(str_t path, char **out_text, size_t *out_size) {
 }
 
 
-Source *source_new(str_t path) {
-    Source *new_source = malloc(sizeof(Source));
+/* == character class scanners == */
+
+
+#define __CHR_NAME  CL_BIT(1)   /* A-Z a-z 0-9 _ */
+#define __CHR_BLANK CL_BIT(2)   /* space \t \r */
+#define __CHR_SPACE CL_BIT(3)   /* space \t \r \n */
+#define __CHR_EOL   CL_BIT(4)   /* \r \n */
+
+
+static const uint8_t CHAR_CLASSES[256] = {
+    ['0' ... '9'] = __CHR_NAME,
+    ['A' ... 'Z'] = __CHR_NAME,
+    ['a' ... 'z'] = __CHR_NAME,
+    ['_']         = __CHR_NAME,
+    [' ']         = __CHR_BLANK | __CHR_SPACE,
+    ['\t']        = __CHR_BLANK | __CHR_SPACE,
+    ['\r']        = __CHR_BLANK | __CHR_SPACE | __CHR_EOL,
+    ['\n']        = __CHR_SPACE | __CHR_EOL,
+};
+
+
+typedef size_t (*ScanFn)(const char *text, size_t length, char arg);
+typedef size_t (*Utf8Fn)(const char *text, size_t length, bool *ascii);
+
+
+/**
+ * One implementation of every scanner. The right one for the
+ * running CPU is picked once, before main() starts.
+ */
+CL_TYPE(Scanner) {
+    str_t  name;
+    ScanFn span[__CL_CHARS_MAX];
+    ScanFn cspan_eol;
+    ScanFn cspan_quote;
+    ScanFn count_char;
+    Utf8Fn validate_utf8;
+};
+
+
+static __Inline size_t __scalar_span(const char *text, size_t length,
+    uint8_t cls) {
+    size_t i = 0;
+
+    while (i < length && (CHAR_CLASSES[(uint8_t)text[i]] & cls)) {
+        i++;
+    }
+
+    return i;
+}
+
+
+static __Inline size_t __scalar_cspan(const char *text, size_t length,
+    uint8_t cls) {
+    size_t i = 0;
+
+    while (i < length && !(CHAR_CLASSES[(uint8_t)text[i]] & cls)) {
+        i++;
+    }
+
+    return i;
+}
+
+
+static __Inline size_t __scalar_cspan_quote(const char *text, size_t length,
+    char quote) {
+    size_t i = 0;
+
+    while (i < length && text[i] != quote && text[i] != '\\') {
+        i++;
+    }
+
+    return i;
+}
+
+
+static size_t scalar_span_name(const char *text, size_t length, char arg) {
+    (void)arg;
+
+    return __scalar_span(text, length, __CHR_NAME);
+}
+
+
+static size_t scalar_span_blank(const char *text, size_t length, char arg) {
+    (void)arg;
+
+    return __scalar_span(text, length, __CHR_BLANK);
+}
+
+
+static size_t scalar_span_space(const char *text, size_t length, char arg) {
+    (void)arg;
+
+    return __scalar_span(text, length, __CHR_SPACE);
+}
+
+
+static size_t scalar_cspan_eol(const char *text, size_t length, char arg) {
+    (void)arg;
+
+    return __scalar_cspan(text, length, __CHR_EOL);
+}
+
+
+static size_t scalar_cspan_quote(const char *text, size_t length, char quote) {
+    return __scalar_cspan_quote(text, length, quote);
+}
+
+
+static size_t scalar_count_char(const char *text, size_t length, char ch) {
+    size_t count = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        count += (text[i] == ch);
+    }
+
+    return count;
+}
+
+
+/* == UTF-8 validation == */
+
+
+static __Inline bool _is_continuation(uint8_t byte) {
+    return (byte & 0xC0) == 0x80;
+}
+
+
+/**
+ * Returns the length of the well-formed UTF-8 sequence at the
+ * start of `text`, or 0 when it is malformed: a stray or missing
+ * continuation byte, an overlong form, a surrogate, a code point
+ * above U+10FFFF or a sequence cut short by the end.
+ */
+static __Inline size_t _utf8_sequence(const uint8_t *text, size_t length) {
+    uint8_t lead = text[0];
+
+    if (lead < 0x80) {
+        return 1;
+    }
+
+    if (lead < 0xC2) {
+        return 0;
+    }
+
+    if (lead < 0xE0) {
+        return (length >= 2 && _is_continuation(text[1])) ? 2 : 0;
+    }
+
+    if (lead < 0xF0) {
+        uint8_t lo = (lead == 0xE0) ? 0xA0 : 0x80;   /* overlong */
+        uint8_t hi = (lead == 0xED) ? 0x9F : 0xBF;   /* surrogates */
+
+        return (length >= 3 && text[1] >= lo && text[1] <= hi &&
+                _is_continuation(text[2])) ? 3 : 0;
+    }
+
+    if (lead < 0xF5) {
+        uint8_t lo = (lead == 0xF0) ? 0x90 : 0x80;   /* overlong */
+        uint8_t hi = (lead == 0xF4) ? 0x8F : 0xBF;   /* above U+10FFFF */
+
+        return (length >= 4 && text[1] >= lo && text[1] <= hi &&
+                _is_continuation(text[2]) &&
+                _is_continuation(text[3])) ? 4 : 0;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Eight ASCII bytes at a time, a sequence at a time otherwise.
+ * Returns the offset of the first malformed sequence, or
+ * `length` when there is none.
+ */
+static size_t scalar_validate_utf8(const char *text, size_t length,
+    bool *ascii) {
+    const uint8_t *bytes = (const uint8_t *)text;
+    bool multibyte = false;
+    size_t i = 0;
+
+    while (i < length) {
+        if (i + 8 <= length) {
+            uint64_t chunk;
+
+            memcpy(&chunk, &bytes[i], sizeof(chunk));
+
+            if ((chunk & 0x8080808080808080ULL) == 0) {
+                i += 8;
+                continue;
+            }
+        }
+
+        size_t n = _utf8_sequence(&bytes[i], length - i);
+
+        if (n == 0) {
+            *ascii = false;
+            return i;
+        }
+
+        multibyte |= (n > 1);
+        i += n;
+    }
+
+    *ascii = !multibyte;
+
+    return length;
+}
+
+
+/**
+ * Where the scalar code has to restart to check the sequences
+ * that may run into `offset`: at the last byte before it that
+ * is not a continuation, at most 4 bytes back.
+ */
+static __Inline size_t _utf8_restart(const char *text, size_t offset) {
+    size_t start = offset;
+
+    while (start > 0 && offset - start < 4) {
+        start--;
+
+        if (!_is_continuation((uint8_t)text[start])) {
+            break;
+        }
+    }
+
+    return start;
+}
+
+
+static const Scanner SCALAR_SCANNER = {
+    .name = "scalar",
+    .span = {
+        [CL_CHARS_NAME]  = scalar_span_name,
+        [CL_CHARS_BLANK] = scalar_span_blank,
+        [CL_CHARS_SPACE] = scalar_span_space,
+    },
+    .cspan_eol = scalar_cspan_eol,
+    .cspan_quote = scalar_cspan_quote,
+    .count_char = scalar_count_char,
+    .validate_utf8 = scalar_validate_utf8,
+};
+
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#define __cl_avx2 __attribute__((target("avx2")))
+
+/*
+ * Both vector widths share the same loop: classify a block,
+ * turn it into a bit mask with one bit per byte, and stop at
+ * the first byte that ends the run. The tail that does not
+ * fill a whole block is left to the scalar code, so no load
+ * ever reads past the end of the text.
+ */
+#define __DEFINE_SCAN(isa, attr, vec, width, load, movemask, match, stop,   \
+                      tail)                                                 \
+    static attr size_t isa##_##match(const char *text, size_t length,       \
+        char arg) {                                                         \
+        size_t i = 0;                                                       \
+                                                                            \
+        for (; i + width <= length; i += width) {                           \
+            vec v = load((const vec *)(text + i));                          \
+            uint64_t bits = (uint32_t)movemask(isa##_is_##match(v, arg));   \
+                                                                            \
+            if (!stop) {                                                    \
+                bits = ~bits & ((UINT64_C(1) << width) - 1);                \
+            }                                                               \
+                                                                            \
+            if (bits != 0) {                                                \
+                return i + __builtin_ctzll(bits);                           \
+            }                                                               \
+        }                                                                   \
+                                                                            \
+        return i + tail(text + i, length - i, arg);                         \
+    }
+
+
+#define __DEFINE_COUNT(isa, attr, vec, width, load, movemask, tail)         \
+    static attr size_t isa##_count_char(const char *text, size_t length,    \
+        char ch) {                                                          \
+        size_t i = 0;                                                       \
+        size_t count = 0;                                                   \
+                                                                            \
+        for (; i + width <= length; i += width) {                           \
+            vec v = load((const vec *)(text + i));                          \
+            count += __builtin_popcount(                                    \
+                (uint32_t)movemask(isa##_is_eq(v, ch)));                    \
+        }                                                                   \
+                                                                            \
+        return count + tail(text + i, length - i, ch);                      \
+    }
+
+
+/* SSE2 is part of every x86-64 CPU */
+
+static __Inline __m128i sse2_in_range(__m128i v, char lo, char hi) {
+    return _mm_and_si128(
+        _mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+        _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+}
+
+
+static __Inline __m128i sse2_is_eq(__m128i v, char ch) {
+    return _mm_cmpeq_epi8(v, _mm_set1_epi8(ch));
+}
+
+
+static __Inline __m128i sse2_is_span_name(__m128i v, char arg) {
+    (void)arg;
+
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+
+    return _mm_or_si128(
+        _mm_or_si128(sse2_in_range(lower, 'a', 'z'),
+                     sse2_in_range(v, '0', '9')),
+        sse2_is_eq(v, '_'));
+}
+
+
+static __Inline __m128i sse2_is_span_blank(__m128i v, char arg) {
+    (void)arg;
+
+    return _mm_or_si128(
+        _mm_or_si128(sse2_is_eq(v, ' '), sse2_is_eq(v, '\t')),
+        sse2_is_eq(v, '\r'));
+}
+
+
+static __Inline __m128i sse2_is_span_space(__m128i v, char arg) {
+    return _mm_or_si128(sse2_is_span_blank(v, arg), sse2_is_eq(v, '\n'));
+}
+
+
+static __Inline __m128i sse2_is_cspan_eol(__m128i v, char arg) {
+    (void)arg;
+
+    return _mm_or_si128(sse2_is_eq(v, '\n'), sse2_is_eq(v, '\r'));
+}
+
+
+static __Inline __m128i sse2_is_cspan_quote(__m128i v, char quote) {
+    return _mm_or_si128(sse2_is_eq(v, quote), sse2_is_eq(v, '\\'));
+}
+
+
+__DEFINE_SCAN(sse2, , __m128i, 16, _mm_loadu_si128, _mm_movemask_epi8,
+    span_name, false, scalar_span_name)
+__DEFINE_SCAN(sse2, , __m128i, 16, _mm_loadu_si128, _mm_movemask_epi8,
+    span_blank, false, scalar_span_blank)
+__DEFINE_SCAN(sse2, , __m128i, 16, _mm_loadu_si128, _mm_movemask_epi8,
+    span_space, false, scalar_span_space)
+__DEFINE_SCAN(sse2, , __m128i, 16, _mm_loadu_si128, _mm_movemask_epi8,
+    cspan_eol, true, scalar_cspan_eol)
+__DEFINE_SCAN(sse2, , __m128i, 16, _mm_loadu_si128, _mm_movemask_epi8,
+    cspan_quote, true, scalar_cspan_quote)
+__DEFINE_COUNT(sse2, , __m128i, 16, _mm_loadu_si128, _mm_movemask_epi8,
+    scalar_count_char)
+
+
+/**
+ * Skips 16 ASCII bytes at a time and checks the sequences
+ * starting at every other byte with the scalar code.
+ */
+static size_t sse2_validate_utf8(const char *text, size_t length,
+    bool *ascii) {
+    bool multibyte = false;
+    size_t i = 0;
+
+    while (i + 16 <= length) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(text + i));
+        uint32_t high = (uint32_t)_mm_movemask_epi8(v);
+
+        if (high == 0) {
+            i += 16;
+            continue;
+        }
+
+        i += __builtin_ctz(high);
+
+        size_t n = _utf8_sequence((const uint8_t *)text + i, length - i);
+
+        if (n == 0) {
+            *ascii = false;
+            return i;
+        }
+
+        multibyte |= (n > 1);
+        i += n;
+    }
+
+    size_t tail = i + scalar_validate_utf8(text + i, length - i, ascii);
+
+    *ascii = *ascii && !multibyte;
+
+    return tail;
+}
+
+
+static const Scanner SSE2_SCANNER = {
+    .name = "sse2",
+    .span = {
+        [CL_CHARS_NAME]  = sse2_span_name,
+        [CL_CHARS_BLANK] = sse2_span_blank,
+        [CL_CHARS_SPACE] = sse2_span_space,
+    },
+    .cspan_eol = sse2_cspan_eol,
+    .cspan_quote = sse2_cspan_quote,
+    .count_char = sse2_count_char,
+    .validate_utf8 = sse2_validate_utf8,
+};
+
+
+/* AVX2, used when the running CPU supports it */
+
+static __Inline __cl_avx2 __m256i avx2_in_range(__m256i v, char lo, char hi) {
+    return _mm256_and_si256(
+        _mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1)),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v));
+}
+
+
+static __Inline __cl_avx2 __m256i avx2_is_eq(__m256i v, char ch) {
+    return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(ch));
+}
+
+
+static __Inline __cl_avx2 __m256i avx2_is_span_name(__m256i v, char arg) {
+    (void)arg;
+
+    __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+
+    return _mm256_or_si256(
+        _mm256_or_si256(avx2_in_range(lower, 'a', 'z'),
+                        avx2_in_range(v, '0', '9')),
+        avx2_is_eq(v, '_'));
+}
+
+
+static __Inline __cl_avx2 __m256i avx2_is_span_blank(__m256i v, char arg) {
+    (void)arg;
+
+    return _mm256_or_si256(
+        _mm256_or_si256(avx2_is_eq(v, ' '), avx2_is_eq(v, '\t')),
+        avx2_is_eq(v, '\r'));
+}
+
+
+static __Inline __cl_avx2 __m256i avx2_is_span_space(__m256i v, char arg) {
+    return _mm256_or_si256(avx2_is_span_blank(v, arg), avx2_is_eq(v, '\n'));
+}
+
+
+static __Inline __cl_avx2 __m256i avx2_is_cspan_eol(__m256i v, char arg) {
+    (void)arg;
+
+    return _mm256_or_si256(avx2_is_eq(v, '\n'), avx2_is_eq(v, '\r'));
+}
+
+
+static __Inline __cl_avx2 __m256i avx2_is_cspan_quote(__m256i v, char quote) {
+    return _mm256_or_si256(avx2_is_eq(v, quote), avx2_is_eq(v, '\\'));
+}
+
+
+__DEFINE_SCAN(avx2, __cl_avx2, __m256i, 32, _mm256_loadu_si256,
+    _mm256_movemask_epi8, span_name, false, sse2_span_name)
+__DEFINE_SCAN(avx2, __cl_avx2, __m256i, 32, _mm256_loadu_si256,
+    _mm256_movemask_epi8, span_blank, false, sse2_span_blank)
+__DEFINE_SCAN(avx2, __cl_avx2, __m256i, 32, _mm256_loadu_si256,
+    _mm256_movemask_epi8, span_space, false, sse2_span_space)
+__DEFINE_SCAN(avx2, __cl_avx2, __m256i, 32, _mm256_loadu_si256,
+    _mm256_movemask_epi8, cspan_eol, true, sse2_cspan_eol)
+__DEFINE_SCAN(avx2, __cl_avx2, __m256i, 32, _mm256_loadu_si256,
+    _mm256_movemask_epi8, cspan_quote, true, sse2_cspan_quote)
+__DEFINE_COUNT(avx2, __cl_avx2, __m256i, 32, _mm256_loadu_si256,
+    _mm256_movemask_epi8, sse2_count_char)
+
+
+/*
+ * UTF-8 validation with the lookup algorithm of Keiser and
+ * Lemire ("Validating UTF-8 In Less Than One Instruction Per
+ * Byte", 2021). Every error shows in a pair of consecutive
+ * bytes: three 16-entry tables, indexed by the high and low
+ * nibble of the first byte and the high nibble of the second,
+ * give a bit per kind of error, and a pair is bad when all
+ * three agree on a bit. Only the third and fourth bytes of
+ * longer sequences need a separate check against the bytes 2
+ * and 3 places back.
+ */
+#define __UTF8_TOO_SHORT    (1 << 0)    /* 11______ 0_______, 11______ 11______ */
+#define __UTF8_TOO_LONG     (1 << 1)    /* 0_______ 10______ */
+#define __UTF8_OVERLONG_3   (1 << 2)    /* 11100000 100_____ */
+#define __UTF8_TOO_LARGE    (1 << 3)    /* 11110100 1001____, 11110101 ... */
+#define __UTF8_SURROGATE    (1 << 4)    /* 11101101 101_____ */
+#define __UTF8_OVERLONG_2   (1 << 5)    /* 1100000_ 10______ */
+#define __UTF8_TOO_LARGE_2  (1 << 6)    /* 11110101 1000____ ... */
+#define __UTF8_OVERLONG_4   (1 << 6)    /* 11110000 1000____ */
+#define __UTF8_TWO_CONTS    (1 << 7)    /* 10______ 10______ */
+#define __UTF8_CARRY        (__UTF8_TOO_SHORT | __UTF8_TOO_LONG | \
+                             __UTF8_TWO_CONTS)
+
+#define __UTF8_TABLE(...)   _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+
+/* the input shifted right by `n` bytes, the gap filled from `prev` */
+#define __avx2_prev(input, prev, n)                                         \
+    _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev, input, 0x21), \
+        16 - (n))
+
+
+static __Inline __cl_avx2 __m256i avx2_high_nibbles(__m256i v) {
+    return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+}
+
+
+static __Inline __cl_avx2 __m256i avx2_utf8_errors(__m256i input,
+    __m256i prev_input) {
+    const __m256i byte_1_high_table = __UTF8_TABLE(
+        /* 0_______ ASCII */
+        __UTF8_TOO_LONG, __UTF8_TOO_LONG, __UTF8_TOO_LONG, __UTF8_TOO_LONG,
+        __UTF8_TOO_LONG, __UTF8_TOO_LONG, __UTF8_TOO_LONG, __UTF8_TOO_LONG,
+        /* 10______ continuation */
+        __UTF8_TWO_CONTS, __UTF8_TWO_CONTS, __UTF8_TWO_CONTS, __UTF8_TWO_CONTS,
+        /* 1100____ two byte lead */
+        __UTF8_TOO_SHORT | __UTF8_OVERLONG_2,
+        /* 1101____ two byte lead */
+        __UTF8_TOO_SHORT,
+        /* 1110____ three byte lead */
+        __UTF8_TOO_SHORT | __UTF8_OVERLONG_3 | __UTF8_SURROGATE,
+        /* 1111____ four byte lead */
+        __UTF8_TOO_SHORT | __UTF8_TOO_LARGE | __UTF8_TOO_LARGE_2 |
+        __UTF8_OVERLONG_4);
+
+    const __m256i byte_1_low_table = __UTF8_TABLE(
+        /* ____0000 */
+        __UTF8_CARRY | __UTF8_OVERLONG_3 | __UTF8_OVERLONG_2 | __UTF8_OVERLONG_4,
+        /* ____0001 */
+        __UTF8_CARRY | __UTF8_OVERLONG_2,
+        /* ____001_ */
+        __UTF8_CARRY,
+        __UTF8_CARRY,
+        /* ____0100 */
+        __UTF8_CARRY | __UTF8_TOO_LARGE,
+        /* ____0101 to ____1111 */
+        __UTF8_CARRY | __UTF8_TOO_LARGE | __UTF8_TOO_LARGE_2,
+        __UTF8_CARRY | __UTF8_TOO_LARGE | __UTF8_TOO_LARGE_2,
+        __UTF8_CARRY | __UTF8_TOO_LARGE | __UTF8_TOO_LARGE_2,
+        __UTF8_CARRY | __UTF8_TOO_LARGE | __UTF8_TOO_LARGE_2,
+        __UTF8_CARRY | __UTF8_TOO_LARGE | __UTF8_TOO_LARGE_2,
+        __UTF8_CARRY | __UTF8_TOO_LARGE | __UTF8_TOO_LARGE_2,
+        __UTF8_CARRY | __UTF8_TOO_LARGE | __UTF8_TOO_LARGE_2,
+        __UTF8_CARRY | __UTF8_TOO_LARGE | __UTF8_TOO_LARGE_2,
+        /* ____1101 */
+        __UTF8_CARRY | __UTF8_TOO_LARGE | __UTF8_TOO_LARGE_2 | __UTF8_SURROGATE,
+        __UTF8_CARRY | __UTF8_TOO_LARGE | __UTF8_TOO_LARGE_2,
+        __UTF8_CARRY | __UTF8_TOO_LARGE | __UTF8_TOO_LARGE_2);
+
+    const __m256i byte_2_high_table = __UTF8_TABLE(
+        /* 0_______ ASCII */
+        __UTF8_TOO_SHORT, __UTF8_TOO_SHORT, __UTF8_TOO_SHORT, __UTF8_TOO_SHORT,
+        __UTF8_TOO_SHORT, __UTF8_TOO_SHORT, __UTF8_TOO_SHORT, __UTF8_TOO_SHORT,
+        /* 1000____ */
+        __UTF8_TOO_LONG | __UTF8_OVERLONG_2 | __UTF8_TWO_CONTS |
+        __UTF8_OVERLONG_3 | __UTF8_TOO_LARGE_2 | __UTF8_OVERLONG_4,
+        /* 1001____ */
+        __UTF8_TOO_LONG | __UTF8_OVERLONG_2 | __UTF8_TWO_CONTS |
+        __UTF8_OVERLONG_3 | __UTF8_TOO_LARGE,
+        /* 101_____ */
+        __UTF8_TOO_LONG | __UTF8_OVERLONG_2 | __UTF8_TWO_CONTS |
+        __UTF8_SURROGATE | __UTF8_TOO_LARGE,
+        __UTF8_TOO_LONG | __UTF8_OVERLONG_2 | __UTF8_TWO_CONTS |
+        __UTF8_SURROGATE | __UTF8_TOO_LARGE,
+        /* 11______ lead */
+        __UTF8_TOO_SHORT, __UTF8_TOO_SHORT, __UTF8_TOO_SHORT, __UTF8_TOO_SHORT);
+
+    __m256i prev1 = __avx2_prev(input, prev_input, 1);
+    __m256i special = _mm256_and_si256(
+        _mm256_and_si256(
+            _mm256_shuffle_epi8(byte_1_high_table, avx2_high_nibbles(prev1)),
+            _mm256_shuffle_epi8(byte_1_low_table,
+                _mm256_and_si256(prev1, _mm256_set1_epi8(0x0F)))),
+        _mm256_shuffle_epi8(byte_2_high_table, avx2_high_nibbles(input)));
+
+    /* only 111_____ and 1111____ leads come out with the top bit */
+    __m256i third = _mm256_subs_epu8(__avx2_prev(input, prev_input, 2),
+        _mm256_set1_epi8((char)(0xE0 - 0x80)));
+    __m256i fourth = _mm256_subs_epu8(__avx2_prev(input, prev_input, 3),
+        _mm256_set1_epi8((char)(0xF0 - 0x80)));
+    __m256i must_continue = _mm256_and_si256(_mm256_or_si256(third, fourth),
+        _mm256_set1_epi8((char)0x80));
+
+    return _mm256_xor_si256(must_continue, special);
+}
+
+
+/**
+ * Non-zero when the block ends inside a sequence: a lead byte
+ * in one of the last 3 places with too few bytes after it.
+ */
+static __Inline __cl_avx2 __m256i avx2_utf8_incomplete(__m256i input) {
+    const __m256i max = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1));
+
+    return _mm256_subs_epu8(input, max);
+}
+
+
+/**
+ * Checks 32 bytes at a time and only tells whether a block is
+ * bad; the scalar code then finds the exact offset from the
+ * last sequence that may run into that block, and checks the
+ * tail that does not fill a whole block.
+ */
+static __cl_avx2 size_t avx2_validate_utf8(const char *text, size_t length,
+    bool *ascii) {
+    __m256i prev = _mm256_setzero_si256();
+    __m256i incomplete = _mm256_setzero_si256();
+    bool multibyte = false;
+    size_t i = 0;
+
+    for (; i + 32 <= length; i += 32) {
+        __m256i input = _mm256_loadu_si256((const __m256i *)(text + i));
+        __m256i error;
+
+        /* a sequence left open is only an error if nothing follows */
+        if (_mm256_movemask_epi8(input) == 0) {
+            error = incomplete;
+            incomplete = _mm256_setzero_si256();
+        } else {
+            error = avx2_utf8_errors(input, prev);
+            incomplete = avx2_utf8_incomplete(input);
+            multibyte = true;
+        }
+
+        if (!_mm256_testz_si256(error, error)) {
+            break;
+        }
+
+        prev = input;
+    }
+
+    size_t start = _utf8_restart(text, i);
+    size_t end = start + scalar_validate_utf8(text + start, length - start,
+        ascii);
+
+    *ascii = *ascii && !multibyte;
+
+    return end;
+}
+
+
+static const Scanner AVX2_SCANNER = {
+    .name = "avx2",
+    .span = {
+        [CL_CHARS_NAME]  = avx2_span_name,
+        [CL_CHARS_BLANK] = avx2_span_blank,
+        [CL_CHARS_SPACE] = avx2_span_space,
+    },
+    .cspan_eol = avx2_cspan_eol,
+    .cspan_quote = avx2_cspan_quote,
+    .count_char = avx2_count_char,
+    .validate_utf8 = avx2_validate_utf8,
+};
+
+#endif /* __x86_64__ || __i386__ */
+
+
+static const Scanner *scanner = &SCALAR_SCANNER;
+
+
+/**
+ * Picks the widest scanner the CPU supports. The CL_SIMD
+ * environment variable ("scalar", "sse2" or "avx2") can force
+ * a narrower one, which is handy when benchmarking.
+ */
+__attribute__((constructor))
+static void _select_scanner(void) {
+    str_t env_simd = getenv("CL_SIMD");
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+
+    const Scanner *best = &SCALAR_SCANNER;
+
+    if (__builtin_cpu_supports("sse2")) {
+        best = &SSE2_SCANNER;
+    }
+
+    if (__builtin_cpu_supports("avx2")) {
+        best = &AVX2_SCANNER;
+    }
+
+    if (env_simd && strcmp(env_simd, "scalar") == 0) {
+        best = &SCALAR_SCANNER;
+    } else if (env_simd && strcmp(env_simd, "sse2") == 0 &&
+               __builtin_cpu_supports("sse2")) {
+        best = &SSE2_SCANNER;
+    }
+
+    scanner = best;
+#else
+    (void)env_simd;
+#endif /* __x86_64__ || __i386__ */
+}
+
+
+str_t source_simd_name(void) {
+    return scanner->name;
+}
+
+
+size_t source_validate_utf8(str_t text, size_t length, bool *ascii) {
+    return scanner->validate_utf8(text, length, ascii);
+}
+
+
+static void _check_utf8(Source *self) {
+    bool ascii = false;
+
+    self->utf8_error = scanner->validate_utf8(self->text, self->length,
+        &ascii);
+
+    if (ascii) {
+        self->flags |= CL_BIT(CL_SOURCE_ASCII);
+    }
+}
+
+
+/**
+ * Records where every line starts. Newlines are counted with
+ * the vector scanner first, so the table is allocated once and
+ * exactly sized.
+ */
+static bool _index_lines(Arena *arena, Source *self) {
+    size_t count = scanner->count_char(self->text, self->length, '\n') + 1;
+    uint32_t *lines = _alloc(arena, count * sizeof(*lines));
+
+    if (!lines) {
+        cl_error("out of memory!\n");
+        return false;
+    }
+
+    str_t curr = self->text;
+    str_t end = self->text + self->length;
+
+    lines[0] = 0;
+
+    for (size_t i = 1; i < count; i++) {
+        str_t eol = memchr(curr, '\n', (size_t)(end - curr));
+
+        curr = eol + 1;
+        lines[i] = (uint32_t)(curr - self->text);
+    }
+
+    self->lines = lines;
+    self->line_count = count;
+
+    return true;
+}
+
+
+static Source *_source_load(Arena *arena, str_t path, bool map) {
+    Source *new_source = _alloc(arena, sizeof(Source));
 
     if (!new_source) {
         return NULL;
     }
 
-    new_source->path = strdup(path);
+    new_source->path = arena ? arena_strdup(arena, path) : strdup(path);
 
     if (!new_source->path) {
-        free(new_source);
+        if (!arena) {
+            free(new_source);
+        }
+
         return NULL;
     }
 
-    if (!_read_file(path, (char **)&new_source->text, &new_source->length)) {
-        free(CL_VOIDPTR(new_source->path));
-        free(CL_VOIDPTR(new_source));
+    new_source->flags = arena ? CL_BIT(CL_SOURCE_ARENA) : 0;
+    new_source->lines = NULL;
+    new_source->line_count = 0;
+
+    if (map &&
+        _map_file(path, (char **)&new_source->text, &new_source->length)) {
+        new_source->flags |= CL_BIT(CL_SOURCE_MAPPED);
+    } else if (!_read_file(arena, path, (char **)&new_source->text,
+                           &new_source->length)) {
+        if (!arena) {
+            free(CL_VOIDPTR(new_source->path));
+            free(CL_VOIDPTR(new_source));
+        }
+
         return NULL;
     }
 
+    if (!_index_lines(arena, new_source)) {
+        source_free(new_source);
+        return NULL;
+    }
+
+    _check_utf8(new_source);
+
     return new_source;
 }
 
 
+Source *source_new(Arena *arena, str_t path) {
+    return _source_load(arena, path, true);
+}
+
+
+/**
+ * Loads a source like source_new, but always copies the text.
+ * A mapping follows the file, and reading it after the file
+ * was truncated raises SIGBUS, so sources that are kept while
+ * their file may be edited must not be mapped.
+ */
+Source *source_read(Arena *arena, str_t path) {
+    return _source_load(arena, path, false);
+}
+
+
 char source_at(Source *self, size_t offset) {
     if (offset >= self->length) {
         cl_debug("%s: index out of bounds: %zu\n", __func__, offset);
@@ -97,13 +980,13 @@ char source_at(Source *self, size_t offset) {
 }
 
 
-sview_t source_get(Source *self, size_t offset) {
+str_t source_get(Source *self, size_t offset) {
     if (offset >= self->length) {
         cl_debug("%s: index out of bounds: %zu\n", __func__, offset);
         return NULL;
     }
 
-    return (sview_t)&self->text[offset];
+    return &self->text[offset];
 }
 
 
@@ -127,8 +1010,92 @@ size_t source_cspan(Source *self, size_t offset, str_t reject) {
 }
 
 
+size_t source_span_class(Source *self, size_t offset, CharClass cls) {
+    if (offset >= self->length) {
+        return 0;
+    }
+
+    return scanner->span[cls](&self->text[offset], self->length - offset, 0);
+}
+
+
+size_t source_cspan_eol(Source *self, size_t offset) {
+    if (offset >= self->length) {
+        return 0;
+    }
+
+    return scanner->cspan_eol(&self->text[offset], self->length - offset, 0);
+}
+
+
+size_t source_cspan_quote(Source *self, size_t offset, char quote) {
+    if (offset >= self->length) {
+        return 0;
+    }
+
+    return scanner->cspan_quote(&self->text[offset], self->length - offset,
+        quote);
+}
+
+
 size_t source_lnlen(Source *self, size_t offset) {
-    return strcspn(&self->text[offset], "\r\n");
+    return source_cspan_eol(self, offset);
+}
+
+
+/**
+ * Finds the 1-based line and column of an offset with a binary
+ * search over the line table. Tokens only store offsets, so
+ * this is only paid for when a position is actually printed.
+ */
+void source_locate(Source *self, size_t offset, uint32_t *line,
+    uint32_t *column) {
+    size_t lo = 0;
+    size_t hi = self->line_count;
+
+    if (offset > self->length) {
+        offset = self->length;
+    }
+
+    /* find the last line that starts at or before offset */
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (self->lines[mid] <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    *line = (uint32_t)lo + 1;
+    *column = (uint32_t)(offset - self->lines[lo]) + 1;
+}
+
+
+bool source_is_utf8(Source *self) {
+    return self->utf8_error == self->length;
+}
+
+
+bool source_line(Source *self, uint32_t line, size_t *offset, size_t *length) {
+    if (line == 0 || line > self->line_count) {
+        return false;
+    }
+
+    size_t start = self->lines[line - 1];
+    size_t end = (line < self->line_count)
+        ? self->lines[line] - 1     /* drop the \n */
+        : self->length;
+
+    if (end > start && self->text[end - 1] == '\r') {
+        end--;
+    }
+
+    *offset = start;
+    *length = end - start;
+
+    return true;
 }
 
 
@@ -137,8 +1104,195 @@ int source_cmp(Source *self, size_t offset, size_t length, str_t str) {
 }
 
 
+/**
+ * Builds the line table of the text after an edit: lines
+ * starting before the edit stay, the ones starting inside the
+ * replaced range are dropped, the new text adds its own and
+ * the rest shift.
+ */
+static uint32_t *_edit_lines(Source *self, SourceEdit edit,
+    size_t *out_count) {
+    uint32_t first, last, column;
+
+    /* the first lines starting after the edit offset and its end */
+    source_locate(self, edit.offset, &first, &column);
+    source_locate(self, (size_t)edit.offset + edit.removed, &last, &column);
+
+    size_t added = 0;
+
+    for (uint32_t i = 0; i < edit.length; i++) {
+        added += (edit.text[i] == '\n');
+    }
+
+    size_t count = first + added + (self->line_count - last);
+    uint32_t *lines = malloc(count * sizeof(*lines));
+
+    if (!lines) {
+        cl_error("out of memory!\n");
+        return NULL;
+    }
+
+    memcpy(lines, self->lines, first * sizeof(*lines));
+
+    size_t index = first;
+
+    for (uint32_t i = 0; i < edit.length; i++) {
+        if (edit.text[i] == '\n') {
+            lines[index++] = edit.offset + i + 1;
+        }
+    }
+
+    uint32_t delta = edit.length - edit.removed; /* wraps when shrinking */
+
+    for (size_t i = last; i < self->line_count; i++) {
+        lines[index++] = self->lines[i] + delta;
+    }
+
+    *out_count = count;
+
+    return lines;
+}
+
+
+/**
+ * Checks the text again after an edit. When it was valid
+ * before, only the edited bytes and the sequences that run
+ * into or out of them can be malformed now. An edit that adds
+ * multibyte sequences clears CL_SOURCE_ASCII; one that removes
+ * them does not set it again.
+ */
+static void _edit_utf8(Source *self, SourceEdit edit, size_t old_length) {
+    if (self->utf8_error != old_length) {
+        self->flags &= CL_BIT_MASK(CL_SOURCE_ASCII);
+        _check_utf8(self);
+        return;
+    }
+
+    size_t start = _utf8_restart(self->text, edit.offset);
+    size_t end = (size_t)edit.offset + edit.length;
+
+    while (end < self->length && end - edit.offset - edit.length < 3 &&
+           _is_continuation((uint8_t)self->text[end])) {
+        end++;
+    }
+
+    bool ascii = false;
+    size_t error = start + scanner->validate_utf8(&self->text[start],
+        end - start, &ascii);
+
+    self->utf8_error = (error < end) ? error : self->length;
+
+    if (!ascii) {
+        self->flags &= CL_BIT_MASK(CL_SOURCE_ASCII);
+    }
+}
+
+
+/**
+ * Applies an edit to the text and updates the line table.
+ * The first edit copies the text to a heap buffer, later ones
+ * are done in place.
+ */
+bool source_edit(Source *self, SourceEdit edit) {
+    if (edit.offset > self->length ||
+        edit.removed > self->length - edit.offset) {
+        cl_debug("%s: edit out of bounds: %u+%u\n", __func__,
+            edit.offset, edit.removed);
+        return false;
+    }
+
+    size_t head = edit.offset;
+    size_t tail = self->length - head - edit.removed;
+    size_t length = head + edit.length + tail;
+
+    if (length > UINT32_MAX) {
+        cl_error("source too large: %zu bytes\n", length);
+        return false;
+    }
+
+    size_t line_count = 0;
+    uint32_t *lines = _edit_lines(self, edit, &line_count);
+
+    if (!lines) {
+        return false;
+    }
+
+    bool owned = CL_BIT_ISSET(CL_SOURCE_EDITED, self->flags) ||
+                 CL_BIT_ISCLR(CL_SOURCE_ARENA, self->flags);
+    char *text = NULL;
+
+    if (CL_BIT_ISSET(CL_SOURCE_EDITED, self->flags)) {
+        text = (char *)self->text;
+
+        if (length > self->length) {
+            text = realloc(text, length + 1);
+        }
+    } else {
+        text = malloc(length + 1);
+    }
+
+    if (!text) {
+        cl_error("out of memory!\n");
+        free(lines);
+        return false;
+    }
+
+    if (CL_BIT_ISSET(CL_SOURCE_EDITED, self->flags)) {
+        /* the tail moves with its NUL terminator */
+        memmove(&text[head + edit.length], &text[head + edit.removed],
+            tail + 1);
+    } else {
+        memcpy(text, self->text, head);
+        memcpy(&text[head + edit.length], &self->text[head + edit.removed],
+            tail);
+        text[length] = '\0';
+
+        if (CL_BIT_ISSET(CL_SOURCE_MAPPED, self->flags)) {
+            munmap(CL_VOIDPTR(self->text), self->length);
+        } else if (owned) {
+            free(CL_VOIDPTR(self->text));
+        }
+    }
+
+    memcpy(&text[head], edit.text, edit.length);
+
+    if (owned) {
+        free(self->lines);
+    }
+
+    size_t old_length = self->length;
+
+    self->flags &= CL_BIT_MASK(CL_SOURCE_MAPPED);
+    self->flags |= CL_BIT(CL_SOURCE_EDITED);
+    self->text = text;
+    self->length = length;
+    self->lines = lines;
+    self->line_count = line_count;
+
+    _edit_utf8(self, edit, old_length);
+
+    return true;
+}
+
+
 void source_free(Source *self) {
+    bool owned = CL_BIT_ISSET(CL_SOURCE_EDITED, self->flags) ||
+                 CL_BIT_ISCLR(CL_SOURCE_ARENA, self->flags);
+
+    if (CL_BIT_ISSET(CL_SOURCE_MAPPED, self->flags)) {
+        munmap(CL_VOIDPTR(self->text), self->length);
+    } else if (owned) {
+        free(CL_VOIDPTR(self->text));
+    }
+
+    if (owned) {
+        free(CL_VOIDPTR(self->lines));
+    }
+
+    if (CL_BIT_ISSET(CL_SOURCE_ARENA, self->flags)) {
+        return;
+    }
+
     free(CL_VOIDPTR(self->path));
-    free(CL_VOIDPTR(self->text));
     free(CL_VOIDPTR(self));
 }
@@ -0,0 +1,839 @@
+#define CL_LOG_SCOPE "token-cache"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cl-log.h"
+#include "cl-hash.h"
+#include "cl-lexer.h"
+#include "cl-vector.h"
+#include "cl-token-cache.h"
+
+
+#define TOKEN_CACHE_MAGIC       "CLTK"
+#define TOKEN_CACHE_FORMAT      3
+#define TOKEN_CACHE_SUFFIX      ".tok"
+#define TOKEN_CACHE_TEMP        ".tmp-"
+
+/* temporary files this old, in seconds, were left by a crash */
+#define TOKEN_CACHE_TEMP_AGE    3600
+
+/* longest varint of a 32-bit value */
+#define VARINT_MAX              5
+
+
+/**
+ * The fixed part of an entry, in the byte order of the machine
+ * that wrote it, which is the only one that reads it. The
+ * payload follows: the kinds, the positions, the names of the
+ * symbols, and the symbol of every token that has one.
+ */
+CL_TYPE(TokenCacheHeader) {
+    char     magic[4];
+    uint32_t format;
+    char     version[16];
+    uint64_t hash;          /* of the text, which names the entry */
+    uint64_t payload_hash;
+    uint64_t text_length;
+    uint32_t token_count;
+    uint32_t symbol_count;
+    uint32_t payload_size;
+    uint32_t reserved;      /* zero */
+};
+
+_Static_assert(sizeof(TokenCacheHeader) == 64, "the header has no padding");
+
+
+struct __CL_TNAME(TokenCache) {
+    char    *dir;
+    size_t   max_size;
+    uint64_t seed;      /* hash of the compiler version */
+
+    /* the length of every token kind with a single spelling */
+    uint8_t  fixed_length[UINT8_MAX + 1];
+
+    atomic_size_t hits;
+    atomic_size_t misses;
+    atomic_size_t stores;
+    atomic_size_t evictions;
+    atomic_size_t bytes_read;
+    atomic_size_t bytes_written;
+};
+
+
+CL_TYPE(CacheFile) {
+    char           *name;
+    size_t          size;
+    struct timespec used;
+};
+
+CL_VECTOR_DEFINE(CacheFile, cache_file)
+
+
+static __Inline bool _has_symbol(uint8_t kind) {
+    return kind == TK_ID || kind == TK_STRING || kind == TK_CHAR;
+}
+
+
+static __Inline void _count(atomic_size_t *counter, size_t amount) {
+    atomic_fetch_add_explicit(counter, amount, memory_order_relaxed);
+}
+
+
+/* == encoding == */
+
+
+CL_TYPE(Encoder) {
+    uint8_t *data;
+    size_t   size;
+    size_t   capacity;
+    bool     failed;
+};
+
+
+static bool _reserve(Encoder *self, size_t more) {
+    if (self->size + more <= self->capacity) {
+        return true;
+    }
+
+    size_t capacity = self->capacity ? self->capacity : 4096;
+
+    while (capacity < self->size + more) {
+        capacity *= 2;
+    }
+
+    uint8_t *data = realloc(self->data, capacity);
+
+    if (!data) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        self->failed = true;
+        return false;
+    }
+
+    self->data = data;
+    self->capacity = capacity;
+
+    return true;
+}
+
+
+static void _put_bytes(Encoder *self, const void *bytes, size_t length) {
+    if (_reserve(self, length)) {
+        memcpy(&self->data[self->size], bytes, length);
+        self->size += length;
+    }
+}
+
+
+static void _put_varint(Encoder *self, uint32_t value) {
+    if (!_reserve(self, VARINT_MAX)) {
+        return;
+    }
+
+    while (value >= 0x80) {
+        self->data[self->size++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+
+    self->data[self->size++] = (uint8_t)value;
+}
+
+
+CL_TYPE(Decoder) {
+    const uint8_t *p;
+    const uint8_t *end;
+    bool           failed;
+};
+
+
+static __Inline uint32_t _get_varint(Decoder *self) {
+    uint32_t value = 0;
+
+    for (int shift = 0; shift < 7 * VARINT_MAX; shift += 7) {
+        if (self->p == self->end) {
+            break;
+        }
+
+        uint8_t byte = *self->p++;
+
+        value |= (uint32_t)(byte & 0x7F) << shift;
+
+        if (byte < 0x80) {
+            return value;
+        }
+    }
+
+    self->failed = true;
+
+    return 0;
+}
+
+
+static const uint8_t *_get_bytes(Decoder *self, size_t length) {
+    if ((size_t)(self->end - self->p) < length) {
+        self->failed = true;
+        return NULL;
+    }
+
+    const uint8_t *bytes = self->p;
+
+    self->p += length;
+
+    return bytes;
+}
+
+
+/* == symbols == */
+
+
+/**
+ * Numbers the distinct symbols of a stream in the order they
+ * first appear, with an open addressing table from symbol ids.
+ */
+CL_TYPE(SymbolMap) {
+    uint32_t *ids;
+    uint32_t *indices;
+    size_t    mask;
+    uint32_t  count;
+};
+
+
+static bool _symbol_map_init(SymbolMap *self, size_t entries) {
+    size_t capacity = 64;
+
+    while (capacity < 2 * entries) {
+        capacity *= 2;
+    }
+
+    self->ids = calloc(capacity, sizeof(uint32_t));
+    self->indices = malloc(capacity * sizeof(uint32_t));
+    self->mask = capacity - 1;
+    self->count = 0;
+
+    if (!self->ids || !self->indices) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        free(self->ids);
+        free(self->indices);
+        return false;
+    }
+
+    return true;
+}
+
+
+/**
+ * Returns the index of a symbol, `*added` telling whether the
+ * symbol was new.
+ */
+static uint32_t _symbol_map_get(SymbolMap *self, uint32_t id, bool *added) {
+    size_t at = (id * 0x9E3779B1U) & self->mask;
+
+    while (self->ids[at] != CL_SYMBOL_NONE && self->ids[at] != id) {
+        at = (at + 1) & self->mask;
+    }
+
+    *added = (self->ids[at] == CL_SYMBOL_NONE);
+
+    if (*added) {
+        self->ids[at] = id;
+        self->indices[at] = self->count++;
+    }
+
+    return self->indices[at];
+}
+
+
+static void _symbol_map_free(SymbolMap *self) {
+    free(self->ids);
+    free(self->indices);
+}
+
+
+/* == entries == */
+
+
+static char *_entry_path(TokenCache *self, uint64_t hash) {
+    size_t length = strlen(self->dir) + sizeof("/0123456789abcdef")
+        + sizeof(TOKEN_CACHE_SUFFIX);
+    char *path = malloc(length);
+
+    if (!path) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    snprintf(path, length, "%s/%016llx" TOKEN_CACHE_SUFFIX, self->dir,
+        (unsigned long long)hash);
+
+    return path;
+}
+
+
+/**
+ * Encodes the payload and returns the header that goes before
+ * it, or false when a token cannot be encoded.
+ */
+static bool _encode(TokenCache *self, Source *src, TokenStream *tokens,
+    Interner *symbols, Encoder *out, TokenCacheHeader *header) {
+    SymbolMap map;
+    size_t symbol_tokens = 0;
+    uint64_t end = 0;
+
+    for (size_t i = 0; i < tokens->count; i++) {
+        symbol_tokens += _has_symbol(tokens->kinds[i]);
+    }
+
+    if (!_symbol_map_init(&map, symbol_tokens)) {
+        return false;
+    }
+
+    _put_bytes(out, tokens->kinds, tokens->count);
+
+    for (size_t i = 0; i < tokens->count; i++) {
+        uint8_t kind = tokens->kinds[i];
+        uint8_t fixed = self->fixed_length[kind];
+
+        if (tokens->offsets[i] < end ||
+            (fixed && tokens->lengths[i] != fixed)) {
+            _symbol_map_free(&map);
+            return false;
+        }
+
+        _put_varint(out, (uint32_t)(tokens->offsets[i] - end));
+
+        if (!fixed) {
+            _put_varint(out, tokens->lengths[i]);
+        }
+
+        end = (uint64_t)tokens->offsets[i] + tokens->lengths[i];
+    }
+
+    /* the names, in the order the refs below first use them */
+    Encoder refs = { 0 };
+
+    for (size_t i = 0; i < tokens->count && !out->failed; i++) {
+        if (!_has_symbol(tokens->kinds[i])) {
+            continue;
+        }
+
+        bool added;
+        uint32_t id = tokens_value(tokens, i);
+        uint32_t index = _symbol_map_get(&map, id, &added);
+
+        _put_varint(&refs, index);
+
+        if (added) {
+            uint32_t length;
+            str_t name = interner_name(symbols, id, &length);
+
+            if (!name) {
+                out->failed = true;
+                break;
+            }
+
+            _put_varint(out, length);
+            _put_bytes(out, name, length);
+        }
+    }
+
+    _put_bytes(out, refs.data, refs.size);
+    out->failed |= refs.failed;
+    free(refs.data);
+
+    *header = (TokenCacheHeader){
+        .magic = TOKEN_CACHE_MAGIC,
+        .format = TOKEN_CACHE_FORMAT,
+        .version = CL_VERSION,
+        .text_length = src->length,
+        .token_count = (uint32_t)tokens->count,
+        .symbol_count = map.count,
+        .payload_size = (uint32_t)out->size,
+    };
+
+    _symbol_map_free(&map);
+
+    return !out->failed && out->size <= UINT32_MAX;
+}
+
+
+/**
+ * A name of the entry's table. An entry is either a name or
+ * the contents of a literal, which only the first token that
+ * refers to it tells, so its id is found on that token.
+ */
+CL_TYPE(CachedSymbol) {
+    str_t    name;
+    uint32_t length;
+    uint32_t id;
+};
+
+
+static uint32_t _symbol_id(Interner *symbols, CachedSymbol *symbol,
+    uint8_t kind) {
+    if (symbol->id == CL_SYMBOL_NONE) {
+        symbol->id = (kind == TK_ID)
+            ? interner_intern(symbols, symbol->name, symbol->length)
+            : interner_add_literal(symbols, symbol->name, symbol->length);
+    }
+
+    return symbol->id;
+}
+
+
+/**
+ * Decodes the entry of the text whose hash is `hash` into an
+ * empty stream. The payload must match its hash, which catches
+ * damage that still decodes, and every count, offset and index
+ * is checked against the text and the entry on top of that, so
+ * a damaged entry is a miss rather than a bad stream.
+ */
+static bool _decode(TokenCache *self, Source *src, uint64_t hash,
+    const uint8_t *data, size_t size, TokenStream *tokens,
+    Interner *symbols) {
+    static const char version[16] = CL_VERSION;
+    TokenCacheHeader header;
+
+    if (size < sizeof(header)) {
+        return false;
+    }
+
+    memcpy(&header, data, sizeof(header));
+
+    if (memcmp(header.magic, TOKEN_CACHE_MAGIC, 4) != 0 ||
+        header.format != TOKEN_CACHE_FORMAT ||
+        memcmp(header.version, version, sizeof(version)) != 0 ||
+        header.hash != hash ||
+        header.text_length != src->length ||
+        header.payload_size != size - sizeof(header) ||
+        header.token_count > src->length ||
+        header.symbol_count > header.token_count ||
+        header.payload_hash != cl_hash64(data + sizeof(header),
+            header.payload_size, self->seed)) {
+        return false;
+    }
+
+    size_t count = header.token_count;
+
+    if (!tokens_reserve(tokens, count)) {
+        return false;
+    }
+
+    Decoder in = {
+        .p = data + sizeof(header),
+        .end = data + size,
+        .failed = false,
+    };
+    const uint8_t *kinds = _get_bytes(&in, count);
+    uint64_t end = 0;
+
+    if (!kinds) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count && !in.failed; i++) {
+        uint8_t kind = kinds[i];
+        uint8_t fixed = self->fixed_length[kind];
+        uint64_t offset = end + _get_varint(&in);
+        uint64_t length = fixed ? fixed : _get_varint(&in);
+
+        end = offset + length;
+
+        if (kind > SYM_RBRACE || end > src->length) {
+            return false;
+        }
+
+        tokens->kinds[i] = kind;
+        tokens->offsets[i] = (uint32_t)offset;
+        tokens->lengths[i] = (uint32_t)length;
+    }
+
+    size_t valued = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        valued += cl_has_value(kinds[i]);
+    }
+
+    if (in.failed || !tokens_reserve_values(tokens, valued)) {
+        return false;
+    }
+
+    CachedSymbol *table = malloc((header.symbol_count + 1) *
+        sizeof(CachedSymbol));
+
+    if (!table) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return false;
+    }
+
+    for (uint32_t k = 0; k < header.symbol_count && !in.failed; k++) {
+        uint32_t length = _get_varint(&in);
+        const uint8_t *name = _get_bytes(&in, length);
+
+        table[k] = (CachedSymbol){ (str_t)name, length, CL_SYMBOL_NONE };
+        in.failed |= (name == NULL);
+    }
+
+    uint32_t *values = tokens->values;
+    size_t value_count = 0;
+
+    for (size_t i = 0; i < count && !in.failed; i++) {
+        if (_has_symbol(kinds[i])) {
+            uint32_t index = _get_varint(&in);
+            uint32_t id = CL_SYMBOL_NONE;
+
+            if (index < header.symbol_count) {
+                id = _symbol_id(symbols, &table[index], kinds[i]);
+            }
+
+            in.failed |= (id == CL_SYMBOL_NONE);
+            values[value_count++] = id;
+        }
+    }
+
+    free(table);
+
+    if (in.failed || in.p != in.end) {
+        return false;
+    }
+
+    tokens->count = count;
+    tokens->value_count = value_count;
+    tokens->failed = false;
+    tokens_index_values(tokens);
+
+    return true;
+}
+
+
+/**
+ * Fills `tokens`, which must be empty, from the entry of the
+ * text of `src`. Returns false on a miss, leaving it empty.
+ */
+bool token_cache_load(TokenCache *self, Source *src, TokenStream *tokens,
+    Interner *symbols) {
+    uint64_t hash = cl_hash64(src->text, src->length, self->seed);
+    char *path = (tokens->count == 0) ? _entry_path(self, hash) : NULL;
+    int fd = path ? open(path, O_RDONLY) : -1;
+    struct stat st;
+    bool hit = false;
+
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+        size_t size = (size_t)st.st_size;
+        void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data != MAP_FAILED) {
+            posix_madvise(data, size, POSIX_MADV_SEQUENTIAL);
+            hit = _decode(self, src, hash, data, size, tokens, symbols);
+            munmap(data, size);
+        }
+
+        if (hit) {
+            /* the time of the last use is what eviction goes by */
+            futimens(fd, NULL);
+            _count(&self->bytes_read, size);
+        } else {
+            tokens->count = 0;
+            tokens->value_count = 0;
+            unlink(path);
+        }
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    free(path);
+    _count(hit ? &self->hits : &self->misses, 1);
+
+    return hit;
+}
+
+
+static bool _write_all(int fd, const void *data, size_t size) {
+    const uint8_t *p = data;
+
+    while (size > 0) {
+        ssize_t written = write(fd, p, size);
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return false;
+        }
+
+        p += written;
+        size -= (size_t)written;
+    }
+
+    return true;
+}
+
+
+/**
+ * Stores a stream lexed from the text of `src`. The entry is
+ * written to a temporary file first and then renamed over any
+ * entry of the same text, which is the same.
+ */
+bool token_cache_store(TokenCache *self, Source *src, TokenStream *tokens,
+    Interner *symbols) {
+    if (tokens->failed || tokens->count > UINT32_MAX) {
+        return false;
+    }
+
+    Encoder payload = { 0 };
+    TokenCacheHeader header;
+
+    if (!_encode(self, src, tokens, symbols, &payload, &header)) {
+        free(payload.data);
+        return false;
+    }
+
+    header.hash = cl_hash64(src->text, src->length, self->seed);
+    header.payload_hash = cl_hash64(payload.data, payload.size, self->seed);
+
+    char *path = _entry_path(self, header.hash);
+    size_t length = strlen(self->dir) + sizeof("/" TOKEN_CACHE_TEMP "XXXXXX");
+    char *temp = path ? malloc(length) : NULL;
+    int fd = -1;
+
+    if (temp) {
+        snprintf(temp, length, "%s/" TOKEN_CACHE_TEMP "XXXXXX", self->dir);
+        fd = mkstemp(temp);
+    }
+
+    bool stored = fd >= 0 &&
+        _write_all(fd, &header, sizeof(header)) &&
+        _write_all(fd, payload.data, payload.size);
+
+    if (fd >= 0) {
+        stored &= (close(fd) == 0);
+        stored = stored && rename(temp, path) == 0;
+
+        if (!stored) {
+            cl_debug("%s: %s\n", __func__, strerror(errno));
+            unlink(temp);
+        }
+    }
+
+    if (stored) {
+        _count(&self->stores, 1);
+        _count(&self->bytes_written, sizeof(header) + payload.size);
+    }
+
+    free(payload.data);
+    free(temp);
+    free(path);
+
+    return stored;
+}
+
+
+/* == directory == */
+
+
+static bool _make_dirs(char *path) {
+    for (char *p = path + 1; ; p++) {
+        if (*p != '/' && *p != '\0') {
+            continue;
+        }
+
+        char saved = *p;
+
+        *p = '\0';
+
+        bool made = mkdir(path, 0755) == 0 || errno == EEXIST;
+
+        *p = saved;
+
+        if (!made || saved == '\0') {
+            return made;
+        }
+    }
+}
+
+
+char *token_cache_default_dir(void) {
+    str_t base = getenv("XDG_CACHE_HOME");
+    str_t home = getenv("HOME");
+    str_t sub = "/clover";
+
+    /* relative paths in XDG variables are to be ignored */
+    if (!base || *base != '/') {
+        if (!home || !*home) {
+            return NULL;
+        }
+
+        base = home;
+        sub = "/.cache/clover";
+    }
+
+    size_t length = strlen(base) + strlen(sub) + 1;
+    char *dir = malloc(length);
+
+    if (!dir) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    snprintf(dir, length, "%s%s", base, sub);
+
+    return dir;
+}
+
+
+TokenCache *token_cache_open(str_t dir, size_t max_size) {
+    TokenCache *new_cache = calloc(1, sizeof(TokenCache));
+
+    if (!new_cache) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    new_cache->dir = strdup(dir);
+    new_cache->max_size = max_size;
+    new_cache->seed = cl_hash64(CL_VERSION, strlen(CL_VERSION), 0);
+
+    if (!new_cache->dir || !_make_dirs(new_cache->dir)) {
+        cl_error("%s: %s\n", dir, strerror(errno));
+        free(new_cache->dir);
+        free(new_cache);
+        return NULL;
+    }
+
+    for (int kind = KW_IMPORT; kind <= SYM_RBRACE; kind++) {
+        new_cache->fixed_length[kind] =
+            (uint8_t)strlen(cl_token_name((TokenType)kind));
+    }
+
+    return new_cache;
+}
+
+
+void token_cache_stats(TokenCache *self, TokenCacheStats *stats) {
+    *stats = (TokenCacheStats){
+        .hits = atomic_load(&self->hits),
+        .misses = atomic_load(&self->misses),
+        .stores = atomic_load(&self->stores),
+        .evictions = atomic_load(&self->evictions),
+        .bytes_read = atomic_load(&self->bytes_read),
+        .bytes_written = atomic_load(&self->bytes_written),
+    };
+}
+
+
+static int _compare_used(const void *a, const void *b) {
+    const struct timespec *x = &((const CacheFile *)a)->used;
+    const struct timespec *y = &((const CacheFile *)b)->used;
+
+    if (x->tv_sec != y->tv_sec) {
+        return (x->tv_sec < y->tv_sec) ? -1 : 1;
+    }
+
+    return (x->tv_nsec < y->tv_nsec) ? -1 : (x->tv_nsec > y->tv_nsec);
+}
+
+
+/**
+ * Removes the entries used least recently until the directory
+ * is under the low water mark, and any temporary file left by
+ * a process that died while storing. Other processes may
+ * remove the same files at the same time, which is harmless.
+ */
+static void _evict(TokenCache *self) {
+    DIR *dir = opendir(self->dir);
+
+    if (!dir) {
+        return;
+    }
+
+    CacheFileVector files = { 0 };
+    size_t total = 0;
+    time_t now = time(NULL);
+    struct dirent *entry;
+
+    while ((entry = readdir(dir)) != NULL) {
+        str_t name = entry->d_name;
+        size_t length = strlen(name);
+        bool temp = strncmp(name, TOKEN_CACHE_TEMP,
+            sizeof(TOKEN_CACHE_TEMP) - 1) == 0;
+        struct stat st;
+
+        if (!temp && (length < sizeof(TOKEN_CACHE_SUFFIX) ||
+            strcmp(&name[length - sizeof(TOKEN_CACHE_SUFFIX) + 1],
+                   TOKEN_CACHE_SUFFIX) != 0)) {
+            continue;
+        }
+
+        if (fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) != 0 ||
+            !S_ISREG(st.st_mode)) {
+            continue;
+        }
+
+        if (temp) {
+            if (now - st.st_mtim.tv_sec > TOKEN_CACHE_TEMP_AGE) {
+                unlinkat(dirfd(dir), name, 0);
+            }
+
+            continue;
+        }
+
+        CacheFile file = {
+            .name = strdup(name),
+            .size = (size_t)st.st_size,
+            .used = st.st_mtim,
+        };
+
+        if (!file.name || !cache_file_vector_push(&files, file)) {
+            free(file.name);
+            break;
+        }
+
+        total += file.size;
+    }
+
+    if (total > self->max_size) {
+        size_t low = self->max_size / 100 * CL_TOKEN_CACHE_LOW_WATER;
+
+        qsort(files.data, files.count, sizeof(CacheFile), _compare_used);
+
+        for (size_t i = 0; i < files.count && total > low; i++) {
+            if (unlinkat(dirfd(dir), files.data[i].name, 0) == 0) {
+                _count(&self->evictions, 1);
+            }
+
+            total -= files.data[i].size;
+        }
+    }
+
+    for (size_t i = 0; i < files.count; i++) {
+        free(files.data[i].name);
+    }
+
+    cache_file_vector_free(&files);
+    closedir(dir);
+}
+
+
+/**
+ * Closes the cache, first trimming the directory to its size
+ * cap when anything was stored.
+ */
+void token_cache_close(TokenCache *self) {
+    if (atomic_load(&self->stores) > 0) {
+        _evict(self);
+    }
+
+    free(self->dir);
+    free(self);
+}
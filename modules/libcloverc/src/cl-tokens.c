@@ -0,0 +1,297 @@
+#define CL_LOG_SCOPE "tokens"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "cl-log.h"
+#include "cl-tokens.h"
+
+
+_Static_assert(SYM_RBRACE <= UINT8_MAX, "token kinds must fit in a byte");
+
+
+static void *_realloc(TokenStream *self, void *ptr, size_t item_size,
+    size_t old_capacity, size_t capacity) {
+    if (self->arena) {
+        return arena_realloc(self->arena, ptr, old_capacity * item_size,
+            capacity * item_size);
+    }
+
+    return realloc(ptr, capacity * item_size);
+}
+
+
+static __Inline size_t _blocks(size_t capacity) {
+    return capacity / CL_TOKENS_BLOCK + 1;
+}
+
+
+static bool _tokens_resize(TokenStream *self, size_t capacity) {
+    uint8_t *kinds = _realloc(self, self->kinds, sizeof(*kinds),
+        self->capacity, capacity);
+
+    if (!kinds) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return false;
+    }
+
+    self->kinds = kinds;
+
+    uint32_t *offsets = _realloc(self, self->offsets, sizeof(*offsets),
+        self->capacity, capacity);
+
+    if (!offsets) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return false;
+    }
+
+    self->offsets = offsets;
+
+    uint32_t *lengths = _realloc(self, self->lengths, sizeof(*lengths),
+        self->capacity, capacity);
+
+    if (!lengths) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return false;
+    }
+
+    self->lengths = lengths;
+
+    uint32_t *bases = _realloc(self, self->value_bases, sizeof(*bases),
+        _blocks(self->capacity), _blocks(capacity));
+
+    if (!bases) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return false;
+    }
+
+    self->value_bases = bases;
+
+    uint64_t *masks = _realloc(self, self->value_masks, sizeof(*masks),
+        _blocks(self->capacity), _blocks(capacity));
+
+    if (!masks) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return false;
+    }
+
+    self->value_masks = masks;
+    self->capacity = capacity;
+
+    return true;
+}
+
+
+static bool _values_resize(TokenStream *self, size_t capacity) {
+    uint32_t *values = _realloc(self, self->values, sizeof(*values),
+        self->value_capacity, capacity);
+
+    if (!values) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return false;
+    }
+
+    self->values = values;
+    self->value_capacity = capacity;
+
+    return true;
+}
+
+
+TokenStream *tokens_new(Arena *arena) {
+    TokenStream *new_tokens = arena ? arena_calloc(arena, 1, sizeof(TokenStream))
+                                    : calloc(1, sizeof(TokenStream));
+
+    if (!new_tokens) {
+        cl_debug("%s: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    new_tokens->arena = arena;
+
+    if (!_tokens_resize(new_tokens, CL_TOKENS_INITIAL_CAPACITY) ||
+        !_values_resize(new_tokens, CL_TOKENS_INITIAL_VALUES)) {
+        tokens_free(new_tokens);
+        return NULL;
+    }
+
+    return new_tokens;
+}
+
+
+/**
+ * Makes room for at least `capacity` tokens.
+ */
+bool tokens_reserve(TokenStream *self, size_t capacity) {
+    if (capacity <= self->capacity) {
+        return true;
+    }
+
+    return _tokens_resize(self, capacity);
+}
+
+
+/**
+ * Makes room for at least `capacity` values.
+ */
+bool tokens_reserve_values(TokenStream *self, size_t capacity) {
+    if (capacity <= self->value_capacity) {
+        return true;
+    }
+
+    return _values_resize(self, capacity);
+}
+
+
+bool tokens_grow(TokenStream *self) {
+    return _tokens_resize(self, self->capacity + self->capacity / 2);
+}
+
+
+bool tokens_grow_values(TokenStream *self) {
+    return _values_resize(self,
+        self->value_capacity + self->value_capacity / 2);
+}
+
+
+/**
+ * Returns how many of the tokens before `index` have a value.
+ */
+static size_t _rank(TokenStream *self, size_t index) {
+    if (index == self->count) {
+        return self->value_count;
+    }
+
+    size_t block = index / CL_TOKENS_BLOCK;
+    uint64_t below = self->value_masks[block] &
+        ((UINT64_C(1) << (index % CL_TOKENS_BLOCK)) - 1);
+
+    return self->value_bases[block] + (size_t)__builtin_popcountll(below);
+}
+
+
+/**
+ * Rebuilds the masks and bases from `block` on, where the first
+ * value is `base`, after the kinds have changed.
+ */
+static void _index_values(TokenStream *self, size_t block, size_t base) {
+    for (size_t from = block * CL_TOKENS_BLOCK; from < self->count;
+        from += CL_TOKENS_BLOCK, block++) {
+        size_t to = (self->count - from < CL_TOKENS_BLOCK)
+            ? self->count : from + CL_TOKENS_BLOCK;
+        uint64_t mask = 0;
+
+        for (size_t i = from; i < to; i++) {
+            mask |= (uint64_t)cl_has_value((TokenType)self->kinds[i])
+                << (i - from);
+        }
+
+        self->value_bases[block] = (uint32_t)base;
+        self->value_masks[block] = mask;
+        base += (size_t)__builtin_popcountll(mask);
+    }
+}
+
+
+/**
+ * Indexes the values of a stream whose kinds, count and values
+ * were written directly rather than pushed.
+ */
+void tokens_index_values(TokenStream *self) {
+    _index_values(self, 0, 0);
+}
+
+
+Token tokens_get(TokenStream *self, size_t index) {
+    Token tk = {
+        .type = (TokenType)self->kinds[index],
+        .offset = self->offsets[index],
+        .length = self->lengths[index],
+        .value = tokens_value(self, index),
+    };
+
+    return tk;
+}
+
+
+/**
+ * Replaces the tokens in [from, to) with `count` new ones and
+ * adds `shift` to the offsets of the tokens after them, which
+ * wraps around to move them back.
+ */
+bool tokens_splice(TokenStream *self, size_t from, size_t to,
+    const Token *items, size_t count, uint32_t shift) {
+    size_t tail = self->count - to;
+    size_t new_count = from + count + tail;
+
+    if (new_count > self->capacity &&
+        !_tokens_resize(self, new_count + new_count / 2)) {
+        return false;
+    }
+
+    size_t valued = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        valued += cl_has_value(items[i].type);
+    }
+
+    /* tokens before `from` keep their values, and so their ranks */
+    size_t block = from / CL_TOKENS_BLOCK;
+    size_t base = _rank(self, block * CL_TOKENS_BLOCK);
+    size_t value_from = _rank(self, from);
+    size_t value_to = _rank(self, to);
+    size_t value_tail = self->value_count - value_to;
+
+    if (!tokens_reserve_values(self, value_from + valued + value_tail)) {
+        return false;
+    }
+
+    size_t dest = from + count;
+
+    memmove(&self->kinds[dest], &self->kinds[to],
+        tail * sizeof(*self->kinds));
+    memmove(&self->offsets[dest], &self->offsets[to],
+        tail * sizeof(*self->offsets));
+    memmove(&self->lengths[dest], &self->lengths[to],
+        tail * sizeof(*self->lengths));
+    memmove(&self->values[value_from + valued], &self->values[value_to],
+        value_tail * sizeof(*self->values));
+
+    uint32_t *values = &self->values[value_from];
+
+    for (size_t i = 0; i < count; i++) {
+        self->kinds[from + i] = (uint8_t)items[i].type;
+        self->offsets[from + i] = items[i].offset;
+        self->lengths[from + i] = items[i].length;
+
+        if (cl_has_value(items[i].type)) {
+            *values++ = items[i].value;
+        }
+    }
+
+    for (size_t i = dest; i < new_count; i++) {
+        self->offsets[i] += shift;
+    }
+
+    self->count = new_count;
+    self->value_count = value_from + valued + value_tail;
+    _index_values(self, block, base);
+
+    return true;
+}
+
+
+void tokens_free(TokenStream *self) {
+    if (self->arena) {
+        return;
+    }
+
+    free(CL_VOIDPTR(self->kinds));
+    free(CL_VOIDPTR(self->offsets));
+    free(CL_VOIDPTR(self->lengths));
+    free(CL_VOIDPTR(self->values));
+    free(CL_VOIDPTR(self->value_bases));
+    free(CL_VOIDPTR(self->value_masks));
+    free(CL_VOIDPTR(self));
+}
@@ -18,18 +18,10 @@ static __Inline void **_vector_getaddrp(Vector *self, size_t index) {
 }
 
 
-static bool _vector_enlarge(Vector *self) {
-    if (self->count + 1 < self->capacity) {
-        return true;
-    }
-
-    size_t increase_amount = self->capacity * 100 / CL_VECTOR_GROWTH_PERCENT;
-    size_t new_capacity = self->capacity + increase_amount;
-
-    size_t old_size = self->capacity * self->item_size;
+static bool _vector_resize(Vector *self, size_t new_capacity) {
     size_t new_size = new_capacity * self->item_size;
 
-    if (new_size < old_size) {
+    if (new_size / self->item_size != new_capacity) {
         cl_debug("%s: maximum capacity reached\n", __func__);
         return false;
     }
@@ -48,6 +40,17 @@ static bool _vector_enlarge(Vector *self) {
 }
 
 
+static bool _vector_enlarge(Vector *self) {
+    if (self->count < self->capacity) {
+        return true;
+    }
+
+    size_t increase_amount = self->capacity * CL_VECTOR_GROWTH_PERCENT / 100;
+
+    return _vector_resize(self, self->capacity + increase_amount);
+}
+
+
 Vector *vector_new(size_t item_size) {
     Vector *new_vector = malloc(sizeof(Vector));
 
@@ -56,7 +59,7 @@ Vector *vector_new(size_t item_size) {
         return NULL;
     }
 
-    void *data = calloc(CL_VECTOR_INITIAL_CAPACITY, item_size);
+    void *data = malloc(CL_VECTOR_INITIAL_CAPACITY * item_size);
 
     if (!data) {
         cl_debug("%s: %s\n", __func__, strerror(errno));
@@ -86,6 +89,19 @@ bool vector_push(Vector *self, void *data) {
 }
 
 
+/**
+ * Makes room for at least `capacity` items, so the next pushes
+ * up to that count do not reallocate.
+ */
+bool vector_reserve(Vector *self, size_t capacity) {
+    if (capacity <= self->capacity) {
+        return true;
+    }
+
+    return _vector_resize(self, capacity);
+}
+
+
 bool vector_pop(Vector *self, __Out __Nullable void *data) {
     if (self->count == 0) {
         return false;
@@ -0,0 +1,215 @@
+#!/usr/bin/env python3
+#
+# Generates the keyword and punctuator recognizers used by the
+# lexer from the LexerPair tables in cl-lexer-consts.h, so the
+# tables stay the single definition of every token spelling.
+#
+#   usage: gen-lexer-tables.py <cl-lexer-consts.h> <output.h>
+#
+
+import re
+import sys
+
+
+def parse_tables(text):
+    tables = {}
+
+    for m in re.finditer(r'const\s+LexerPair\s+(\w+)\[\]\s*=\s*\{(.*?)\};',
+                         text, re.S):
+        pairs = re.findall(r'__CL_PAIR\("((?:[^"\\]|\\.)*)",\s*(\w+)\)',
+                           m.group(2))
+        tables[m.group(1)] = pairs
+
+    return tables
+
+
+def c_char(ch):
+    return "'\\''" if ch == "'" else "'\\\\'" if ch == '\\' else f"'{ch}'"
+
+
+# == keywords ==
+
+
+def keyword_hash(name, a, b, mask):
+    return (ord(name[0]) * a + ord(name[-1]) * b + len(name)) & mask
+
+
+def find_perfect_hash(names):
+    size = 1
+
+    while size < len(names):
+        size <<= 1
+
+    while size <= 1024:
+        for a in range(1, 256):
+            for b in range(1, 256):
+                slots = {keyword_hash(n, a, b, size - 1) for n in names}
+
+                if len(slots) == len(names):
+                    return a, b, size
+
+        size <<= 1
+
+    sys.exit('gen-lexer-tables: no perfect hash found for the keywords')
+
+
+def gen_keywords(keywords):
+    names = [name for name, _ in keywords]
+    a, b, size = find_perfect_hash(names)
+
+    lengths = [len(n) for n in names]
+    slots = {keyword_hash(n, a, b, size - 1): (n, t) for n, t in keywords}
+
+    out = []
+    out.append(f'#define CL_KEYWORD_MIN_LENGTH   {min(lengths)}')
+    out.append(f'#define CL_KEYWORD_MAX_LENGTH   {max(lengths)}')
+    out.append(f'#define CL_KEYWORD_HASH(s,n)    \\')
+    out.append(f'    (((uint8_t)(s)[0] * {a}u + (uint8_t)(s)[(n) - 1] * {b}u + '
+               f'(n)) & {size - 1}u)')
+    out.append('')
+    out.append('')
+    out.append('static const struct {')
+    out.append('    str_t     name;')
+    out.append('    uint32_t  length;')
+    out.append('    TokenType type;')
+    out.append(f'}} CL_KEYWORD_TABLE[{size}] = {{')
+
+    for slot in sorted(slots):
+        name, kind = slots[slot]
+        out.append(f'    [{slot:>3}] = {{ "{name}", {len(name)}, {kind} }},')
+
+    out.append('};')
+    out.append('')
+    out.append('')
+    out.append('/**')
+    out.append(' * Returns the keyword spelled by the given name, or TK_ID')
+    out.append(' * when the name is not a keyword.')
+    out.append(' */')
+    out.append('static __Inline TokenType cl_lookup_keyword(str_t name, '
+               'uint32_t length) {')
+    out.append('    if (length < CL_KEYWORD_MIN_LENGTH || '
+               'length > CL_KEYWORD_MAX_LENGTH) {')
+    out.append('        return TK_ID;')
+    out.append('    }')
+    out.append('')
+    out.append('    uint32_t slot = CL_KEYWORD_HASH(name, length);')
+    out.append('')
+    out.append('    if (CL_KEYWORD_TABLE[slot].length == length &&')
+    out.append('        memcmp(CL_KEYWORD_TABLE[slot].name, name, length) == 0) {')
+    out.append('        return CL_KEYWORD_TABLE[slot].type;')
+    out.append('    }')
+    out.append('')
+    out.append('    return TK_ID;')
+    out.append('}')
+
+    return out
+
+
+# == punctuators ==
+
+
+def gen_match(spellings, prefix, best, indent):
+    pad = '    ' * indent
+    depth = len(prefix)
+    out = []
+
+    if prefix in spellings:
+        best = (spellings[prefix], depth)
+
+    children = sorted({s[depth] for s in spellings
+                       if len(s) > depth and s.startswith(prefix)})
+
+    for ch in children:
+        out.append(f'{pad}if (s[{depth}] == {c_char(ch)}) {{')
+        out += gen_match(spellings, prefix + ch, best, indent + 1)
+        out.append(f'{pad}}}')
+        out.append('')
+
+    if out:
+        out.pop()
+
+    if best is None:
+        return out
+
+    if children:
+        out.append('')
+
+    out.append(f'{pad}*out_type = {best[0]};')
+    out.append(f'{pad}return {best[1]};')
+
+    return out
+
+
+def gen_punctuators(pairs):
+    spellings = dict(pairs)
+    first = sorted({s[0] for s in spellings})
+
+    out = []
+    out.append('/**')
+    out.append(' * Expands to the DISPATCH entries of every byte that')
+    out.append(' * starts an operator or a symbol.')
+    out.append(' */')
+    out.append('#define CL_PUNCTUATOR_DISPATCH(fn) \\')
+
+    entries = [f'[{c_char(c)}] = fn' for c in first]
+    rows = [', '.join(entries[i:i + 6]) for i in range(0, len(entries), 6)]
+    out.append(' \\\n'.join('    ' + row + (',' if i < len(rows) - 1 else '')
+                            for i, row in enumerate(rows)))
+    out.append('')
+    out.append('')
+    out.append('/**')
+    out.append(' * Matches the longest operator or symbol at the start of')
+    out.append(' * the given NUL terminated text and returns its length, or')
+    out.append(' * 0 when there is none.')
+    out.append(' */')
+    out.append('static __Inline uint32_t cl_match_punctuator(str_t s, '
+               '__Out TokenType *out_type) {')
+    out.append('    switch (s[0]) {')
+
+    for ch in first:
+        out.append(f'        case {c_char(ch)}:')
+        body = gen_match(spellings, ch, None, 3)
+        out += [line if line else '' for line in body]
+        out.append('')
+
+    out.append('        default:')
+    out.append('            return 0;')
+    out.append('    }')
+    out.append('}')
+
+    return out
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(f'usage: {sys.argv[0]} <cl-lexer-consts.h> <output.h>')
+
+    with open(sys.argv[1]) as f:
+        tables = parse_tables(f.read())
+
+    out = []
+    out.append('/* generated by gen-lexer-tables.py from cl-lexer-consts.h, '
+               'do not edit */')
+    out.append('')
+    out.append('#ifndef CL_LEXER_TABLES_H_')
+    out.append('#define CL_LEXER_TABLES_H_')
+    out.append('')
+    out.append('#include <string.h>')
+    out.append('')
+    out.append('#include "cl-annotation.h"')
+    out.append('#include "cl-types.h"')
+    out.append('')
+    out.append('')
+    out += gen_keywords(tables['KEYWORDS'])
+    out.append('')
+    out.append('')
+    out += gen_punctuators(tables['OPERATORS'] + tables['SYMBOLS'])
+    out.append('')
+    out.append('#endif /* CL_LEXER_TABLES_H_ */')
+
+    with open(sys.argv[2], 'w') as f:
+        f.write('\n'.join(out) + '\n')
+
+
+if __name__ == '__main__':
+    main()
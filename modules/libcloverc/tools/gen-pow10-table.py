@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+#
+# Generates the table of 128-bit powers of ten used to convert
+# float literals with the Eisel-Lemire algorithm. Every entry
+# is 10^e scaled by a power of two into [2^127, 2^128), rounded
+# down, as the pair (high 64 bits, low 64 bits).
+#
+#   usage: gen-pow10-table.py <output.h>
+#
+
+import sys
+
+MIN_EXP10 = -348
+MAX_EXP10 = 347
+
+
+def mantissa(e):
+    if e >= 0:
+        value = 10 ** e
+        bits = value.bit_length()
+
+        if bits >= 128:
+            return value >> (bits - 128)
+
+        return value << (128 - bits)
+
+    divisor = 10 ** -e
+
+    return (1 << (127 + divisor.bit_length())) // divisor
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(f'usage: {sys.argv[0]} <output.h>')
+
+    out = []
+    out.append('/* generated by gen-pow10-table.py, do not edit */')
+    out.append('')
+    out.append('#ifndef CL_POW10_TABLE_H_')
+    out.append('#define CL_POW10_TABLE_H_')
+    out.append('')
+    out.append('#include <stdint.h>')
+    out.append('')
+    out.append(f'#define CL_POW10_MIN_EXP    ({MIN_EXP10})')
+    out.append(f'#define CL_POW10_MAX_EXP    {MAX_EXP10}')
+    out.append('')
+    out.append('')
+    out.append('/**')
+    out.append(' * 10^e for CL_POW10_MIN_EXP <= e <= CL_POW10_MAX_EXP, as the')
+    out.append(' * high and low halves of a 128-bit mantissa.')
+    out.append(' */')
+    out.append('static const uint64_t CL_POW10_TABLE[][2] = {')
+
+    for e in range(MIN_EXP10, MAX_EXP10 + 1):
+        m = mantissa(e)
+        hi, lo = m >> 64, m & (2 ** 64 - 1)
+        out.append(f'    {{ 0x{hi:016X}, 0x{lo:016X} }}, /* 1e{e} */')
+
+    out.append('};')
+    out.append('')
+    out.append('#endif /* CL_POW10_TABLE_H_ */')
+
+    with open(sys.argv[1], 'w') as f:
+        f.write('\n'.join(out) + '\n')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cl-log.h>
+#include <cl-bits.h>
+#include <cl-object.h>
+#include <cl-bytecode.h>
+
+
+#define isoption(s)     (*s == '-')
+#define strcmpeq(a,b)   (strcmp(a,b) == 0)
+
+#define DUMP_HEADERS    1
+#define DUMP_SYMBOLS    2
+#define DUMP_CONTENTS   3
+#define DUMP_CODE       4
+
+
+static void show_help(str_t program) {
+    printf((
+        "Usage:\n"
+        "  %s [option] [--] objects...\n"
+        "\n"
+        "Shows what is in Clover objects (.co files). Without any\n"
+        "option, shows the headers, the sections and the symbols.\n"
+        "\n"
+        "Options:\n"
+        "  -x               Show the header and the sections\n"
+        "  -t               Show the symbols\n"
+        "  -s               Show the contents of the sections\n"
+        "  -d               Disassemble the functions\n"
+        "  -h  --help       Shows this message and exits\n"
+        "  -v  --version    Shows program version and exits\n"
+    ), program);
+}
+
+
+static void show_version(str_t program) {
+    printf("%s " CL_VERSION " (" CL_BUILDINFO ")\n", program);
+}
+
+
+static void dump_headers(ObjectFile *object) {
+    const ObjectHeader *header = object->header;
+
+    printf("format %u.%u, written by clover %.*s, %llu bytes\n",
+        header->format_major, header->format_minor,
+        (int)sizeof(header->version), header->version,
+        (unsigned long long)header->file_size);
+
+    if (header->entry == CL_OBJECT_NO_ENTRY) {
+        printf("no entry point\n");
+    } else {
+        printf("entry point: %s\n", object_string(object,
+            object->symbols[header->entry].name));
+    }
+
+    printf("\nSections:\n");
+    printf("  %-3s %-10s %10s %10s %6s\n", "Idx", "Name", "Offset", "Size",
+        "Align");
+
+    for (size_t i = 0; i < object->section_count; i++) {
+        const ObjectSection *section = &object->sections[i];
+
+        printf("  %-3zu %-10s %#10llx %10llu %6u\n", i,
+            object_section_name(section->kind),
+            (unsigned long long)section->offset,
+            (unsigned long long)section->size, section->align);
+    }
+}
+
+
+static void dump_symbols(ObjectFile *object) {
+    printf("\nSymbols:\n");
+    printf("  %-5s %-6s %-10s %-10s %8s %8s  %s\n", "Idx", "Kind", "Flags",
+        "Section", "Value", "Size", "Name");
+
+    for (size_t i = 0; i < object->symbol_count; i++) {
+        const ObjectSymbol *symbol = &object->symbols[i];
+        char flags[32];
+
+        snprintf(flags, sizeof(flags), "%s%s%s%s",
+            CL_BIT_ISSET(CL_OBJECT_SYM_PUB, symbol->flags) ? "pub " : "",
+            CL_BIT_ISSET(CL_OBJECT_SYM_STATIC, symbol->flags) ? "static " : "",
+            CL_BIT_ISSET(CL_OBJECT_SYM_FLOAT, symbol->flags) ? "float" : "",
+            CL_BIT_ISSET(CL_OBJECT_SYM_INIT, symbol->flags) ? "init" : "");
+
+        printf("  %-5zu %-6s %-10s %-10s %8llx %8llu  %s (%s:%u)\n", i,
+            object_symbol_kind(symbol->kind), *flags ? flags : "-",
+            object_section_name(object->sections[symbol->section].kind),
+            (unsigned long long)symbol->value,
+            (unsigned long long)symbol->size,
+            object_string(object, symbol->name),
+            object_string(object, symbol->file), symbol->line);
+    }
+}
+
+
+/**
+ * Prints data as offset, 16 bytes in hex and the same bytes as
+ * text, like `xxd`.
+ */
+static void dump_bytes(const uint8_t *data, size_t size) {
+    for (size_t line = 0; line < size; line += 16) {
+        printf("  %08zx ", line);
+
+        for (size_t i = line; i < line + 16; i++) {
+            if (i < size) {
+                printf("%s%02x", (i % 4 == 0) ? " " : "", data[i]);
+            } else {
+                printf("%s  ", (i % 4 == 0) ? " " : "");
+            }
+        }
+
+        printf("  ");
+
+        for (size_t i = line; i < line + 16 && i < size; i++) {
+            putchar((data[i] >= 0x20 && data[i] < 0x7F) ? data[i] : '.');
+        }
+
+        putchar('\n');
+    }
+}
+
+
+static void dump_contents(ObjectFile *object) {
+    const uint8_t *base = object->map;
+
+    for (size_t i = 1; i < object->section_count; i++) {
+        const ObjectSection *section = &object->sections[i];
+
+        printf("\nContents of section %s:\n",
+            object_section_name(section->kind));
+        dump_bytes(&base[section->offset], section->size);
+    }
+}
+
+
+/**
+ * Disassembles every function, one instruction per line with
+ * its index, and the targets of jumps.
+ */
+static void dump_code(ObjectFile *object) {
+    for (size_t i = 0; i < object->symbol_count; i++) {
+        const ObjectSymbol *symbol = &object->symbols[i];
+
+        if (symbol->kind != CL_OBJECT_SYM_FN ||
+            symbol->size < sizeof(BytecodeFunction)) {
+            continue;
+        }
+
+        const BytecodeFunction *fn = object_symbol_data(object, symbol);
+        size_t size = sizeof(BytecodeFunction) +
+            (size_t)fn->constant_count * sizeof(uint64_t) +
+            (size_t)fn->code_count * sizeof(Instruction);
+
+        printf("\n%s: %u params, %u registers, %u frame slots, "
+            "%u constants\n", object_string(object, symbol->name),
+            fn->param_count, fn->register_count, fn->frame_size,
+            fn->constant_count);
+
+        if (size > symbol->size) {
+            printf("  (truncated)\n");
+            continue;
+        }
+
+        const uint64_t *constants = (const void *)(fn + 1);
+        const Instruction *code = (const void *)(constants +
+            fn->constant_count);
+        char text[64];
+
+        for (uint32_t pc = 0; pc < fn->code_count; pc++) {
+            bytecode_disassemble(code[pc], constants, fn->constant_count,
+                text, sizeof(text));
+
+            if (CL_OP(code[pc]) == CL_OP_JMP) {
+                printf("  %5u  %-32s ; to %lld\n", pc, text,
+                    (long long)pc + 1 + CL_SJ(code[pc]));
+            } else {
+                printf("  %5u  %s\n", pc, text);
+            }
+        }
+    }
+}
+
+
+static bool dump(str_t path, uint32_t what, bool many) {
+    ObjectFile *object = object_open(path);
+
+    if (!object) {
+        return false;
+    }
+
+    if (many) {
+        printf("%s:\n", path);
+    }
+
+    if (CL_BIT_ISSET(DUMP_HEADERS, what)) {
+        dump_headers(object);
+    }
+
+    if (CL_BIT_ISSET(DUMP_SYMBOLS, what)) {
+        dump_symbols(object);
+    }
+
+    if (CL_BIT_ISSET(DUMP_CONTENTS, what)) {
+        dump_contents(object);
+    }
+
+    if (CL_BIT_ISSET(DUMP_CODE, what)) {
+        dump_code(object);
+    }
+
+    if (many) {
+        putchar('\n');
+    }
+
+    object_close(object);
+
+    return true;
+}
+
+
+int main(int argc, str_t argv[]) {
+    const str_t program = CL_PRGNAME;
+    bool end_options = false;
+    uint32_t what = 0;
+    int count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        str_t curr = argv[i];
+
+        if (!isoption(curr) || end_options) {
+            count++;
+            continue;
+        }
+
+        if (strcmpeq(curr, "-h") || strcmpeq(curr, "--help")) {
+            show_help(program);
+            return EXIT_SUCCESS;
+        } else if (strcmpeq(curr, "-v") || strcmpeq(curr, "--version")) {
+            show_version(program);
+            return EXIT_SUCCESS;
+        } else if (strcmpeq(curr, "-x")) {
+            what |= CL_BIT(DUMP_HEADERS);
+        } else if (strcmpeq(curr, "-t")) {
+            what |= CL_BIT(DUMP_SYMBOLS);
+        } else if (strcmpeq(curr, "-s")) {
+            what |= CL_BIT(DUMP_CONTENTS);
+        } else if (strcmpeq(curr, "-d")) {
+            what |= CL_BIT(DUMP_CODE);
+        } else if (strcmpeq(curr, "--")) {
+            end_options = true;
+        } else {
+            cl_error("unknown option: %s\n", curr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (count == 0) {
+        show_help(program);
+        return EXIT_FAILURE;
+    }
+
+    if (what == 0) {
+        what = CL_BIT(DUMP_HEADERS) | CL_BIT(DUMP_SYMBOLS);
+    }
+
+    bool ok = true;
+    end_options = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (isoption(argv[i]) && !end_options) {
+            end_options = strcmpeq(argv[i], "--");
+            continue;
+        }
+
+        ok &= dump(argv[i], what, count > 1);
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}